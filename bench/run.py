@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+"""Runs the Lox benchmarks in this directory under each cpplox execution mode.
+
+For every benchmark and mode the wall time, peak resident set size and the
+number of garbage collections are recorded and written as JSON. The GC count
+is read from the file named by the LOX_GC_STATS environment variable, which
+the compiled runtime and the VM write when they exit. The interpreter uses
+reference counting, so it has no GC count.
+
+    bench/run.py --cpplox bin/cpplox --output bench.json
+"""
+
+import argparse
+import json
+import os
+import resource
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from pathlib import Path
+
+BENCH_DIR = Path(__file__).resolve().parent
+
+MODES = ["interpreter", "vm", "jit", "compiled"]
+
+# Benchmarks that read their input from stdin.
+INPUTS = {
+    "Lox": BENCH_DIR / "input" / "fib.lox",
+}
+
+
+def read_peak_rss(pid):
+    """Returns the peak RSS in kilobytes of a running process, if known."""
+    try:
+        with open(f"/proc/{pid}/status") as status:
+            for line in status:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1])
+    except (OSError, ValueError):
+        pass
+    return 0
+
+
+def run(command, stdin=None, timeout=None, env=None):
+    """Runs a command and returns its exit status, wall time and peak RSS.
+
+    The child is reaped with wait4 so that the resource usage is that of the
+    benchmark alone rather than of every child this script has started.
+    """
+    # On Linux the child's ru_maxrss starts at this process' RSS, inherited
+    # through fork, so below that the child's own high-water mark is sampled.
+    baseline = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    with open(stdin or os.devnull, "rb") as input_file:
+        start = time.perf_counter()
+        process = subprocess.Popen(command, stdin=input_file, stdout=subprocess.DEVNULL,
+                                   stderr=subprocess.PIPE, env=env)
+        timed_out = threading.Event()
+        finished = threading.Event()
+        sampled_rss = 0
+
+        def watch():
+            nonlocal sampled_rss
+            while not finished.wait(0.005):
+                sampled_rss = max(sampled_rss, read_peak_rss(process.pid))
+                if timeout and time.perf_counter() - start > timeout:
+                    timed_out.set()
+                    process.kill()
+                    return
+
+        watcher = threading.Thread(target=watch)
+        watcher.start()
+
+        # Drain stderr before reaping so that a chatty child cannot block.
+        stderr = process.stderr.read()
+        _, status, usage = os.wait4(process.pid, 0)
+        wall = time.perf_counter() - start
+        process.returncode = os.waitstatus_to_exitcode(status)
+        finished.set()
+        watcher.join()
+
+    # ru_maxrss is in kilobytes on Linux and in bytes on macOS.
+    peak_rss = usage.ru_maxrss // 1024 if sys.platform == "darwin" else usage.ru_maxrss
+    if sys.platform.startswith("linux") and peak_rss <= baseline and sampled_rss:
+        peak_rss = sampled_rss
+
+    return {
+        "status": "timeout" if timed_out.is_set() else ("ok" if process.returncode == 0 else "failed"),
+        "exit_code": process.returncode,
+        "wall_seconds": round(wall, 6),
+        "peak_rss_kb": peak_rss,
+        "stderr": stderr.decode(errors="replace").strip()[-1000:],
+    }
+
+
+def read_gc_stats(path):
+    try:
+        with open(path) as stats_file:
+            collections = json.load(stats_file)["collections"]
+    except (OSError, ValueError, KeyError):
+        return None, None
+
+    return sum(collections.values()), collections
+
+
+def build(benchmark, args, work_dir):
+    """Compiles a benchmark to an executable, returning the executable path or an error."""
+    obj = work_dir / (benchmark.stem + ".o")
+    exe = work_dir / benchmark.stem
+    for command in ([args.cpplox, str(benchmark), "-o", str(obj)],
+                    [args.clang, str(obj), "-o", str(exe), "-pthread"]):
+        try:
+            result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        except OSError as error:
+            return None, str(error)
+        if result.returncode != 0:
+            return None, result.stdout.decode(errors="replace").strip()[-1000:]
+    return exe, None
+
+
+def bench(benchmark, mode, args, work_dir):
+    result = {"benchmark": benchmark.stem, "mode": mode}
+
+    if mode == "interpreter":
+        command = [args.cpplox, str(benchmark)]
+    elif mode == "vm":
+        command = [args.cpplox, str(benchmark), "--vm"]
+    elif mode == "jit":
+        command = [args.cpplox, str(benchmark), "--jit"]
+    else:
+        start = time.perf_counter()
+        exe, error = build(benchmark, args, work_dir)
+        if exe is None:
+            result.update(status="failed", stderr=error)
+            return result
+        result["compile_seconds"] = round(time.perf_counter() - start, 6)
+        command = [str(exe)]
+
+    stats = work_dir / "gc.json"
+    stats.unlink(missing_ok=True)
+    env = dict(os.environ, LOX_GC_STATS=str(stats))
+
+    result.update(run(command, stdin=INPUTS.get(benchmark.stem), timeout=args.timeout, env=env))
+    result["gc_count"], result["gc"] = read_gc_stats(stats)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--cpplox", required=True, help="path to the cpplox binary")
+    parser.add_argument("--clang", default="clang", help="compiler used to link compiled benchmarks")
+    parser.add_argument("--modes", default=",".join(MODES),
+                        help="comma separated execution modes to run (default: %(default)s)")
+    parser.add_argument("--timeout", type=float, default=300, help="per run timeout in seconds")
+    parser.add_argument("--output", help="write the results as JSON to this file")
+    parser.add_argument("benchmarks", nargs="*", help="benchmark names to run (default: all)")
+    args = parser.parse_args()
+
+    modes = args.modes.split(",")
+    for mode in modes:
+        if mode not in MODES:
+            parser.error(f"unknown mode '{mode}', expected one of {', '.join(MODES)}")
+
+    benchmarks = sorted(BENCH_DIR.glob("*.lox"))
+    if args.benchmarks:
+        benchmarks = [b for b in benchmarks if b.stem in args.benchmarks]
+
+    results = []
+    with tempfile.TemporaryDirectory(prefix="cpplox-bench-") as work_dir:
+        for benchmark in benchmarks:
+            for mode in modes:
+                result = bench(benchmark, mode, args, Path(work_dir))
+                results.append(result)
+
+                if result["status"] == "ok":
+                    gc_count = "-" if result["gc_count"] is None else result["gc_count"]
+                    print(f"{benchmark.stem:<16} {mode:<12} {result['wall_seconds']:>9.3f}s "
+                          f"{result['peak_rss_kb']:>9} KB  gc: {gc_count}", flush=True)
+                else:
+                    print(f"{benchmark.stem:<16} {mode:<12} {result['status']}", flush=True)
+                    if result.get("stderr"):
+                        print("    " + result["stderr"].replace("\n", "\n    "), flush=True)
+
+    report = {"cpplox": str(args.cpplox), "modes": modes, "results": results}
+    if args.output:
+        with open(args.output, "w") as output_file:
+            json.dump(report, output_file, indent=2)
+            output_file.write("\n")
+
+    return 0 if all(r["status"] == "ok" for r in results) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,5 +1,10 @@
 #ifndef LOX_LLVM_UTIL_H
 #define LOX_LLVM_UTIL_H
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+
 template<class... Ts>
 struct overloaded : Ts... {
     using Ts::operator()...;
@@ -22,4 +27,28 @@ template<typename ContainerT, typename RangeT>
 ContainerT to(RangeT &&range) {
     return ContainerT(begin(range), end(range));
 }
+
+/**
+ * Reads a character from stdin like getchar, except that SIGUSR1 interrupts a
+ * read waiting for input to call poll, which writes any report it requested,
+ * before the read is retried.
+ */
+template<typename Poll>
+int getcharPolling(Poll &&poll) {
+    struct sigaction action {};
+    sigaction(SIGUSR1, nullptr, &action);
+    const auto flags = action.sa_flags;
+    action.sa_flags &= ~SA_RESTART;
+    sigaction(SIGUSR1, &action, nullptr);
+
+    int c;
+    while ((c = getchar()) == EOF && ferror(stdin) && errno == EINTR) {
+        clearerr(stdin);
+        poll();
+    }
+
+    action.sa_flags = flags;
+    sigaction(SIGUSR1, &action, nullptr);
+    return c;
+}
 #endif//LOX_LLVM_UTIL_H
@@ -1,18 +1,19 @@
 #include "Callstack.h"
 
+#include "GC.h"
 #include "MDUtil.h"
 #include "Memory.h"
 
+#include <sys/resource.h>
+
 namespace lox {
-    void PushCall(LoxBuilder &Builder, Value *line, Value *name) {
-        static auto *PushFunction([&Builder] {
+    void PrintStackTrace(LoxBuilder &Builder, Value *line, Value *location) {
+        static auto *PrintStackTraceFunction([&Builder] {
             auto *const F = Function::Create(
                 FunctionType::get(Builder.getVoidTy(), {Builder.getInt32Ty(), Builder.getPtrTy()}, false),
-                Function::InternalLinkage, "$push", Builder.getModule()
+                Function::InternalLinkage, "$printStackTrace", Builder.getModule()
             );
 
-            F->addFnAttr(Attribute::AlwaysInline);
-
             LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
 
             auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
@@ -20,57 +21,122 @@ namespace lox {
 
             auto *const arguments = F->args().begin();
             auto *const line = arguments;
-            auto *const name = arguments + 1;
-
-            auto *const $sp = B.getModule().getCallStackPointer();
-            auto *const $cs = B.getModule().getCallStack();
-
-            auto *const sp = B.CreateLoad(B.getInt32Ty(), $sp);
-
-            auto *const addr = B.CreateInBoundsGEP($cs->getValueType(), $cs, {B.getInt32(0), sp});
-            B.CreateStore(line, B.CreateStructGEP(B.getModule().getCallStruct(), addr, 0));
-            B.CreateStore(name, B.CreateStructGEP(B.getModule().getCallStruct(), addr, 1));
+            auto *const location = arguments + 1;
+
+            auto *const RootFrameStruct = B.getModule().getRootFrameStructType();
+            auto *const frame = CreateEntryBlockAlloca(F, B.getPtrTy(), "frame");
+            auto *const printed = CreateEntryBlockAlloca(F, B.getInt32Ty(), "printed");
+
+            // The outermost frame is the script's.
+            const auto PrintFrame = [&](Value *current, Value *frameLine) {
+                auto *const previous = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(RootFrameStruct, current, 0));
+                auto *const name = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(RootFrameStruct, current, 3));
+                B.PrintFErr(
+                    B.CreateSelect(
+                        B.CreateIsNull(previous), B.CreateGlobalCachedString("[line %d] in script\n"),
+                        B.CreateGlobalCachedString("[line %d] in %s()\n")
+                    ),
+                    {frameLine, name}
+                );
+            };
+
+            auto *const InnermostBlock = B.CreateBasicBlock("innermost");
+            auto *const LocationBlock = B.CreateBasicBlock("location");
+            auto *const WhileCond = B.CreateBasicBlock("while.cond");
+            auto *const WhileBody = B.CreateBasicBlock("while.body");
+            auto *const PrintBlock = B.CreateBasicBlock("print");
+            auto *const WhileInc = B.CreateBasicBlock("while.inc");
+            auto *const WhileEnd = B.CreateBasicBlock("while.end");
+            auto *const OmittedBlock = B.CreateBasicBlock("omitted");
+            auto *const EndBlock = B.CreateBasicBlock("end");
+
+            // The error is in the innermost frame's function if the location is its name,
+            // otherwise it's in the runtime, called from the innermost frame.
+            auto *const innermost = B.CreateLoad(B.getPtrTy(), B.getModule().getRootFrames(), "innermost");
+            B.CreateStore(innermost, frame);
+            B.CreateStore(B.getInt32(1), printed);
+            auto *const IsNotNullBlock = B.CreateBasicBlock("innermost.notnull");
+            B.CreateCondBr(B.CreateIsNull(innermost), LocationBlock, IsNotNullBlock);
+            B.SetInsertPoint(IsNotNullBlock);
+            B.CreateCondBr(
+                B.CreateICmpEQ(
+                    B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(RootFrameStruct, innermost, 3)), location
+                ),
+                InnermostBlock, LocationBlock
+            );
 
-            B.CreateStore(B.CreateAdd(sp, B.getInt32(1), "call+1", true, true), $sp);
+            B.SetInsertPoint(InnermostBlock);
+            PrintFrame(innermost, line);
+            B.CreateStore(B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(RootFrameStruct, innermost, 0)), frame);
+            B.CreateBr(WhileCond);
+
+            B.SetInsertPoint(LocationBlock);
+            B.PrintFErr(B.CreateGlobalCachedString("[line %d] in %s()\n"), {line, location});
+            B.CreateBr(WhileCond);
+
+            B.SetInsertPoint(WhileCond);
+            auto *const current = B.CreateLoad(B.getPtrTy(), frame, "current");
+            B.CreateCondBr(B.CreateIsNull(current), WhileEnd, WhileBody);
+
+            B.SetInsertPoint(WhileBody);
+            auto *const count = B.CreateLoad(B.getInt32Ty(), printed);
+            B.CreateStore(B.CreateAdd(count, B.getInt32(1), "printed+1", true, true), printed);
+            B.CreateCondBr(B.CreateICmpULT(count, B.getInt32(MAX_STACK_TRACE_FRAMES)), PrintBlock, WhileInc);
+
+            B.SetInsertPoint(PrintBlock);
+            PrintFrame(current, B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(RootFrameStruct, current, 2)));
+            B.CreateBr(WhileInc);
+
+            B.SetInsertPoint(WhileInc);
+            B.CreateStore(B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(RootFrameStruct, current, 0)), frame);
+            B.CreateBr(WhileCond);
+
+            // A deep recursion is summarised by its innermost frames.
+            B.SetInsertPoint(WhileEnd);
+            auto *const total = B.CreateLoad(B.getInt32Ty(), printed);
+            B.CreateCondBr(B.CreateICmpUGT(total, B.getInt32(MAX_STACK_TRACE_FRAMES)), OmittedBlock, EndBlock);
+
+            B.SetInsertPoint(OmittedBlock);
+            B.PrintFErr(
+                B.CreateGlobalCachedString("[%d more frames]\n"),
+                {B.CreateSub(total, B.getInt32(MAX_STACK_TRACE_FRAMES))}
+            );
+            B.CreateBr(EndBlock);
 
+            B.SetInsertPoint(EndBlock);
             B.CreateRetVoid();
 
             return F;
         }());
 
-        Builder.CreateCall(PushFunction, {line, name});
+        Builder.CreateCall(PrintStackTraceFunction, {line, location});
     }
 
-    void PopCall(LoxBuilder &Builder) {
-        static auto *PopFunction([&Builder] {
-            auto *const F = Function::Create(
-                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$pop",
-                Builder.getModule()
-            );
-
-            F->addFnAttr(Attribute::AlwaysInline);
-
-            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
-
-            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
-            B.SetInsertPoint(EntryBasicBlock);
-
-            auto *const $sp = B.getModule().getCallStackPointer();
-            auto *const sp = B.CreateLoad(B.getInt32Ty(), $sp);
-            B.CreateStore(B.CreateSub(sp, B.getInt32(1), "sp", true, true), $sp);
-
-            B.CreateRetVoid();
-
-            return F;
-        }());
-
-        Builder.CreateCall(PopFunction, {});
+    void CheckStackOverflow(LoxBuilder &Builder, Value *frame, const unsigned int line) {
+        auto *const IsStackOverflow = Builder.CreateBasicBlock("is.stackoverflow");
+        auto *const IsNotStackOverflow = Builder.CreateBasicBlock("isnot.stackoverflow");
+
+        // The stack grows down, so the frame is the lowest address the function uses,
+        // apart from the calls it makes; the limit leaves space for those into the runtime.
+        auto mdBuilder = MDBuilder(Builder.getContext());
+        Builder.CreateCondBr(
+            Builder.CreateICmpULT(
+                Builder.CreatePtrToInt(frame, Builder.getInt64Ty()),
+                Builder.CreateLoad(Builder.getInt64Ty(), Builder.getModule().getStackLimit(), "stackLimit")
+            ),
+            IsStackOverflow, IsNotStackOverflow, metadata::createUnlikelyBranchWeights(mdBuilder)
+        );
+
+        Builder.SetInsertPoint(IsStackOverflow);
+        Builder.RuntimeError(line, "Stack overflow.\n", {}, Builder.getFunction());
+
+        Builder.SetInsertPoint(IsNotStackOverflow);
     }
 
-    void PrintStackTrace(LoxBuilder &Builder) {
-        static auto *PrintStackTraceFunction([&Builder] {
+    void ConfigureStack(LoxBuilder &Builder) {
+        static auto *ConfigureStackFunction([&Builder] {
             auto *const F = Function::Create(
-                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$printStackTrace",
+                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$configureStack",
                 Builder.getModule()
             );
 
@@ -79,95 +145,82 @@ namespace lox {
             auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
             B.SetInsertPoint(EntryBasicBlock);
 
-            auto *const $sp = B.getModule().getCallStackPointer();
-            auto *const $cs = B.getModule().getCallStack();
-
-            auto *const sp = B.CreateLoad(B.getInt32Ty(), $sp);
-
-            auto *const i = CreateEntryBlockAlloca(F, B.getInt32Ty(), "i");
-
-            B.CreateStore(B.getInt32(1), i);
-
-            auto *const ForCond = B.CreateBasicBlock("for.cond");
-            auto *const ForBody = B.CreateBasicBlock("for.body");
-            auto *const ForInc = B.CreateBasicBlock("for.inc");
-            auto *const ForEnd = B.CreateBasicBlock("for.end");
-
-            B.CreateBr(ForCond);
-            B.SetInsertPoint(ForCond);
-            B.CreateCondBr(B.CreateICmpSLE(B.CreateLoad(B.getInt32Ty(), i), sp), ForBody, ForEnd);
-            B.SetInsertPoint(ForBody);
-
-            auto *const top =
-                B.CreateSub(B.CreateLoad(B.getInt32Ty(), $sp), B.CreateLoad(B.getInt32Ty(), i), "top", true, true);
-            auto *const addr = B.CreateInBoundsGEP($cs->getValueType(), $cs, {B.getInt32(0), top});
-
-            auto *const line = B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(B.getModule().getCallStruct(), addr, 0));
-            auto *const name = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getCallStruct(), addr, 1));
-
-            auto *const IsScriptBlock = B.CreateBasicBlock("is.script");
-            auto *const IsNotScriptBlock = B.CreateBasicBlock("isnot.script");
-
-            B.CreateCondBr(B.CreateICmpEQ(sp, B.CreateLoad(B.getInt32Ty(), i)), IsScriptBlock, IsNotScriptBlock);
-
-            B.SetInsertPoint(IsScriptBlock);
-            B.PrintFErr(B.CreateGlobalCachedString("[line %d] in script\n"), {line});
-            B.CreateBr(ForInc);
-            B.SetInsertPoint(IsNotScriptBlock);
-            B.PrintFErr(B.CreateGlobalCachedString("[line %d] in %s()\n"), {line, name});
-            B.CreateBr(ForInc);
-
-            B.SetInsertPoint(ForInc);
-            B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt32Ty(), i), B.getInt32(1), "i+1", true, true), i);
-            B.CreateBr(ForCond);
-
-            B.SetInsertPoint(ForEnd);
-
-            B.CreateRetVoid();
-
-            return F;
-        }());
-
-        Builder.CreateCall(PrintStackTraceFunction, {});
-    }
-
-    void CheckStackOverflow(LoxBuilder &Builder, Value *line, Value *name) {
-        static auto *CheckStackOverflowFunction([&Builder] {
-            auto *const F = Function::Create(
-                FunctionType::get(Builder.getVoidTy(), {Builder.getInt32Ty(), Builder.getPtrTy()}, false),
-                Function::InternalLinkage, "$checkStackOverflow", Builder.getModule()
+            static const auto GetEnv =
+                B.getModule().getOrInsertFunction("getenv", FunctionType::get(B.getPtrTy(), {B.getPtrTy()}, false));
+            static const auto GetRLimit = B.getModule().getOrInsertFunction(
+                "getrlimit", FunctionType::get(B.getInt32Ty(), {B.getInt32Ty(), B.getPtrTy()}, false)
             );
 
-            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
-
-            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
-            B.SetInsertPoint(EntryBasicBlock);
-            auto *const arguments = F->args().begin();
-            auto *const line = arguments;
-            auto *const name = arguments + 1;
+            const auto &M = B.getModule();
+            // An address in this frame, near the top of the stack.
+            auto *const top = CreateEntryBlockAlloca(F, B.getInt8Ty(), "top");
+
+            auto *const SetBlock = B.CreateBasicBlock("LOX_STACK_SIZE.set");
+            auto *const InvalidBlock = B.CreateBasicBlock("LOX_STACK_SIZE.invalid");
+            auto *const SizeBlock = B.CreateBasicBlock("size");
+            auto *const value = B.CreateCall(GetEnv, {B.CreateGlobalCachedString("LOX_STACK_SIZE")});
+            B.CreateCondBr(B.CreateIsNull(value), SizeBlock, SetBlock);
+            B.SetInsertPoint(SetBlock);
+            B.CreateCondBr(ParseByteSize(B, value, M.getStackSize()), SizeBlock, InvalidBlock);
+            B.SetInsertPoint(InvalidBlock);
+            B.PrintFErr(
+                B.CreateGlobalCachedString("Ignoring invalid %s value '%s'.\n"),
+                {B.CreateGlobalCachedString("LOX_STACK_SIZE"), value}
+            );
+            B.CreateBr(SizeBlock);
+
+            // The soft limit is the one the process' memory was laid out for when it
+            // started, so raising it now wouldn't make room for the stack to grow into.
+            B.SetInsertPoint(SizeBlock);
+            auto *const RLimitStruct = StructType::get(B.getInt64Ty(), B.getInt64Ty());
+            auto *const limits = CreateEntryBlockAlloca(F, RLimitStruct, "rlimit");
+            auto *const current = B.CreateStructGEP(RLimitStruct, limits, 0);
+            // If the limits can't be read, the stack is taken to be unlimited.
+            B.CreateStore(B.getInt64(RLIM_INFINITY), current);
+            B.CreateCall(GetRLimit, {B.getInt32(RLIMIT_STACK), limits});
+            auto *const soft = B.CreateLoad(B.getInt64Ty(), current, "soft");
+            auto *const size = B.CreateLoad(B.getInt64Ty(), M.getStackSize(), "size");
+
+            auto *const DefaultBlock = B.CreateBasicBlock("size.default");
+            auto *const GivenBlock = B.CreateBasicBlock("size.given");
+            auto *const IgnoredBlock = B.CreateBasicBlock("size.ignored");
+            auto *const LimitBlock = B.CreateBasicBlock("limit");
+            B.CreateCondBr(B.CreateICmpEQ(size, B.getInt64(0)), DefaultBlock, GivenBlock);
+
+            // Without a size, the whole stack may be used.
+            B.SetInsertPoint(DefaultBlock);
+            auto *const defaultSize = B.CreateSelect(
+                B.CreateICmpEQ(soft, B.getInt64(RLIM_INFINITY)), B.getInt64(DEFAULT_STACK_SIZE), soft
+            );
+            B.CreateBr(LimitBlock);
 
-            auto *const $sp = B.getModule().getCallStackPointer();
+            B.SetInsertPoint(GivenBlock);
+            B.CreateCondBr(B.CreateICmpUGT(size, soft), IgnoredBlock, LimitBlock);
 
-            auto *const sp = B.CreateLoad(B.getInt32Ty(), $sp);
+            // A size above the soft limit is capped at it.
+            B.SetInsertPoint(IgnoredBlock);
+            B.PrintFErr(
+                B.CreateGlobalCachedString("Stack size %llu is above the stack limit, using %llu; see ulimit -s.\n"),
+                {size, soft}
+            );
+            B.CreateBr(LimitBlock);
 
-            auto mdBuilder = MDBuilder(Builder.getContext());
-            auto *const IsStackOverFlow = B.CreateBasicBlock("is.stackoverflow");
-            auto *const IsNotStackOverFlow = B.CreateBasicBlock("isnot.stackoverflow");
+            B.SetInsertPoint(LimitBlock);
+            auto *const stackSize = B.CreatePHI(B.getInt64Ty(), 3, "stackSize");
+            stackSize->addIncoming(defaultSize, DefaultBlock);
+            stackSize->addIncoming(size, GivenBlock);
+            stackSize->addIncoming(soft, IgnoredBlock);
 
-            B.CreateCondBr(
-                B.CreateICmpSLT(sp, B.getInt32(MAX_CALL_STACK_SIZE - 1)), IsNotStackOverFlow, IsStackOverFlow,
-                metadata::createLikelyBranchWeights(mdBuilder)
+            auto *const usable = B.CreateSub(
+                stackSize, B.CreateBinaryIntrinsic(Intrinsic::umin, stackSize, B.getInt64(STACK_RESERVE)), "usable"
             );
+            B.CreateStore(B.CreateSub(B.CreatePtrToInt(top, B.getInt64Ty()), usable), M.getStackLimit());
 
-            B.SetInsertPoint(IsStackOverFlow);
-            B.RuntimeError(line, "Stack overflow.\n", {}, name);
-
-            B.SetInsertPoint(IsNotStackOverFlow);
             B.CreateRetVoid();
 
             return F;
         }());
 
-        Builder.CreateCall(CheckStackOverflowFunction, {line, name});
+        Builder.CreateCall(ConfigureStackFunction);
     }
-}// namespace lox
\ No newline at end of file
+}// namespace lox
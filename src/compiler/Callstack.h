@@ -4,10 +4,26 @@
 #include "LoxBuilder.h"
 
 namespace lox {
-    void PushCall(LoxBuilder &Builder, Value *line, Value *name);
-    void PopCall(LoxBuilder &Builder);
-    void PrintStackTrace(LoxBuilder &Builder);
-    void CheckStackOverflow(LoxBuilder &Builder, Value *line, Value *name);
+    /**
+     * Prints the stack trace of a runtime error at the line of the location, a
+     * function name, by walking the chain of root frames: each frame's header
+     * records its function's name and the line of the call it's making.
+     */
+    void PrintStackTrace(LoxBuilder &Builder, Value *line, Value *location);
+
+    /**
+     * Raises a stack overflow error if the frame, linked into the root frames
+     * by the function's prologue, is below the stack limit. The line is
+     * the function's declaration.
+     */
+    void CheckStackOverflow(LoxBuilder &Builder, Value *frame, unsigned int line);
+
+    /**
+     * Sets the stack limit from the stack size baked into the program, or from
+     * the LOX_STACK_SIZE environment variable, capped at the process' soft
+     * stack limit, which fixed the space left for the stack when it started.
+     */
+    void ConfigureStack(LoxBuilder &Builder);
 }// namespace lox
 
 #endif//CPPLOX_CALLSTACK_H
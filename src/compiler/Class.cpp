@@ -1,4 +1,5 @@
 
+#include "GC.h"
 #include "LoxBuilder.h"
 #include "Stack.h"
 
@@ -24,29 +25,41 @@ namespace lox {
     Value *LoxBuilder::AllocateInstance(Value *klass) {
         auto *const ptr = AllocateObj(ObjType::INSTANCE, "instance");
 
-        Value *fields = AllocateTable();
-
+        // New instances start with the empty root shape; the fields table is only
+        // allocated if the instance outgrows its inline slots.
         CreateStore(klass, CreateObjStructGEP(ObjType::INSTANCE, ptr, 1));
-        CreateStore(fields, CreateObjStructGEP(ObjType::INSTANCE, ptr, 2));
+        CreateStore(getNullPtr(), CreateObjStructGEP(ObjType::INSTANCE, ptr, 2));
+        CreateStore(
+            CreateLoad(getPtrTy(), getModule().getRootShape()), CreateObjStructGEP(ObjType::INSTANCE, ptr, 3)
+        );
+
+        return ptr;
+    }
+
+    Value *LoxBuilder::AllocateBoundMethod(Value *receiver, Value *method) {
+        assert(receiver->getType() == getPtrTy());
+        assert(method->getType() == getPtrTy());
 
-        CreateInvariantStart(ptr, getSizeOf(ObjType::INSTANCE));
+        auto *const ptr = AllocateObj(ObjType::BOUND_METHOD, "bound_method");
+        CreateStore(ObjVal(receiver), CreateObjStructGEP(ObjType::BOUND_METHOD, ptr, 1));
+        CreateStore(method, CreateObjStructGEP(ObjType::BOUND_METHOD, ptr, 2));
 
         return ptr;
     }
 
-    Value *LoxBuilder::BindMethod(Value *klass, Value *receiver, Value *key, const unsigned int line, const llvm::Function *pFunction) {
+    Value *LoxBuilder::LookupMethod(Value *klass, Value *key, const unsigned int line, const llvm::Function *pFunction) {
         assert(klass->getType() == getPtrTy());
-        assert(receiver->getType() == getPtrTy());
+        assert(key->getType() == getPtrTy());
 
-        static auto *BindMethodFunction([this] {
+        static auto *LookupMethodFunction([this] {
             auto *const F = Function::Create(
                 FunctionType::get(
                     getPtrTy(),
-                    {getPtrTy(), getPtrTy(), getPtrTy(), getInt32Ty(), getPtrTy()},
+                    {getPtrTy(), getPtrTy(), getInt32Ty(), getPtrTy()},
                     false
                 ),
                 Function::InternalLinkage,
-                "$bindMethod",
+                "$lookupMethod",
                 getModule()
             );
 
@@ -57,10 +70,9 @@ namespace lox {
 
             auto *const arguments = F->args().begin();
             auto *const klass = arguments;
-            auto *const receiver = arguments + 1;
-            auto *const key = arguments + 2;
-            auto *const line = arguments + 3;
-            auto *const function = arguments + 4;
+            auto *const key = arguments + 1;
+            auto *const line = arguments + 2;
+            auto *const function = arguments + 3;
 
             auto *const methods = B.CreateLoad(B.getPtrTy(), B.CreateObjStructGEP(ObjType::CLASS, klass, 2));
             auto *const method = B.TableGet(methods, key);
@@ -81,23 +93,71 @@ namespace lox {
             }
             B.SetInsertPoint(IsDefinedBlock);
             {
-                auto *const ptr = B.AllocateObj(ObjType::BOUND_METHOD, "bound_method");
-                B.CreateStore(B.ObjVal(receiver), B.CreateObjStructGEP(ObjType::BOUND_METHOD, ptr, 1));
-                B.CreateStore(B.AsObj(method), B.CreateObjStructGEP(ObjType::BOUND_METHOD, ptr, 2));
-
-                B.CreateRet(ptr);
+                B.CreateRet(B.AsObj(method));
             }
 
             return F;
         }());
 
-        auto *const ptr = CreateCall(
-            BindMethodFunction,
-            {klass, receiver, key, getInt32(line), CreateGlobalCachedString(pFunction == nullptr ? "script" : pFunction->getName())}
+        return CreateCall(
+            LookupMethodFunction,
+            {klass, key, getInt32(line), CreateGlobalCachedString(pFunction == nullptr ? "script" : pFunction->getName())}
+        );
+    }
+
+    Value *LoxBuilder::LookupMethodCached(
+        Value *klass, Value *key, const unsigned int line, const llvm::Function *pFunction
+    ) {
+        assert(klass->getType() == getPtrTy());
+        assert(key->getType() == getPtrTy());
+
+        // The call site remembers the last class it looked up a method for. Both the class
+        // and the method are roots, so that the class address can't be reused.
+        auto *const cachedClass = new GlobalVariable(
+            getModule(), getInt64Ty(), false, GlobalValue::PrivateLinkage, cast<Constant>(getUninitializedVal()),
+            "$cache.class"
+        );
+        auto *const cachedMethod = new GlobalVariable(
+            getModule(), getInt64Ty(), false, GlobalValue::PrivateLinkage, cast<Constant>(getUninitializedVal()),
+            "$cache.method"
         );
+        AddGlobalGCRoot(getModule(), cachedClass);
+        AddGlobalGCRoot(getModule(), cachedMethod);
+
+        auto *const HitBlock = CreateBasicBlock("method.cache.hit");
+        auto *const MissBlock = CreateBasicBlock("method.cache.miss");
+        auto *const EndBlock = CreateBasicBlock("method.cache.end");
+
+        CreateCondBr(CreateICmpEQ(CreateLoad(getInt64Ty(), cachedClass), ObjVal(klass)), HitBlock, MissBlock);
+
+        SetInsertPoint(HitBlock);
+        auto *const cached = AsObj(CreateLoad(getInt64Ty(), cachedMethod));
+        CreateBr(EndBlock);
+
+        SetInsertPoint(MissBlock);
+        auto *const method = LookupMethod(klass, key, line, pFunction);
+        CreateStore(ObjVal(klass), cachedClass);
+        CreateStore(ObjVal(method), cachedMethod);
+        CreateBr(EndBlock);
+
+        SetInsertPoint(EndBlock);
+        auto *const result = CreatePHI(getPtrTy(), 2, "method");
+        result->addIncoming(cached, HitBlock);
+        result->addIncoming(method, MissBlock);
+
+        return result;
+    }
+
+    Value *LoxBuilder::BindMethod(
+        Value *klass, Value *receiver, Value *key, const unsigned int line, const llvm::Function *pFunction
+    ) {
+        assert(klass->getType() == getPtrTy());
+        assert(receiver->getType() == getPtrTy());
+
+        auto *const ptr = AllocateBoundMethod(receiver, LookupMethodCached(klass, key, line, pFunction));
 
         CreateInvariantStart(ptr, getSizeOf(ObjType::BOUND_METHOD));
 
         return ptr;
     }
-}// namespace lox
\ No newline at end of file
+}// namespace lox
@@ -0,0 +1,82 @@
+#include "CompileCache.h"
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA256.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+
+using namespace llvm::sys;
+
+namespace lox {
+    // Bumped when the layout of the key, or of the cache, changes.
+    constexpr uint64_t CACHE_VERSION = 1;
+
+    // Each part is prefixed with its length, so that no two different lists of parts hash the same.
+    static void Hash(SHA256 &Hasher, const StringRef part) {
+        uint8_t length[sizeof(uint64_t)];
+        support::endian::write64le(length, part.size());
+        Hasher.update(ArrayRef(length));
+        Hasher.update(part);
+    }
+
+    std::string CompileCache::key(const StringRef source, const StringRef triple, const ArrayRef<std::string> options) {
+        SHA256 Hasher;
+        Hash(Hasher, std::to_string(CACHE_VERSION));
+        Hash(Hasher, LLVM_VERSION_STRING);
+
+        const auto executable = fs::getMainExecutable(nullptr, reinterpret_cast<void *>(&CompileCache::key));
+        if (fs::file_status status; !fs::status(executable, status)) {
+            Hash(Hasher, std::to_string(status.getSize()));
+            Hash(Hasher, std::to_string(status.getLastModificationTime().time_since_epoch().count()));
+        }
+
+        Hash(Hasher, triple);
+        for (const auto &option: options) { Hash(Hasher, option); }
+        Hash(Hasher, source);
+
+        return toHex(Hasher.final(), /*LowerCase=*/true);
+    }
+
+    SmallString<128> CompileCache::path(const StringRef key) const {
+        SmallString<128> path(directory);
+        path::append(path, key + ".o");
+        return path;
+    }
+
+    std::unique_ptr<MemoryBuffer> CompileCache::lookup(const StringRef key) const {
+        auto object = MemoryBuffer::getFile(path(key), /*IsText=*/false, /*RequiresNullTerminator=*/false);
+        if (!object) return nullptr;
+        return std::move(*object);
+    }
+
+    bool CompileCache::store(const StringRef key, const StringRef object) const {
+        if (fs::create_directories(directory)) return false;
+
+        int fd;
+        SmallString<128> temporary;
+        if (fs::createUniqueFile(Twine(path(key)) + ".%%%%%%.tmp", fd, temporary)) return false;
+
+        {
+            raw_fd_ostream out(fd, /*shouldClose=*/true);
+            out << object;
+            out.close();
+            if (out.has_error()) {
+                out.clear_error();
+                fs::remove(temporary);
+                return false;
+            }
+        }
+
+        if (fs::rename(temporary, path(key))) {
+            fs::remove(temporary);
+            return false;
+        }
+
+        return true;
+    }
+}// namespace lox
@@ -0,0 +1,49 @@
+#ifndef COMPILECACHE_H
+#define COMPILECACHE_H
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <memory>
+#include <string>
+
+using namespace llvm;
+
+namespace lox {
+
+    /**
+     * A directory of compiled objects, each named by the hash of everything it was
+     * compiled from: the source, the compiler, the target triple and the options
+     * baked into the program. An object found in the cache is used as it is,
+     * without scanning, parsing or compiling the script again.
+     */
+    class CompileCache {
+        SmallString<128> directory;
+
+        [[nodiscard]] SmallString<128> path(StringRef key) const;
+
+    public:
+        explicit CompileCache(const StringRef directory) : directory{directory} {}
+
+        /**
+         * The key of a script's object. The compiler is identified by the size and
+         * modification time of its executable, as well as LLVM's version, so that
+         * rebuilding the compiler invalidates the cache.
+         */
+        [[nodiscard]] static std::string key(StringRef source, StringRef triple, ArrayRef<std::string> options);
+
+        // The cached object, or nullptr if there is none.
+        [[nodiscard]] std::unique_ptr<MemoryBuffer> lookup(StringRef key) const;
+
+        /**
+         * Adds an object to the cache. It's written to a temporary file and renamed, so
+         * concurrent compilers never read a partial object; returns false on failure.
+         */
+        [[nodiscard]] bool store(StringRef key, StringRef object) const;
+    };
+
+}// namespace lox
+
+#endif//COMPILECACHE_H
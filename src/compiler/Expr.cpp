@@ -1,4 +1,3 @@
-#include "Callstack.h"
 #include "FunctionCompiler.h"
 #include "MDUtil.h"
 #include "ModuleCompiler.h"
@@ -15,7 +14,15 @@ using namespace std::string_view_literals;
 
 namespace lox {
 
-    Value *FunctionCompiler::evaluate(const Expr &expr) { return std::visit(*this, expr); }
+    Value *FunctionCompiler::evaluate(const Expr &expr) {
+        // An expression's instructions are attributed to its line, the rest
+        // of the enclosing expression's to the enclosing one's.
+        const auto enclosing = Builder.getCurrentDebugLocation();
+        setDebugLine(lineOf(expr));
+        auto *const value = std::visit(*this, expr);
+        Builder.SetCurrentDebugLocation(enclosing);
+        return value;
+    }
 
     Value *FunctionCompiler::operator()(const AssignExprPtr &assignExpr) {
         auto *const value = evaluate(assignExpr->value);
@@ -23,7 +30,12 @@ namespace lox {
         // Copy metadata from the value to the variable.
         metadata::eraseMetadata(variable);
         metadata::copyMetadata(value, variable);
-        Builder.CreateStore(value, variable);
+        // A closed upvalue stores the value in the upvalue object itself.
+        auto *const upvalue =
+            lookupLocal(assignExpr->name) == nullptr ? resolveUpvalue(this, assignExpr->name.getLexeme()) : nullptr;
+        if (upvalue != nullptr) { DeletionBarrier(Builder, Builder.CreateLoad(Builder.getInt64Ty(), variable)); }
+        Builder.CreateStore(isNumberSlot(variable) ? Builder.AsNumber(value) : value, variable);
+        if (upvalue != nullptr) { WriteBarrier(Builder, upvalue, value); }
         return value;
     }
 
@@ -31,6 +43,24 @@ namespace lox {
         auto *const left = evaluate(binaryExpr->left);
         auto *const right = evaluate(binaryExpr->right);
 
+        // Operands inferred to be numbers need no type checks.
+        if (typeOf(binaryExpr->left) == InferredType::NUMBER && typeOf(binaryExpr->right) == InferredType::NUMBER) {
+            auto *const X = Builder.AsNumber(left);
+            auto *const Y = Builder.AsNumber(right);
+            switch (binaryExpr->op) {
+                case BinaryOp::PLUS: return Builder.NumberVal(Builder.CreateFAdd(X, Y));
+                case BinaryOp::MINUS: return Builder.NumberVal(Builder.CreateFSub(X, Y));
+                case BinaryOp::SLASH: return Builder.NumberVal(Builder.CreateFDiv(X, Y));
+                case BinaryOp::STAR: return Builder.NumberVal(Builder.CreateFMul(X, Y));
+                case BinaryOp::GREATER: return Builder.BoolVal(Builder.CreateFCmpOGT(X, Y));
+                case BinaryOp::GREATER_EQUAL: return Builder.BoolVal(Builder.CreateFCmpOGE(X, Y));
+                case BinaryOp::LESS: return Builder.BoolVal(Builder.CreateFCmpOLT(X, Y));
+                case BinaryOp::LESS_EQUAL: return Builder.BoolVal(Builder.CreateFCmpOLE(X, Y));
+                case BinaryOp::BANG_EQUAL: return Builder.BoolVal(Builder.CreateNot(Builder.CreateFCmpOEQ(X, Y)));
+                case BinaryOp::EQUAL_EQUAL: return Builder.BoolVal(Builder.CreateFCmpOEQ(X, Y));
+            }
+        }
+
         auto mdBuilder = MDBuilder(Builder.getContext());
         switch (binaryExpr->op) {
             case BinaryOp::MINUS:
@@ -168,10 +198,6 @@ namespace lox {
         assert(receiver->getType() == Builder.getInt64Ty());
         assert(closure->getType() == Builder.getPtrTy());
 
-        CheckStackOverflow(
-            Builder, Builder.getInt32(line), Builder.CreateGlobalCachedString(Builder.getFunction()->getName())
-        );
-
         auto *const upvalues = Builder.CreateLoad(
             Builder.getPtrTy(), Builder.CreateStructGEP(Builder.getModule().getStructType(ObjType::CLOSURE), closure, 2)
         );
@@ -186,10 +212,15 @@ namespace lox {
         FunctionType *FT = FunctionType::get(IntegerType::getInt64Ty(Builder.getContext()), paramTypes, false);
 
         Value *functionPtr;
+        Function *NumberFunction = nullptr;
 
         if (metadata::hasMetadata(closure, "lox-function")) {
             const auto *const metadata = metadata::getMetadata(closure, "lox-function");
             functionPtr = Builder.getModule().getFunction(cast<MDString>(metadata->getOperand(2))->getString());
+            if (metadata->getNumOperands() > 3) {
+                NumberFunction =
+                    Builder.getModule().getFunction(cast<MDString>(metadata->getOperand(3))->getString());
+            }
 
             auto *const expectedArity = mdconst::extract<ConstantInt>(metadata->getOperand(1));
 
@@ -201,6 +232,9 @@ namespace lox {
 
                 auto *const Unreachable = Builder.CreateBasicBlock("unreachable");
                 Builder.SetInsertPoint(Unreachable);
+                // The clone's signature has the declared arity, so it can't be called
+                // with these arguments, even from an unreachable block.
+                NumberFunction = nullptr;
             }
         } else {
             auto *const function = Builder.CreateLoad(
@@ -225,18 +259,74 @@ namespace lox {
             );
         }
 
-        PushCall(Builder, Builder.getInt32(line), Builder.CreateGlobalCachedString(Builder.getFunction()->getName()));
-        auto *const result = Builder.CreateCall(FT, functionPtr, paramValues);
-        PopCall(Builder);
+        // The line of the call, for the stack trace of an error in the callee; the
+        // frame's header already names this function.
+        Builder.CreateStore(
+            Builder.getInt32(line), Builder.CreateStructGEP(Builder.getModule().getRootFrameStructType(), frame, 2)
+        );
+        Value *result;
+        if (NumberFunction != nullptr) {
+            // If all the arguments are numbers, call the function's clone which takes them unboxed.
+            auto *const NumberBlock = Builder.CreateBasicBlock("call.number");
+            auto *const BoxedBlock = Builder.CreateBasicBlock("call.boxed");
+            auto *const EndBlock = Builder.CreateBasicBlock("call.end");
+
+            Value *isNumber = Builder.getTrue();
+            for (auto *const param: paramValues | std::views::drop(2)) {
+                isNumber = Builder.CreateAnd(isNumber, Builder.IsNumber(param));
+            }
+            Builder.CreateCondBr(isNumber, NumberBlock, BoxedBlock);
+
+            Builder.SetInsertPoint(NumberBlock);
+            std::vector<Value *> numberParamValues{paramValues[0], paramValues[1]};
+            for (auto *const param: paramValues | std::views::drop(2)) {
+                numberParamValues.push_back(Builder.AsNumber(param));
+            }
+            auto *const numberResult = Builder.CreateCall(NumberFunction, numberParamValues);
+            Builder.CreateBr(EndBlock);
+
+            Builder.SetInsertPoint(BoxedBlock);
+            auto *const boxedResult = Builder.CreateCall(FT, functionPtr, paramValues);
+            Builder.CreateBr(EndBlock);
+
+            Builder.SetInsertPoint(EndBlock);
+            auto *const phi = Builder.CreatePHI(Builder.getInt64Ty(), 2);
+            phi->addIncoming(numberResult, NumberBlock);
+            phi->addIncoming(boxedResult, BoxedBlock);
+            result = phi;
+        } else {
+            result = Builder.CreateCall(FT, functionPtr, paramValues);
+        }
 
         return result;
     }
 
+    void CheckInstance(LoxBuilder &Builder, const std::string_view message, const unsigned int line, Value *instance) {
+        auto *const NotInstanceBlock = Builder.CreateBasicBlock("not.instance");
+        auto *const EndBlock = Builder.CreateBasicBlock("end");
+
+        Builder.CreateCondBr(Builder.IsInstance(instance), EndBlock, NotInstanceBlock);
+
+        Builder.SetInsertPoint(NotInstanceBlock);
+        Builder.RuntimeError(line, message, {}, Builder.getFunction());
+
+        Builder.SetInsertPoint(EndBlock);
+    }
+
     Value *FunctionCompiler::operator()(const CallExprPtr &callExpr) {
         const auto paramValues = to<std::vector<Value *>>(
             callExpr->arguments | std::views::transform([&](const auto &p) -> Value * { return evaluate(p); })
         );
 
+        // Calls of the form obj.method() and super.method() call the method directly,
+        // without allocating a bound method first.
+        if (const auto *const getExpr = std::get_if<GetExprPtr>(&callExpr->callee)) {
+            return invoke(*getExpr, paramValues, callExpr->keyword.getLine());
+        }
+        if (const auto *const superExpr = std::get_if<SuperExprPtr>(&callExpr->callee)) {
+            return invokeSuper(*superExpr, paramValues, callExpr->keyword.getLine());
+        }
+
         auto *const value = evaluate(callExpr->callee);
 
         if (metadata::hasMetadata(value, "lox-function")) {
@@ -264,6 +354,65 @@ namespace lox {
             }
         }
 
+        return keepReachable(callValue(value, paramValues, callExpr->keyword.getLine()));
+    }
+
+    Value *FunctionCompiler::invoke(
+        const GetExprPtr &getExpr, const std::vector<Value *> &paramValues, const unsigned int line
+    ) {
+        auto *const object = evaluate(getExpr->object);
+        CheckInstance(Builder, "Only instances have properties.\n"sv, getExpr->name.getLine(), object);
+
+        auto *const instance = Builder.AsObj(object);
+        auto *const key = Builder.CreateStringConstant(getExpr->name.getLexeme());
+        auto *const field = Builder.InstanceGetFieldCached(instance, key);
+
+        auto *const IsFieldBlock = Builder.CreateBasicBlock("invoke.field");
+        auto *const IsMethodBlock = Builder.CreateBasicBlock("invoke.method");
+        auto *const EndBlock = Builder.CreateBasicBlock("invoke.end");
+
+        Builder.CreateCondBr(Builder.IsUninitialized(field), IsMethodBlock, IsFieldBlock);
+
+        Builder.SetInsertPoint(IsFieldBlock);
+        // Fields shadow methods and can contain any value.
+        auto *const fieldResult = callValue(field, paramValues, line);
+        auto *const EndFieldBlock = Builder.GetInsertBlock();
+        Builder.CreateBr(EndBlock);
+
+        Builder.SetInsertPoint(IsMethodBlock);
+        auto *const klass =
+            Builder.CreateLoad(Builder.getPtrTy(), Builder.CreateObjStructGEP(ObjType::INSTANCE, instance, 1));
+        auto *const method = Builder.LookupMethodCached(
+            klass, key, getExpr->name.getLine(), enclosing == nullptr ? nullptr : Builder.getFunction()
+        );
+        auto *const methodResult = call(object, method, paramValues, line);
+        auto *const EndMethodBlock = Builder.GetInsertBlock();
+        Builder.CreateBr(EndBlock);
+
+        Builder.SetInsertPoint(EndBlock);
+        auto *const result = Builder.CreatePHI(Builder.getInt64Ty(), 2);
+        result->addIncoming(fieldResult, EndFieldBlock);
+        result->addIncoming(methodResult, EndMethodBlock);
+
+        return keepReachable(result);
+    }
+
+    Value *FunctionCompiler::invokeSuper(
+        const SuperExprPtr &superExpr, const std::vector<Value *> &paramValues, const unsigned int line
+    ) {
+        static auto assignable = Assignable{Token(THIS, "this"sv, nullptr, superExpr->name.getLine())};
+        auto *const instance = Builder.CreateLoad(Builder.getInt64Ty(), lookupVariable(assignable));
+        auto *const klass = Builder.CreateLoad(Builder.getInt64Ty(), lookupVariable(*superExpr));
+        auto *const method = Builder.LookupMethodCached(
+            Builder.AsObj(klass), Builder.CreateStringConstant(superExpr->method.getLexeme()), superExpr->name.getLine(),
+            enclosing == nullptr ? nullptr : Builder.getFunction()
+        );
+
+        return keepReachable(call(instance, method, paramValues, line));
+    }
+
+    Value *
+    FunctionCompiler::callValue(Value *value, const std::vector<Value *> &paramValues, const unsigned int line) {
         const bool isClass = metadata::hasMetadata(value, "lox-class");
 
         auto *const valuePtr = Builder.AsObj(value);
@@ -304,11 +453,11 @@ namespace lox {
 
         Builder.CreateCondBr(Builder.IsUninitialized(initializer), NoInitializerBlock, HasInitializerBlock);
         Builder.SetInsertPoint(HasInitializerBlock);
-        call(instanceVal, Builder.AsObj(initializer), paramValues, callExpr->keyword.getLine());
+        call(instanceVal, Builder.AsObj(initializer), paramValues, line);
         Builder.CreateBr(EndClassBlock);
 
         Builder.SetInsertPoint(NoInitializerBlock);
-        CheckArity(*this, EndClassBlock, Builder.getInt32(0), paramValues.size(), callExpr->keyword.getLine());
+        CheckArity(*this, EndClassBlock, Builder.getInt32(0), paramValues.size(), line);
 
         Builder.SetInsertPoint(EndClassBlock);
 
@@ -325,7 +474,7 @@ namespace lox {
 
         Builder.SetInsertPoint(NotCallableBlock);
         Builder.RuntimeError(
-            callExpr->keyword.getLine(), "Can only call functions and classes.\n", {}, Builder.getFunction()
+            line, "Can only call functions and classes.\n", {}, Builder.getFunction()
         );
 
         Builder.SetInsertPoint(IsClosureBlock);
@@ -342,7 +491,7 @@ namespace lox {
         receiver->addIncoming(receiverObjVal, IsMethodBlock);
         receiver->addIncoming(value, IsClosureBlock);
 
-        auto *const functionReturnVal = call(receiver, closure, paramValues, callExpr->keyword.getLine());
+        auto *const functionReturnVal = call(receiver, closure, paramValues, line);
 
         auto *const EndCall = Builder.GetInsertBlock();
 
@@ -352,6 +501,10 @@ namespace lox {
         result->addIncoming(instanceVal, EndClassBlock);
         result->addIncoming(functionReturnVal, EndCall);
 
+        return result;
+    }
+
+    Value *FunctionCompiler::keepReachable(Value *result) {
         auto *const IsObjBlock = Builder.CreateBasicBlock("is.obj");
         auto *const ReturnBlock = Builder.CreateBasicBlock("return");
         Builder.CreateCondBr(Builder.IsObj(result), IsObjBlock, ReturnBlock);
@@ -391,28 +544,14 @@ namespace lox {
         return result;
     }
 
-    void CheckInstance(LoxBuilder &Builder, const std::string_view message, const unsigned int line, Value *instance) {
-        auto *const NotInstanceBlock = Builder.CreateBasicBlock("not.instance");
-        auto *const EndBlock = Builder.CreateBasicBlock("end");
-
-        Builder.CreateCondBr(Builder.IsInstance(instance), EndBlock, NotInstanceBlock);
-
-        Builder.SetInsertPoint(NotInstanceBlock);
-        Builder.RuntimeError(line, message, {}, Builder.getFunction());
-
-        Builder.SetInsertPoint(EndBlock);
-    }
-
     Value *FunctionCompiler::operator()(const GetExprPtr &getExpr) {
         Value *object = evaluate(getExpr->object);
         CheckInstance(Builder, "Only instances have properties.\n"sv, getExpr->name.getLine(), object);
 
         auto *const instance = Builder.AsObj(object);
-        auto *const fields =
-            Builder.CreateLoad(Builder.getPtrTy(), Builder.CreateObjStructGEP(ObjType::INSTANCE, instance, 2));
 
-        auto *const key = Builder.AllocateString(getExpr->name.getLexeme(), getExpr->name.getLexeme());
-        auto *const result = Builder.TableGet(fields, key);
+        auto *const key = Builder.CreateStringConstant(getExpr->name.getLexeme());
+        auto *const result = Builder.InstanceGetFieldCached(instance, key);
 
         auto *const IsMethodBlock = Builder.CreateBasicBlock("property.ismethod");
         auto *const IsDefinedBlock = Builder.CreateBasicBlock("property.defined");
@@ -448,10 +587,9 @@ namespace lox {
 
         auto *const instance = Builder.AsObj(object);
         auto *const value = evaluate(setExpr->value);
-        auto *const fields =
-            Builder.CreateLoad(Builder.getPtrTy(), Builder.CreateObjStructGEP(ObjType::INSTANCE, instance, 2));
 
-        Builder.TableSet(fields, Builder.AllocateString(setExpr->name.getLexeme(), "key"), value);
+        Builder.InstanceSetFieldCached(instance, Builder.CreateStringConstant(setExpr->name.getLexeme()), value);
+        WriteBarrier(Builder, instance, value);
 
         return value;
     }
@@ -465,9 +603,8 @@ namespace lox {
         auto *const instance = Builder.CreateLoad(Builder.getInt64Ty(), lookupVariable(assignable));
         auto *const klass = Builder.CreateLoad(Builder.getInt64Ty(), lookupVariable(*superExpr));
         auto *const method = DelayGC(Builder, [&](LoxBuilder &B) {
-            auto *const key = B.ObjVal(B.AllocateString(superExpr->method.getLexeme()));
             return B.BindMethod(
-                B.AsObj(klass), B.AsObj(instance), B.AsObj(key), superExpr->name.getLine(),
+                B.AsObj(klass), B.AsObj(instance), B.CreateStringConstant(superExpr->method.getLexeme()), superExpr->name.getLine(),
                 enclosing == nullptr ? nullptr : B.getFunction()
             );
         });
@@ -476,6 +613,7 @@ namespace lox {
 
     Value *FunctionCompiler::operator()(const VarExprPtr &varExpr) {
         auto *const value = lookupVariable(*varExpr);
+        if (isNumberSlot(value)) { return Builder.NumberVal(Builder.CreateLoad(Builder.getDoubleTy(), value)); }
         auto *inst = Builder.CreateLoad(Builder.getInt64Ty(), value);
         metadata::copyMetadata(value, inst);
         return inst;
@@ -493,8 +631,8 @@ namespace lox {
                     return Builder.getInt64(std::bit_cast<int64_t>(double_value));
                 },
                 [this](const std::string_view string_value) -> Value * {
-                    // Push onto the locals stack so that the string is reachable as a GC root, before it's assigned to a variable.
-                    return insertTemp(Builder.ObjVal(Builder.AllocateString(string_value)), "string");
+                    // String literals are constants, which are never collected.
+                    return Builder.ObjVal(Builder.CreateStringConstant(string_value));
                 },
                 [this](const std::nullptr_t) -> Value * { return Builder.getNilVal(); },
             },
@@ -561,6 +699,10 @@ namespace lox {
                     Builder.CreateSelect(Builder.IsTruthy(left), Builder.getFalse(), Builder.getTrue())
                 );
             case UnaryOp::MINUS: {
+                if (typeOf(unaryExpr->expression) == InferredType::NUMBER) {
+                    return Builder.NumberVal(Builder.CreateFNeg(Builder.AsNumber(left)));
+                }
+
                 auto *const InvalidNumBlock = Builder.CreateBasicBlock("if.not.num");
                 auto *const EndBlock = Builder.CreateBasicBlock("if.num");
 
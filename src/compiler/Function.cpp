@@ -77,7 +77,7 @@ namespace lox {
         }());
 
         auto *const ptr = DelayGC(*this, [&](LoxBuilder &B) {
-            auto *const nameObj = AllocateString(name);
+            auto *const nameObj = CreateStringConstant(name);
             auto *const functionObj = AllocateFunction(*this, function, nameObj, isNative);
             return B.CreateCall(AllocationClosureFunction, {functionObj});
         });
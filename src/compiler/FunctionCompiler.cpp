@@ -1,15 +1,210 @@
 #include "FunctionCompiler.h"
 #include "../Debug.h"
+#include "Callstack.h"
+#include "GC.h"
 #include "ModuleCompiler.h"
 
+#include <llvm/ADT/BitVector.h>
+#include <llvm/IR/InstIterator.h>
+
 namespace lox {
 
+    // Whether calling the function may run a collection. Runtime functions are searched for
+    // a path to $gc, Lox functions and natives allocate, and C library functions never collect.
+    static bool MayCollect(const Function *F, DenseMap<const Function *, bool> &cache) {
+        if (F->isIntrinsic()) return false;
+        if (!F->getName().starts_with("$")) return F->hasLocalLinkage();
+        if (const auto cached = cache.find(F); cached != cache.end()) return cached->second;
+
+        bool result = false;
+        SmallPtrSet<const Function *, 32> visited{F};
+        SmallVector<const Function *> worklist{F};
+        while (!result && !worklist.empty()) {
+            const auto *const current = worklist.pop_back_val();
+            if (current->getName() == "$gc" || current->isDeclaration()) {
+                result = true;
+                break;
+            }
+            for (const auto &I: instructions(current)) {
+                const auto *const call = dyn_cast<CallBase>(&I);
+                if (call == nullptr || call->isInlineAsm()) continue;
+                const auto *const callee = call->getCalledFunction();
+                if (callee == nullptr) {
+                    result = true;
+                    break;
+                }
+                if (callee->isIntrinsic()) continue;
+                if (!callee->getName().starts_with("$")) {
+                    if (callee->hasLocalLinkage()) {
+                        result = true;
+                        break;
+                    }
+                    continue;
+                }
+                if (visited.insert(callee).second) worklist.push_back(callee);
+            }
+        }
+
+        cache[F] = result;
+        return result;
+    }
+
+    static bool IsSafepoint(const Instruction &I, DenseMap<const Function *, bool> &cache) {
+        const auto *const call = dyn_cast<CallBase>(&I);
+        if (call == nullptr || call->isInlineAsm()) return false;
+        const auto *const callee = call->getCalledFunction();
+        return callee == nullptr || MayCollect(callee, cache);
+    }
+
+    // Adds the instructions using the value, or a value computed from it, to the uses;
+    // once stored, the value is kept alive by wherever it's stored.
+    static void AddDerivedUses(Value *value, SmallPtrSetImpl<Instruction *> &uses) {
+        SmallVector<Value *> worklist{value};
+        while (!worklist.empty()) {
+            for (auto *const user: worklist.pop_back_val()->users()) {
+                auto *const I = dyn_cast<Instruction>(user);
+                if (I == nullptr || !uses.insert(I).second) continue;
+                if (!isa<StoreInst>(I)) worklist.push_back(I);
+            }
+        }
+    }
+
+    unsigned int FunctionCompiler::allocateRootSlots() {
+        auto &F = *Builder.getFunction();
+        const unsigned int count = rootSlots.size();
+        auto &cache = Builder.getModule().getMayCollectCache();
+
+        // A slot must be in the frame if its address escapes, to an upvalue for example,
+        // or if it's live at a call that may collect: the value is used after the call,
+        // directly or through a value computed from it.
+        BitVector keep(count);
+        DenseMap<const Instruction *, BitVector> gens;
+        DenseMap<const Instruction *, unsigned int> kills;
+        for (unsigned int i = 0; i < count; i++) {
+            auto *const slot = rootSlots[i];
+            SmallPtrSet<Instruction *, 16> uses;
+            for (auto *const user: slot->users()) {
+                if (auto *const load = dyn_cast<LoadInst>(user)) {
+                    uses.insert(load);
+                    AddDerivedUses(load, uses);
+                } else if (auto *const store = dyn_cast<StoreInst>(user);
+                           store != nullptr && store->getValueOperand() != slot) {
+                    kills[store] = i;
+                    // The stored value must also stay reachable until its last use.
+                    if (auto *const value = store->getValueOperand(); isa<Instruction, Argument>(value)) {
+                        SmallPtrSet<Instruction *, 16> storedUses;
+                        AddDerivedUses(value, storedUses);
+                        storedUses.erase(store);
+                        uses.insert(storedUses.begin(), storedUses.end());
+                    }
+                } else {
+                    keep.set(i);
+                }
+            }
+            for (const auto *const I: uses) {
+                auto &gen = gens[I];
+                if (gen.empty()) gen.resize(count);
+                gen.set(i);
+            }
+        }
+
+        const auto transfer = [&](const BasicBlock &BB, BitVector live, const bool markSafepoints) {
+            for (const auto &I: reverse(BB)) {
+                if (const auto kill = kills.find(&I); kill != kills.end()) live.reset(kill->second);
+                if (const auto gen = gens.find(&I); gen != gens.end()) live |= gen->second;
+                if (markSafepoints && IsSafepoint(I, cache)) keep |= live;
+            }
+            return live;
+        };
+        DenseMap<const BasicBlock *, BitVector> liveIn;
+        const auto liveOut = [&](const BasicBlock &BB) {
+            BitVector live(count);
+            for (const auto *const successor: successors(&BB)) {
+                if (const auto in = liveIn.find(successor); in != liveIn.end()) live |= in->second;
+            }
+            return live;
+        };
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (const auto &BB: reverse(F)) {
+                auto in = transfer(BB, liveOut(BB), false);
+                if (auto &entry = liveIn[&BB]; entry != in) {
+                    entry = std::move(in);
+                    changed = true;
+                }
+            }
+        }
+        for (const auto &BB: F) transfer(BB, liveOut(BB), true);
+
+        // Clearing a slot at the end of its scope is only needed if a collection
+        // can happen before the slot is written again.
+        const auto collectionFollows = [&](StoreInst *store, const unsigned int slot) {
+            SmallPtrSet<const BasicBlock *, 16> visited;
+            SmallVector<std::pair<const BasicBlock *, BasicBlock::const_iterator>> worklist{
+                {store->getParent(), std::next(store->getIterator())}
+            };
+            while (!worklist.empty()) {
+                const auto [BB, begin] = worklist.pop_back_val();
+                bool overwritten = false;
+                for (auto it = begin; it != BB->end() && !overwritten; ++it) {
+                    if (const auto kill = kills.find(&*it); kill != kills.end() && kill->second == slot) {
+                        overwritten = true;
+                    } else if (IsSafepoint(*it, cache)) {
+                        return true;
+                    }
+                }
+                if (overwritten) continue;
+                for (const auto *const successor: successors(BB)) {
+                    if (visited.insert(successor).second) worklist.emplace_back(successor, successor->begin());
+                }
+            }
+            return false;
+        };
+        for (auto *const store: scopeExitStores) {
+            if (const auto slot = kills.lookup(store); !keep.test(slot) || !collectionFollows(store, slot)) {
+                kills.erase(store);
+                store->eraseFromParent();
+            }
+        }
+
+        // The kept slots are renumbered to fill the frame, the others become plain allocas.
+        unsigned int index = 0;
+        for (unsigned int i = 0; i < count; i++) {
+            auto *const slot = rootSlots[i];
+            Instruction *replacement;
+            if (keep.test(i)) {
+                IRBuilder SlotBuilder(slot);
+                replacement =
+                    cast<Instruction>(SlotBuilder.CreateConstInBoundsGEP1_32(Builder.getInt64Ty(), slots, index++));
+            } else {
+                replacement = CreateEntryBlockAlloca(&F, Builder.getInt64Ty(), "");
+            }
+            replacement->takeName(slot);
+            slot->replaceAllUsesWith(replacement);
+            slot->eraseFromParent();
+        }
+        rootSlots.clear();
+        scopeExitStores.clear();
+
+        return index;
+    }
+
     void FunctionCompiler::compile(
         const std::vector<Stmt> &statements, const std::vector<Token> &parameters,
-        const std::function<void(LoxBuilder &)> &entryBlockBuilder
+        const std::function<void(LoxBuilder &)> &entryBlockBuilder, const unsigned int line
     ) {
 
         Builder.SetInsertPoint(EntryBasicBlock);
+        if (auto *const DIB = Builder.getModule().getDIBuilder()) {
+            auto *const file = Builder.getModule().getDebugFile();
+            auto *const subprogram = DIB->createFunction(
+                file, Builder.getFunction()->getName(), StringRef(), file, line,
+                DIB->createSubroutineType(DIB->getOrCreateTypeArray({})), line, DINode::FlagPrototyped,
+                DISubprogram::SPFlagDefinition
+            );
+            Builder.getFunction()->setSubprogram(subprogram);
+            setDebugLine(line);
+        }
         // Alloca's will normally be generated here with CreateEntryBlockAlloca
         if constexpr (DEBUG_LOG_GC) {
             Builder.PrintF({
@@ -21,6 +216,12 @@ namespace lox {
         auto *const PrologueBlock = Builder.CreateBasicBlock("prologue");
         Builder.CreateBr(PrologueBlock);
         Builder.SetInsertPoint(PrologueBlock);
+        // The frame is linked at the beginning of the prologue, so that it's part of the stack trace.
+        if (type != LoxFunctionType::NONE) {
+            CheckStackOverflow(Builder, frame, line);
+            // Calls and loop back-edges are where a program that doesn't allocate spends its time.
+            PollGCStatsRequest(Builder);
+        }
 
         beginScope();
         {
@@ -35,9 +236,8 @@ namespace lox {
             {
                 if constexpr (DEBUG_LOG_GC) {
                     Builder.PrintF(
-                        {Builder.CreateGlobalCachedString("## start function inner scope %s (sp %d)\n"),
-                         Builder.CreateGlobalCachedString(Builder.getFunction()->getName()),
-                         Builder.CreateLoad(Builder.getInt32Ty(), sp)}
+                        {Builder.CreateGlobalCachedString("## start function inner scope %s (frame %p)\n"),
+                         Builder.CreateGlobalCachedString(Builder.getFunction()->getName()), frame}
                     );
                 }
                 // Declare parameters and store them in local variables.
@@ -62,9 +262,8 @@ namespace lox {
 
             if constexpr (DEBUG_LOG_GC) {
                 Builder.PrintF(
-                    {Builder.CreateGlobalCachedString("## end function inner scope %s (sp %d)\n"),
-                     Builder.CreateGlobalCachedString(Builder.getFunction()->getName()),
-                     Builder.CreateLoad(Builder.getInt32Ty(), sp)}
+                    {Builder.CreateGlobalCachedString("## end function inner scope %s (frame %p)\n"),
+                     Builder.CreateGlobalCachedString(Builder.getFunction()->getName()), frame}
                 );
             }
 
@@ -86,22 +285,55 @@ namespace lox {
 
         endScope();
 
-        // At the beginning of the function, remember the current local variable stack pointer.
+        // Now that the locals which must survive a collection are known, the frame
+        // type can be completed with their slots, which follow the header.
+        const auto slotsCount = allocateRootSlots();
+        auto *const RootFrameStruct = Builder.getModule().getRootFrameStructType();
+        std::vector<Type *> frameElements(RootFrameStruct->element_begin(), RootFrameStruct->element_end());
+        frameElements.push_back(ArrayType::get(Builder.getInt64Ty(), slotsCount));
+        frame->setAllocatedType(StructType::get(Builder.getContext(), frameElements));
+
+        // At the beginning of the function, link the frame into the chain of root frames
+        // with all slots cleared, so that the GC never sees an unwritten slot. Even without
+        // locals the frame is linked, for the stack trace.
         IRBuilder EntryBlockBuilder(PrologueBlock, PrologueBlock->begin());
-        const auto locals = Builder.getModule().getLocalsStack();
-        EntryBlockBuilder.CreateStore(locals.CreateGetCount(EntryBlockBuilder), sp);
-        // Create new slots for the required number of locals.
-        locals.CreatePushN(Builder.getModule(), EntryBlockBuilder, EntryBlockBuilder.getInt32(localsCount));
+        auto *const rootFrames = Builder.getModule().getRootFrames();
+        EntryBlockBuilder.CreateStore(
+            EntryBlockBuilder.CreateLoad(EntryBlockBuilder.getPtrTy(), rootFrames),
+            EntryBlockBuilder.CreateStructGEP(RootFrameStruct, frame, 0)
+        );
+        EntryBlockBuilder.CreateStore(
+            EntryBlockBuilder.getInt32(slotsCount), EntryBlockBuilder.CreateStructGEP(RootFrameStruct, frame, 1)
+        );
+        EntryBlockBuilder.CreateStore(
+            EntryBlockBuilder.getInt32(line), EntryBlockBuilder.CreateStructGEP(RootFrameStruct, frame, 2)
+        );
+        EntryBlockBuilder.CreateStore(
+            Builder.CreateGlobalCachedString(Builder.getFunction()->getName()),
+            EntryBlockBuilder.CreateStructGEP(RootFrameStruct, frame, 3)
+        );
+        if (slotsCount == 0) {
+            cast<Instruction>(slots)->eraseFromParent();
+        } else {
+            EntryBlockBuilder.CreateMemSet(
+                slots, EntryBlockBuilder.getInt8(0), slotsCount * sizeof(uint64_t), Align(8)
+            );
+        }
+        auto *const link = EntryBlockBuilder.CreateStore(frame, rootFrames);
+        // The profiler's signal handler walks the chain, so the header must be written before
+        // the frame is linked; a single-thread fence costs no instruction.
+        if (Builder.getModule().isProfiling()) link->setAtomic(AtomicOrdering::Release, SyncScope::SingleThread);
 
-        // At the end of the function, reset the stack pointer then any variables allocated
+        // At the end of the function, unlink the frame then any variables allocated
         // in the function are no longer accessible as GC roots and can be freed.
-        locals.CreatePopN(Builder, Builder.getInt32(localsCount));
+        Builder.CreateStore(
+            Builder.CreateLoad(Builder.getPtrTy(), Builder.CreateStructGEP(RootFrameStruct, frame, 0)), rootFrames
+        );
 
         if constexpr (DEBUG_LOG_GC) {
             Builder.PrintF(
-                {Builder.CreateGlobalCachedString("# end function scope %s (sp %d)\n"),
-                 Builder.CreateGlobalCachedString(Builder.getFunction()->getName()),
-                 Builder.CreateLoad(Builder.getInt32Ty(), sp)}
+                {Builder.CreateGlobalCachedString("# end function scope %s\n"),
+                 Builder.CreateGlobalCachedString(Builder.getFunction()->getName())}
             );
         }
 
@@ -46,22 +46,19 @@ namespace lox {
         struct Local {
             FunctionCompiler &compiler;
             std::string_view name;
+            // Numbers are not GC roots, so a local that only ever holds numbers
+            // is kept in an alloca of a double rather than in a root frame slot,
+            // which lets it be promoted to double SSA values.
+            bool isNumber;
+            unsigned int index;
             Value *value;
             bool isCaptured = false;
-            unsigned int index;
-            Local(FunctionCompiler &compiler, const std::string_view name, Value *value, const bool isCaptured = false)
-                : compiler{compiler}, name{name}, value{value}, isCaptured{isCaptured} {
-                auto &B = compiler.Builder;
-                B.CreateLifetimeStart(value, B.getInt64(64));
-                index = compiler.localsCount++;
+            Local(FunctionCompiler &compiler, const std::string_view name, const bool isNumber = false)
+                : compiler{compiler}, name{name}, isNumber{isNumber}, index{isNumber ? 0 : compiler.localsCount++},
+                  value{isNumber ? compiler.CreateNumberSlot(name) : compiler.CreateRootSlot(index, name)} {
                 if constexpr (DEBUG_STACK) {
-                    auto *const stackOffset = B.CreateAdd(
-                        B.CreateLoad(B.getInt32Ty(), compiler.sp), B.getInt32(index), "stackOffset", true, true
-                    );
-                    B.PrintF(
-                        {B.CreateGlobalCachedString("create local %d at %d %p\n"), B.getInt32(index), stackOffset, value
-                        }
-                    );
+                    auto &B = compiler.Builder;
+                    B.PrintF({B.CreateGlobalCachedString("create local %d at %p\n"), B.getInt32(index), value});
                 }
             }
             ~Local() {
@@ -77,21 +74,14 @@ namespace lox {
                     closeUpvalues(B, value);
                 }
 
-                B.CreateLifetimeEnd(value, B.getInt64(64));
-
-                const auto &locals = B.getModule().getLocalsStack();
-                auto *const stackIndex =
-                    B.CreateAdd(B.CreateLoad(B.getInt32Ty(), compiler.sp), B.getInt32(index), "stackIndex", true, true);
                 if constexpr (DEBUG_STACK) {
-                    B.PrintF(
-                        {B.CreateGlobalCachedString("end local %d at %d %p sp: %d c: %d\n"), B.getInt32(index),
-                         stackIndex, value, B.CreateLoad(B.getInt32Ty(), compiler.sp), locals.CreateGetCount(B)}
-                    );
+                    B.PrintF({B.CreateGlobalCachedString("end local %d at %p\n"), B.getInt32(index), value});
                 }
 
-                // At the end of the scope, clear the entry in the locals stack,
-                // so that it's no longer reachable by the GC.
-                locals.CreateSet(B, stackIndex, B.getNullPtr());
+                // At the end of the scope, clear the slot in the root frame,
+                // so that the value is no longer reachable by the GC; the store
+                // is dropped if no collection can happen before the slot is reused.
+                if (!isNumber) compiler.scopeExitStores.push_back(B.CreateStore(B.getUninitializedVal(), value));
             }
         };
 
@@ -104,8 +94,14 @@ namespace lox {
         LoxFunctionType type;
         BasicBlock *EntryBasicBlock = Builder.CreateBasicBlock("entry");
         BasicBlock *ExitBasicBlock = Builder.CreateBasicBlock("epilogue");
-        AllocaInst *sp;
+        // The root frame holds the locals of the function that must survive a
+        // collection, so that the GC can find them by walking the chain of frames
+        // from the module's root frames; see allocateRootSlots.
+        AllocaInst *frame;
+        Value *slots;
         unsigned int localsCount = 0;
+        std::vector<GetElementPtrInst *> rootSlots;
+        std::vector<StoreInst *> scopeExitStores;
         std::unordered_set<Value *> functionLocals;
 
     public:
@@ -115,13 +111,29 @@ namespace lox {
         )
             : Builder{Context, Module, F}, enclosing(enclosing), type{type} {
             Builder.SetInsertPoint(EntryBasicBlock);
-            sp = CreateEntryBlockAlloca(Builder.getFunction(), Builder.getInt32Ty(), "$sp");
+            frame = CreateEntryBlockAlloca(
+                Builder.getFunction(), Builder.getModule().getRootFrameStructType(), "$frame"
+            );
+            IRBuilder FrameBuilder(EntryBasicBlock, std::next(frame->getIterator()));
+            // The local slots start directly after the frame header; the frame's
+            // type is completed once the number of locals is known.
+            slots = FrameBuilder.CreateConstInBoundsGEP1_32(
+                Builder.getModule().getRootFrameStructType(), frame, 1, "$slots"
+            );
+        }
+
+        // With -g, attributes the instructions emitted from now on to the line of the script.
+        void setDebugLine(const unsigned int line) {
+            if (line == 0) return;
+            if (auto *const subprogram = Builder.getFunction()->getSubprogram()) {
+                Builder.SetCurrentDebugLocation(DILocation::get(Builder.getContext(), line, 0, subprogram));
+            }
         }
 
-        // Statement code generation.
+        // Statement code generation; the line is the function's declaration.
         void compile(
             const std::vector<Stmt> &statements, const std::vector<Token> &parameters = {},
-            const std::function<void(LoxBuilder &)> &entryBlockBuilder = nullptr
+            const std::function<void(LoxBuilder &)> &entryBlockBuilder = nullptr, unsigned int line = 0
         );
         void evaluate(const Stmt &stmt);
         void operator()(const BlockStmtPtr &blockStmt);
@@ -140,6 +152,10 @@ namespace lox {
         Value *operator()(const BinaryExprPtr &binaryExpr);
         Value *operator()(const CallExprPtr &callExpr);
         Value *call(Value *receiver, Value *closure, std::vector<Value *> paramValues, unsigned int line);
+        Value *callValue(Value *value, const std::vector<Value *> &paramValues, unsigned int line);
+        Value *invoke(const GetExprPtr &getExpr, const std::vector<Value *> &paramValues, unsigned int line);
+        Value *invokeSuper(const SuperExprPtr &superExpr, const std::vector<Value *> &paramValues, unsigned int line);
+        Value *keepReachable(Value *result);
         Value *operator()(const GetExprPtr &getExpr);
         Value *operator()(const SetExprPtr &setExpr);
         Value *operator()(const ThisExprPtr &thisExpr);
@@ -274,7 +290,9 @@ namespace lox {
             return Builder.getModule().getNamedGlobal(("g" + name).str());
         }
 
-        Value *insertVariable(const std::string_view key, Value *value, const bool isConstant = false) {
+        Value *insertVariable(
+            const std::string_view key, Value *value, const bool isConstant = false, const bool isNumber = false
+        ) {
             assert(value->getType() == Builder.getInt64Ty());
 
             if (isGlobalScope()) {
@@ -301,22 +319,12 @@ namespace lox {
 
                 return global;
             } else {
-                auto *const alloca = CreateEntryBlockAlloca(Builder.getFunction(), Builder.getInt64Ty(), key);
-                const auto local = std::make_shared<Local>(*this, key, alloca);
+                const auto local = std::make_shared<Local>(*this, key, isNumber);
                 variables.insert(key, local);
-                metadata::copyMetadata(value, alloca);
-                Builder.CreateStore(value, alloca);
-
-                if (isConstant) { Builder.CreateInvariantStart(alloca, Builder.getInt64(64)); }
+                metadata::copyMetadata(value, local->value);
+                Builder.CreateStore(isNumber ? Builder.AsNumber(value) : value, local->value);
 
-                const auto locals = Builder.getModule().getLocalsStack();
-                auto *const stackIndex = Builder.CreateAdd(
-                    Builder.CreateLoad(Builder.getInt32Ty(), sp), Builder.getInt32(local->index), "stackIndex", true,
-                    true
-                );
-                locals.CreateSet(Builder, stackIndex, alloca);
-
-                return alloca;
+                return local->value;
             }
         }
 
@@ -324,26 +332,45 @@ namespace lox {
             assert(value->getType() == Builder.getInt64Ty());
 
             const auto *const name = "$temp";
-            auto *const alloca =
-                CreateEntryBlockAlloca(Builder.getFunction(), Builder.getInt64Ty(), (name + what).str());
-
-            const auto local = std::make_shared<Local>(*this, name, alloca);
+            const auto local = std::make_shared<Local>(*this, name);
+            local->value->setName((name + what).str());
             variables.insert(name, local);
-            Builder.CreateStore(value, alloca);
-            Builder.CreateInvariantStart(alloca, Builder.getInt64(64));
-
-            const auto locals = Builder.getModule().getLocalsStack();
-            auto *const stackIndex = Builder.CreateAdd(
-                Builder.CreateLoad(Builder.getInt32Ty(), sp), Builder.getInt32(local->index), "stackIndex", true, true
-            );
-            locals.CreateSet(Builder, stackIndex, alloca);
+            Builder.CreateStore(value, local->value);
 
             return value;
         }
 
         Value *captureLocal(Value *local);
 
+        // Returns a pointer to the root frame slot for the local at index.
+        Value *CreateRootSlot(const unsigned int index, const std::string_view name) {
+            IRBuilder SlotBuilder(EntryBasicBlock, std::next(cast<Instruction>(slots)->getIterator()));
+            auto *const slot = cast<GetElementPtrInst>(
+                SlotBuilder.CreateConstInBoundsGEP1_32(Builder.getInt64Ty(), slots, index, name)
+            );
+            rootSlots.push_back(slot);
+            return slot;
+        }
+
+        // Returns a pointer to a local that only ever holds numbers, stored unboxed.
+        Value *CreateNumberSlot(const std::string_view name) {
+            return CreateEntryBlockAlloca(Builder.getFunction(), Builder.getDoubleTy(), name);
+        }
+
+        [[nodiscard]] static bool isNumberSlot(const Value *variable) {
+            const auto *const alloca = dyn_cast<AllocaInst>(variable);
+            return alloca != nullptr && alloca->getAllocatedType()->isDoubleTy();
+        }
+
     private:
+        /**
+         * Once the function is compiled, keeps in the root frame only the slots
+         * whose value is live across a call that may collect garbage, and turns
+         * the others into allocas of their own, which can be promoted to
+         * registers. Returns the number of slots left in the frame.
+         */
+        unsigned int allocateRootSlots();
+
         static Value *resolveUpvalue(FunctionCompiler *compiler, const std::string_view name) {
             if (compiler->enclosing == nullptr) return nullptr;
 
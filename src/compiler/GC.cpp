@@ -1,8 +1,11 @@
 #include "GC.h"
 
 #include "../Debug.h"
+#include "Heap.h"
+#include "MDUtil.h"
 #include "Memory.h"
 #include "ModuleCompiler.h"
+#include "ParallelMark.h"
 #include "Upvalue.h"
 
 #include "Stack.h"
@@ -10,6 +13,10 @@
 
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
 
+#include <charconv>
+#include <csignal>
+#include <ctime>
+
 namespace lox {
 
     void MarkObject(LoxBuilder &Builder, Value *ObjectPtr) {
@@ -19,6 +26,40 @@ namespace lox {
         Builder.CreateCall(MarkObjectFunction, {ObjectPtr});
     }
 
+    // The monotonic clock in nanoseconds.
+    static Value *Now(LoxBuilder &B) {
+        static const auto ClockGetTime = B.getModule().getOrInsertFunction(
+            "clock_gettime", FunctionType::get(B.getInt32Ty(), {B.getInt32Ty(), B.getPtrTy()}, false)
+        );
+
+        auto *const TimespecType = ArrayType::get(B.getInt64Ty(), 2);
+        auto *const timespec = CreateEntryBlockAlloca(B.getFunction(), TimespecType, "timespec");
+        B.CreateCall(ClockGetTime, {B.getInt32(CLOCK_MONOTONIC), timespec});
+        auto *const seconds = B.CreateLoad(B.getInt64Ty(), B.CreateConstInBoundsGEP2_32(TimespecType, timespec, 0, 0));
+        auto *const nanoseconds = B.CreateLoad(B.getInt64Ty(), B.CreateConstInBoundsGEP2_32(TimespecType, timespec, 0, 1));
+        return B.CreateAdd(B.CreateMul(seconds, B.getInt64(1'000'000'000)), nanoseconds, "now");
+    }
+
+    // Adds a pause of the mutator, from start to end, to the GC statistics.
+    static void RecordPause(LoxBuilder &B, Value *start, Value *end) {
+        const auto &M = B.getModule();
+        auto *const pause = B.CreateSub(end, start, "pause");
+        B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt64Ty(), M.getPauseTotal()), pause), M.getPauseTotal());
+        B.CreateStore(
+            B.CreateBinaryIntrinsic(Intrinsic::umax, B.CreateLoad(B.getInt64Ty(), M.getPauseMax()), pause),
+            M.getPauseMax()
+        );
+        // The bucket is the number of bucket bounds that the pause reaches.
+        Value *bucket = B.getInt64(0);
+        for (const auto bound: GC_PAUSE_BUCKETS) {
+            bucket = B.CreateAdd(bucket, B.CreateZExt(B.CreateICmpUGE(pause, B.getInt64(bound)), B.getInt64Ty()));
+        }
+        auto *const count = B.CreateInBoundsGEP(
+            ArrayType::get(B.getInt64Ty(), GC_PAUSE_BUCKETS.size() + 1), M.getPauseHistogram(), {B.getInt64(0), bucket}
+        );
+        B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt64Ty(), count), B.getInt64(1)), count);
+    }
+
     static void MarkValue(LoxBuilder &B, Value *value) {
         assert(value->getType() == B.getInt64Ty());
 
@@ -187,9 +228,45 @@ namespace lox {
                     B.PrintF({B.CreateGlobalCachedString("black instance %s\n"), B.AsCString(B.CreateLoad(B.getInt64Ty(), B.CreateObjStructGEP(ObjType::CLASS, instanceKlass, 1)))});
                 }
                 MarkObject(B, instanceKlass);
-                MarkTable(B, fields);
 
-                B.CreateBr(EndBlock);
+                auto *const IsDictionaryBlock = B.CreateBasicBlock("instance.dictionary");
+                auto *const IsShapeBlock = B.CreateBasicBlock("instance.shape");
+
+                B.CreateCondBr(B.CreateIsNotNull(fields), IsDictionaryBlock, IsShapeBlock);
+                B.SetInsertPoint(IsDictionaryBlock);
+                {
+                    MarkTable(B, fields);
+                    B.CreateBr(EndBlock);
+                }
+                B.SetInsertPoint(IsShapeBlock);
+                {
+                    auto *const InstanceStruct = B.getModule().getStructType(ObjType::INSTANCE);
+                    auto *const shape = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(InstanceStruct, instance, 3));
+                    auto *const count = B.CreateLoad(
+                        B.getInt32Ty(), B.CreateStructGEP(B.getModule().getShapeStructType(), shape, 2), "count"
+                    );
+                    auto *const slot = CreateEntryBlockAlloca(F, B.getInt32Ty(), "slot");
+                    B.CreateStore(B.getInt32(0), slot);
+
+                    auto *const WhileCond = B.CreateBasicBlock("while.cond");
+                    auto *const WhileBody = B.CreateBasicBlock("while.body");
+
+                    B.CreateBr(WhileCond);
+                    B.SetInsertPoint(WhileCond);
+                    B.CreateCondBr(B.CreateICmpULT(B.CreateLoad(B.getInt32Ty(), slot), count), WhileBody, EndBlock);
+                    B.SetInsertPoint(WhileBody);
+                    {
+                        auto *const index = B.CreateLoad(B.getInt32Ty(), slot);
+                        MarkValue(
+                            B, B.CreateLoad(
+                                   B.getInt64Ty(),
+                                   B.CreateInBoundsGEP(InstanceStruct, instance, {B.getInt32(0), B.getInt32(4), index})
+                               )
+                        );
+                        B.CreateStore(B.CreateAdd(index, B.getInt32(1), "slot+1", true, true), slot);
+                        B.CreateBr(WhileCond);
+                    }
+                }
             }
             B.SetInsertPoint(IsBoundMethod);
             {
@@ -221,7 +298,7 @@ namespace lox {
         Builder.CreateCall(BlackObjectFunction, {ObjectPtr});
     }
 
-    static void TraceReferences(LoxBuilder &Builder) {
+    static Function *BlackenFunction(LoxBuilder &Builder) {
         static auto *BlackenFunction([&Builder] {
             auto *const F = Function::Create(
                 FunctionType::get(
@@ -246,11 +323,26 @@ namespace lox {
             return F;
         }());
 
+        return BlackenFunction;
+    }
+
+    static void TraceReferences(LoxBuilder &Builder) {
         if constexpr (DEBUG_LOG_GC) {
             Builder.PrintString("-- trace refs --");
         }
 
-        Builder.getModule().getGrayStack().CreatePopAll(Builder, BlackenFunction);
+        Builder.getModule().getGrayStack().CreatePopAll(Builder, BlackenFunction(Builder));
+    }
+
+    // Blackens up to INCREMENTAL_MARK_STEP gray objects.
+    static void TraceIncrement(LoxBuilder &Builder) {
+        if constexpr (DEBUG_LOG_GC) {
+            Builder.PrintString("-- trace increment --");
+        }
+
+        Builder.getModule().getGrayStack().CreatePopAtMost(
+            Builder, BlackenFunction(Builder), Builder.getInt32(INCREMENTAL_MARK_STEP)
+        );
     }
 
     static void MarkGlobalRoots(LoxBuilder &Builder) {
@@ -288,30 +380,90 @@ namespace lox {
         }
     }
 
-    static void IterateLocals(LoxBuilder &Builder, Function *FunctionPointer) {
-        if constexpr (DEBUG_LOG_GC) {
-            auto *const sp = Builder.getModule().getLocalsStack().CreateGetCount(Builder);
-            Builder.PrintF({Builder.CreateGlobalCachedString("--iterate locals (%d)--\n"), sp});
-        }
+    static void MarkRootFrames(LoxBuilder &Builder) {
+        static auto *const MarkRootFramesFunction = [&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(
+                    Builder.getVoidTy(),
+                    {},
+                    false
+                ),
+                Function::InternalLinkage,
+                "$markRootFrames",
+                Builder.getModule()
+            );
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
 
-        Builder.getModule().getLocalsStack().CreateIterateObjectValues(Builder, FunctionPointer);
-    }
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const RootFrameStruct = B.getModule().getRootFrameStructType();
+            auto *const frame = CreateEntryBlockAlloca(F, B.getPtrTy(), "frame");
+            auto *const i = CreateEntryBlockAlloca(F, B.getInt64Ty(), "i");
+            B.CreateStore(B.CreateLoad(B.getPtrTy(), B.getModule().getRootFrames()), frame);
+
+            auto *const WhileCond = B.CreateBasicBlock("while.cond");
+            auto *const WhileBody = B.CreateBasicBlock("while.body");
+            auto *const WhileEnd = B.CreateBasicBlock("while.end");
+            auto *const ForCond = B.CreateBasicBlock("for.cond");
+            auto *const ForBody = B.CreateBasicBlock("for.body");
+            auto *const ForEnd = B.CreateBasicBlock("for.end");
+
+            B.CreateBr(WhileCond);
+            B.SetInsertPoint(WhileCond);
+            B.CreateCondBr(B.CreateIsNotNull(B.CreateLoad(B.getPtrTy(), frame)), WhileBody, WhileEnd);
+            B.SetInsertPoint(WhileBody);
+            {
+                auto *const current = B.CreateLoad(B.getPtrTy(), frame);
+                auto *const count = B.CreateZExt(
+                    B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(RootFrameStruct, current, 1, "count")),
+                    B.getInt64Ty()
+                );
+                // The local slots start directly after the frame header.
+                auto *const slots = B.CreateConstInBoundsGEP1_32(RootFrameStruct, current, 1, "slots");
+
+                if constexpr (DEBUG_LOG_GC) {
+                    B.PrintF({B.CreateGlobalCachedString("--iterate root frame %p (%d)--\n"), current, count});
+                }
+
+                B.CreateStore(B.getInt64(0), i);
+                B.CreateBr(ForCond);
+                B.SetInsertPoint(ForCond);
+                B.CreateCondBr(B.CreateICmpULT(B.CreateLoad(B.getInt64Ty(), i), count), ForBody, ForEnd);
+                B.SetInsertPoint(ForBody);
+                {
+                    auto *const index = B.CreateLoad(B.getInt64Ty(), i);
+                    MarkValue(B, B.CreateLoad(B.getInt64Ty(), B.CreateInBoundsGEP(B.getInt64Ty(), slots, index)));
+                    B.CreateStore(B.CreateAdd(index, B.getInt64(1), "i+1", true, true), i);
+                    B.CreateBr(ForCond);
+                }
+                B.SetInsertPoint(ForEnd);
+                B.CreateStore(
+                    B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(RootFrameStruct, current, 0, "previous")), frame
+                );
+                B.CreateBr(WhileCond);
+            }
+            B.SetInsertPoint(WhileEnd);
+            B.CreateRetVoid();
+
+            return F;
+        }();
 
-    static void MarkRoots(LoxBuilder &Builder) {
-        static auto *const MarkObjectFunction = Builder.getModule().getFunction("$markObject");
-        if constexpr (DEBUG_LOG_GC) {
-            Builder.PrintString("--mark roots--");
-        }
-        IterateLocals(Builder, MarkObjectFunction);
-        MarkGlobalRoots(Builder);
-        IterateUpvalues(Builder, MarkObjectFunction);
         if constexpr (DEBUG_LOG_GC) {
-            Builder.PrintString("--end mark roots--");
+            Builder.PrintString("--iterate locals--");
         }
+
+        Builder.CreateCall(MarkRootFramesFunction);
     }
 
-    static void Sweep(LoxBuilder &Builder) {
-        static auto *TraceRefsFunction([&Builder] {
+    // Shapes are permanent roots by design: they're buffers, not Lox objects, and are
+    // never freed, since a shape stays reachable from the root shape through the
+    // transition tables even once no instance has it. The transitions are keyed by
+    // the same key strings and hold raw shape pointers, so there is nothing else to
+    // trace. Marking every shape's key keeps the strings, compared by address, from
+    // being freed and their address reused for another name.
+    static void MarkShapes(LoxBuilder &Builder) {
+        static auto *const MarkShapesFunction = [&Builder] {
             auto *const F = Function::Create(
                 FunctionType::get(
                     Builder.getVoidTy(),
@@ -319,25 +471,17 @@ namespace lox {
                     false
                 ),
                 Function::InternalLinkage,
-                "$sweep",
+                "$markShapes",
                 Builder.getModule()
             );
-
             LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
             auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
             B.SetInsertPoint(EntryBasicBlock);
 
-            auto *const object = CreateEntryBlockAlloca(F, B.getPtrTy(), "object");
-            auto *const previous = CreateEntryBlockAlloca(F, B.getPtrTy(), "next");
-            B.CreateStore(
-                B.CreateLoad(B.getPtrTy(), B.getModule().getObjects()),
-                object
-            );
-            B.CreateStore(B.getNullPtr(), previous);
-
-            if constexpr (DEBUG_LOG_GC) {
-                B.PrintF({B.CreateGlobalCachedString("--sweep (objects @ %p)--\n"), B.CreateLoad(B.getPtrTy(), object)});
-            }
+            auto *const ShapeStruct = B.getModule().getShapeStructType();
+            auto *const shape = CreateEntryBlockAlloca(F, B.getPtrTy(), "shape");
+            B.CreateStore(B.CreateLoad(B.getPtrTy(), B.getModule().getShapes()), shape);
 
             auto *const WhileCond = B.CreateBasicBlock("while.cond");
             auto *const WhileBody = B.CreateBasicBlock("while.body");
@@ -345,83 +489,90 @@ namespace lox {
 
             B.CreateBr(WhileCond);
             B.SetInsertPoint(WhileCond);
-            B.CreateCondBr(B.CreateIsNotNull(B.CreateLoad(B.getPtrTy(), object)), WhileBody, WhileEnd);
+            B.CreateCondBr(B.CreateIsNotNull(B.CreateLoad(B.getPtrTy(), shape)), WhileBody, WhileEnd);
             B.SetInsertPoint(WhileBody);
             {
-                auto *const IsNotMarkedBlock = B.CreateBasicBlock("is.notmarked");
-                auto *const IsMarkedBlock = B.CreateBasicBlock("is.marked");
+                auto *const current = B.CreateLoad(B.getPtrTy(), shape);
+                auto *const key = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(ShapeStruct, current, 1, "key"));
+                auto *const IsKeyBlock = B.CreateBasicBlock("key");
+                auto *const NextBlock = B.CreateBasicBlock("next");
+                B.CreateCondBr(B.CreateIsNotNull(key), IsKeyBlock, NextBlock);
+                B.SetInsertPoint(IsKeyBlock);
+                MarkObject(B, key);
+                B.CreateBr(NextBlock);
+                B.SetInsertPoint(NextBlock);
+                B.CreateStore(B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(ShapeStruct, current, 4, "next")), shape);
+                B.CreateBr(WhileCond);
+            }
+            B.SetInsertPoint(WhileEnd);
+            B.CreateRetVoid();
 
-                auto *const isMarked = B.CreateLoad(B.getInt1Ty(), B.CreateStructGEP(B.getModule().getObjStructType(), B.CreateLoad(B.getPtrTy(), object), 1, "isMarked"));
-                B.CreateCondBr(B.CreateICmpEQ(B.getTrue(), isMarked), IsMarkedBlock, IsNotMarkedBlock);
+            return F;
+        }();
 
-                B.SetInsertPoint(IsMarkedBlock);
-                {
-                    B.CreateStore(B.getFalse(), B.CreateStructGEP(B.getModule().getObjStructType(), B.CreateLoad(B.getPtrTy(), object), 1, "isMarked"));
-                    B.CreateStore(B.CreateLoad(B.getPtrTy(), object), previous);
-                    auto *const nextptr = B.CreateLoad(
-                        B.getPtrTy(),
-                        B.CreateStructGEP(B.getModule().getObjStructType(), B.CreateLoad(B.getPtrTy(), object), 2, "next")
-                    );
-                    B.CreateStore(
-                        nextptr,
-                        object
-                    );
-                    B.CreateBr(WhileCond);
-                }
-                B.SetInsertPoint(IsNotMarkedBlock);
-                {
-                    auto *const unreached = CreateEntryBlockAlloca(F, B.getPtrTy(), "unreached");
-
-                    B.CreateStore(B.CreateLoad(B.getPtrTy(), object), unreached);
-                    B.CreateStore(
-                        B.CreateLoad(
-                            B.getPtrTy(),
-                            B.CreateStructGEP(B.getModule().getObjStructType(), B.CreateLoad(B.getPtrTy(), object), 2, "next")
-                        ),
-                        object
-                    );
+        if constexpr (DEBUG_LOG_GC) {
+            Builder.PrintString("--iterate shapes--");
+        }
 
-                    auto *const IsNull = B.CreateBasicBlock("is.notmarked.null");
-                    auto *const IsNotNull = B.CreateBasicBlock("is.notmarked.notnull");
-                    auto *const End = B.CreateBasicBlock("end");
+        Builder.CreateCall(MarkShapesFunction);
+    }
 
-                    B.CreateCondBr(B.CreateIsNull(B.CreateLoad(B.getPtrTy(), previous)), IsNull, IsNotNull);
-                    B.SetInsertPoint(IsNull);
-                    {
-                        B.CreateStore(B.CreateLoad(B.getPtrTy(), object), B.getModule().getObjects());
-                        B.CreateBr(End);
-                    }
-                    B.SetInsertPoint(IsNotNull);
-                    {
-                        B.CreateStore(
-                            B.CreateLoad(B.getPtrTy(), object),
-                            B.CreateStructGEP(B.getModule().getObjStructType(), B.CreateLoad(B.getPtrTy(), previous), 2, "next")
-                        );
-                        B.CreateBr(End);
-                    }
-                    B.SetInsertPoint(End);
+    static void MarkRoots(LoxBuilder &Builder) {
+        static auto *const MarkObjectFunction = Builder.getModule().getFunction("$markObject");
+        if constexpr (DEBUG_LOG_GC) {
+            Builder.PrintString("--mark roots--");
+        }
+        MarkRootFrames(Builder);
+        MarkGlobalRoots(Builder);
+        MarkShapes(Builder);
+        IterateUpvalues(Builder, MarkObjectFunction);
+        if constexpr (DEBUG_LOG_GC) {
+            Builder.PrintString("--end mark roots--");
+        }
+    }
 
-                    if constexpr (DEBUG_LOG_GC) {
-                        B.PrintF({B.CreateGlobalCachedString("unreached %p: "), B.CreateLoad(B.getPtrTy(), unreached)});
-                    }
+    static void RescanRemembered(LoxBuilder &Builder) {
+        static auto *RescanFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(
+                    Builder.getVoidTy(),
+                    {Builder.getPtrTy()},
+                    false
+                ),
+                Function::InternalLinkage,
+                "$rescanRemembered",
+                Builder.getModule()
+            );
 
-                    FreeObject(B, B.ObjVal(B.CreateLoad(B.getPtrTy(), unreached)));
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
 
-                    B.CreateBr(WhileCond);
-                }
-            }
-            B.SetInsertPoint(WhileEnd);
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
 
-            if constexpr (DEBUG_LOG_GC) {
-                B.PrintString("--end sweep--");
+            auto *const object = F->arg_begin();
+
+            auto *const IsOldBlock = B.CreateBasicBlock("is.old");
+            auto *const EndBlock = B.CreateBasicBlock("end");
+
+            ClearBit(B, Bitmap::REMEMBERED, object);
+            // After a major collection cleared the marks, the object is
+            // traced only if it's reached again.
+            B.CreateCondBr(TestBit(B, Bitmap::MARK, object), IsOldBlock, EndBlock);
+            B.SetInsertPoint(IsOldBlock);
+            {
+                B.getModule().getGrayStack().CreatePush(B.getModule(), B, object);
+                B.CreateBr(EndBlock);
             }
 
+            B.SetInsertPoint(EndBlock);
             B.CreateRetVoid();
 
             return F;
         }());
 
-        Builder.CreateCall(TraceRefsFunction);
+        // Old objects that were written with references since the last collection
+        // must be traced again, since a minor collection does not trace old objects.
+        Builder.getModule().getRememberedSet().CreatePopAll(Builder, RescanFunction);
     }
 
     static void RemoveWhiteStrings(LoxBuilder &Builder) {
@@ -450,8 +601,11 @@ namespace lox {
             auto *const ShouldDeleteBlock = B.CreateBasicBlock("should.delete");
             auto *const EndBlock = B.CreateBasicBlock("end");
 
-            auto *const isMarked = B.CreateStructGEP(B.getModule().getObjStructType(), key, 1, "isMarked");
-            B.CreateCondBr(B.CreateAnd(B.CreateIsNotNull(key), B.CreateNot(B.CreateLoad(B.getInt1Ty(), isMarked))), ShouldDeleteBlock, EndBlock);
+            auto *const IsKeyBlock = B.CreateBasicBlock("is.key");
+
+            B.CreateCondBr(B.CreateIsNotNull(key), IsKeyBlock, EndBlock);
+            B.SetInsertPoint(IsKeyBlock);
+            B.CreateCondBr(IsMarked(B, key), EndBlock, ShouldDeleteBlock);
             B.SetInsertPoint(ShouldDeleteBlock);
             {
                 if constexpr (DEBUG_LOG_GC) {
@@ -509,17 +663,30 @@ namespace lox {
             auto *const ObjectPtr = arguments;
 
             auto *const IsNotNull = B.CreateBasicBlock("is.notnull");
+            auto *const IsHeapBlock = B.CreateBasicBlock("is.heap");
             auto *const IsNotMarkedBlock = B.CreateBasicBlock("is.notmarked");
             auto *const IsMarkedBlock = DEBUG_LOG_GC ? B.CreateBasicBlock("is.marked") : nullptr;
             auto *const EndBlock = B.CreateBasicBlock("end.obj");
 
             B.CreateCondBr(B.CreateIsNull(ObjectPtr), EndBlock, IsNotNull);
             B.SetInsertPoint(IsNotNull);
+            // String constants are outside the heap and never collected.
+            B.CreateCondBr(IsHeapObject(B, ObjectPtr), IsHeapBlock, EndBlock);
+            B.SetInsertPoint(IsHeapBlock);
             {
-                auto *const isMarked = B.CreateLoad(
-                    B.getInt1Ty(),
-                    B.CreateStructGEP(B.getModule().getObjStructType(), ObjectPtr, 1, "isMarked")
-                );
+                // GC threads race to mark the same objects: the one that sets the bit blackens the object.
+                auto *const ParallelBlock = B.CreateBasicBlock("parallel");
+                auto *const ParallelMarkedBlock = B.CreateBasicBlock("parallel.marked");
+                auto *const SerialBlock = B.CreateBasicBlock("serial");
+                B.CreateCondBr(B.CreateLoad(B.getInt1Ty(), B.getModule().getParallelMarking()), ParallelBlock, SerialBlock);
+                B.SetInsertPoint(ParallelBlock);
+                B.CreateCondBr(SetBitAtomic(B, Bitmap::MARK, ObjectPtr), ParallelMarkedBlock, EndBlock);
+                B.SetInsertPoint(ParallelMarkedBlock);
+                PushMarkWorker(B, ObjectPtr);
+                B.CreateBr(EndBlock);
+
+                B.SetInsertPoint(SerialBlock);
+                auto *const isMarked = TestBit(B, Bitmap::MARK, ObjectPtr);
 
                 if constexpr (DEBUG_LOG_GC) {
                     B.CreateCondBr(B.CreateICmpEQ(B.getTrue(), isMarked), IsMarkedBlock, IsNotMarkedBlock);
@@ -540,9 +707,12 @@ namespace lox {
 
                 B.getModule().getGrayStack().CreatePush(B.getModule(), B, ObjectPtr);
 
+                SetBit(B, Bitmap::MARK, ObjectPtr);
+
+                auto *const markedBytes = B.getModule().getMarkedBytes();
                 B.CreateStore(
-                    B.getTrue(),
-                    B.CreateStructGEP(B.getModule().getObjStructType(), ObjectPtr, 1, "isMarked")
+                    B.CreateAdd(B.CreateLoad(B.getInt64Ty(), markedBytes), B.CreateZExt(SlotSize(B, ObjectPtr), B.getInt64Ty())),
+                    markedBytes
                 );
 
                 B.CreateBr(EndBlock);
@@ -567,44 +737,230 @@ namespace lox {
                 B.PrintF({B.CreateGlobalCachedString("  extra root: %p\n"), extraRoot});
             }
 
+            auto *const CheckBlock = B.CreateBasicBlock("check");
+            auto *const TriggerBlock = B.CreateBasicBlock("trigger");
+            auto *const CheckMinorBlock = B.CreateBasicBlock("check.minor");
+            // Each is updated to the block that ends its path into the collection, for the phis.
+            auto *StartMajorBlock = B.CreateBasicBlock("major.start");
+            auto *MarkStepBlock = B.CreateBasicBlock("major.step");
+            auto *MinorBlock = B.CreateBasicBlock("minor");
             auto *const CollectBlock = B.CreateBasicBlock("collect");
             auto *const EndBlock = B.CreateBasicBlock("end");
 
+            // Every allocation comes through here, so a report requested by SIGUSR1
+            // is written here, as well as at calls and loop back-edges.
+            PollGCStatsRequest(B);
+
+            B.CreateCondBr(B.CreateLoad(B.getInt1Ty(), B.getModule().getEnableGC()), CheckBlock, EndBlock);
+
+            // While a major collection is marking, each allocation advances it.
+            B.SetInsertPoint(CheckBlock);
+            B.CreateCondBr(B.CreateLoad(B.getInt1Ty(), B.getModule().getGCMarking()), MarkStepBlock, TriggerBlock);
+
+            B.SetInsertPoint(TriggerBlock);
+            auto *const allocatedBytes = B.CreateLoad(B.getInt64Ty(), B.getModule().getAllocatedBytes());
+            auto *const nurseryBytes = B.CreateLoad(B.getInt64Ty(), B.getModule().getNurseryBytes());
+            auto *const maxHeap = B.CreateLoad(B.getInt64Ty(), B.getModule().getGCMaxHeap());
+            // A major collection is needed once the old generation outgrows its threshold,
+            // or the heap its maximum; otherwise a minor collection runs whenever the nursery is full.
+            auto *const isMajor = B.CreateOr(
+                {force,
+                 B.CreateICmpSGT(B.CreateSub(allocatedBytes, nurseryBytes), B.CreateLoad(B.getInt64Ty(), B.getModule().getNextGC())),
+                 B.CreateAnd(B.CreateICmpNE(maxHeap, B.getInt64(0)), B.CreateICmpUGT(allocatedBytes, maxHeap))}
+            );
+            B.CreateCondBr(isMajor, StartMajorBlock, CheckMinorBlock);
+
+            B.SetInsertPoint(CheckMinorBlock);
             B.CreateCondBr(
-                B.CreateAnd(
-                    B.CreateLoad(B.getInt1Ty(), B.getModule().getEnableGC()),
-                    B.CreateOr(
-                        force,
-                        B.CreateICmpSGT(B.CreateLoad(B.getInt32Ty(), B.getModule().getAllocatedBytes()), B.CreateLoad(B.getInt32Ty(), B.getModule().getNextGC()))
-                    )
-                ),
-                CollectBlock, EndBlock
+                B.CreateICmpSGT(nurseryBytes, B.CreateLoad(B.getInt64Ty(), B.getModule().getNurserySize())), MinorBlock, EndBlock
             );
+
             B.SetInsertPoint(EndBlock);
             if constexpr (DEBUG_LOG_GC) {
                 B.PrintF({B.CreateGlobalCachedString("skip GC\n")});
             }
             B.CreateRetVoid();
 
+            // A major collection starts by marking the roots. The objects reachable
+            // from them are then traced a step at a time by the following allocations,
+            // which allocate black; the deletion barrier marks the references that the
+            // program overwrites meanwhile, so that every object reachable at the start
+            // is marked. With several GC threads, they instead trace everything at once.
+            B.SetInsertPoint(StartMajorBlock);
+            auto *const startMajor = Now(B);
+            {
+                auto *const majorCollections = B.getModule().getMajorCollections();
+                B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt64Ty(), majorCollections), B.getInt64(1)), majorCollections);
+                B.CreateStore(B.getInt64(0), B.getModule().getMarkedBytes());
+
+                // Old objects are marked from the previous collection,
+                // so clear them to trace the whole heap.
+                ClearMarks(B);
+                B.CreateStore(B.getTrue(), B.getModule().getGCMarking());
+
+                B.CreateCall(MarkObjectFunction, {extraRoot});
+                MarkRoots(B);
+                // Forget the remembered objects: all of them are traced again.
+                RescanRemembered(B);
+
+                auto *const StartedBlock = B.CreateBasicBlock("major.started");
+                StartMajorBlock = B.GetInsertBlock();
+                B.CreateCondBr(
+                    B.CreateOr(force, B.CreateICmpUGT(B.CreateLoad(B.getInt32Ty(), B.getModule().getGCThreads()), B.getInt32(1))),
+                    CollectBlock, StartedBlock
+                );
+                B.SetInsertPoint(StartedBlock);
+                RecordPause(B, startMajor, Now(B));
+                B.CreateRetVoid();
+            }
+
+            B.SetInsertPoint(MarkStepBlock);
+            auto *const startStep = Now(B);
+            {
+                B.CreateCall(MarkObjectFunction, {extraRoot});
+                TraceIncrement(B);
+
+                auto *const SteppedBlock = B.CreateBasicBlock("major.stepped");
+                MarkStepBlock = B.GetInsertBlock();
+                B.CreateCondBr(
+                    B.CreateOr(force, B.CreateICmpEQ(B.getModule().getGrayStack().CreateGetCount(B), B.getInt32(0))),
+                    CollectBlock, SteppedBlock
+                );
+                B.SetInsertPoint(SteppedBlock);
+                RecordPause(B, startStep, Now(B));
+                B.CreateRetVoid();
+            }
+
+            B.SetInsertPoint(MinorBlock);
+            auto *const startMinor = Now(B);
+            {
+                auto *const minorCollections = B.getModule().getMinorCollections();
+                B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt64Ty(), minorCollections), B.getInt64(1)), minorCollections);
+                B.CreateStore(B.getInt64(0), B.getModule().getMarkedBytes());
+                MinorBlock = B.GetInsertBlock();
+                B.CreateBr(CollectBlock);
+            }
+
+            // A minor collection runs entirely here. A major collection ends here once
+            // the gray stack is empty, with a final pause that rescans the roots and
+            // the remembered objects and prunes the intern table.
             B.SetInsertPoint(CollectBlock);
-            auto *const before = B.CreateLoad(B.getInt32Ty(), B.getModule().getAllocatedBytes());
+            auto *const start = B.CreatePHI(B.getInt64Ty(), 3, "start");
+            start->addIncoming(startMajor, StartMajorBlock);
+            start->addIncoming(startStep, MarkStepBlock);
+            start->addIncoming(startMinor, MinorBlock);
+            auto *const major = B.CreatePHI(B.getInt1Ty(), 3, "major");
+            major->addIncoming(B.getTrue(), StartMajorBlock);
+            major->addIncoming(B.getTrue(), MarkStepBlock);
+            major->addIncoming(B.getFalse(), MinorBlock);
+
+            if constexpr (DEBUG_LOG_GC) {
+                B.PrintF({B.CreateGlobalCachedString("-- %s collection --\n"), B.CreateSelect(major, B.CreateGlobalCachedString("major"), B.CreateGlobalCachedString("minor"))});
+            }
+            auto *const before = B.CreateLoad(B.getInt64Ty(), B.getModule().getAllocatedBytes());
 
             // Mark the extra root, if any (maybe nullptr).
             B.CreateCall(MarkObjectFunction, {extraRoot});
 
             MarkRoots(B);
-            TraceReferences(B);
+            RescanRemembered(B);
+            {
+                auto *const ParallelBlock = B.CreateBasicBlock("trace.parallel");
+                auto *const SerialBlock = B.CreateBasicBlock("trace.serial");
+                auto *const TracedBlock = B.CreateBasicBlock("traced");
+                B.CreateCondBr(
+                    B.CreateAnd(major, B.CreateICmpUGT(B.CreateLoad(B.getInt32Ty(), B.getModule().getGCThreads()), B.getInt32(1))),
+                    ParallelBlock, SerialBlock
+                );
+                B.SetInsertPoint(ParallelBlock);
+                TraceParallel(B, BlackenFunction(B));
+                B.CreateBr(TracedBlock);
+                B.SetInsertPoint(SerialBlock);
+                TraceReferences(B);
+                B.CreateBr(TracedBlock);
+                B.SetInsertPoint(TracedBlock);
+            }
+            B.CreateStore(B.getFalse(), B.getModule().getGCMarking());
             RemoveWhiteStrings(B);
-            Sweep(B);
+            // Unmarked objects are freed lazily, as the allocator sweeps their pages;
+            // survivors keep their mark bit: a marked object is an old object,
+            // which a minor collection will neither trace nor sweep.
+            StartSweep(B);
+
+            // The dead objects are still counted in the allocated bytes until
+            // they are swept, so after a major collection the live bytes are
+            // estimated from the marked objects.
+            auto *const deadBytes = B.CreateSub(
+                B.CreateLoad(B.getInt64Ty(), B.getModule().getObjectBytes()),
+                B.CreateLoad(B.getInt64Ty(), B.getModule().getMarkedBytes()),
+                "deadBytes"
+            );
+            auto *const liveBytes = B.CreateSub(B.CreateLoad(B.getInt64Ty(), B.getModule().getAllocatedBytes()), deadBytes, "liveBytes");
+
+            const auto &M = B.getModule();
+            auto *const heapLimit = B.CreateLoad(B.getInt64Ty(), M.getGCMaxHeap(), "maxHeap");
+
+            // After a major collection, the next one runs when the heap has grown by the growth
+            // factor, within the bounds of the heap size settings.
+            auto *const grown = B.CreateFPToUI(
+                B.CreateFMul(B.CreateUIToFP(liveBytes, B.getDoubleTy()), B.CreateLoad(B.getDoubleTy(), B.getModule().getGCGrowthFactor())),
+                B.getInt64Ty()
+            );
+            auto *const minHeap = B.CreateLoad(B.getInt64Ty(), B.getModule().getGCMinHeap());
+            auto *const atLeastMin = B.CreateSelect(B.CreateICmpULT(grown, minHeap), minHeap, grown);
+            auto *const nextGC = B.CreateSelect(
+                B.CreateAnd(B.CreateICmpNE(heapLimit, B.getInt64(0)), B.CreateICmpUGT(atLeastMin, heapLimit)), heapLimit, atLeastMin, "nextGC"
+            );
+            B.CreateStore(B.CreateSelect(major, nextGC, B.CreateLoad(B.getInt64Ty(), B.getModule().getNextGC())), B.getModule().getNextGC());
 
-            B.CreateStore(
-                B.CreateMul(B.getInt32(GC_GROWTH_FACTOR), B.CreateLoad(B.getInt32Ty(), B.getModule().getAllocatedBytes()), "nextGC", true, true),
-                B.getModule().getNextGC()
+            // Only the live bytes count against the maximum heap size, which a
+            // major collection has just made as small as it can be.
+            auto *const OutOfMemoryBlock = B.CreateBasicBlock("out.of.memory");
+            auto *const PaceBlock = B.CreateBasicBlock("pace");
+            B.CreateCondBr(
+                B.CreateAnd({major, B.CreateICmpNE(heapLimit, B.getInt64(0)), B.CreateICmpUGT(liveBytes, heapLimit)}),
+                OutOfMemoryBlock, PaceBlock
             );
+            B.SetInsertPoint(OutOfMemoryBlock);
+            OutOfMemory(B);
+
+            // The nursery is sized for the allocation rate since the last collection:
+            // programs which allocate quickly get a larger nursery, so that minor
+            // collections run about once per MINOR_GC_INTERVAL_NS of mutator time.
+            B.SetInsertPoint(PaceBlock);
+            {
+                auto *const mutatorTime = B.CreateSub(start, B.CreateLoad(B.getInt64Ty(), B.getModule().getLastCollection()));
+                auto *const rate = B.CreateFDiv(
+                    B.CreateUIToFP(B.CreateLoad(B.getInt64Ty(), M.getNurseryBytes()), B.getDoubleTy()),
+                    B.CreateUIToFP(B.CreateSelect(B.CreateICmpSLT(mutatorTime, B.getInt64(1)), B.getInt64(1), mutatorTime), B.getDoubleTy()),
+                    "rate"
+                );
+                auto *const nurserySize = B.getModule().getNurserySize();
+                // Average with the previous size, so that a single burst doesn't resize the nursery.
+                auto *const target = B.CreateFMul(
+                    B.CreateFAdd(
+                        B.CreateFMul(rate, ConstantFP::get(B.getDoubleTy(), MINOR_GC_INTERVAL_NS)),
+                        B.CreateUIToFP(B.CreateLoad(B.getInt64Ty(), nurserySize), B.getDoubleTy())
+                    ),
+                    ConstantFP::get(B.getDoubleTy(), 0.5)
+                );
+                auto *const clamped = B.CreateBinaryIntrinsic(
+                    Intrinsic::minnum,
+                    B.CreateBinaryIntrinsic(Intrinsic::maxnum, target, ConstantFP::get(B.getDoubleTy(), MIN_NURSERY_SIZE)),
+                    ConstantFP::get(B.getDoubleTy(), MAX_NURSERY_SIZE)
+                );
+                B.CreateStore(B.CreateFPToUI(clamped, B.getInt64Ty()), nurserySize);
+            }
+
+            B.CreateStore(B.getInt64(0), B.getModule().getNurseryBytes());
+            auto *const end = Now(B);
+            B.CreateStore(end, B.getModule().getLastCollection());
+
+            RecordPause(B, start, end);
 
             if constexpr (DEBUG_LOG_GC) {
                 B.PrintString("-- end GC ---");
-                B.PrintF({B.CreateGlobalCachedString("     collected %zu bytes (from %zu to %zu) next at %zu\n"), B.CreateSub(before, B.CreateLoad(B.getInt32Ty(), B.getModule().getAllocatedBytes()), "from", true, true), before, B.CreateLoad(B.getInt32Ty(), B.getModule().getAllocatedBytes()), B.CreateLoad(B.getInt32Ty(), B.getModule().getNextGC())});
+                B.PrintF({B.CreateGlobalCachedString("     collected %zu bytes (from %zu to %zu) next at %zu\n"), B.CreateSub(before, B.CreateLoad(B.getInt64Ty(), B.getModule().getAllocatedBytes()), "from", true, true), before, B.CreateLoad(B.getInt64Ty(), B.getModule().getAllocatedBytes()), B.CreateLoad(B.getInt64Ty(), B.getModule().getNextGC())});
             }
 
             B.CreateRetVoid();
@@ -619,6 +975,153 @@ namespace lox {
         CreateCall(getModule().getFunction("$gc"), {force ? getTrue() : getFalse(), extraRoot ? extraRoot : getNullPtr()});
     }
 
+    void WriteBarrier(LoxBuilder &Builder, Value *ObjectPtr) {
+        assert(ObjectPtr->getType() == Builder.getPtrTy());
+
+        static auto *RememberFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(
+                    Builder.getVoidTy(),
+                    {Builder.getPtrTy()},
+                    false
+                ),
+                Function::InternalLinkage,
+                "$remember",
+                Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const object = F->arg_begin();
+
+            auto *const RememberBlock = B.CreateBasicBlock("remember");
+            auto *const EndBlock = B.CreateBasicBlock("end");
+
+            auto *const IsHeapBlock = B.CreateBasicBlock("is.heap");
+            auto *const IsOldBlock = B.CreateBasicBlock("is.old");
+
+            B.CreateCondBr(IsHeapObject(B, object), IsHeapBlock, EndBlock);
+            B.SetInsertPoint(IsHeapBlock);
+            B.CreateCondBr(TestBit(B, Bitmap::MARK, object), IsOldBlock, EndBlock);
+            B.SetInsertPoint(IsOldBlock);
+            B.CreateCondBr(TestBit(B, Bitmap::REMEMBERED, object), EndBlock, RememberBlock);
+            B.SetInsertPoint(RememberBlock);
+            {
+                // The remembered bit remembers the old object only once,
+                // until the next collection traces it again.
+                SetBit(B, Bitmap::REMEMBERED, object);
+                B.getModule().getRememberedSet().CreatePush(B.getModule(), B, object);
+                B.CreateBr(EndBlock);
+            }
+
+            B.SetInsertPoint(EndBlock);
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(RememberFunction, {ObjectPtr});
+    }
+
+    void WriteBarrier(LoxBuilder &Builder, Value *ObjectPtr, Value *value) {
+        assert(ObjectPtr->getType() == Builder.getPtrTy());
+        assert(value->getType() == Builder.getInt64Ty());
+
+        static auto *WriteBarrierFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(
+                    Builder.getVoidTy(),
+                    {Builder.getPtrTy(), Builder.getInt64Ty()},
+                    false
+                ),
+                Function::InternalLinkage,
+                "$writeBarrier",
+                Builder.getModule()
+            );
+
+            F->addFnAttr(Attribute::AlwaysInline);
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const arguments = F->arg_begin();
+            auto *const object = arguments;
+            auto *const value = arguments + 1;
+
+            auto *const IsObjBlock = B.CreateBasicBlock("is.obj");
+            auto *const IsYoungBlock = B.CreateBasicBlock("is.young");
+            auto *const EndBlock = B.CreateBasicBlock("end");
+
+            // Only a reference to a young object needs to be remembered.
+            B.CreateCondBr(B.IsObj(value), IsObjBlock, EndBlock);
+            B.SetInsertPoint(IsObjBlock);
+            B.CreateCondBr(IsMarked(B, B.AsObj(value)), EndBlock, IsYoungBlock);
+            B.SetInsertPoint(IsYoungBlock);
+            {
+                WriteBarrier(B, object);
+                B.CreateBr(EndBlock);
+            }
+
+            B.SetInsertPoint(EndBlock);
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(WriteBarrierFunction, {ObjectPtr, value});
+    }
+
+    void DeletionBarrier(LoxBuilder &Builder, Value *OldValue) {
+        assert(OldValue->getType() == Builder.getInt64Ty());
+
+        static auto *DeletionBarrierFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(
+                    Builder.getVoidTy(),
+                    {Builder.getInt64Ty()},
+                    false
+                ),
+                Function::InternalLinkage,
+                "$deletionBarrier",
+                Builder.getModule()
+            );
+
+            F->addFnAttr(Attribute::AlwaysInline);
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const MarkingBlock = B.CreateBasicBlock("marking");
+            auto *const EndBlock = B.CreateBasicBlock("end");
+
+            // Outside of a major collection the barrier is a single load and branch.
+            auto mdBuilder = MDBuilder(B.getContext());
+            B.CreateCondBr(
+                B.CreateLoad(B.getInt1Ty(), B.getModule().getGCMarking()), MarkingBlock, EndBlock,
+                metadata::createUnlikelyBranchWeights(mdBuilder)
+            );
+            B.SetInsertPoint(MarkingBlock);
+            {
+                MarkValue(B, F->arg_begin());
+                B.CreateBr(EndBlock);
+            }
+
+            B.SetInsertPoint(EndBlock);
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(DeletionBarrierFunction, {OldValue});
+    }
+
     /**
      * Each call to this function will append code to the $markGlobalRoots
      * function to mark the value in the global as a root, if it's an object.
@@ -658,4 +1161,397 @@ namespace lox {
 
         return result;
     }
+
+    void CountByType(LoxBuilder &Builder, GlobalVariable *Statistic, Value *ObjType, Value *Bytes) {
+        assert(ObjType->getType() == Builder.getInt8Ty());
+        assert(Bytes->getType() == Builder.getInt64Ty());
+
+        auto *const entry = Builder.CreateInBoundsGEP(
+            Statistic->getValueType(), Statistic, {Builder.getInt32(0), Builder.CreateZExt(ObjType, Builder.getInt32Ty())}
+        );
+        Builder.CreateStore(Builder.CreateAdd(Builder.CreateLoad(Builder.getInt64Ty(), entry), Bytes), entry);
+    }
+
+    void UpdatePeakHeap(LoxBuilder &Builder) {
+        auto *const peakHeap = Builder.getModule().getPeakHeap();
+        Builder.CreateStore(
+            Builder.CreateBinaryIntrinsic(
+                Intrinsic::umax, Builder.CreateLoad(Builder.getInt64Ty(), peakHeap),
+                Builder.CreateLoad(Builder.getInt64Ty(), Builder.getModule().getAllocatedBytes())
+            ),
+            peakHeap
+        );
+    }
+
+    // Formats a histogram bucket bound, such as 10us or 1ms.
+    static std::string FormatDuration(const uint64_t nanoseconds) {
+        if (nanoseconds >= 1'000'000) { return std::to_string(nanoseconds / 1'000'000) + "ms"; }
+        if (nanoseconds >= 1'000) { return std::to_string(nanoseconds / 1'000) + "us"; }
+        return std::to_string(nanoseconds) + "ns";
+    }
+
+    static constexpr std::array<std::pair<ObjType, std::string_view>, OBJ_TYPE_COUNT - 1> OBJ_TYPE_NAMES{{
+        {ObjType::STRING, "string"},
+        {ObjType::FUNCTION, "function"},
+        {ObjType::CLOSURE, "closure"},
+        {ObjType::UPVALUE, "upvalue"},
+        {ObjType::CLASS, "class"},
+        {ObjType::INSTANCE, "instance"},
+        {ObjType::BOUND_METHOD, "bound_method"},
+    }};
+
+    void WriteGCStats(LoxBuilder &Builder) {
+        static auto *WriteGCStatsFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {}, false),
+                Function::InternalLinkage,
+                "$writeGCStats",
+                Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            static const auto GetEnv =
+                B.getModule().getOrInsertFunction("getenv", FunctionType::get(B.getPtrTy(), {B.getPtrTy()}, false));
+            static const auto FOpen = B.getModule().getOrInsertFunction(
+                "fopen", FunctionType::get(B.getPtrTy(), {B.getPtrTy(), B.getPtrTy()}, false)
+            );
+            static const auto FPrintF = B.getModule().getOrInsertFunction(
+                "fprintf", FunctionType::get(B.getInt8Ty(), {B.getPtrTy(), B.getPtrTy()}, true)
+            );
+            static const auto FClose =
+                B.getModule().getOrInsertFunction("fclose", FunctionType::get(B.getInt32Ty(), {B.getPtrTy()}, false));
+
+            auto *const OpenBlock = B.CreateBasicBlock("open");
+            auto *const WriteBlock = B.CreateBasicBlock("write");
+            auto *const EndBlock = B.CreateBasicBlock("end");
+
+            auto *const path = B.CreateCall(GetEnv, {B.CreateGlobalCachedString("LOX_GC_STATS")});
+            B.CreateCondBr(B.CreateIsNull(path), EndBlock, OpenBlock);
+
+            B.SetInsertPoint(OpenBlock);
+            auto *const file = B.CreateCall(FOpen, {path, B.CreateGlobalCachedString("w")});
+            B.CreateCondBr(B.CreateIsNull(file), EndBlock, WriteBlock);
+
+            B.SetInsertPoint(WriteBlock);
+            const auto &M = B.getModule();
+            const auto Write = [&](const StringRef format, const std::vector<Value *> &values = {}) {
+                std::vector<Value *> args{file, B.CreateGlobalCachedString(format)};
+                args.insert(args.end(), values.begin(), values.end());
+                B.CreateCall(FPrintF, args);
+            };
+            const auto Load = [&](GlobalVariable *global) { return B.CreateLoad(B.getInt64Ty(), global); };
+            const auto LoadElement = [&](GlobalVariable *array, const unsigned index) {
+                return B.CreateLoad(
+                    B.getInt64Ty(), B.CreateConstInBoundsGEP2_64(array->getValueType(), array, 0, index)
+                );
+            };
+
+            Write(
+                "{\"collections\": {\"minor\": %lld, \"major\": %lld},\n",
+                {Load(M.getMinorCollections()), Load(M.getMajorCollections())}
+            );
+
+            Write(
+                " \"pauses\": {\"total_ns\": %lld, \"max_ns\": %lld, \"histogram\": {",
+                {Load(M.getPauseTotal()), Load(M.getPauseMax())}
+            );
+            for (unsigned int i = 0; i <= GC_PAUSE_BUCKETS.size(); i++) {
+                const auto label = i < GC_PAUSE_BUCKETS.size() ? "<" + FormatDuration(GC_PAUSE_BUCKETS[i])
+                                                                : ">=" + FormatDuration(GC_PAUSE_BUCKETS.back());
+                Write((i == 0 ? "" : ", ") + ("\"" + label + "\": %lld"), {LoadElement(M.getPauseHistogram(), i)});
+            }
+            Write("}},\n");
+
+            Write(" \"objects\": {");
+            for (const auto &[type, name]: OBJ_TYPE_NAMES) {
+                const auto index = static_cast<unsigned>(type);
+                Write(
+                    (index == 1 ? "" : ", ") + ("\"" + std::string(name) + "\": {\"allocated\": %lld, \"freed\": %lld}"),
+                    {LoadElement(M.getAllocatedByType(), index), LoadElement(M.getFreedByType(), index)}
+                );
+            }
+            Write("},\n");
+
+            auto *const current = Load(M.getAllocatedBytes());
+            Write(
+                " \"heap\": {\"current\": %lld, \"peak\": %lld},\n",
+                {current, B.CreateBinaryIntrinsic(Intrinsic::umax, current, Load(M.getPeakHeap()))}
+            );
+
+            // The intern table doesn't exist yet if a report is requested while it's being allocated.
+            {
+                auto *const strings = B.CreateLoad(B.getPtrTy(), M.getRuntimeStrings());
+                auto *const CurrentBlock = B.GetInsertBlock();
+                auto *const TableBlock = B.CreateBasicBlock("strings.table");
+                auto *const StringsBlock = B.CreateBasicBlock("strings");
+                B.CreateCondBr(B.CreateIsNull(strings), StringsBlock, TableBlock);
+                B.SetInsertPoint(TableBlock);
+                auto *const count = B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(M.getTableStructType(), strings, 0));
+                auto *const capacity =
+                    B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(M.getTableStructType(), strings, 1));
+                B.CreateBr(StringsBlock);
+
+                B.SetInsertPoint(StringsBlock);
+                auto *const interned = B.CreatePHI(B.getInt32Ty(), 2, "interned");
+                interned->addIncoming(B.getInt32(0), CurrentBlock);
+                interned->addIncoming(count, TableBlock);
+                auto *const internedCapacity = B.CreatePHI(B.getInt32Ty(), 2, "capacity");
+                internedCapacity->addIncoming(B.getInt32(0), CurrentBlock);
+                internedCapacity->addIncoming(capacity, TableBlock);
+                Write(" \"strings\": {\"interned\": %d, \"capacity\": %d},\n", {interned, internedCapacity});
+            }
+
+            Write(" \"gray_stack\": {\"high_water\": %d}}\n", {M.getGrayStack().CreateGetHighWater(B)});
+            B.CreateCall(FClose, {file});
+            B.CreateBr(EndBlock);
+
+            B.SetInsertPoint(EndBlock);
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(WriteGCStatsFunction);
+    }
+
+    void PollGCStatsRequest(LoxBuilder &Builder) {
+        auto *const ReportBlock = Builder.CreateBasicBlock("report.gcstats");
+        auto *const ContinueBlock = Builder.CreateBasicBlock("continue");
+        auto *const requested = Builder.getModule().getGCStatsRequested();
+        auto mdBuilder = MDBuilder(Builder.getContext());
+        Builder.CreateCondBr(
+            Builder.CreateICmpNE(Builder.CreateLoad(Builder.getInt32Ty(), requested, true), Builder.getInt32(0)),
+            ReportBlock, ContinueBlock, metadata::createUnlikelyBranchWeights(mdBuilder)
+        );
+        Builder.SetInsertPoint(ReportBlock);
+        Builder.CreateStore(Builder.getInt32(0), requested, true);
+        WriteGCStats(Builder);
+        Builder.CreateBr(ContinueBlock);
+        Builder.SetInsertPoint(ContinueBlock);
+    }
+
+    std::optional<uint64_t> ParseByteSize(const std::string_view size) {
+        uint64_t value = 0;
+        const auto [end, error] = std::from_chars(size.data(), size.data() + size.size(), value);
+        if (error != std::errc() || end == size.data()) { return std::nullopt; }
+
+        const std::string_view suffix(end, size.data() + size.size());
+        if (suffix.empty()) { return value; }
+        if (suffix == "K" || suffix == "k") { return value << 10; }
+        if (suffix == "M" || suffix == "m") { return value << 20; }
+        if (suffix == "G" || suffix == "g") { return value << 30; }
+        return std::nullopt;
+    }
+
+    std::optional<OutOfMemoryAction> ParseOutOfMemoryAction(const std::string_view action) {
+        if (action == "error") { return OutOfMemoryAction::ERROR; }
+        if (action == "abort") { return OutOfMemoryAction::ABORT; }
+        return std::nullopt;
+    }
+
+    Value *ParseByteSize(LoxBuilder &Builder, Value *String, Value *Result) {
+        static auto *ParseByteSizeFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getInt1Ty(), {Builder.getPtrTy(), Builder.getPtrTy()}, false),
+                Function::InternalLinkage, "$parseByteSize", Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const arguments = F->arg_begin();
+            auto *const string = arguments;
+            auto *const result = arguments + 1;
+
+            static const auto StrToULL = B.getModule().getOrInsertFunction(
+                "strtoull", FunctionType::get(B.getInt64Ty(), {B.getPtrTy(), B.getPtrTy(), B.getInt32Ty()}, false)
+            );
+
+            auto *const endPtr = CreateEntryBlockAlloca(F, B.getPtrTy(), "end");
+            auto *const value = B.CreateCall(StrToULL, {string, endPtr, B.getInt32(10)}, "value");
+            auto *const end = B.CreateLoad(B.getPtrTy(), endPtr);
+
+            auto *const DigitsBlock = B.CreateBasicBlock("digits");
+            auto *const SuffixBlock = B.CreateBasicBlock("suffix");
+            auto *const ValidBlock = B.CreateBasicBlock("valid");
+            auto *const InvalidBlock = B.CreateBasicBlock("invalid");
+
+            B.CreateCondBr(B.CreateICmpEQ(end, string), InvalidBlock, DigitsBlock);
+
+            B.SetInsertPoint(DigitsBlock);
+            auto *const Switch = B.CreateSwitch(B.CreateLoad(B.getInt8Ty(), end), InvalidBlock);
+            Switch->addCase(B.getInt8(0), ValidBlock);
+            for (const char suffix: {'K', 'k', 'M', 'm', 'G', 'g'}) { Switch->addCase(B.getInt8(suffix), SuffixBlock); }
+
+            // The suffix must be the last character.
+            B.SetInsertPoint(SuffixBlock);
+            auto *const suffix = B.CreateLoad(B.getInt8Ty(), end);
+            auto *const upper = B.CreateAnd(suffix, B.getInt8(~0x20));
+            auto *const suffixShift = B.CreateSelect(
+                B.CreateICmpEQ(upper, B.getInt8('K')), B.getInt64(10),
+                B.CreateSelect(B.CreateICmpEQ(upper, B.getInt8('M')), B.getInt64(20), B.getInt64(30))
+            );
+            B.CreateCondBr(
+                B.CreateICmpEQ(B.CreateLoad(B.getInt8Ty(), B.CreateConstInBoundsGEP1_64(B.getInt8Ty(), end, 1)), B.getInt8(0)),
+                ValidBlock, InvalidBlock
+            );
+
+            B.SetInsertPoint(ValidBlock);
+            auto *const shift = B.CreatePHI(B.getInt64Ty(), 2, "shift");
+            shift->addIncoming(B.getInt64(0), DigitsBlock);
+            shift->addIncoming(suffixShift, SuffixBlock);
+            B.CreateStore(B.CreateShl(value, shift), result);
+            B.CreateRet(B.getTrue());
+
+            B.SetInsertPoint(InvalidBlock);
+            B.CreateRet(B.getFalse());
+
+            return F;
+        }());
+
+        return Builder.CreateCall(ParseByteSizeFunction, {String, Result});
+    }
+
+    void ConfigureGC(LoxBuilder &Builder) {
+        static auto *ConfigureGCFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$configureGC",
+                Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            static const auto GetEnv =
+                B.getModule().getOrInsertFunction("getenv", FunctionType::get(B.getPtrTy(), {B.getPtrTy()}, false));
+            static const auto StrToD = B.getModule().getOrInsertFunction(
+                "strtod", FunctionType::get(B.getDoubleTy(), {B.getPtrTy(), B.getPtrTy()}, false)
+            );
+            static const auto StrToL = B.getModule().getOrInsertFunction(
+                "strtol", FunctionType::get(B.getInt64Ty(), {B.getPtrTy(), B.getPtrTy(), B.getInt32Ty()}, false)
+            );
+            static const auto StrCmp = B.getModule().getOrInsertFunction(
+                "strcmp", FunctionType::get(B.getInt32Ty(), {B.getPtrTy(), B.getPtrTy()}, false)
+            );
+
+            // Calls parse with the value of the environment variable, if it's set: parse
+            // stores the setting and returns true, or returns false if the value is invalid.
+            const auto Setting = [&](const std::string &name, const std::function<Value *(LoxBuilder &, Value *)> &parse) {
+                auto *const SetBlock = B.CreateBasicBlock(name + ".set");
+                auto *const InvalidBlock = B.CreateBasicBlock(name + ".invalid");
+                auto *const EndBlock = B.CreateBasicBlock(name + ".end");
+
+                auto *const value = B.CreateCall(GetEnv, {B.CreateGlobalCachedString(name)});
+                B.CreateCondBr(B.CreateIsNull(value), EndBlock, SetBlock);
+                B.SetInsertPoint(SetBlock);
+                B.CreateCondBr(parse(B, value), EndBlock, InvalidBlock);
+                B.SetInsertPoint(InvalidBlock);
+                B.PrintFErr(
+                    B.CreateGlobalCachedString("Ignoring invalid %s value '%s'.\n"), {B.CreateGlobalCachedString(name), value}
+                );
+                B.CreateBr(EndBlock);
+                B.SetInsertPoint(EndBlock);
+            };
+
+            const auto &M = B.getModule();
+            for (const auto &[name, global]: {std::pair{"LOX_GC_INITIAL_HEAP", M.getNextGC()},
+                                              {"LOX_GC_MIN_HEAP", M.getGCMinHeap()},
+                                              {"LOX_GC_MAX_HEAP", M.getGCMaxHeap()}}) {
+                Setting(name, [global](LoxBuilder &B, Value *value) { return ParseByteSize(B, value, global); });
+            }
+            Setting("LOX_GC_GROWTH", [&M](LoxBuilder &B, Value *value) -> Value * {
+                auto *const endPtr = CreateEntryBlockAlloca(B.getFunction(), B.getPtrTy(), "end");
+                auto *const growth = B.CreateCall(StrToD, {value, endPtr});
+                auto *const end = B.CreateLoad(B.getPtrTy(), endPtr);
+                // A growth factor of one or less would collect on every allocation.
+                auto *const isValid = B.CreateAnd(
+                    {B.CreateICmpNE(end, value), B.CreateICmpEQ(B.CreateLoad(B.getInt8Ty(), end), B.getInt8(0)),
+                     B.CreateFCmpOGT(growth, ConstantFP::get(B.getDoubleTy(), 1.0))}
+                );
+                B.CreateStore(
+                    B.CreateSelect(isValid, growth, B.CreateLoad(B.getDoubleTy(), M.getGCGrowthFactor())),
+                    M.getGCGrowthFactor()
+                );
+                return isValid;
+            });
+            Setting("LOX_GC_OOM", [&M](LoxBuilder &B, Value *value) -> Value * {
+                auto *const isError = B.CreateICmpEQ(B.CreateCall(StrCmp, {value, B.CreateGlobalCachedString("error")}), B.getInt32(0));
+                auto *const isAbort = B.CreateICmpEQ(B.CreateCall(StrCmp, {value, B.CreateGlobalCachedString("abort")}), B.getInt32(0));
+                B.CreateStore(
+                    B.CreateSelect(
+                        isError, B.getInt32(static_cast<int32_t>(OutOfMemoryAction::ERROR)),
+                        B.CreateSelect(
+                            isAbort, B.getInt32(static_cast<int32_t>(OutOfMemoryAction::ABORT)),
+                            B.CreateLoad(B.getInt32Ty(), M.getGCOutOfMemory())
+                        )
+                    ),
+                    M.getGCOutOfMemory()
+                );
+                return B.CreateOr(isError, isAbort);
+            });
+
+            Setting("LOX_GC_THREADS", [&M](LoxBuilder &B, Value *value) -> Value * {
+                auto *const endPtr = CreateEntryBlockAlloca(B.getFunction(), B.getPtrTy(), "end");
+                auto *const threads = B.CreateCall(StrToL, {value, endPtr, B.getInt32(10)});
+                auto *const end = B.CreateLoad(B.getPtrTy(), endPtr);
+                auto *const isValid = B.CreateAnd(
+                    {B.CreateICmpNE(end, value), B.CreateICmpEQ(B.CreateLoad(B.getInt8Ty(), end), B.getInt8(0)),
+                     B.CreateICmpSGE(threads, B.getInt64(0)), B.CreateICmpSLE(threads, B.getInt64(MAX_GC_THREADS))}
+                );
+                B.CreateStore(
+                    B.CreateSelect(
+                        isValid, B.CreateTrunc(threads, B.getInt32Ty()), B.CreateLoad(B.getInt32Ty(), M.getGCThreads())
+                    ),
+                    M.getGCThreads()
+                );
+                return isValid;
+            });
+            InitializeMarkWorkers(B);
+
+            // SIGUSR1 requests a report, if there is a file to write it to.
+            {
+                static const auto Signal = B.getModule().getOrInsertFunction(
+                    "signal", FunctionType::get(B.getPtrTy(), {B.getInt32Ty(), B.getPtrTy()}, false)
+                );
+
+                auto *const Handler = Function::Create(
+                    FunctionType::get(B.getVoidTy(), {B.getInt32Ty()}, false), Function::InternalLinkage,
+                    "$requestGCStats", B.getModule()
+                );
+                LoxBuilder HandlerBuilder(B.getContext(), B.getModule(), *Handler);
+                HandlerBuilder.SetInsertPoint(HandlerBuilder.CreateBasicBlock("entry"));
+                // Only the flag is set here: writing the report isn't async-signal-safe.
+                HandlerBuilder.CreateStore(HandlerBuilder.getInt32(1), M.getGCStatsRequested(), true);
+                HandlerBuilder.CreateRetVoid();
+
+                auto *const InstallBlock = B.CreateBasicBlock("install.handler");
+                auto *const InstalledBlock = B.CreateBasicBlock("installed.handler");
+                B.CreateCondBr(
+                    B.CreateIsNull(B.CreateCall(GetEnv, {B.CreateGlobalCachedString("LOX_GC_STATS")})), InstalledBlock,
+                    InstallBlock
+                );
+                B.SetInsertPoint(InstallBlock);
+                B.CreateCall(Signal, {B.getInt32(SIGUSR1), Handler});
+                B.CreateBr(InstalledBlock);
+                B.SetInsertPoint(InstalledBlock);
+            }
+
+            // Allocation before the first collection is paced from the start of the program.
+            B.CreateStore(Now(B), M.getLastCollection());
+
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(ConfigureGCFunction);
+    }
 }// namespace lox
@@ -4,13 +4,41 @@
 #include "LoxBuilder.h"
 
 constexpr bool STRESS_GC = false;
-constexpr int GC_GROWTH_FACTOR = 2;
+// The nursery is sized so that minor collections run about this often, in
+// nanoseconds of mutator time, at the current allocation rate.
+constexpr double MINOR_GC_INTERVAL_NS = 2'000'000;
+// A major collection marks incrementally: each allocation while it's marking
+// blackens up to this many gray objects, so the mutator only stops for the
+// root scans at the start and the end of the collection.
+constexpr int32_t INCREMENTAL_MARK_STEP = 256;
 
 namespace lox {
     Function *CreateGcFunction(LoxBuilder &Builder);
+    // Reads the GC settings from the environment, overriding those baked into the program.
+    void ConfigureGC(LoxBuilder &Builder);
+    // The runtime equivalent of ParseByteSize: stores the size and returns true if it's valid.
+    Value *ParseByteSize(LoxBuilder &Builder, Value *String, Value *Result);
     void MarkObject(LoxBuilder &Builder, Value *ObjectPtr);
     void AddGlobalGCRoot(LoxModule &Module, GlobalVariable *global);
 
+    /**
+     * Must be called after storing value into a field of the object,
+     * so that an old object referencing a young object is remembered
+     * for the next minor collection.
+     */
+    void WriteBarrier(LoxBuilder &Builder, Value *ObjectPtr, Value *value);
+    // Remembers the object if it's old, for stores of values not known here.
+    void WriteBarrier(LoxBuilder &Builder, Value *ObjectPtr);
+
+    /**
+     * Must be called before overwriting a reference held by a heap object,
+     * with the value being overwritten (an i64). While a major collection is
+     * marking, the value is marked, so that everything reachable when marking
+     * started is marked (a snapshot-at-the-beginning barrier). Stores into
+     * roots, and into fields that held no value yet, need no barrier.
+     */
+    void DeletionBarrier(LoxBuilder &Builder, Value *OldValue);
+
     /**
      * The garbage collector will be disabled for the duration of the block
      * and executed after.
@@ -22,6 +50,23 @@ namespace lox {
      * @return the value produced by the block function.
      */
     Value *DelayGC(LoxBuilder &B, const std::function<Value *(LoxBuilder &)> &block);
+
+    // Adds the bytes to the entry of the ObjType (an i8) in a per type statistic, such as getAllocatedByType().
+    void CountByType(LoxBuilder &Builder, GlobalVariable *Statistic, Value *ObjType, Value *Bytes);
+    // Raises the peak heap size to the allocated bytes, if they are higher.
+    void UpdatePeakHeap(LoxBuilder &Builder);
+
+    /**
+     * Writes the GC statistics as JSON to the file named by the LOX_GC_STATS
+     * environment variable, if it is set: the collection counts, a histogram
+     * of pause times, the bytes allocated and freed per object type, the peak
+     * heap size, the size of the intern table and the high water mark of the
+     * gray stack. The report is written at exit, and at the next allocation,
+     * call or loop iteration after the process receives SIGUSR1.
+     */
+    void WriteGCStats(LoxBuilder &Builder);
+    // Writes the GC statistics if SIGUSR1 requested them since the last poll.
+    void PollGCStatsRequest(LoxBuilder &Builder);
 }// namespace lox
 
 #endif//GC_H
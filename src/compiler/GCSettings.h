@@ -0,0 +1,49 @@
+#ifndef GCSETTINGS_H
+#define GCSETTINGS_H
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace lox {
+    // What the runtime does when the heap can't grow any further.
+    enum class OutOfMemoryAction : int32_t {
+        // Report a runtime error, with a stack trace, and exit.
+        ERROR = 0,
+        // Abort the process, for a core dump.
+        ABORT = 1,
+    };
+
+    /**
+     * The GC policy of a compiled program. These are the defaults baked into
+     * the binary, either these or the --gc-* flags; each can be overridden
+     * at startup by an environment variable:
+     *
+     *   LOX_GC_INITIAL_HEAP  heap size at which the first major collection runs
+     *   LOX_GC_GROWTH        the next major collection runs when the heap has grown
+     *                        to this multiple of the bytes live after the last one
+     *   LOX_GC_MIN_HEAP      lower bound of the major collection threshold
+     *   LOX_GC_MAX_HEAP      the heap never grows beyond this, 0 for no limit
+     *   LOX_GC_OOM           `error` or `abort`, when the live heap exceeds the maximum
+     *   LOX_GC_THREADS       threads marking each major collection, 0 for one per CPU;
+     *                        with one thread, major collections are marked incrementally
+     *
+     * Sizes are in bytes, with an optional K, M or G suffix.
+     */
+    struct GCSettings {
+        uint64_t initialHeap = 4 * 1024 * 1024;
+        double growthFactor = 2.0;
+        uint64_t minHeap = 1024 * 1024;
+        uint64_t maxHeap = 0;
+        OutOfMemoryAction outOfMemory = OutOfMemoryAction::ERROR;
+        uint32_t threads = 1;
+    };
+
+    constexpr uint32_t MAX_GC_THREADS = 256;
+
+    // Parses a size such as 512K or 2G.
+    std::optional<uint64_t> ParseByteSize(std::string_view size);
+    std::optional<OutOfMemoryAction> ParseOutOfMemoryAction(std::string_view action);
+}// namespace lox
+
+#endif//GCSETTINGS_H
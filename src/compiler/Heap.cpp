@@ -0,0 +1,1139 @@
+#include "Heap.h"
+#include "../Debug.h"
+#include "GC.h"
+#include "Memory.h"
+
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/Support/MathExtras.h>
+
+#include <sys/mman.h>
+
+#include <vector>
+
+namespace lox {
+    constexpr uint64_t PAGE_GRANULES = PAGE_SIZE / GRANULE_SIZE;
+
+    // The index of the first granule after the page header, where the slots start.
+    static uint64_t FirstGranule(const LoxModule &M) {
+        return alignTo(M.getDataLayout().getTypeAllocSize(M.getPageStructType()).getFixedValue(), GRANULE_SIZE) /
+               GRANULE_SIZE;
+    }
+
+    static Value *PageOf(LoxBuilder &B, Value *ObjectPtr) {
+        return B.CreateIntrinsic(
+            Intrinsic::ptrmask, {B.getPtrTy(), B.getInt64Ty()}, {ObjectPtr, B.getInt64(~(PAGE_SIZE - 1))}
+        );
+    }
+
+    static Value *BitmapWord(LoxBuilder &B, Value *Page, const Bitmap bitmap, Value *Index) {
+        return B.CreateInBoundsGEP(
+            B.getModule().getPageStructType(), Page, {B.getInt32(0), B.getInt32(static_cast<unsigned>(bitmap)), Index}
+        );
+    }
+
+    // Returns the bitmap word holding the bit of the object and the mask selecting it.
+    static std::pair<Value *, Value *> BitOf(LoxBuilder &B, const Bitmap bitmap, Value *ObjectPtr) {
+        auto *const granule = B.CreateLShr(
+            B.CreateAnd(B.CreatePtrToInt(ObjectPtr, B.getInt64Ty()), B.getInt64(PAGE_SIZE - 1)),
+            B.getInt64(Log2_64(GRANULE_SIZE)), "granule"
+        );
+        return {
+            BitmapWord(B, PageOf(B, ObjectPtr), bitmap, B.CreateLShr(granule, B.getInt64(6))),
+            B.CreateShl(B.getInt64(1), B.CreateAnd(granule, B.getInt64(63)))
+        };
+    }
+
+    Value *IsHeapObject(LoxBuilder &B, Value *ObjectPtr) {
+        auto *const base = B.CreateLoad(B.getInt64Ty(), B.getModule().getHeapBase());
+        return B.CreateICmpULT(
+            B.CreateSub(B.CreatePtrToInt(ObjectPtr, B.getInt64Ty()), base), B.getInt64(HEAP_RESERVATION), "isHeap"
+        );
+    }
+
+    Value *TestBit(LoxBuilder &B, const Bitmap bitmap, Value *ObjectPtr) {
+        auto [word, mask] = BitOf(B, bitmap, ObjectPtr);
+        return B.CreateICmpNE(B.CreateAnd(B.CreateLoad(B.getInt64Ty(), word), mask), B.getInt64(0));
+    }
+
+    void SetBit(LoxBuilder &B, const Bitmap bitmap, Value *ObjectPtr) {
+        auto [word, mask] = BitOf(B, bitmap, ObjectPtr);
+        B.CreateStore(B.CreateOr(B.CreateLoad(B.getInt64Ty(), word), mask), word);
+    }
+
+    Value *SetBitAtomic(LoxBuilder &B, const Bitmap bitmap, Value *ObjectPtr) {
+        auto [word, mask] = BitOf(B, bitmap, ObjectPtr);
+        auto *const CurrentBlock = B.GetInsertBlock();
+        auto *const SetBlock = B.CreateBasicBlock("set.atomic");
+        auto *const EndBlock = B.CreateBasicBlock("set.atomic.end");
+
+        // Most objects are reached once, so test before paying for the atomic update.
+        auto *const load = B.CreateLoad(B.getInt64Ty(), word);
+        load->setAtomic(AtomicOrdering::Monotonic);
+        B.CreateCondBr(B.CreateICmpNE(B.CreateAnd(load, mask), B.getInt64(0)), EndBlock, SetBlock);
+        B.SetInsertPoint(SetBlock);
+        auto *const previous = B.CreateAtomicRMW(AtomicRMWInst::Or, word, mask, MaybeAlign(8), AtomicOrdering::Monotonic);
+        auto *const wasClear = B.CreateICmpEQ(B.CreateAnd(previous, mask), B.getInt64(0));
+        B.CreateBr(EndBlock);
+
+        B.SetInsertPoint(EndBlock);
+        auto *const result = B.CreatePHI(B.getInt1Ty(), 2, "wasClear");
+        result->addIncoming(B.getFalse(), CurrentBlock);
+        result->addIncoming(wasClear, SetBlock);
+        return result;
+    }
+
+    void ClearBit(LoxBuilder &B, const Bitmap bitmap, Value *ObjectPtr) {
+        auto [word, mask] = BitOf(B, bitmap, ObjectPtr);
+        B.CreateStore(B.CreateAnd(B.CreateLoad(B.getInt64Ty(), word), B.CreateNot(mask)), word);
+    }
+
+    Value *IsMarked(LoxBuilder &B, Value *ObjectPtr) {
+        auto *const CurrentBlock = B.GetInsertBlock();
+        auto *const IsHeapBlock = B.CreateBasicBlock("is.heap");
+        auto *const EndBlock = B.CreateBasicBlock("is.marked.end");
+
+        B.CreateCondBr(IsHeapObject(B, ObjectPtr), IsHeapBlock, EndBlock);
+        B.SetInsertPoint(IsHeapBlock);
+        auto *const isMarked = TestBit(B, Bitmap::MARK, ObjectPtr);
+        B.CreateBr(EndBlock);
+
+        B.SetInsertPoint(EndBlock);
+        auto *const result = B.CreatePHI(B.getInt1Ty(), 2, "isMarked");
+        result->addIncoming(B.getTrue(), CurrentBlock);
+        result->addIncoming(isMarked, IsHeapBlock);
+        return result;
+    }
+
+    Value *SlotSize(LoxBuilder &B, Value *ObjectPtr) {
+        return B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(B.getModule().getPageStructType(), PageOf(B, ObjectPtr), 1));
+    }
+
+    static Value *HeapFor(LoxBuilder &B, Value *SizeClass) {
+        return B.CreateInBoundsGEP(
+            ArrayType::get(B.getModule().getHeapStructType(), SIZE_CLASS_COUNT), B.getModule().getHeaps(),
+            {B.getInt32(0), SizeClass}, "heap"
+        );
+    }
+
+    static Value *ArenaFor(LoxBuilder &B, Value *SizeClass) {
+        return B.CreateInBoundsGEP(
+            ArrayType::get(B.getModule().getArenaStructType(), SIZE_CLASS_COUNT), B.getModule().getArenas(),
+            {B.getInt32(0), SizeClass}, "arena"
+        );
+    }
+
+    // Calls the body with every page of every heap.
+    static void ForEachPage(LoxBuilder &B, const std::function<void(LoxBuilder &, Value *)> &body) {
+        auto *const PageStruct = B.getModule().getPageStructType();
+        auto *const page = CreateEntryBlockAlloca(B.getFunction(), B.getPtrTy(), "page");
+
+        for (unsigned int i = 0; i < SIZE_CLASS_COUNT; i++) {
+            auto *const heap = B.CreateConstInBoundsGEP2_32(
+                ArrayType::get(B.getModule().getHeapStructType(), SIZE_CLASS_COUNT), B.getModule().getHeaps(), 0, i
+            );
+            B.CreateStore(B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getHeapStructType(), heap, 0)), page);
+
+            auto *const WhileCond = B.CreateBasicBlock("while.cond");
+            auto *const WhileBody = B.CreateBasicBlock("while.body");
+            auto *const WhileEnd = B.CreateBasicBlock("while.end");
+
+            B.CreateBr(WhileCond);
+            B.SetInsertPoint(WhileCond);
+            B.CreateCondBr(B.CreateIsNotNull(B.CreateLoad(B.getPtrTy(), page)), WhileBody, WhileEnd);
+            B.SetInsertPoint(WhileBody);
+            {
+                auto *const current = B.CreateLoad(B.getPtrTy(), page);
+                B.CreateStore(B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(PageStruct, current, 0, "next")), page);
+                body(B, current);
+                B.CreateBr(WhileCond);
+            }
+            B.SetInsertPoint(WhileEnd);
+        }
+    }
+
+    static const FunctionCallee &MUnmap(LoxBuilder &B) {
+        static const auto MUnmap = B.getModule().getOrInsertFunction(
+            "munmap", FunctionType::get(B.getInt32Ty(), {B.getPtrTy(), B.getInt64Ty()}, false)
+        );
+        return MUnmap;
+    }
+
+    void OutOfMemory(LoxBuilder &Builder) {
+        static auto *OutOfMemoryFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$outOfMemory",
+                Builder.getModule()
+            );
+            F->addFnAttr(Attribute::NoReturn);
+            F->addFnAttr(Attribute::Cold);
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            static const auto Abort =
+                B.getModule().getOrInsertFunction("abort", FunctionType::get(B.getVoidTy(), {}, false));
+
+            auto *const ErrorBlock = B.CreateBasicBlock("error");
+            auto *const AbortBlock = B.CreateBasicBlock("abort");
+
+            auto *const Switch = B.CreateSwitch(B.CreateLoad(B.getInt32Ty(), B.getModule().getGCOutOfMemory()), ErrorBlock);
+            Switch->addCase(B.getInt32(static_cast<int32_t>(OutOfMemoryAction::ABORT)), AbortBlock);
+
+            B.SetInsertPoint(ErrorBlock);
+            B.RuntimeError(B.getInt32(0), "Out of memory.\n", {}, B.CreateGlobalCachedString("heap"), false);
+
+            B.SetInsertPoint(AbortBlock);
+            B.PrintFErr(B.CreateGlobalCachedString("Out of memory.\n"));
+            B.CreateCall(Abort);
+            B.CreateUnreachable();
+
+            return F;
+        }());
+
+        Builder.CreateCall(OutOfMemoryFunction);
+        Builder.CreateUnreachable();
+    }
+
+    void InitializeHeap(LoxBuilder &Builder) {
+        static auto *InitializeHeapFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$initializeHeap",
+                Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            static const auto MMap = B.getModule().getOrInsertFunction(
+                "mmap", FunctionType::get(
+                            B.getPtrTy(),
+                            {B.getPtrTy(), B.getInt64Ty(), B.getInt32Ty(), B.getInt32Ty(), B.getInt32Ty(), B.getInt64Ty()},
+                            false
+                        )
+            );
+
+            // Only address space is reserved here: pages are made accessible as they are allocated.
+            // One more page is reserved so that the heap can be aligned to the page size.
+            auto *const mapping = B.CreateCall(
+                MMap, {B.getNullPtr(), B.getInt64(HEAP_RESERVATION + PAGE_SIZE), B.getInt32(PROT_NONE),
+                       B.getInt32(MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE), B.getInt32(-1), B.getInt64(0)}
+            );
+
+            auto *const FailedBlock = B.CreateBasicBlock("failed");
+            auto *const ReservedBlock = B.CreateBasicBlock("reserved");
+
+            B.CreateCondBr(
+                B.CreateICmpEQ(B.CreatePtrToInt(mapping, B.getInt64Ty()), B.getInt64(-1)), FailedBlock, ReservedBlock
+            );
+            B.SetInsertPoint(FailedBlock);
+            B.RuntimeError(
+                B.getInt32(0), "Could not reserve the heap.\n", {}, B.CreateGlobalCachedString("heap"), false
+            );
+
+            B.SetInsertPoint(ReservedBlock);
+            auto *const address = B.CreatePtrToInt(mapping, B.getInt64Ty());
+            auto *const head = B.CreateSub(
+                B.CreateAnd(B.CreateAdd(address, B.getInt64(PAGE_SIZE - 1)), B.getInt64(~(PAGE_SIZE - 1))), address,
+                "head"
+            );
+            auto *const base = B.CreateInBoundsGEP(B.getInt8Ty(), mapping, head, "base");
+
+            // Give back the unaligned ends of the mapping (either may be empty).
+            B.CreateCall(MUnmap(B), {mapping, head});
+            B.CreateCall(
+                MUnmap(B), {B.CreateInBoundsGEP(B.getInt8Ty(), base, B.getInt64(HEAP_RESERVATION)),
+                            B.CreateSub(B.getInt64(PAGE_SIZE), head)}
+            );
+
+            B.CreateStore(B.CreatePtrToInt(base, B.getInt64Ty()), B.getModule().getHeapBase());
+            B.CreateStore(base, B.getModule().getHeapTop());
+
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(InitializeHeapFunction);
+    }
+
+    static Value *AllocatePage(LoxBuilder &Builder, Value *SizeClass, Value *SlotSize) {
+        static auto *AllocatePageFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getPtrTy(), {Builder.getInt32Ty(), Builder.getInt32Ty()}, false),
+                Function::InternalLinkage, "$allocatePage", Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const arguments = F->arg_begin();
+            auto *const sizeClass = arguments;
+            auto *const slotSize = arguments + 1;
+
+            static const auto MProtect = B.getModule().getOrInsertFunction(
+                "mprotect", FunctionType::get(B.getInt32Ty(), {B.getPtrTy(), B.getInt64Ty(), B.getInt32Ty()}, false)
+            );
+
+            auto *const PageStruct = B.getModule().getPageStructType();
+            auto *const InitializeBlock = B.CreateBasicBlock("initialize");
+            auto *const newPage = PHINode::Create(B.getPtrTy(), 3, "page", InitializeBlock);
+
+            // A free page is reused, whatever its size class was, before the
+            // heap grows: preferably one that is still committed.
+            for (auto *const freePages: {B.getModule().getFreePages(), B.getModule().getDecommittedPages()}) {
+                auto *const ReuseBlock = B.CreateBasicBlock("reuse");
+                auto *const NoFreePageBlock = B.CreateBasicBlock("no.free.page");
+
+                auto *const freePage = B.CreateLoad(B.getPtrTy(), freePages, "freePage");
+                B.CreateCondBr(B.CreateIsNotNull(freePage), ReuseBlock, NoFreePageBlock);
+                B.SetInsertPoint(ReuseBlock);
+                B.CreateStore(B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(PageStruct, freePage, 0)), freePages);
+                newPage->addIncoming(freePage, ReuseBlock);
+                B.CreateBr(InitializeBlock);
+
+                B.SetInsertPoint(NoFreePageBlock);
+            }
+
+            auto *const page = B.CreateLoad(B.getPtrTy(), B.getModule().getHeapTop(), "page");
+            auto *const end = B.CreateAdd(
+                B.CreateLoad(B.getInt64Ty(), B.getModule().getHeapBase()), B.getInt64(HEAP_RESERVATION), "end"
+            );
+
+            auto *const OutOfMemoryBlock = B.CreateBasicBlock("out.of.memory");
+            auto *const CommitBlock = B.CreateBasicBlock("commit");
+            auto *const CommittedBlock = B.CreateBasicBlock("committed");
+
+            B.CreateCondBr(
+                B.CreateICmpUGE(B.CreatePtrToInt(page, B.getInt64Ty()), end), OutOfMemoryBlock, CommitBlock
+            );
+
+            B.SetInsertPoint(CommitBlock);
+            auto *const result =
+                B.CreateCall(MProtect, {page, B.getInt64(PAGE_SIZE), B.getInt32(PROT_READ | PROT_WRITE)});
+            B.CreateCondBr(B.CreateICmpNE(result, B.getInt32(0)), OutOfMemoryBlock, CommittedBlock);
+
+            B.SetInsertPoint(OutOfMemoryBlock);
+            OutOfMemory(B);
+
+            B.SetInsertPoint(CommittedBlock);
+            B.CreateStore(
+                B.CreateInBoundsGEP(B.getInt8Ty(), page, B.getInt64(PAGE_SIZE)), B.getModule().getHeapTop()
+            );
+            newPage->addIncoming(page, CommittedBlock);
+            B.CreateBr(InitializeBlock);
+
+            // A fresh page is zeroed, so its bitmaps are already clear; so are
+            // those of a free page, which held no object when it was released.
+            B.SetInsertPoint(InitializeBlock);
+            auto *const slotGranules = B.CreateLShr(slotSize, B.getInt32(Log2_64(GRANULE_SIZE)));
+            B.CreateStore(B.getNullPtr(), B.CreateStructGEP(PageStruct, newPage, 0));
+            B.CreateStore(slotSize, B.CreateStructGEP(PageStruct, newPage, 1));
+            B.CreateStore(
+                B.CreateUDiv(B.getInt32(PAGE_GRANULES - FirstGranule(B.getModule())), slotGranules, "slotCount"),
+                B.CreateStructGEP(PageStruct, newPage, 2)
+            );
+            B.CreateStore(B.getInt32(0), B.CreateStructGEP(PageStruct, newPage, 3));
+            B.CreateStore(
+                B.CreateLoad(B.getInt32Ty(), B.getModule().getSweepEpoch()), B.CreateStructGEP(PageStruct, newPage, 4)
+            );
+            B.CreateStore(sizeClass, B.CreateStructGEP(PageStruct, newPage, 5));
+
+            if constexpr (DEBUG_LOG_GC) {
+                B.PrintF({B.CreateGlobalCachedString("allocate page %p (slot size %d)\n"), newPage, slotSize});
+            }
+
+            B.CreateRet(newPage);
+
+            return F;
+        }());
+
+        return Builder.CreateCall(AllocatePageFunction, {SizeClass, SlotSize});
+    }
+
+    /**
+     * Frees the objects of the page that are allocated but not marked,
+     * which makes their slots available to the allocator again.
+     */
+    static void SweepPage(LoxBuilder &Builder, Value *Page) {
+        static auto *SweepPageFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {Builder.getPtrTy()}, false), Function::InternalLinkage,
+                "$sweepPage", Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const page = F->arg_begin();
+            auto *const PageStruct = B.getModule().getPageStructType();
+
+            auto *const index = CreateEntryBlockAlloca(F, B.getInt64Ty(), "index");
+            auto *const dead = CreateEntryBlockAlloca(F, B.getInt64Ty(), "dead");
+            auto *const freed = CreateEntryBlockAlloca(F, B.getInt32Ty(), "freed");
+            B.CreateStore(B.getInt64(0), index);
+            B.CreateStore(B.getInt32(0), freed);
+
+            if constexpr (DEBUG_LOG_GC) {
+                B.PrintF({B.CreateGlobalCachedString("--sweep page %p--\n"), page});
+            }
+
+            auto *const WhileCond = B.CreateBasicBlock("while.cond");
+            auto *const WhileBody = B.CreateBasicBlock("while.body");
+            auto *const FreeBlock = B.CreateBasicBlock("free");
+            auto *const FreeCond = B.CreateBasicBlock("free.cond");
+            auto *const FreeBody = B.CreateBasicBlock("free.body");
+            auto *const NextBlock = B.CreateBasicBlock("next");
+            auto *const WhileEnd = B.CreateBasicBlock("while.end");
+
+            B.CreateBr(WhileCond);
+            B.SetInsertPoint(WhileCond);
+            B.CreateCondBr(
+                B.CreateICmpULT(B.CreateLoad(B.getInt64Ty(), index), B.getInt64(PAGE_BITMAP_WORDS)), WhileBody,
+                WhileEnd
+            );
+            B.SetInsertPoint(WhileBody);
+            {
+                // A whole word of the bitmaps is swept at once: the objects
+                // which are allocated but not marked are dead.
+                auto *const i = B.CreateLoad(B.getInt64Ty(), index);
+                auto *const allocatedWord = BitmapWord(B, page, Bitmap::ALLOCATED, i);
+                auto *const allocated = B.CreateLoad(B.getInt64Ty(), allocatedWord);
+                auto *const marked = B.CreateLoad(B.getInt64Ty(), BitmapWord(B, page, Bitmap::MARK, i));
+                auto *const unmarked = B.CreateAnd(allocated, B.CreateNot(marked), "dead");
+                B.CreateStore(unmarked, dead);
+                B.CreateCondBr(B.CreateICmpNE(unmarked, B.getInt64(0)), FreeBlock, NextBlock);
+
+                B.SetInsertPoint(FreeBlock);
+                B.CreateStore(B.CreateAnd(allocated, marked), allocatedWord);
+                B.CreateBr(FreeCond);
+
+                B.SetInsertPoint(FreeCond);
+                auto *const remaining = B.CreateLoad(B.getInt64Ty(), dead);
+                B.CreateCondBr(B.CreateICmpNE(remaining, B.getInt64(0)), FreeBody, NextBlock);
+                B.SetInsertPoint(FreeBody);
+                {
+                    auto *const bit = B.CreateBinaryIntrinsic(Intrinsic::cttz, remaining, B.getTrue());
+                    B.CreateStore(B.CreateAnd(remaining, B.CreateSub(remaining, B.getInt64(1))), dead);
+
+                    auto *const granule = B.CreateAdd(B.CreateShl(B.CreateLoad(B.getInt64Ty(), index), 6), bit);
+                    auto *const object = B.CreateInBoundsGEP(
+                        B.getInt8Ty(), page, B.CreateShl(granule, B.getInt64(Log2_64(GRANULE_SIZE))), "object"
+                    );
+
+                    if constexpr (DEBUG_LOG_GC) {
+                        B.PrintF({B.CreateGlobalCachedString("unreached %p: "), object});
+                    }
+
+                    CountByType(
+                        B, B.getModule().getFreedByType(),
+                        B.CreateLoad(B.getInt8Ty(), B.CreateStructGEP(B.getModule().getObjStructType(), object, 0)),
+                        B.CreateZExt(SlotSize(B, page), B.getInt64Ty())
+                    );
+                    FreeObject(B, B.ObjVal(object));
+                    B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt32Ty(), freed), B.getInt32(1)), freed);
+                    B.CreateBr(FreeCond);
+                }
+
+                B.SetInsertPoint(NextBlock);
+                B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt64Ty(), index), B.getInt64(1)), index);
+                B.CreateBr(WhileCond);
+            }
+            B.SetInsertPoint(WhileEnd);
+
+            auto *const count = B.CreateLoad(B.getInt32Ty(), freed);
+            auto *const bytes = B.CreateMul(
+                B.CreateZExt(count, B.getInt64Ty()), B.CreateZExt(SlotSize(B, page), B.getInt64Ty()), "bytes", true,
+                true
+            );
+            auto *const allocatedSlots = B.CreateStructGEP(PageStruct, page, 3);
+            B.CreateStore(B.CreateSub(B.CreateLoad(B.getInt32Ty(), allocatedSlots), count), allocatedSlots);
+            for (auto *const counter: {B.getModule().getAllocatedBytes(), B.getModule().getObjectBytes()}) {
+                B.CreateStore(B.CreateSub(B.CreateLoad(B.getInt64Ty(), counter), bytes), counter);
+            }
+            B.CreateStore(
+                B.CreateLoad(B.getInt32Ty(), B.getModule().getSweepEpoch()), B.CreateStructGEP(PageStruct, page, 4)
+            );
+
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(SweepPageFunction, {Page});
+    }
+
+    Value *AllocateSlot(LoxBuilder &Builder, Value *SizeClass, Value *SlotSize) {
+        assert(SizeClass->getType() == Builder.getInt32Ty());
+        assert(SlotSize->getType() == Builder.getInt32Ty());
+
+        static auto *AllocateSlotFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getPtrTy(), {Builder.getInt32Ty(), Builder.getInt32Ty()}, false),
+                Function::InternalLinkage, "$allocateSlot", Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const arguments = F->arg_begin();
+            auto *const sizeClass = arguments;
+            auto *const slotSize = arguments + 1;
+
+            auto *const PageStruct = B.getModule().getPageStructType();
+            auto *const HeapStruct = B.getModule().getHeapStructType();
+            auto *const heap = HeapFor(B, sizeClass);
+            auto *const heapPage = B.CreateStructGEP(HeapStruct, heap, 1, "heap.page");
+            auto *const heapGranule = B.CreateStructGEP(HeapStruct, heap, 2, "heap.granule");
+            auto *const slotGranules = B.CreateLShr(slotSize, B.getInt32(Log2_64(GRANULE_SIZE)), "slotGranules");
+
+            auto *const page = CreateEntryBlockAlloca(F, B.getPtrTy(), "page");
+            auto *const granule = CreateEntryBlockAlloca(F, B.getInt32Ty(), "granule");
+            B.CreateStore(B.CreateLoad(B.getPtrTy(), heapPage), page);
+            B.CreateStore(B.CreateLoad(B.getInt32Ty(), heapGranule), granule);
+
+            auto *const ScanBlock = B.CreateBasicBlock("scan");
+            auto *const TestBlock = B.CreateBasicBlock("test");
+            auto *const FoundBlock = B.CreateBasicBlock("found");
+            auto *const NextPageBlock = B.CreateBasicBlock("next.page");
+            auto *const EnterPageBlock = B.CreateBasicBlock("enter.page");
+            auto *const UnsweptBlock = B.CreateBasicBlock("unswept");
+            auto *const SweepBlock = B.CreateBasicBlock("sweep");
+            auto *const SweptBlock = B.CreateBasicBlock("swept");
+            auto *const NewPageBlock = B.CreateBasicBlock("new.page");
+
+            // The current page is null after a collection, so that the
+            // allocator starts again from the first page.
+            B.CreateCondBr(B.CreateIsNull(B.CreateLoad(B.getPtrTy(), page)), NextPageBlock, ScanBlock);
+
+            // Look for the next slot, from the cursor, that is not allocated.
+            B.SetInsertPoint(ScanBlock);
+            {
+                auto *const current = B.CreateLoad(B.getInt32Ty(), granule);
+                B.CreateCondBr(
+                    B.CreateICmpUGT(B.CreateAdd(current, slotGranules), B.getInt32(PAGE_GRANULES)), NextPageBlock,
+                    TestBlock
+                );
+            }
+            B.SetInsertPoint(TestBlock);
+            auto *const current = B.CreateLoad(B.getInt32Ty(), granule);
+            auto *const index = B.CreateZExt(current, B.getInt64Ty());
+            auto *const word = BitmapWord(B, B.CreateLoad(B.getPtrTy(), page), Bitmap::ALLOCATED, B.CreateLShr(index, 6));
+            auto *const mask = B.CreateShl(B.getInt64(1), B.CreateAnd(index, B.getInt64(63)));
+            auto *const bits = B.CreateLoad(B.getInt64Ty(), word);
+            B.CreateStore(B.CreateAdd(current, slotGranules), granule);
+            B.CreateCondBr(B.CreateICmpNE(B.CreateAnd(bits, mask), B.getInt64(0)), ScanBlock, FoundBlock);
+
+            B.SetInsertPoint(FoundBlock);
+            {
+                auto *const found = B.CreateLoad(B.getPtrTy(), page);
+                B.CreateStore(B.CreateOr(bits, mask), word);
+                auto *const allocatedSlots = B.CreateStructGEP(PageStruct, found, 3);
+                B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt32Ty(), allocatedSlots), B.getInt32(1)), allocatedSlots);
+                B.CreateStore(found, heapPage);
+                B.CreateStore(B.CreateLoad(B.getInt32Ty(), granule), heapGranule);
+                B.CreateRet(B.CreateInBoundsGEP(
+                    B.getInt8Ty(), found, B.CreateShl(index, B.getInt64(Log2_64(GRANULE_SIZE))), "slot"
+                ));
+            }
+
+            B.SetInsertPoint(NextPageBlock);
+            {
+                auto *const previous = B.CreateLoad(B.getPtrTy(), page);
+                auto *const IsFirstBlock = B.CreateBasicBlock("first.page");
+                auto *const IsNextBlock = B.CreateBasicBlock("following.page");
+                auto *const NextBlock = B.CreateBasicBlock("next");
+
+                B.CreateCondBr(B.CreateIsNull(previous), IsFirstBlock, IsNextBlock);
+                B.SetInsertPoint(IsFirstBlock);
+                auto *const first = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(HeapStruct, heap, 0));
+                B.CreateBr(NextBlock);
+                B.SetInsertPoint(IsNextBlock);
+                auto *const following = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(PageStruct, previous, 0));
+                B.CreateBr(NextBlock);
+
+                B.SetInsertPoint(NextBlock);
+                auto *const next = B.CreatePHI(B.getPtrTy(), 2, "next");
+                next->addIncoming(first, IsFirstBlock);
+                next->addIncoming(following, IsNextBlock);
+                B.CreateCondBr(B.CreateIsNull(next), NewPageBlock, EnterPageBlock);
+
+                B.SetInsertPoint(EnterPageBlock);
+                B.CreateStore(next, page);
+                B.CreateStore(B.getInt32(FirstGranule(B.getModule())), granule);
+                B.CreateCondBr(
+                    B.CreateICmpEQ(
+                        B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(PageStruct, next, 4)),
+                        B.CreateLoad(B.getInt32Ty(), B.getModule().getSweepEpoch())
+                    ),
+                    SweptBlock, UnsweptBlock
+                );
+
+                // While a major collection is marking, the live objects of a page
+                // are not all marked yet, so pages are left unswept until it ends:
+                // their unmarked objects were already dead at the last collection.
+                B.SetInsertPoint(UnsweptBlock);
+                B.CreateCondBr(B.CreateLoad(B.getInt1Ty(), B.getModule().getGCMarking()), NextPageBlock, SweepBlock);
+
+                // The page is swept the first time it's visited after a collection.
+                B.SetInsertPoint(SweepBlock);
+                SweepPage(B, next);
+                B.CreateBr(SweptBlock);
+
+                // Full pages are skipped without scanning their bitmap.
+                B.SetInsertPoint(SweptBlock);
+                B.CreateCondBr(
+                    B.CreateICmpEQ(
+                        B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(PageStruct, next, 3)),
+                        B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(PageStruct, next, 2))
+                    ),
+                    NextPageBlock, ScanBlock
+                );
+
+                // Every page is full: add a new page after the last one.
+                B.SetInsertPoint(NewPageBlock);
+                auto *const newPage = AllocatePage(B, sizeClass, slotSize);
+                B.CreateStore(
+                    newPage, B.CreateSelect(
+                                 B.CreateIsNull(previous), B.CreateStructGEP(HeapStruct, heap, 0),
+                                 B.CreateStructGEP(PageStruct, previous, 0)
+                             )
+                );
+                B.CreateStore(newPage, page);
+                B.CreateStore(B.getInt32(FirstGranule(B.getModule())), granule);
+                B.CreateBr(ScanBlock);
+            }
+
+            return F;
+        }());
+
+        return Builder.CreateCall(AllocateSlotFunction, {SizeClass, SlotSize});
+    }
+
+    void ClearMarks(LoxBuilder &Builder) {
+        static auto *ClearMarksFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$clearMarks",
+                Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            ForEachPage(B, [](LoxBuilder &B, Value *page) {
+                B.CreateMemSet(
+                    BitmapWord(B, page, Bitmap::MARK, B.getInt64(0)), B.getInt8(0), PAGE_BITMAP_WORDS * 8, Align(8)
+                );
+            });
+
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(ClearMarksFunction);
+    }
+
+    // Whether any object of the page is marked, testing a whole word of the bitmap at once.
+    static Value *HasMarkedObject(LoxBuilder &Builder, Value *Page) {
+        static auto *HasMarkedObjectFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getInt1Ty(), {Builder.getPtrTy()}, false), Function::InternalLinkage,
+                "$hasMarkedObject", Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const page = F->arg_begin();
+            auto *const index = CreateEntryBlockAlloca(F, B.getInt64Ty(), "index");
+            B.CreateStore(B.getInt64(0), index);
+
+            auto *const WhileCond = B.CreateBasicBlock("while.cond");
+            auto *const WhileBody = B.CreateBasicBlock("while.body");
+            auto *const MarkedBlock = B.CreateBasicBlock("marked");
+            auto *const WhileEnd = B.CreateBasicBlock("while.end");
+
+            B.CreateBr(WhileCond);
+            B.SetInsertPoint(WhileCond);
+            auto *const i = B.CreateLoad(B.getInt64Ty(), index);
+            B.CreateCondBr(B.CreateICmpULT(i, B.getInt64(PAGE_BITMAP_WORDS)), WhileBody, WhileEnd);
+            B.SetInsertPoint(WhileBody);
+            B.CreateStore(B.CreateAdd(i, B.getInt64(1)), index);
+            B.CreateCondBr(
+                B.CreateICmpNE(B.CreateLoad(B.getInt64Ty(), BitmapWord(B, page, Bitmap::MARK, i)), B.getInt64(0)),
+                MarkedBlock, WhileCond
+            );
+
+            B.SetInsertPoint(MarkedBlock);
+            B.CreateRet(B.getTrue());
+
+            B.SetInsertPoint(WhileEnd);
+            B.CreateRet(B.getFalse());
+
+            return F;
+        }());
+
+        return Builder.CreateCall(HasMarkedObjectFunction, {Page});
+    }
+
+    /**
+     * Gives the pages that have been free for a whole collection cycle back to
+     * the OS, then sweeps the object pages in which no object survived the
+     * collection and makes them free pages, so that the memory of a size class
+     * the program stopped using is reused by the others, or returned.
+     */
+    static void ReleaseEmptyPages(LoxBuilder &Builder) {
+        static auto *ReleaseEmptyPagesFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$releaseEmptyPages",
+                Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            static const auto MAdvise = B.getModule().getOrInsertFunction(
+                "madvise", FunctionType::get(B.getInt32Ty(), {B.getPtrTy(), B.getInt64Ty(), B.getInt32Ty()}, false)
+            );
+
+            auto *const PageStruct = B.getModule().getPageStructType();
+            auto *const freePages = B.getModule().getFreePages();
+            auto *const decommittedPages = B.getModule().getDecommittedPages();
+            auto *const link = CreateEntryBlockAlloca(F, B.getPtrTy(), "link");
+
+            // The page reads as zeroes when it's next touched, so the next
+            // field, which links it into the list, is stored after decommitting it.
+            {
+                auto *const WhileCond = B.CreateBasicBlock("decommit.cond");
+                auto *const WhileBody = B.CreateBasicBlock("decommit.body");
+                auto *const WhileEnd = B.CreateBasicBlock("decommit.end");
+
+                B.CreateBr(WhileCond);
+                B.SetInsertPoint(WhileCond);
+                auto *const page = B.CreateLoad(B.getPtrTy(), freePages, "page");
+                B.CreateCondBr(B.CreateIsNotNull(page), WhileBody, WhileEnd);
+                B.SetInsertPoint(WhileBody);
+                {
+                    B.CreateStore(B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(PageStruct, page, 0)), freePages);
+                    if constexpr (DEBUG_LOG_GC) {
+                        B.PrintF({B.CreateGlobalCachedString("decommit page %p\n"), page});
+                    }
+                    B.CreateCall(MAdvise, {page, B.getInt64(PAGE_SIZE), B.getInt32(MADV_DONTNEED)});
+                    B.CreateStore(
+                        B.CreateLoad(B.getPtrTy(), decommittedPages), B.CreateStructGEP(PageStruct, page, 0)
+                    );
+                    B.CreateStore(page, decommittedPages);
+                    B.CreateBr(WhileCond);
+                }
+                B.SetInsertPoint(WhileEnd);
+            }
+
+            for (unsigned int i = 0; i < SIZE_CLASS_COUNT; i++) {
+                auto *const heap = B.CreateConstInBoundsGEP2_32(
+                    ArrayType::get(B.getModule().getHeapStructType(), SIZE_CLASS_COUNT), B.getModule().getHeaps(), 0, i
+                );
+                // The field that points to the current page: the heap's first page or the previous page's next.
+                B.CreateStore(B.CreateStructGEP(B.getModule().getHeapStructType(), heap, 0), link);
+
+                auto *const WhileCond = B.CreateBasicBlock("while.cond");
+                auto *const WhileBody = B.CreateBasicBlock("while.body");
+                auto *const ReleaseBlock = B.CreateBasicBlock("release");
+                auto *const KeepBlock = B.CreateBasicBlock("keep");
+                auto *const WhileEnd = B.CreateBasicBlock("while.end");
+
+                B.CreateBr(WhileCond);
+                B.SetInsertPoint(WhileCond);
+                auto *const page = B.CreateLoad(B.getPtrTy(), B.CreateLoad(B.getPtrTy(), link), "page");
+                B.CreateCondBr(B.CreateIsNotNull(page), WhileBody, WhileEnd);
+                B.SetInsertPoint(WhileBody);
+                auto *const next = B.CreateStructGEP(PageStruct, page, 0, "next");
+                B.CreateCondBr(HasMarkedObject(B, page), KeepBlock, ReleaseBlock);
+
+                B.SetInsertPoint(ReleaseBlock);
+                {
+                    if constexpr (DEBUG_LOG_GC) {
+                        B.PrintF({B.CreateGlobalCachedString("release page %p\n"), page});
+                    }
+                    SweepPage(B, page);
+                    B.CreateStore(B.CreateLoad(B.getPtrTy(), next), B.CreateLoad(B.getPtrTy(), link));
+                    B.CreateStore(B.CreateLoad(B.getPtrTy(), freePages), next);
+                    B.CreateStore(page, freePages);
+                    B.CreateBr(WhileCond);
+                }
+
+                B.SetInsertPoint(KeepBlock);
+                B.CreateStore(next, link);
+                B.CreateBr(WhileCond);
+
+                B.SetInsertPoint(WhileEnd);
+            }
+
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(ReleaseEmptyPagesFunction);
+    }
+
+    void StartSweep(LoxBuilder &Builder) {
+        static auto *StartSweepFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$startSweep",
+                Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            ReleaseEmptyPages(B);
+
+            // Every page swept before this collection is now unswept.
+            auto *const epoch = B.getModule().getSweepEpoch();
+            B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt32Ty(), epoch), B.getInt32(1)), epoch);
+
+            for (unsigned int i = 0; i < SIZE_CLASS_COUNT; i++) {
+                auto *const heap = B.CreateConstInBoundsGEP2_32(
+                    ArrayType::get(B.getModule().getHeapStructType(), SIZE_CLASS_COUNT), B.getModule().getHeaps(), 0, i
+                );
+                B.CreateStore(B.getNullPtr(), B.CreateStructGEP(B.getModule().getHeapStructType(), heap, 1));
+            }
+
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(StartSweepFunction);
+    }
+
+    // Adds the difference to the allocated bytes; buffers don't trigger a collection.
+    static void AccountBuffer(LoxBuilder &B, Value *Bytes) {
+        auto *const allocatedBytes = B.getModule().getAllocatedBytes();
+        B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt64Ty(), allocatedBytes), Bytes), allocatedBytes);
+        UpdatePeakHeap(B);
+    }
+
+    Value *LoxBuilder::AllocateBuffer(Value *Size, const StringRef what) {
+        assert(Size->getType() == getInt64Ty());
+
+        static auto *AllocateBufferFunction([this] {
+            auto *const F = Function::Create(
+                FunctionType::get(getPtrTy(), {getInt64Ty()}, false), Function::InternalLinkage, "$allocateBuffer",
+                getModule()
+            );
+
+            F->addFnAttr(Attribute::getWithAllocSizeArgs(getContext(), 0, {}));
+
+            LoxBuilder B(getContext(), getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const size = F->arg_begin();
+            auto *const ArenaStruct = B.getModule().getArenaStructType();
+
+            // The size class of each whole number of granules up to the largest class.
+            std::vector<uint8_t> classOfGranules;
+            std::vector<uint32_t> classSizes(SIZE_CLASSES.begin(), SIZE_CLASSES.end());
+            for (uint64_t granules = 0; granules <= MAX_SMALL_SIZE / GRANULE_SIZE; granules++) {
+                classOfGranules.push_back(SizeClassOf(granules * GRANULE_SIZE));
+            }
+            auto *const ClassOfGranulesArray = ConstantDataArray::get(B.getContext(), classOfGranules);
+            auto *const ClassSizesArray = ConstantDataArray::get(B.getContext(), classSizes);
+            static auto *const classOf = new GlobalVariable(
+                B.getModule(), ClassOfGranulesArray->getType(), true, GlobalValue::PrivateLinkage,
+                ClassOfGranulesArray, "$sizeClassOf"
+            );
+            static auto *const classSize = new GlobalVariable(
+                B.getModule(), ClassSizesArray->getType(), true, GlobalValue::PrivateLinkage, ClassSizesArray,
+                "$sizeClasses"
+            );
+
+            auto *const SmallBlock = B.CreateBasicBlock("small");
+            auto *const LargeBlock = B.CreateBasicBlock("large");
+
+            B.CreateCondBr(B.CreateICmpULE(size, B.getInt64(MAX_SMALL_SIZE)), SmallBlock, LargeBlock);
+
+            B.SetInsertPoint(SmallBlock);
+            {
+                auto *const sizeClass = B.CreateZExt(
+                    B.CreateLoad(
+                        B.getInt8Ty(),
+                        B.CreateInBoundsGEP(
+                            ClassOfGranulesArray->getType(), classOf,
+                            {B.getInt64(0), B.CreateLShr(B.CreateAdd(size, B.getInt64(GRANULE_SIZE - 1)),
+                                                         B.getInt64(Log2_64(GRANULE_SIZE)))}
+                        )
+                    ),
+                    B.getInt32Ty(), "sizeClass"
+                );
+                auto *const slotSize = B.CreateLoad(
+                    B.getInt32Ty(),
+                    B.CreateInBoundsGEP(ClassSizesArray->getType(), classSize, {B.getInt32(0), sizeClass}), "slotSize"
+                );
+                auto *const arena = ArenaFor(B, sizeClass);
+                auto *const freeList = B.CreateStructGEP(ArenaStruct, arena, 0, "freeList");
+                auto *const next = B.CreateStructGEP(ArenaStruct, arena, 1, "next");
+                auto *const end = B.CreateStructGEP(ArenaStruct, arena, 2, "end");
+                AccountBuffer(B, B.CreateZExt(slotSize, B.getInt64Ty()));
+
+                auto *const PopBlock = B.CreateBasicBlock("pop");
+                auto *const BumpBlock = B.CreateBasicBlock("bump");
+                auto *const BumpedBlock = B.CreateBasicBlock("bumped");
+                auto *const RefillBlock = B.CreateBasicBlock("refill");
+
+                // Reuse the most recently freed buffer of the class first.
+                auto *const head = B.CreateLoad(B.getPtrTy(), freeList, "head");
+                B.CreateCondBr(B.CreateIsNotNull(head), PopBlock, BumpBlock);
+                B.SetInsertPoint(PopBlock);
+                B.CreateStore(B.CreateLoad(B.getPtrTy(), head), freeList);
+                B.CreateRet(head);
+
+                B.SetInsertPoint(BumpBlock);
+                auto *const buffer = B.CreateLoad(B.getPtrTy(), next, "buffer");
+                auto *const bumped = B.CreateGEP(B.getInt8Ty(), buffer, slotSize, "bumped");
+                B.CreateCondBr(
+                    B.CreateICmpULE(
+                        B.CreatePtrToInt(bumped, B.getInt64Ty()),
+                        B.CreatePtrToInt(B.CreateLoad(B.getPtrTy(), end), B.getInt64Ty())
+                    ),
+                    BumpedBlock, RefillBlock
+                );
+                B.SetInsertPoint(BumpedBlock);
+                B.CreateStore(bumped, next);
+                B.CreateRet(buffer);
+
+                // The current page is used up (or there is none yet): buffers
+                // are bumped through the slots of a new page of the class.
+                B.SetInsertPoint(RefillBlock);
+                auto *const page = AllocatePage(B, sizeClass, slotSize);
+                auto *const first = B.CreateInBoundsGEP(
+                    B.getInt8Ty(), page, B.getInt64(FirstGranule(B.getModule()) * GRANULE_SIZE), "first"
+                );
+                auto *const slotCount = B.CreateLoad(
+                    B.getInt32Ty(), B.CreateStructGEP(B.getModule().getPageStructType(), page, 2), "slotCount"
+                );
+                B.CreateStore(B.CreateInBoundsGEP(B.getInt8Ty(), first, slotSize), next);
+                B.CreateStore(
+                    B.CreateInBoundsGEP(B.getInt8Ty(), first, B.CreateMul(slotCount, slotSize, "", true, true)), end
+                );
+                B.CreateRet(first);
+            }
+
+            B.SetInsertPoint(LargeBlock);
+            {
+                auto *const LargeBufferStruct = B.getModule().getLargeBufferStructType();
+                auto *const headerSize = B.getSizeOf(LargeBufferStruct, 1);
+                auto *const header = B.CreateRealloc(B.getNullPtr(), B.CreateAdd(size, headerSize), "large buffer");
+
+                auto *const OutOfMemoryBlock = B.CreateBasicBlock("out.of.memory");
+                auto *const AllocatedBlock = B.CreateBasicBlock("allocated");
+                B.CreateCondBr(B.CreateIsNull(header), OutOfMemoryBlock, AllocatedBlock);
+                B.SetInsertPoint(OutOfMemoryBlock);
+                OutOfMemory(B);
+
+                // Link the buffer at the head of the list of large buffers.
+                B.SetInsertPoint(AllocatedBlock);
+                auto *const largeBuffers = B.getModule().getLargeBuffers();
+                auto *const first = B.CreateLoad(B.getPtrTy(), largeBuffers, "first");
+                B.CreateStore(first, B.CreateStructGEP(LargeBufferStruct, header, 0));
+                B.CreateStore(B.getNullPtr(), B.CreateStructGEP(LargeBufferStruct, header, 1));
+                B.CreateStore(size, B.CreateStructGEP(LargeBufferStruct, header, 2));
+
+                auto *const LinkBlock = B.CreateBasicBlock("link");
+                auto *const LinkedBlock = B.CreateBasicBlock("linked");
+                B.CreateCondBr(B.CreateIsNotNull(first), LinkBlock, LinkedBlock);
+                B.SetInsertPoint(LinkBlock);
+                B.CreateStore(header, B.CreateStructGEP(LargeBufferStruct, first, 1));
+                B.CreateBr(LinkedBlock);
+
+                B.SetInsertPoint(LinkedBlock);
+                B.CreateStore(header, largeBuffers);
+                AccountBuffer(B, size);
+                B.CreateRet(B.CreateInBoundsGEP(B.getInt8Ty(), header, headerSize, "buffer"));
+            }
+
+            return F;
+        }());
+
+        auto *const buffer = CreateCall(AllocateBufferFunction, {Size});
+
+        if constexpr (DEBUG_LOG_GC) {
+            PrintF({CreateGlobalCachedString("allocate %s (%d) = %p\n"), CreateGlobalCachedString(what), Size, buffer});
+        }
+
+        return buffer;
+    }
+
+    void LoxBuilder::FreeBuffer(Value *Buffer) {
+        assert(Buffer->getType() == getPtrTy());
+
+        static auto *FreeBufferFunction([this] {
+            auto *const F = Function::Create(
+                FunctionType::get(getVoidTy(), {getPtrTy()}, false), Function::InternalLinkage, "$freeBuffer",
+                getModule()
+            );
+
+            LoxBuilder B(getContext(), getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const buffer = F->arg_begin();
+
+            auto *const NotNullBlock = B.CreateBasicBlock("not.null");
+            auto *const SmallBlock = B.CreateBasicBlock("small");
+            auto *const LargeBlock = B.CreateBasicBlock("large");
+            auto *const EndBlock = B.CreateBasicBlock("end");
+
+            B.CreateCondBr(B.CreateIsNull(buffer), EndBlock, NotNullBlock);
+            B.SetInsertPoint(NotNullBlock);
+            B.CreateCondBr(IsHeapObject(B, buffer), SmallBlock, LargeBlock);
+
+            // Small buffers go back on the free list of their page's size class.
+            B.SetInsertPoint(SmallBlock);
+            {
+                auto *const PageStruct = B.getModule().getPageStructType();
+                auto *const page = PageOf(B, buffer);
+                auto *const sizeClass = B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(PageStruct, page, 5));
+                auto *const freeList = B.CreateStructGEP(B.getModule().getArenaStructType(), ArenaFor(B, sizeClass), 0);
+                B.CreateStore(B.CreateLoad(B.getPtrTy(), freeList), buffer);
+                B.CreateStore(buffer, freeList);
+                AccountBuffer(B, B.CreateNeg(B.CreateZExt(SlotSize(B, buffer), B.getInt64Ty())));
+                B.CreateBr(EndBlock);
+            }
+
+            // Large buffers are unlinked from the list and given back to libc.
+            B.SetInsertPoint(LargeBlock);
+            {
+                auto *const LargeBufferStruct = B.getModule().getLargeBufferStructType();
+                auto *const header = B.CreateGEP(B.getInt8Ty(), buffer, B.CreateNeg(B.getSizeOf(LargeBufferStruct, 1)));
+                auto *const next = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(LargeBufferStruct, header, 0), "next");
+                auto *const previous =
+                    B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(LargeBufferStruct, header, 1), "previous");
+
+                auto *const HasNextBlock = B.CreateBasicBlock("has.next");
+                auto *const UnlinkPreviousBlock = B.CreateBasicBlock("unlink.previous");
+                auto *const HasPreviousBlock = B.CreateBasicBlock("has.previous");
+                auto *const IsFirstBlock = B.CreateBasicBlock("is.first");
+                auto *const UnlinkedBlock = B.CreateBasicBlock("unlinked");
+
+                B.CreateCondBr(B.CreateIsNotNull(next), HasNextBlock, UnlinkPreviousBlock);
+                B.SetInsertPoint(HasNextBlock);
+                B.CreateStore(previous, B.CreateStructGEP(LargeBufferStruct, next, 1));
+                B.CreateBr(UnlinkPreviousBlock);
+
+                B.SetInsertPoint(UnlinkPreviousBlock);
+                B.CreateCondBr(B.CreateIsNotNull(previous), HasPreviousBlock, IsFirstBlock);
+                B.SetInsertPoint(HasPreviousBlock);
+                B.CreateStore(next, B.CreateStructGEP(LargeBufferStruct, previous, 0));
+                B.CreateBr(UnlinkedBlock);
+                B.SetInsertPoint(IsFirstBlock);
+                B.CreateStore(next, B.getModule().getLargeBuffers());
+                B.CreateBr(UnlinkedBlock);
+
+                B.SetInsertPoint(UnlinkedBlock);
+                auto *const size = B.CreateLoad(B.getInt64Ty(), B.CreateStructGEP(LargeBufferStruct, header, 2));
+                AccountBuffer(B, B.CreateNeg(size));
+                B.IRBuilder::CreateFree(header);
+                B.CreateBr(EndBlock);
+            }
+
+            B.SetInsertPoint(EndBlock);
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        CreateCall(FreeBufferFunction, {Buffer});
+    }
+
+    void FreeHeap(LoxBuilder &Builder) {
+        static auto *FreeHeapFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$freeHeap",
+                Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const FreeBlock = B.CreateBasicBlock("free");
+            auto *const EndBlock = B.CreateBasicBlock("end");
+
+            auto *const base = B.CreateLoad(B.getInt64Ty(), B.getModule().getHeapBase());
+            B.CreateCondBr(B.CreateICmpEQ(base, B.getInt64(0)), EndBlock, FreeBlock);
+
+            B.SetInsertPoint(FreeBlock);
+            {
+                // Objects and small buffers need no finalization: unmapping
+                // the reservation releases all of their pages at once.
+                auto *const LargeBufferStruct = B.getModule().getLargeBufferStructType();
+                auto *const buffer = CreateEntryBlockAlloca(F, B.getPtrTy(), "buffer");
+                B.CreateStore(B.CreateLoad(B.getPtrTy(), B.getModule().getLargeBuffers()), buffer);
+
+                auto *const WhileCond = B.CreateBasicBlock("while.cond");
+                auto *const WhileBody = B.CreateBasicBlock("while.body");
+                auto *const WhileEnd = B.CreateBasicBlock("while.end");
+
+                B.CreateBr(WhileCond);
+                B.SetInsertPoint(WhileCond);
+                B.CreateCondBr(B.CreateIsNotNull(B.CreateLoad(B.getPtrTy(), buffer)), WhileBody, WhileEnd);
+                B.SetInsertPoint(WhileBody);
+                {
+                    auto *const current = B.CreateLoad(B.getPtrTy(), buffer);
+                    B.CreateStore(
+                        B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(LargeBufferStruct, current, 0, "next")), buffer
+                    );
+                    B.IRBuilder::CreateFree(current);
+                    B.CreateBr(WhileCond);
+                }
+                B.SetInsertPoint(WhileEnd);
+            }
+
+            B.CreateCall(MUnmap(B), {B.CreateIntToPtr(base, B.getPtrTy()), B.getInt64(HEAP_RESERVATION)});
+            B.CreateStore(B.getInt64(0), B.getModule().getHeapBase());
+            B.CreateStore(B.getNullPtr(), B.getModule().getHeapTop());
+            B.CreateStore(B.getNullPtr(), B.getModule().getFreePages());
+            B.CreateStore(B.getNullPtr(), B.getModule().getDecommittedPages());
+            B.CreateStore(B.getNullPtr(), B.getModule().getLargeBuffers());
+            B.CreateStore(
+                ConstantAggregateZero::get(ArrayType::get(B.getModule().getHeapStructType(), SIZE_CLASS_COUNT)),
+                B.getModule().getHeaps()
+            );
+            B.CreateStore(
+                ConstantAggregateZero::get(ArrayType::get(B.getModule().getArenaStructType(), SIZE_CLASS_COUNT)),
+                B.getModule().getArenas()
+            );
+            B.CreateBr(EndBlock);
+
+            B.SetInsertPoint(EndBlock);
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(FreeHeapFunction);
+    }
+}// namespace lox
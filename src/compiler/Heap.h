@@ -0,0 +1,79 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "LoxBuilder.h"
+
+#include <llvm/IR/Value.h>
+
+#include <array>
+
+namespace lox {
+    // Objects are allocated in pages carved out of one reserved range of
+    // address space, so the page of an object is found by masking its address
+    // and whether a pointer is into the heap by a single comparison. Each page
+    // holds objects of one size class, and its header keeps the GC bits of
+    // its objects in side bitmaps with one bit per granule: the bits of an
+    // object are at the index of its first granule.
+    //
+    // Pages are swept lazily: a collection only marks, and the allocator
+    // frees the unmarked objects of a page when it next allocates in it.
+    // Pages in which no object survived are instead swept at the end of the
+    // collection and become free pages, which any size class can reuse; those
+    // still free at the next collection are given back to the OS.
+    //
+    // The buffers owned by objects (strings, tables, upvalue arrays) and
+    // shapes are allocated in pages of the same range, segregated by size
+    // class, so that at exit the whole heap is released at once.
+    constexpr uint64_t HEAP_RESERVATION = 32ULL * 1024 * 1024 * 1024;
+
+    // The slot sizes of the size classes.
+    constexpr std::array<uint32_t, SIZE_CLASS_COUNT> SIZE_CLASSES{
+        16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+    };
+    // Larger buffers are allocated with malloc.
+    constexpr uint32_t MAX_SMALL_SIZE = SIZE_CLASSES.back();
+
+    constexpr unsigned int SizeClassOf(const uint64_t size) {
+        unsigned int sizeClass = 0;
+        while (SIZE_CLASSES[sizeClass] < size) { sizeClass++; }
+        return sizeClass;
+    }
+
+    enum class Bitmap : unsigned {
+        MARK = 6,
+        ALLOCATED = 7,
+        REMEMBERED = 8,
+    };
+
+    // Reserves the heap's address range; must run before the first allocation.
+    void InitializeHeap(LoxBuilder &Builder);
+    // Releases the whole heap, with every object and buffer still allocated.
+    void FreeHeap(LoxBuilder &Builder);
+    // Takes the configured out of memory action; terminates the current block.
+    void OutOfMemory(LoxBuilder &Builder);
+
+    /**
+     * Returns a pointer to a free object slot in a page of the size class,
+     * sweeping pages until one has a free slot.
+     */
+    Value *AllocateSlot(LoxBuilder &Builder, Value *SizeClass, Value *SlotSize);
+
+    // Clears the mark bits of every page, for a major collection.
+    void ClearMarks(LoxBuilder &Builder);
+    // Ends a collection: pages must be swept again before allocating in them.
+    void StartSweep(LoxBuilder &Builder);
+
+    Value *IsHeapObject(LoxBuilder &Builder, Value *ObjectPtr);
+    // The object must be in the heap.
+    Value *TestBit(LoxBuilder &Builder, Bitmap bitmap, Value *ObjectPtr);
+    void SetBit(LoxBuilder &Builder, Bitmap bitmap, Value *ObjectPtr);
+    // Sets the bit atomically, returning true only to the one caller that changed it.
+    Value *SetBitAtomic(LoxBuilder &Builder, Bitmap bitmap, Value *ObjectPtr);
+    void ClearBit(LoxBuilder &Builder, Bitmap bitmap, Value *ObjectPtr);
+    // Objects outside the heap, such as string constants, are always marked.
+    Value *IsMarked(LoxBuilder &Builder, Value *ObjectPtr);
+    // The slot size of the page holding the heap object.
+    Value *SlotSize(LoxBuilder &Builder, Value *ObjectPtr);
+}// namespace lox
+
+#endif//HEAP_H
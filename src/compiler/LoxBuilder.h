@@ -58,19 +58,26 @@ namespace lox {
         ConstantInt *getSizeOf(Type *type, unsigned int arraySize) const;
         Value *AllocateObj(lox::ObjType objType, std::string_view name = "");
         Value *AllocateString(Value *String, Value *Length, std::string_view name = "");
-        Value *AllocateString(StringRef String, std::string_view name = "");
+        Constant *CreateStringConstant(StringRef String);
+        Value *AllocateInternTable();
         Value *AllocateClosure(llvm::Function *function, std::string_view name, bool isNative);
         Value *AllocateUpvalue(Value *value);
         Value *AllocateClass(Value *name);
         Value *AllocateInstance(Value *klass);
+        Value *AllocateShape(Value *parent, Value *key);
+        Value *InstanceGetField(Value *instance, Value *key);
+        void InstanceSetField(Value *instance, Value *key, Value *value);
+        Value *InstanceGetFieldCached(Value *instance, Value *key);
+        void InstanceSetFieldCached(Value *instance, Value *key, Value *value);
+        Value *AllocateBoundMethod(Value *receiver, Value *method);
         Value *AllocateTable();
         Value *TableSet(Value *Table, Value *Key, Value *Value);
         Value *TableGet(Value *Table, Value *Key);
         Value *TableAddAll(Value *FromTable, Value *ToTable);
 
-        Value *CreateReallocate(Value *ptr, Value *oldSize, Value *newSize);
         Value *CreateRealloc(Value *ptr, Value *newSize, StringRef what);
-        void CreateFree(Value *ptr, enum ObjType type, Value *arraySize);
+        Value *AllocateBuffer(Value *Size, StringRef what);
+        void FreeBuffer(Value *Buffer);
         void CollectGarbage(bool force, Value *extraRoot = nullptr);
         Value *Concat(Value *a, Value *b);
 
@@ -85,7 +92,8 @@ namespace lox {
         void PrintString(Value *value);
         void PrintBool(Value *value);
 
-        void Exit(Value *code);
+        // Exits with the code, after writing the GC statistics and the profile, and freeing the heap if asked to.
+        void Exit(Value *code, bool freeObjects = false);
 
         Value *CreateObjStructGEP(const enum ObjType objType, Value *Ptr, const unsigned Idx, const Twine &Name = "") {
             return CreateStructGEP(getModule().getStructType(objType), Ptr, Idx, Name);
@@ -120,6 +128,8 @@ namespace lox {
         [[nodiscard]] BasicBlock *CreateBasicBlock(const std::string_view &name) const {
             return BasicBlock::Create(getContext(), name, getFunction());
         }
+        Value *LookupMethod(Value *klass, Value *key, unsigned int line, const llvm::Function *pFunction);
+        Value *LookupMethodCached(Value *klass, Value *key, unsigned int line, const llvm::Function *pFunction);
         Value *
         BindMethod(Value *klass, Value *receiver, Value *key, unsigned int line, const llvm::Function *pFunction);
 
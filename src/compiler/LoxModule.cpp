@@ -5,6 +5,6 @@
 namespace lox {
     void LoxModule::initialize() {
         grayStack = std::make_shared<GlobalStack>(*this, "gray");
-        localsStack = std::make_shared<GlobalStack>(*this, "locals");
+        rememberedSet = std::make_shared<GlobalStack>(*this, "remembered");
     }
 }// namespace lox
\ No newline at end of file
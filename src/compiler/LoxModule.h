@@ -1,12 +1,41 @@
 #ifndef LOXMODULE_H
 #define LOXMODULE_H
+#include "GCSettings.h"
 #include "Value.h"
 
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/Module.h>
-
-constexpr unsigned int MAX_CALL_STACK_SIZE = 512;
-constexpr unsigned int FIRST_GC_AT = 512;
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+
+// Stack kept free below the stack limit, for the runtime functions called by
+// the deepest Lox function and for reporting a stack overflow.
+constexpr uint64_t STACK_RESERVE = 256 * 1024;
+// The stack size of a program when neither it nor the stack's limit is set.
+constexpr uint64_t DEFAULT_STACK_SIZE = 8 * 1024 * 1024;
+// A stack trace prints at most this many frames.
+constexpr unsigned int MAX_STACK_TRACE_FRAMES = 64;
+// The profiler of a --profile program samples the stack every interval of CPU
+// time, into a ring buffer of the latest samples; each records up to the
+// innermost PROFILE_MAX_DEPTH frames.
+constexpr uint64_t PROFILE_INTERVAL_US = 1000;
+constexpr uint64_t PROFILE_SAMPLES = 32768;
+constexpr unsigned int PROFILE_MAX_DEPTH = 32;
+// Instances store up to this many fields inline before falling back to a fields table.
+constexpr unsigned int INSTANCE_INLINE_FIELDS = 8;
+// Number of shapes remembered by each property access inline cache.
+constexpr unsigned int PROPERTY_CACHE_ENTRIES = 4;
+// Objects are allocated in pages of this size, aligned to it (see Heap.h).
+constexpr uint64_t PAGE_SIZE = 256 * 1024;
+constexpr uint64_t GRANULE_SIZE = 16;
+// Each page bitmap has a bit per granule of the page.
+constexpr uint64_t PAGE_BITMAP_WORDS = PAGE_SIZE / GRANULE_SIZE / 64;
+// Bounds of the nursery size, which is paced by the allocation rate (see GC.h).
+constexpr uint64_t MIN_NURSERY_SIZE = 256 * 1024;
+constexpr uint64_t MAX_NURSERY_SIZE = 64 * 1024 * 1024;
+// Number of size classes, see SIZE_CLASSES in Heap.h.
+constexpr unsigned int SIZE_CLASS_COUNT = 14;
 
 namespace lox {
     using namespace llvm;
@@ -14,11 +43,10 @@ namespace lox {
     class GlobalStack;
 
     class LoxModule : public Module {
+        // The GC bits of an object are kept in the bitmaps of its page, not in its header.
         StructType *const ObjStructType = StructType::create(
             getContext(),
-            {IntegerType::getInt8Ty(getContext()),// ObjType
-             IntegerType::getInt1Ty(getContext()),// isMarked
-             PointerType::get(getContext(), 0)},  // next
+            {IntegerType::getInt8Ty(getContext())},// ObjType
             "Obj"
         );
         StructType *const StringStructType = StructType::create(
@@ -72,12 +100,28 @@ namespace lox {
             },
             "Class"
         );
+        // A shape maps field names to the inline slots of instances: each shape
+        // adds one key to its parent, in slot count - 1. Shapes are shared and immutable,
+        // and are never collected; the GC marks their keys, see MarkShapes.
+        StructType *const ShapeStruct = StructType::create(
+            getContext(),
+            {
+                PointerType::getUnqual(getContext()), // parent
+                StringStructType->getPointerTo(),     // key
+                IntegerType::getInt32Ty(getContext()),// count
+                PointerType::getUnqual(getContext()), // transitions
+                PointerType::getUnqual(getContext()), // next
+            },
+            "Shape"
+        );
         StructType *const InstanceStruct = StructType::create(
             getContext(),
             {
                 ObjStructType,
                 ClassStruct->getPointerTo(),         // klass
-                PointerType::getUnqual(getContext()),// fields
+                PointerType::getUnqual(getContext()),// fields (only in dictionary mode)
+                ShapeStruct->getPointerTo(),         // shape
+                ArrayType::get(IntegerType::getInt64Ty(getContext()), INSTANCE_INLINE_FIELDS),// inline fields
             },
             "Instance"
         );
@@ -97,6 +141,7 @@ namespace lox {
                 IntegerType::getInt32Ty(getContext()),// count
                 IntegerType::getInt32Ty(getContext()),// capacity
                 PointerType::getUnqual(getContext()), // entries
+                PointerType::getUnqual(getContext()), // control bytes, allocated after the entries
             },
             "Table"
         );
@@ -108,76 +153,435 @@ namespace lox {
             },
             "Entry"
         );
-        GlobalVariable *const objects =
-            cast<GlobalVariable>(getOrInsertGlobal("objects", PointerType::get(getContext(), 0)));
+        // The header of a heap page, which is followed by its object slots.
+        StructType *const PageStruct = StructType::create(
+            getContext(),
+            {
+                PointerType::getUnqual(getContext()),                                    // next
+                IntegerType::getInt32Ty(getContext()),                                   // slot size
+                IntegerType::getInt32Ty(getContext()),                                   // slot count
+                IntegerType::getInt32Ty(getContext()),                                   // allocated slots
+                IntegerType::getInt32Ty(getContext()),                                   // swept at epoch
+                IntegerType::getInt32Ty(getContext()),                                   // size class
+                ArrayType::get(IntegerType::getInt64Ty(getContext()), PAGE_BITMAP_WORDS),// mark bits
+                ArrayType::get(IntegerType::getInt64Ty(getContext()), PAGE_BITMAP_WORDS),// allocated bits
+                ArrayType::get(IntegerType::getInt64Ty(getContext()), PAGE_BITMAP_WORDS),// remembered bits
+            },
+            "Page"
+        );
+        // The object pages of one size class and the allocation cursor into them.
+        StructType *const HeapStruct = StructType::create(
+            getContext(),
+            {
+                PointerType::getUnqual(getContext()), // pages
+                PointerType::getUnqual(getContext()), // current page, null after a collection
+                IntegerType::getInt32Ty(getContext()),// next granule to allocate in the current page
+            },
+            "Heap"
+        );
+        GlobalVariable *const heaps =
+            cast<GlobalVariable>(getOrInsertGlobal("$heaps", ArrayType::get(HeapStruct, SIZE_CLASS_COUNT)));
+        // Buffers of one size class are allocated from a free list of freed
+        // buffers, or else by bumping a pointer through the class's current page.
+        StructType *const ArenaStruct = StructType::create(
+            getContext(),
+            {
+                PointerType::getUnqual(getContext()),// free list
+                PointerType::getUnqual(getContext()),// next free byte of the current page
+                PointerType::getUnqual(getContext()),// end of the current page's slots
+            },
+            "Arena"
+        );
+        GlobalVariable *const arenas =
+            cast<GlobalVariable>(getOrInsertGlobal("$arenas", ArrayType::get(ArenaStruct, SIZE_CLASS_COUNT)));
+        // Buffers larger than the largest size class are allocated with malloc,
+        // after this header which links them into a list.
+        StructType *const LargeBufferStruct = StructType::create(
+            getContext(),
+            {
+                PointerType::getUnqual(getContext()), // next
+                PointerType::getUnqual(getContext()), // previous
+                IntegerType::getInt64Ty(getContext()),// size
+                IntegerType::getInt64Ty(getContext()),// padding, to keep the buffer 16 byte aligned
+            },
+            "LargeBuffer"
+        );
+        GlobalVariable *const largeBuffers =
+            cast<GlobalVariable>(getOrInsertGlobal("$largeBuffers", PointerType::get(getContext(), 0)));
+        GlobalVariable *const heapBase =
+            cast<GlobalVariable>(getOrInsertGlobal("$heapBase", IntegerType::getInt64Ty(getContext())));
+        GlobalVariable *const heapTop =
+            cast<GlobalVariable>(getOrInsertGlobal("$heapTop", PointerType::get(getContext(), 0)));
+        // Pages which held no live object at the end of a collection, linked by their next
+        // field, that any size class can reuse: first those released at the last collection,
+        // which are still committed, then those given back to the OS since.
+        GlobalVariable *const freePages =
+            cast<GlobalVariable>(getOrInsertGlobal("$freePages", PointerType::get(getContext(), 0)));
+        GlobalVariable *const decommittedPages =
+            cast<GlobalVariable>(getOrInsertGlobal("$decommittedPages", PointerType::get(getContext(), 0)));
+        GlobalVariable *const sweepEpoch =
+            cast<GlobalVariable>(getOrInsertGlobal("$sweepEpoch", IntegerType::getInt32Ty(getContext())));
         GlobalVariable *const runtimeStrings =
             cast<GlobalVariable>(getOrInsertGlobal("strings", PointerType::get(getContext(), 0)));
-        GlobalVariable *const openUpvalues =
-            cast<GlobalVariable>(getOrInsertGlobal("openUpvalues", PointerType::get(getContext(), 0)));
-        StructType *const Call = StructType::create(
+        GlobalVariable *const rootShape =
+            cast<GlobalVariable>(getOrInsertGlobal("$rootShape", PointerType::get(getContext(), 0)));
+        GlobalVariable *const shapes =
+            cast<GlobalVariable>(getOrInsertGlobal("$shapes", PointerType::get(getContext(), 0)));
+        // Unused inline cache entries point to this instead of a shape, so that
+        // dictionary mode instances, which have no shape, never hit the cache.
+        GlobalVariable *const noShape =
+            cast<GlobalVariable>(getOrInsertGlobal("$noShape", IntegerType::getInt8Ty(getContext())));
+        // An inline cache entry: instances with the shape `from` have the property
+        // in `slot` (-1 if it's not a field); storing it moves them to shape `to`.
+        StructType *const PropertyCacheEntryStruct = StructType::create(
             getContext(),
             {
-                IntegerType::getInt32Ty(getContext()),// line
-                PointerType::getUnqual(getContext()), // name
+                PointerType::getUnqual(getContext()), // from
+                PointerType::getUnqual(getContext()), // to
+                IntegerType::getInt32Ty(getContext()),// slot
             },
-            "Call"
+            "PropertyCacheEntry"
         );
-        GlobalVariable *const callstack =
-            cast<GlobalVariable>(getOrInsertGlobal("callstack", ArrayType::get(Call, MAX_CALL_STACK_SIZE)));
-        GlobalVariable *const callstackpointer =
-            cast<GlobalVariable>(getOrInsertGlobal("callsp", IntegerType::getInt32Ty(getContext())));
+        GlobalVariable *const openUpvalues =
+            cast<GlobalVariable>(getOrInsertGlobal("openUpvalues", PointerType::get(getContext(), 0)));
+        // The stack size baked into the program, 0 for the stack's limit, see ConfigureStack.
+        GlobalVariable *const stackSize =
+            cast<GlobalVariable>(getOrInsertGlobal("$stackSize", IntegerType::getInt64Ty(getContext())));
+        // Lox frames below this address overflow the stack.
+        GlobalVariable *const stackLimit =
+            cast<GlobalVariable>(getOrInsertGlobal("$stackLimit", IntegerType::getInt64Ty(getContext())));
         GlobalVariable *const allocatedBytes =
-            cast<GlobalVariable>(getOrInsertGlobal("$allocatedBytes", IntegerType::getInt32Ty(getContext())));
+            cast<GlobalVariable>(getOrInsertGlobal("$allocatedBytes", IntegerType::getInt64Ty(getContext())));
         GlobalVariable *const nextGC =
-            cast<GlobalVariable>(getOrInsertGlobal("$nextGC", IntegerType::getInt32Ty(getContext())));
+            cast<GlobalVariable>(getOrInsertGlobal("$nextGC", IntegerType::getInt64Ty(getContext())));
+        GlobalVariable *const nurseryBytes =
+            cast<GlobalVariable>(getOrInsertGlobal("$nurseryBytes", IntegerType::getInt64Ty(getContext())));
+        // Bytes in allocated object slots, including dead objects not swept yet.
+        GlobalVariable *const objectBytes =
+            cast<GlobalVariable>(getOrInsertGlobal("$objectBytes", IntegerType::getInt64Ty(getContext())));
+        // Bytes in object slots marked by the current collection.
+        GlobalVariable *const markedBytes =
+            cast<GlobalVariable>(getOrInsertGlobal("$markedBytes", IntegerType::getInt64Ty(getContext())));
+        // The GC policy, see GCSettings; the initializers are the settings baked into the program.
+        GlobalVariable *const gcGrowthFactor =
+            cast<GlobalVariable>(getOrInsertGlobal("$gcGrowthFactor", Type::getDoubleTy(getContext())));
+        GlobalVariable *const gcMinHeap =
+            cast<GlobalVariable>(getOrInsertGlobal("$gcMinHeap", IntegerType::getInt64Ty(getContext())));
+        GlobalVariable *const gcMaxHeap =
+            cast<GlobalVariable>(getOrInsertGlobal("$gcMaxHeap", IntegerType::getInt64Ty(getContext())));
+        GlobalVariable *const gcOutOfMemory =
+            cast<GlobalVariable>(getOrInsertGlobal("$gcOutOfMemory", IntegerType::getInt32Ty(getContext())));
+        GlobalVariable *const gcThreads =
+            cast<GlobalVariable>(getOrInsertGlobal("$gcThreads", IntegerType::getInt32Ty(getContext())));
+        // Bytes allocated since the last collection that trigger a minor collection,
+        // paced by the allocation rate.
+        GlobalVariable *const nurserySize =
+            cast<GlobalVariable>(getOrInsertGlobal("$nurserySize", IntegerType::getInt64Ty(getContext())));
+        // Monotonic time in nanoseconds at which the last collection ended.
+        GlobalVariable *const lastCollection =
+            cast<GlobalVariable>(getOrInsertGlobal("$lastCollection", IntegerType::getInt64Ty(getContext())));
+        GlobalVariable *const minorCollections =
+            cast<GlobalVariable>(getOrInsertGlobal("$minorCollections", IntegerType::getInt64Ty(getContext())));
+        GlobalVariable *const majorCollections =
+            cast<GlobalVariable>(getOrInsertGlobal("$majorCollections", IntegerType::getInt64Ty(getContext())));
+        // Statistics for the LOX_GC_STATS report.
+        GlobalVariable *const allocatedByType = cast<GlobalVariable>(
+            getOrInsertGlobal("$allocatedByType", ArrayType::get(IntegerType::getInt64Ty(getContext()), OBJ_TYPE_COUNT))
+        );
+        GlobalVariable *const freedByType = cast<GlobalVariable>(
+            getOrInsertGlobal("$freedByType", ArrayType::get(IntegerType::getInt64Ty(getContext()), OBJ_TYPE_COUNT))
+        );
+        GlobalVariable *const peakHeap =
+            cast<GlobalVariable>(getOrInsertGlobal("$peakHeap", IntegerType::getInt64Ty(getContext())));
+        GlobalVariable *const pauseHistogram = cast<GlobalVariable>(getOrInsertGlobal(
+            "$pauseHistogram", ArrayType::get(IntegerType::getInt64Ty(getContext()), GC_PAUSE_BUCKETS.size() + 1)
+        ));
+        GlobalVariable *const pauseTotal =
+            cast<GlobalVariable>(getOrInsertGlobal("$pauseTotal", IntegerType::getInt64Ty(getContext())));
+        GlobalVariable *const pauseMax =
+            cast<GlobalVariable>(getOrInsertGlobal("$pauseMax", IntegerType::getInt64Ty(getContext())));
+        // Set by the SIGUSR1 handler: the report is written at the next allocation.
+        GlobalVariable *const gcStatsRequested =
+            cast<GlobalVariable>(getOrInsertGlobal("$gcStatsRequested", IntegerType::getInt32Ty(getContext())));
         GlobalVariable *const enableGC =
             cast<GlobalVariable>(getOrInsertGlobal("$enableGC", IntegerType::getInt1Ty(getContext())));
+        // True while a major collection is marking incrementally, between allocations.
+        GlobalVariable *const gcMarking =
+            cast<GlobalVariable>(getOrInsertGlobal("$gcMarking", IntegerType::getInt1Ty(getContext())));
+        // With several GC threads, each marks from its own deque of gray objects,
+        // see ParallelMark.h; a worker fills one cache line.
+        StructType *const MarkWorkerStruct = StructType::create(
+            getContext(),
+            {
+                PointerType::getUnqual(getContext()),         // entries
+                IntegerType::getInt32Ty(getContext()),        // bottom, where thieves take entries
+                IntegerType::getInt32Ty(getContext()),        // top, where the owner pushes and pops
+                IntegerType::getInt32Ty(getContext()),        // capacity
+                IntegerType::getInt32Ty(getContext()),        // lock
+                IntegerType::getInt64Ty(getContext()),        // bytes marked by this worker
+                IntegerType::getInt64Ty(getContext()),        // pthread_t, 0 if the thread didn't start
+                ArrayType::get(IntegerType::getInt8Ty(getContext()), 24),
+            },
+            "MarkWorker"
+        );
+        GlobalVariable *const markWorkers =
+            cast<GlobalVariable>(getOrInsertGlobal("$markWorkers", PointerType::getUnqual(getContext())));
+        // The pthread key holding the current thread's worker.
+        GlobalVariable *const markWorkerKey =
+            cast<GlobalVariable>(getOrInsertGlobal("$markWorkerKey", IntegerType::getInt32Ty(getContext())));
+        // The workers that found no gray object left; marking ends when all are idle.
+        GlobalVariable *const markIdle =
+            cast<GlobalVariable>(getOrInsertGlobal("$markIdle", IntegerType::getInt32Ty(getContext())));
+        // True while the workers are marking, so that marked objects go to their deques.
+        GlobalVariable *const parallelMarking =
+            cast<GlobalVariable>(getOrInsertGlobal("$parallelMarking", IntegerType::getInt1Ty(getContext())));
+        // Each compiled function links a root frame into this chain: the header
+        // is followed by `count` NaN-boxed local slots. The header also records
+        // the function's name and the line of the call it's making, for stack traces.
+        StructType *const RootFrameStruct = StructType::create(
+            getContext(),
+            {
+                PointerType::getUnqual(getContext()), // previous frame
+                IntegerType::getInt32Ty(getContext()),// count
+                IntegerType::getInt32Ty(getContext()),// line
+                PointerType::getUnqual(getContext()), // name
+            },
+            "RootFrame"
+        );
+        GlobalVariable *const rootFrames =
+            cast<GlobalVariable>(getOrInsertGlobal("$rootFrames", PointerType::get(getContext(), 0)));
         std::shared_ptr<GlobalStack> grayStack;
-        std::shared_ptr<GlobalStack> localsStack;
+        std::shared_ptr<GlobalStack> rememberedSet;
         llvm::StringMap<Constant *> strings;
+        llvm::StringMap<GlobalVariable *> stringConstants;
+        // Whether calling each runtime function may run a collection, see allocateRootSlots.
+        DenseMap<const Function *, bool> mayCollect;
+        // The debug information of the script, only with -g.
+        std::unique_ptr<DIBuilder> DIB;
+        DIFile *debugFile = nullptr;
+        // The profiler's samples, only with --profile, see Profile.h.
+        StructType *ProfileSampleStruct = nullptr;
+        GlobalVariable *profileSamples = nullptr;
+        GlobalVariable *profileCount = nullptr;
 
     public:
         explicit LoxModule(LLVMContext &Context) : Module("lox", Context) {
-            objects->setLinkage(GlobalValue::PrivateLinkage);
-            objects->setAlignment(Align(8));
-            objects->setConstant(false);
-            objects->setInitializer(ConstantPointerNull::get(PointerType::get(Context, 0)));
+            heaps->setLinkage(GlobalValue::PrivateLinkage);
+            heaps->setAlignment(Align(8));
+            heaps->setConstant(false);
+            heaps->setInitializer(ConstantAggregateZero::get(ArrayType::get(HeapStruct, SIZE_CLASS_COUNT)));
+
+            arenas->setLinkage(GlobalValue::PrivateLinkage);
+            arenas->setAlignment(Align(8));
+            arenas->setConstant(false);
+            arenas->setInitializer(ConstantAggregateZero::get(ArrayType::get(ArenaStruct, SIZE_CLASS_COUNT)));
+
+            largeBuffers->setLinkage(GlobalValue::PrivateLinkage);
+            largeBuffers->setAlignment(Align(8));
+            largeBuffers->setConstant(false);
+            largeBuffers->setInitializer(ConstantPointerNull::get(PointerType::get(Context, 0)));
+
+            heapBase->setLinkage(GlobalValue::PrivateLinkage);
+            heapBase->setAlignment(Align(8));
+            heapBase->setConstant(false);
+            heapBase->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), 0));
+
+            heapTop->setLinkage(GlobalValue::PrivateLinkage);
+            heapTop->setAlignment(Align(8));
+            heapTop->setConstant(false);
+            heapTop->setInitializer(ConstantPointerNull::get(PointerType::get(Context, 0)));
+
+            freePages->setLinkage(GlobalValue::PrivateLinkage);
+            freePages->setAlignment(Align(8));
+            freePages->setConstant(false);
+            freePages->setInitializer(ConstantPointerNull::get(PointerType::get(Context, 0)));
+
+            decommittedPages->setLinkage(GlobalValue::PrivateLinkage);
+            decommittedPages->setAlignment(Align(8));
+            decommittedPages->setConstant(false);
+            decommittedPages->setInitializer(ConstantPointerNull::get(PointerType::get(Context, 0)));
+
+            sweepEpoch->setLinkage(GlobalValue::PrivateLinkage);
+            sweepEpoch->setAlignment(Align(8));
+            sweepEpoch->setConstant(false);
+            sweepEpoch->setInitializer(ConstantInt::get(IntegerType::getInt32Ty(getContext()), 0));
 
             runtimeStrings->setLinkage(GlobalValue::PrivateLinkage);
             runtimeStrings->setAlignment(Align(8));
             runtimeStrings->setConstant(false);
             runtimeStrings->setInitializer(ConstantPointerNull::get(PointerType::get(Context, 0)));
 
+            rootShape->setLinkage(GlobalValue::PrivateLinkage);
+            rootShape->setAlignment(Align(8));
+            rootShape->setConstant(false);
+            rootShape->setInitializer(ConstantPointerNull::get(PointerType::get(Context, 0)));
+
+            shapes->setLinkage(GlobalValue::PrivateLinkage);
+            shapes->setAlignment(Align(8));
+            shapes->setConstant(false);
+            shapes->setInitializer(ConstantPointerNull::get(PointerType::get(Context, 0)));
+
+            noShape->setLinkage(GlobalValue::PrivateLinkage);
+            noShape->setConstant(true);
+            noShape->setInitializer(ConstantInt::get(IntegerType::getInt8Ty(getContext()), 0));
+
             openUpvalues->setLinkage(GlobalValue::PrivateLinkage);
             openUpvalues->setAlignment(Align(8));
             openUpvalues->setConstant(false);
             openUpvalues->setInitializer(ConstantPointerNull::get(PointerType::get(Context, 0)));
 
-            callstack->setLinkage(GlobalVariable::PrivateLinkage);
-            callstack->setAlignment(Align(8));
-            callstack->setConstant(false);
-            callstack->setInitializer(Constant::getNullValue(ArrayType::get(Call, MAX_CALL_STACK_SIZE)));
+            stackSize->setLinkage(GlobalVariable::PrivateLinkage);
+            stackSize->setAlignment(Align(8));
+            stackSize->setConstant(false);
+            setStackSize(0);
 
-            callstackpointer->setLinkage(GlobalVariable::PrivateLinkage);
-            callstackpointer->setAlignment(Align(8));
-            callstackpointer->setConstant(false);
-            callstackpointer->setInitializer(ConstantInt::get(IntegerType::getInt32Ty(getContext()), 0));
+            stackLimit->setLinkage(GlobalVariable::PrivateLinkage);
+            stackLimit->setAlignment(Align(8));
+            stackLimit->setConstant(false);
+            stackLimit->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), 0));
 
             allocatedBytes->setLinkage(GlobalVariable::PrivateLinkage);
             allocatedBytes->setAlignment(Align(8));
             allocatedBytes->setConstant(false);
-            allocatedBytes->setInitializer(ConstantInt::get(IntegerType::getInt32Ty(getContext()), 0));
+            allocatedBytes->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), 0));
 
             nextGC->setLinkage(GlobalVariable::PrivateLinkage);
             nextGC->setAlignment(Align(8));
             nextGC->setConstant(false);
-            nextGC->setInitializer(ConstantInt::get(IntegerType::getInt32Ty(getContext()), FIRST_GC_AT));
+
+            nurseryBytes->setLinkage(GlobalVariable::PrivateLinkage);
+            nurseryBytes->setAlignment(Align(8));
+            nurseryBytes->setConstant(false);
+            nurseryBytes->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), 0));
+
+            objectBytes->setLinkage(GlobalVariable::PrivateLinkage);
+            objectBytes->setAlignment(Align(8));
+            objectBytes->setConstant(false);
+            objectBytes->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), 0));
+
+            markedBytes->setLinkage(GlobalVariable::PrivateLinkage);
+            markedBytes->setAlignment(Align(8));
+            markedBytes->setConstant(false);
+            markedBytes->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), 0));
+
+            gcGrowthFactor->setLinkage(GlobalVariable::PrivateLinkage);
+            gcGrowthFactor->setAlignment(Align(8));
+            gcGrowthFactor->setConstant(false);
+
+            gcMinHeap->setLinkage(GlobalVariable::PrivateLinkage);
+            gcMinHeap->setAlignment(Align(8));
+            gcMinHeap->setConstant(false);
+
+            gcMaxHeap->setLinkage(GlobalVariable::PrivateLinkage);
+            gcMaxHeap->setAlignment(Align(8));
+            gcMaxHeap->setConstant(false);
+
+            gcOutOfMemory->setLinkage(GlobalVariable::PrivateLinkage);
+            gcOutOfMemory->setAlignment(Align(8));
+            gcOutOfMemory->setConstant(false);
+
+            gcThreads->setLinkage(GlobalVariable::PrivateLinkage);
+            gcThreads->setAlignment(Align(8));
+            gcThreads->setConstant(false);
+
+            setGCSettings(GCSettings{});
+
+            markWorkers->setLinkage(GlobalVariable::PrivateLinkage);
+            markWorkers->setAlignment(Align(8));
+            markWorkers->setConstant(false);
+            markWorkers->setInitializer(ConstantPointerNull::get(PointerType::get(Context, 0)));
+
+            markWorkerKey->setLinkage(GlobalVariable::PrivateLinkage);
+            markWorkerKey->setAlignment(Align(8));
+            markWorkerKey->setConstant(false);
+            markWorkerKey->setInitializer(ConstantInt::get(IntegerType::getInt32Ty(getContext()), 0));
+
+            markIdle->setLinkage(GlobalVariable::PrivateLinkage);
+            markIdle->setAlignment(Align(8));
+            markIdle->setConstant(false);
+            markIdle->setInitializer(ConstantInt::get(IntegerType::getInt32Ty(getContext()), 0));
+
+            parallelMarking->setLinkage(GlobalVariable::PrivateLinkage);
+            parallelMarking->setAlignment(Align(8));
+            parallelMarking->setConstant(false);
+            parallelMarking->setInitializer(ConstantInt::get(IntegerType::getInt1Ty(getContext()), 0));
+
+            nurserySize->setLinkage(GlobalVariable::PrivateLinkage);
+            nurserySize->setAlignment(Align(8));
+            nurserySize->setConstant(false);
+            nurserySize->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), MIN_NURSERY_SIZE));
+
+            lastCollection->setLinkage(GlobalVariable::PrivateLinkage);
+            lastCollection->setAlignment(Align(8));
+            lastCollection->setConstant(false);
+            lastCollection->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), 0));
+
+            minorCollections->setLinkage(GlobalVariable::PrivateLinkage);
+            minorCollections->setAlignment(Align(8));
+            minorCollections->setConstant(false);
+            minorCollections->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), 0));
+
+            majorCollections->setLinkage(GlobalVariable::PrivateLinkage);
+            majorCollections->setAlignment(Align(8));
+            majorCollections->setConstant(false);
+            majorCollections->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), 0));
+
+            allocatedByType->setLinkage(GlobalVariable::PrivateLinkage);
+            allocatedByType->setAlignment(Align(8));
+            allocatedByType->setConstant(false);
+            allocatedByType->setInitializer(
+                ConstantAggregateZero::get(ArrayType::get(IntegerType::getInt64Ty(getContext()), OBJ_TYPE_COUNT))
+            );
+
+            freedByType->setLinkage(GlobalVariable::PrivateLinkage);
+            freedByType->setAlignment(Align(8));
+            freedByType->setConstant(false);
+            freedByType->setInitializer(
+                ConstantAggregateZero::get(ArrayType::get(IntegerType::getInt64Ty(getContext()), OBJ_TYPE_COUNT))
+            );
+
+            peakHeap->setLinkage(GlobalVariable::PrivateLinkage);
+            peakHeap->setAlignment(Align(8));
+            peakHeap->setConstant(false);
+            peakHeap->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), 0));
+
+            pauseHistogram->setLinkage(GlobalVariable::PrivateLinkage);
+            pauseHistogram->setAlignment(Align(8));
+            pauseHistogram->setConstant(false);
+            pauseHistogram->setInitializer(ConstantAggregateZero::get(
+                ArrayType::get(IntegerType::getInt64Ty(getContext()), GC_PAUSE_BUCKETS.size() + 1)
+            ));
+
+            pauseTotal->setLinkage(GlobalVariable::PrivateLinkage);
+            pauseTotal->setAlignment(Align(8));
+            pauseTotal->setConstant(false);
+            pauseTotal->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), 0));
+
+            pauseMax->setLinkage(GlobalVariable::PrivateLinkage);
+            pauseMax->setAlignment(Align(8));
+            pauseMax->setConstant(false);
+            pauseMax->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), 0));
+
+            gcStatsRequested->setLinkage(GlobalVariable::PrivateLinkage);
+            gcStatsRequested->setAlignment(Align(8));
+            gcStatsRequested->setConstant(false);
+            gcStatsRequested->setInitializer(ConstantInt::get(IntegerType::getInt32Ty(getContext()), 0));
 
             enableGC->setLinkage(GlobalVariable::PrivateLinkage);
             enableGC->setAlignment(Align(8));
             enableGC->setConstant(false);
             enableGC->setInitializer(ConstantInt::get(IntegerType::getInt1Ty(getContext()), 1));
 
+            gcMarking->setLinkage(GlobalVariable::PrivateLinkage);
+            gcMarking->setAlignment(Align(8));
+            gcMarking->setConstant(false);
+            gcMarking->setInitializer(ConstantInt::get(IntegerType::getInt1Ty(getContext()), 0));
+
+            rootFrames->setLinkage(GlobalValue::PrivateLinkage);
+            rootFrames->setAlignment(Align(8));
+            rootFrames->setConstant(false);
+            rootFrames->setInitializer(ConstantPointerNull::get(PointerType::get(Context, 0)));
+
             initialize();
         }
 
@@ -189,6 +593,10 @@ namespace lox {
 
         StructType *getEntryStructType() const { return EntryStruct; }
 
+        StructType *getShapeStructType() const { return ShapeStruct; }
+
+        StructType *getPropertyCacheEntryStructType() const { return PropertyCacheEntryStruct; }
+
         StructType *getStructType(const ObjType objType) const {
             switch (objType) {
                 case ObjType::STRING:
@@ -210,29 +618,182 @@ namespace lox {
             }
         }
 
-        GlobalVariable *getObjects() const { return objects; }
+        StructType *getPageStructType() const { return PageStruct; }
+
+        StructType *getHeapStructType() const { return HeapStruct; }
+
+        GlobalVariable *getHeaps() const { return heaps; }
+
+        StructType *getArenaStructType() const { return ArenaStruct; }
+
+        GlobalVariable *getArenas() const { return arenas; }
+
+        StructType *getLargeBufferStructType() const { return LargeBufferStruct; }
+
+        GlobalVariable *getLargeBuffers() const { return largeBuffers; }
+
+        GlobalVariable *getHeapBase() const { return heapBase; }
+
+        GlobalVariable *getHeapTop() const { return heapTop; }
+
+        GlobalVariable *getFreePages() const { return freePages; }
+
+        GlobalVariable *getDecommittedPages() const { return decommittedPages; }
+
+        GlobalVariable *getSweepEpoch() const { return sweepEpoch; }
 
         GlobalVariable *getOpenUpvalues() const { return openUpvalues; }
 
+        GlobalVariable *getRootShape() const { return rootShape; }
+
+        GlobalVariable *getShapes() const { return shapes; }
+
+        GlobalVariable *getNoShape() const { return noShape; }
+
         GlobalVariable *getRuntimeStrings() const { return runtimeStrings; }
 
-        GlobalVariable *getCallStack() const { return callstack; }
+        // Bakes the stack size into the program, as the default for LOX_STACK_SIZE.
+        void setStackSize(const uint64_t size) const {
+            stackSize->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), size));
+        }
 
-        Type *getCallStruct() const { return Call; }
+        GlobalVariable *getStackSize() const { return stackSize; }
 
-        GlobalVariable *getCallStackPointer() const { return callstackpointer; }
+        GlobalVariable *getStackLimit() const { return stackLimit; }
 
         const GlobalStack &getGrayStack() const { return *grayStack; }
 
-        const GlobalStack &getLocalsStack() const { return *localsStack; }
+        const GlobalStack &getRememberedSet() const { return *rememberedSet; }
+
+        StructType *getRootFrameStructType() const { return RootFrameStruct; }
+
+        GlobalVariable *getRootFrames() const { return rootFrames; }
 
         GlobalVariable *getAllocatedBytes() const { return allocatedBytes; }
 
         GlobalVariable *getNextGC() const { return nextGC; }
 
+        GlobalVariable *getNurseryBytes() const { return nurseryBytes; }
+
+        GlobalVariable *getObjectBytes() const { return objectBytes; }
+
+        GlobalVariable *getMarkedBytes() const { return markedBytes; }
+
+        // Bakes the GC policy into the program, as the defaults for the environment variables.
+        void setGCSettings(const GCSettings &settings) const {
+            nextGC->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), settings.initialHeap));
+            gcGrowthFactor->setInitializer(ConstantFP::get(Type::getDoubleTy(getContext()), settings.growthFactor));
+            gcMinHeap->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), settings.minHeap));
+            gcMaxHeap->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), settings.maxHeap));
+            gcOutOfMemory->setInitializer(ConstantInt::get(
+                IntegerType::getInt32Ty(getContext()), static_cast<int32_t>(settings.outOfMemory)
+            ));
+            gcThreads->setInitializer(ConstantInt::get(IntegerType::getInt32Ty(getContext()), settings.threads));
+        }
+
+        GlobalVariable *getGCGrowthFactor() const { return gcGrowthFactor; }
+
+        GlobalVariable *getGCMinHeap() const { return gcMinHeap; }
+
+        GlobalVariable *getGCMaxHeap() const { return gcMaxHeap; }
+
+        GlobalVariable *getGCOutOfMemory() const { return gcOutOfMemory; }
+
+        GlobalVariable *getGCThreads() const { return gcThreads; }
+
+        GlobalVariable *getNurserySize() const { return nurserySize; }
+
+        GlobalVariable *getLastCollection() const { return lastCollection; }
+
+        GlobalVariable *getMinorCollections() const { return minorCollections; }
+
+        GlobalVariable *getMajorCollections() const { return majorCollections; }
+
+        GlobalVariable *getAllocatedByType() const { return allocatedByType; }
+
+        GlobalVariable *getFreedByType() const { return freedByType; }
+
+        GlobalVariable *getPeakHeap() const { return peakHeap; }
+
+        GlobalVariable *getPauseHistogram() const { return pauseHistogram; }
+
+        GlobalVariable *getPauseTotal() const { return pauseTotal; }
+
+        GlobalVariable *getPauseMax() const { return pauseMax; }
+
+        GlobalVariable *getGCStatsRequested() const { return gcStatsRequested; }
+
         GlobalVariable *getEnableGC() const { return enableGC; }
 
+        GlobalVariable *getGCMarking() const { return gcMarking; }
+
+        StructType *getMarkWorkerStructType() const { return MarkWorkerStruct; }
+
+        GlobalVariable *getMarkWorkers() const { return markWorkers; }
+
+        GlobalVariable *getMarkWorkerKey() const { return markWorkerKey; }
+
+        GlobalVariable *getMarkIdle() const { return markIdle; }
+
+        GlobalVariable *getParallelMarking() const { return parallelMarking; }
+
         StringMap<Constant *> &getStringCache() { return strings; }
+
+        StringMap<GlobalVariable *> &getStringConstants() { return stringConstants; }
+
+        DenseMap<const Function *, bool> &getMayCollectCache() { return mayCollect; }
+
+        // Emits DWARF debug information, mapping compiled functions to the lines of the script.
+        void enableDebugInfo(const StringRef filename, const bool isOptimized) {
+            SmallString<256> path(filename);
+            sys::fs::make_absolute(path);
+            DIB = std::make_unique<DIBuilder>(*this);
+            debugFile = DIB->createFile(sys::path::filename(path), sys::path::parent_path(path));
+            // Lox has no DWARF language code: debuggers treat the script as C.
+            DIB->createCompileUnit(dwarf::DW_LANG_C, debugFile, "cpplox", isOptimized, "", 0);
+            addModuleFlag(Warning, "Debug Info Version", DEBUG_METADATA_VERSION);
+            addModuleFlag(Warning, "Dwarf Version", 4);
+        }
+
+        // The debug information builder, or nullptr without -g.
+        DIBuilder *getDIBuilder() const { return DIB.get(); }
+
+        DIFile *getDebugFile() const { return debugFile; }
+
+        // Builds the sampling profiler into the program.
+        void enableProfiling() {
+            ProfileSampleStruct = StructType::create(
+                getContext(),
+                {
+                    IntegerType::getInt32Ty(getContext()),                                 // depth
+                    IntegerType::getInt1Ty(getContext()),                                  // truncated
+                    ArrayType::get(PointerType::getUnqual(getContext()), PROFILE_MAX_DEPTH),// names
+                },
+                "ProfileSample"
+            );
+            const auto samplesType = ArrayType::get(ProfileSampleStruct, PROFILE_SAMPLES);
+            profileSamples = cast<GlobalVariable>(getOrInsertGlobal("$profileSamples", samplesType));
+            profileSamples->setLinkage(GlobalVariable::PrivateLinkage);
+            profileSamples->setAlignment(Align(8));
+            profileSamples->setConstant(false);
+            profileSamples->setInitializer(Constant::getNullValue(samplesType));
+
+            profileCount =
+                cast<GlobalVariable>(getOrInsertGlobal("$profileCount", IntegerType::getInt64Ty(getContext())));
+            profileCount->setLinkage(GlobalVariable::PrivateLinkage);
+            profileCount->setAlignment(Align(8));
+            profileCount->setConstant(false);
+            profileCount->setInitializer(ConstantInt::get(IntegerType::getInt64Ty(getContext()), 0));
+        }
+
+        bool isProfiling() const { return profileSamples != nullptr; }
+
+        StructType *getProfileSampleStructType() const { return ProfileSampleStruct; }
+
+        GlobalVariable *getProfileSamples() const { return profileSamples; }
+
+        // The number of samples taken, including those overwritten in the ring buffer.
+        GlobalVariable *getProfileCount() const { return profileCount; }
     };
 }// namespace lox
 
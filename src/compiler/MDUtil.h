@@ -9,6 +9,11 @@ namespace lox::metadata {
         return Builder.createBranchWeights((1U << 20) - 1, 1);
     }
 
+    inline MDNode *createUnlikelyBranchWeights(MDBuilder &Builder) {
+        // TODO: Use MDBuilder::createUnlikelyBranchWeights when updating LLVM.
+        return Builder.createBranchWeights(1, (1U << 20) - 1);
+    }
+
     inline bool hasMetadata(Value *value, const StringRef name) {
         if (auto *const i = dyn_cast<Instruction>(value); i && i->hasMetadata(name)) {
             return true;
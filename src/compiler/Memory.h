@@ -11,6 +11,7 @@ using namespace llvm;
 
 namespace lox {
     AllocaInst *CreateEntryBlockAlloca(Function *TheFunction, Type *type, std::string_view VarName, const std::function<void(IRBuilder<> &, AllocaInst *)> &entryBuilder = nullptr);
+    // Frees the memory owned by the object; its slot is reclaimed by sweeping its page.
     void FreeObject(LoxBuilder &Builder, Value *value);
     void FreeObjects(LoxBuilder &Builder);
 }// namespace lox
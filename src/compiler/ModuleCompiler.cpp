@@ -1,9 +1,13 @@
 #include "ModuleCompiler.h"
 #include "../Debug.h"
+#include "Callstack.h"
 #include "FunctionCompiler.h"
 #include "GC.h"
+#include "Heap.h"
 #include "MDUtil.h"
+#include "Profile.h"
 #include "Stack.h"
+#include "TypeCheckElimination.h"
 
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/DerivedTypes.h"
@@ -18,10 +22,15 @@
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/TargetParser/Host.h"
 
+#include <cerrno>
+#include <csignal>
 #include <iostream>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Value.h>
@@ -84,7 +93,7 @@ namespace lox {
         CreateGcFunction(*Builder);
 
         ScriptCompiler.compile(program, {}, [&ScriptCompiler](LoxBuilder &B) {
-            ScriptCompiler.insertVariable("$initString", B.ObjVal(B.AllocateString("init")), true);
+            ScriptCompiler.insertVariable("$initString", B.ObjVal(B.CreateStringConstant("init")), true);
 
             Native("clock", 0, ScriptCompiler, [](LoxBuilder &B, Argument *) {
                 static const FunctionCallee clock =
@@ -101,7 +110,52 @@ namespace lox {
             Native("read", 0, ScriptCompiler, [](LoxBuilder &B, Argument *) {
                 static const FunctionCallee getchar =
                     B.getModule().getOrInsertFunction("getchar", FunctionType::get(B.getInt8Ty(), {}, false));
+                static const FunctionCallee siginterrupt = B.getModule().getOrInsertFunction(
+                    "siginterrupt", FunctionType::get(B.getInt32Ty(), {B.getInt32Ty(), B.getInt32Ty()}, false)
+                );
+                static const FunctionCallee ferror = B.getModule().getOrInsertFunction(
+                    "ferror", FunctionType::get(B.getInt32Ty(), {B.getPtrTy()}, false)
+                );
+                static const FunctionCallee clearerr = B.getModule().getOrInsertFunction(
+                    "clearerr", FunctionType::get(B.getVoidTy(), {B.getPtrTy()}, false)
+                );
+                static const FunctionCallee errnoLocation =
+                    B.getModule().getOrInsertFunction("__errno_location", FunctionType::get(B.getPtrTy(), {}, false));
+                static auto *const StdIn = B.getModule().getOrInsertGlobal("stdin", B.getPtrTy());
+
+                auto *const ReadBlock = B.CreateBasicBlock("read");
+                auto *const ErrorBlock = B.CreateBasicBlock("read.error");
+                auto *const InterruptedBlock = B.CreateBasicBlock("read.interrupted");
+                auto *const DoneBlock = B.CreateBasicBlock("read.done");
+
+                // SIGUSR1 interrupts a read waiting for input, so that a GC statistics
+                // report it requests is written while the program waits.
+                B.CreateCall(siginterrupt, {B.getInt32(SIGUSR1), B.getInt32(1)});
+                B.CreateBr(ReadBlock);
+
+                B.SetInsertPoint(ReadBlock);
                 auto *const result = B.CreateCall(getchar);
+                B.CreateCondBr(B.CreateICmpEQ(result, B.getInt8(-1)), ErrorBlock, DoneBlock);
+
+                B.SetInsertPoint(ErrorBlock);
+                auto *const input = B.CreateLoad(B.getPtrTy(), StdIn, "stdin");
+                B.CreateCondBr(
+                    B.CreateAnd(
+                        B.CreateICmpNE(B.CreateCall(ferror, {input}), B.getInt32(0)),
+                        B.CreateICmpEQ(
+                            B.CreateLoad(B.getInt32Ty(), B.CreateCall(errnoLocation)), B.getInt32(EINTR)
+                        )
+                    ),
+                    InterruptedBlock, DoneBlock
+                );
+
+                B.SetInsertPoint(InterruptedBlock);
+                B.CreateCall(clearerr, {input});
+                PollGCStatsRequest(B);
+                B.CreateBr(ReadBlock);
+
+                B.SetInsertPoint(DoneBlock);
+                B.CreateCall(siginterrupt, {B.getInt32(SIGUSR1), B.getInt32(0)});
                 B.CreateRet(B.CreateSelect(
                     B.CreateICmpEQ(result, B.getInt8(-1)), B.getNilVal(),
                     B.NumberVal(B.CreateSIToFP(result, B.getDoubleTy()))
@@ -135,8 +189,8 @@ namespace lox {
 
                 auto *const length = B.CreateLoad(B.getInt32Ty(), count);
                 auto *const allocsize = B.CreateAdd(B.getInt32(1), length, "lengthwithnullterminator", true, true);
-                auto *const chars = B.CreateRealloc(
-                    B.getNullPtr(), B.CreateSExt(B.getSizeOf(B.getInt8Ty(), allocsize), B.getInt64Ty()), "string"
+                auto *const chars = B.AllocateBuffer(
+                    B.CreateSExt(B.getSizeOf(B.getInt8Ty(), allocsize), B.getInt64Ty()), "string"
                 );
 
                 B.CreateMemCpy(chars, Align(8), bytes, Align(8), length);
@@ -148,27 +202,39 @@ namespace lox {
         });
 
         Builder->SetInsertPoint(Builder->CreateBasicBlock("entry"));
-        auto *const runtimeStringsTable = Builder->AllocateTable();
+        InitializeHeap(*Builder);
+        ConfigureGC(*Builder);
+        ConfigureStack(*Builder);
+        if (getModule().isProfiling()) StartProfiler(*Builder);
+        // All string constants are known at this point: they are interned in the initial table.
+        auto *const runtimeStringsTable = Builder->AllocateInternTable();
         Builder->CreateStore(runtimeStringsTable, getModule().getRuntimeStrings());
+        Builder->CreateStore(
+            Builder->AllocateShape(Builder->getNullPtr(), Builder->getNullPtr()), getModule().getRootShape()
+        );
         Builder->CreateCall(F);
 
         if constexpr (ENABLE_RUNTIME_ASSERTS) {
-            auto *const locals = Builder->getModule().getLocalsStack().CreateGetCount(*Builder);
+            auto *const frames = Builder->CreateLoad(Builder->getPtrTy(), Builder->getModule().getRootFrames());
             auto *const IsZeroBlock = Builder->CreateBasicBlock("is.empty");
             auto *const IsNotZeroBlock = Builder->CreateBasicBlock("is.notempty");
 
-            Builder->CreateCondBr(Builder->CreateICmpEQ(Builder->getInt32(0), locals), IsZeroBlock, IsNotZeroBlock);
+            Builder->CreateCondBr(Builder->CreateIsNull(frames), IsZeroBlock, IsNotZeroBlock);
             Builder->SetInsertPoint(IsNotZeroBlock);
             Builder->RuntimeError(
-                Builder->getInt32(0), "locals not zero (%d)\n", {locals}, Builder->CreateGlobalCachedString("assert")
+                Builder->getInt32(0), "root frames not empty (%p)\n", {frames}, Builder->CreateGlobalCachedString("assert")
             );
 
             Builder->SetInsertPoint(IsZeroBlock);
         }
 
+        WriteGCStats(*Builder);
+        if (getModule().isProfiling()) WriteProfile(*Builder);
         FreeObjects(*Builder);
 
         Builder->CreateRet(Builder->getInt32(0));
+
+        if (auto *const DIB = getModule().getDIBuilder()) DIB->finalize();
     }
 
     bool ModuleCompiler::initializeTarget() const {
@@ -215,6 +281,11 @@ namespace lox {
         PB.registerLoopAnalyses(LAM);
         PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
 
+        // Before anything else, while the type checks are as LoxBuilder emitted them.
+        PB.registerPipelineStartEPCallback([](ModulePassManager &MPM, OptimizationLevel) {
+            MPM.addPass(createModuleToFunctionPassAdaptor(TypeCheckEliminationPass()));
+        });
+
         ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O2);
 
         MPM.run(getModule(), MAM);
@@ -231,6 +302,16 @@ namespace lox {
         return ec.value() == 0;
     }
 
+    // Adds the passes emitting an object file for the module to a pass manager.
+    static bool AddObjectPasses(TargetMachine &TheTargetMachine, legacy::PassManager &pass, raw_pwrite_stream &dest) {
+        if (constexpr auto FileType = CodeGenFileType::ObjectFile;
+            TheTargetMachine.addPassesToEmitFile(pass, dest, nullptr, FileType)) {
+            std::cerr << "TheTargetMachine can't emit a file of this type";
+            return false;
+        }
+        return true;
+    }
+
     bool ModuleCompiler::writeObject(const std::string_view Filename) const {
         if (!this->TheTargetMachine) { return false; }
         std::error_code EC;
@@ -242,17 +323,107 @@ namespace lox {
         }
 
         legacy::PassManager pass;
+        if (!AddObjectPasses(*TheTargetMachine, pass, dest)) { return false; }
 
-        if (constexpr auto FileType = CodeGenFileType::ObjectFile;
-            TheTargetMachine->addPassesToEmitFile(pass, dest, nullptr, FileType)) {
-            std::cerr << "TheTargetMachine can't emit a file of this type";
+        pass.run(getModule());
+        dest.flush();
+
+        std::cout << "Wrote " << Filename << "\n";
+        return true;
+    }
+
+    bool ModuleCompiler::emitObject(SmallVectorImpl<char> &Object) const {
+        if (!this->TheTargetMachine) { return false; }
+        raw_svector_ostream dest(Object);
+
+        legacy::PassManager pass;
+        if (!AddObjectPasses(*TheTargetMachine, pass, dest)) { return false; }
+
+        pass.run(getModule());
+        return true;
+    }
+
+    bool ModuleCompiler::writeObject(const std::string_view Filename, const StringRef Object) {
+        std::error_code EC;
+        raw_fd_ostream dest(Filename, EC, sys::fs::OF_None);
+
+        if (EC) {
+            std::cerr << "Could not open file: " << EC.message();
             return false;
         }
 
-        pass.run(getModule());
-        dest.flush();
+        dest << Object;
+        dest.close();
+        if (dest.has_error()) {
+            std::cerr << "Could not write file: " << dest.error().message();
+            dest.clear_error();
+            return false;
+        }
 
         std::cout << "Wrote " << Filename << "\n";
         return true;
     }
+
+    // An LLJIT instance which resolves the runtime's calls into libc (printf,
+    // realloc, exit etc.) against the current process, or nullptr on failure.
+    static std::unique_ptr<orc::LLJIT> CreateJIT() {
+        auto JIT = orc::LLJITBuilder().create();
+        if (!JIT) {
+            std::cerr << "Could not create JIT: " << toString(JIT.takeError()) << std::endl;
+            return nullptr;
+        }
+
+        auto Generator =
+            orc::DynamicLibrarySearchGenerator::GetForCurrentProcess((*JIT)->getDataLayout().getGlobalPrefix());
+        if (!Generator) {
+            std::cerr << "Could not create JIT: " << toString(Generator.takeError()) << std::endl;
+            return nullptr;
+        }
+        (*JIT)->getMainJITDylib().addGenerator(std::move(*Generator));
+
+        return std::move(*JIT);
+    }
+
+    static int RunMain(orc::LLJIT &JIT) {
+        auto MainSymbol = JIT.lookup("main");
+        if (!MainSymbol) {
+            std::cerr << "Could not find main: " << toString(MainSymbol.takeError()) << std::endl;
+            return 65;
+        }
+
+        auto *const Main = MainSymbol->toPtr<int()>();
+        return Main();
+    }
+
+    int ModuleCompiler::runJIT() {
+        if (!this->TheTargetMachine) { return 65; }
+
+        const auto JIT = CreateJIT();
+        if (!JIT) { return 65; }
+
+        // The builder references the module and context, so release it before
+        // they are moved into the JIT.
+        Builder.reset();
+        if (auto Err = JIT->addIRModule(orc::ThreadSafeModule(std::move(M), std::move(Context)))) {
+            std::cerr << "Could not add module to JIT: " << toString(std::move(Err)) << std::endl;
+            return 65;
+        }
+
+        return RunMain(*JIT);
+    }
+
+    int ModuleCompiler::runJIT(std::unique_ptr<MemoryBuffer> Object) {
+        InitializeNativeTarget();
+        InitializeNativeTargetAsmPrinter();
+
+        const auto JIT = CreateJIT();
+        if (!JIT) { return 65; }
+
+        if (auto Err = JIT->addObjectFile(std::move(Object))) {
+            std::cerr << "Could not add object to JIT: " << toString(std::move(Err)) << std::endl;
+            return 65;
+        }
+
+        return RunMain(*JIT);
+    }
 }// namespace lox
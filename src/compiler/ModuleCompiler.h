@@ -7,6 +7,7 @@
 
 #include <llvm/IR/Function.h>
 #include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/MemoryBuffer.h>
 
 using namespace llvm;
 using namespace llvm::sys;
@@ -14,7 +15,7 @@ using namespace llvm::sys;
 namespace lox {
 
     class ModuleCompiler {
-        std::shared_ptr<LLVMContext> Context = std::make_shared<LLVMContext>();
+        std::unique_ptr<LLVMContext> Context = std::make_unique<LLVMContext>();
         std::unique_ptr<LoxModule> M = std::make_unique<LoxModule>(*Context);
         std::unique_ptr<LoxBuilder> Builder;
         mutable TargetMachine *TheTargetMachine{};
@@ -36,6 +37,17 @@ namespace lox {
         bool optimize() const;
         [[nodiscard]] bool writeIR(std::string_view Filename) const;
         [[nodiscard]] bool writeObject(std::string_view Filename) const;
+        // Compiles the module to an object file in memory.
+        [[nodiscard]] bool emitObject(SmallVectorImpl<char> &Object) const;
+        // Writes an object file compiled earlier, such as one from the compile cache.
+        [[nodiscard]] static bool writeObject(std::string_view Filename, StringRef Object);
+        /**
+         * Hands the module over to an in-process LLJIT instance and runs its
+         * main function. The compiler can no longer be used afterwards.
+         */
+        [[nodiscard]] int runJIT();
+        // Links an object file compiled earlier into an LLJIT instance and runs its main function.
+        [[nodiscard]] static int runJIT(std::unique_ptr<MemoryBuffer> Object);
     };
 
 }// namespace lox
@@ -0,0 +1,671 @@
+#include "ParallelMark.h"
+
+#include "../Debug.h"
+#include "GCSettings.h"
+#include "Heap.h"
+#include "Memory.h"
+#include "Stack.h"
+
+#include <unistd.h>
+
+namespace lox {
+
+    static Value *WorkerField(LoxBuilder &B, Value *Worker, const unsigned field) {
+        return B.CreateStructGEP(B.getModule().getMarkWorkerStructType(), Worker, field);
+    }
+
+    static Value *WorkerAt(LoxBuilder &B, Value *Index) {
+        return B.CreateInBoundsGEP(
+            B.getModule().getMarkWorkerStructType(), B.CreateLoad(B.getPtrTy(), B.getModule().getMarkWorkers()), Index,
+            "worker"
+        );
+    }
+
+    // The bottom and top of a deque are only changed under its lock, but
+    // other workers peek at them without it.
+    static Value *LoadAtomic(LoxBuilder &B, Value *Ptr) {
+        auto *const load = B.CreateLoad(B.getInt32Ty(), Ptr);
+        load->setAtomic(AtomicOrdering::Monotonic);
+        return load;
+    }
+
+    static void StoreAtomic(LoxBuilder &B, Value *value, Value *Ptr) {
+        B.CreateStore(value, Ptr)->setAtomic(AtomicOrdering::Monotonic);
+    }
+
+    // Whether the worker's deque has objects, read without its lock.
+    static Value *HasEntries(LoxBuilder &B, Value *Worker) {
+        return B.CreateICmpSGT(LoadAtomic(B, WorkerField(B, Worker, 2)), LoadAtomic(B, WorkerField(B, Worker, 1)));
+    }
+
+    static void Lock(LoxBuilder &B, Value *Worker) {
+        auto *const SpinBlock = B.CreateBasicBlock("lock.spin");
+        auto *const LockedBlock = B.CreateBasicBlock("locked");
+
+        B.CreateBr(SpinBlock);
+        B.SetInsertPoint(SpinBlock);
+        auto *const exchange = B.CreateAtomicCmpXchg(
+            WorkerField(B, Worker, 4), B.getInt32(0), B.getInt32(1), MaybeAlign(4), AtomicOrdering::Acquire,
+            AtomicOrdering::Monotonic
+        );
+        B.CreateCondBr(B.CreateExtractValue(exchange, 1), LockedBlock, SpinBlock);
+        B.SetInsertPoint(LockedBlock);
+    }
+
+    static void Unlock(LoxBuilder &B, Value *Worker) {
+        B.CreateStore(B.getInt32(0), WorkerField(B, Worker, 4))->setAtomic(AtomicOrdering::Release);
+    }
+
+    static Function *PushFunction(LoxBuilder &Builder) {
+        static auto *PushFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {Builder.getPtrTy(), Builder.getPtrTy()}, false),
+                Function::InternalLinkage, "$markWorkerPush", Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const worker = F->arg_begin();
+            auto *const object = F->arg_begin() + 1;
+
+            auto *const FullBlock = B.CreateBasicBlock("full");
+            auto *const CompactBlock = B.CreateBasicBlock("compact");
+            auto *const GrowBlock = B.CreateBasicBlock("grow");
+            auto *const StoreBlock = B.CreateBasicBlock("store");
+
+            Lock(B, worker);
+            auto *const top = B.CreateLoad(B.getInt32Ty(), WorkerField(B, worker, 2), "top");
+            auto *const capacity = B.CreateLoad(B.getInt32Ty(), WorkerField(B, worker, 3), "capacity");
+            B.CreateCondBr(B.CreateICmpEQ(top, capacity), FullBlock, StoreBlock);
+
+            // The slots below the bottom were stolen: reuse them before growing.
+            B.SetInsertPoint(FullBlock);
+            auto *const bottom = B.CreateLoad(B.getInt32Ty(), WorkerField(B, worker, 1), "bottom");
+            auto *const entries = B.CreateLoad(B.getPtrTy(), WorkerField(B, worker, 0), "entries");
+            B.CreateCondBr(B.CreateICmpSGT(bottom, B.getInt32(0)), CompactBlock, GrowBlock);
+
+            B.SetInsertPoint(CompactBlock);
+            {
+                auto *const count = B.CreateSub(top, bottom, "count");
+                B.CreateMemMove(
+                    entries, Align(8), B.CreateInBoundsGEP(B.getPtrTy(), entries, bottom), Align(8),
+                    B.getSizeOf(B.getPtrTy(), count)
+                );
+                StoreAtomic(B, count, WorkerField(B, worker, 2));
+                StoreAtomic(B, B.getInt32(0), WorkerField(B, worker, 1));
+                B.CreateBr(StoreBlock);
+            }
+
+            B.SetInsertPoint(GrowBlock);
+            {
+                auto *const newCapacity = B.CreateSelect(
+                    B.CreateICmpEQ(capacity, B.getInt32(0)), B.getInt32(256),
+                    B.CreateMul(capacity, B.getInt32(GROWTH_FACTOR), "newCapacity", true, true)
+                );
+                auto *const result = B.CreateRealloc(entries, B.getSizeOf(B.getPtrTy(), newCapacity), "mark deque");
+
+                auto *const IsNullBlock = B.CreateBasicBlock("error.realloc");
+                auto *const OkBlock = B.CreateBasicBlock("ok.realloc");
+                B.CreateCondBr(B.CreateIsNull(result), IsNullBlock, OkBlock);
+                B.SetInsertPoint(IsNullBlock);
+                // Other threads are still marking, so don't free the heap under them.
+                B.RuntimeError(
+                    B.getInt32(0), "Could not grow the mark deque of a GC thread.\n", {},
+                    B.CreateGlobalCachedString("markWorkerPush"), false
+                );
+                B.SetInsertPoint(OkBlock);
+                B.CreateStore(result, WorkerField(B, worker, 0));
+                B.CreateStore(newCapacity, WorkerField(B, worker, 3));
+                B.CreateBr(StoreBlock);
+            }
+
+            B.SetInsertPoint(StoreBlock);
+            auto *const index = B.CreateLoad(B.getInt32Ty(), WorkerField(B, worker, 2), "index");
+            B.CreateStore(
+                object,
+                B.CreateInBoundsGEP(B.getPtrTy(), B.CreateLoad(B.getPtrTy(), WorkerField(B, worker, 0)), index)
+            );
+            StoreAtomic(B, B.CreateAdd(index, B.getInt32(1), "top+1", true, true), WorkerField(B, worker, 2));
+            Unlock(B, worker);
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        return PushFunction;
+    }
+
+    // Pops the object at the top of the worker's deque, or returns null if it's empty.
+    static Function *PopFunction(LoxBuilder &Builder) {
+        static auto *PopFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getPtrTy(), {Builder.getPtrTy()}, false), Function::InternalLinkage,
+                "$markWorkerPop", Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const worker = F->arg_begin();
+
+            auto *const PopBlock = B.CreateBasicBlock("pop");
+            auto *const EmptyBlock = B.CreateBasicBlock("empty");
+
+            Lock(B, worker);
+            auto *const top = B.CreateLoad(B.getInt32Ty(), WorkerField(B, worker, 2), "top");
+            auto *const bottom = B.CreateLoad(B.getInt32Ty(), WorkerField(B, worker, 1), "bottom");
+            B.CreateCondBr(B.CreateICmpSGT(top, bottom), PopBlock, EmptyBlock);
+
+            B.SetInsertPoint(PopBlock);
+            {
+                auto *const newTop = B.CreateSub(top, B.getInt32(1), "newTop");
+                auto *const object = B.CreateLoad(
+                    B.getPtrTy(),
+                    B.CreateInBoundsGEP(B.getPtrTy(), B.CreateLoad(B.getPtrTy(), WorkerField(B, worker, 0)), newTop)
+                );
+                // An emptied deque starts again from its first slot.
+                auto *const isEmpty = B.CreateICmpEQ(newTop, bottom);
+                StoreAtomic(B, B.CreateSelect(isEmpty, B.getInt32(0), newTop), WorkerField(B, worker, 2));
+                StoreAtomic(B, B.CreateSelect(isEmpty, B.getInt32(0), bottom), WorkerField(B, worker, 1));
+                Unlock(B, worker);
+                B.CreateRet(object);
+            }
+
+            B.SetInsertPoint(EmptyBlock);
+            Unlock(B, worker);
+            B.CreateRet(B.getNullPtr());
+
+            return F;
+        }());
+
+        return PopFunction;
+    }
+
+    /**
+     * Moves a batch of objects from the bottom of the victim's deque to the
+     * thief's. The batch is copied out under the victim's lock and pushed
+     * after releasing it, so that a worker never holds two locks.
+     *
+     * @return whether any object was stolen.
+     */
+    static Function *StealFunction(LoxBuilder &Builder) {
+        static auto *StealFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getInt1Ty(), {Builder.getPtrTy(), Builder.getPtrTy()}, false),
+                Function::InternalLinkage, "$markWorkerSteal", Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const thief = F->arg_begin();
+            auto *const victim = F->arg_begin() + 1;
+
+            auto *const BatchType = ArrayType::get(B.getPtrTy(), MARK_STEAL_BATCH);
+            auto *const batch = CreateEntryBlockAlloca(F, BatchType, "batch");
+            auto *const i = CreateEntryBlockAlloca(F, B.getInt32Ty(), "i");
+
+            auto *const LockBlock = B.CreateBasicBlock("lock");
+            auto *const TakeBlock = B.CreateBasicBlock("take");
+            auto *const RaceBlock = B.CreateBasicBlock("race");
+            auto *const FailBlock = B.CreateBasicBlock("fail");
+
+            B.CreateCondBr(HasEntries(B, victim), LockBlock, FailBlock);
+
+            B.SetInsertPoint(LockBlock);
+            Lock(B, victim);
+            auto *const top = B.CreateLoad(B.getInt32Ty(), WorkerField(B, victim, 2), "top");
+            auto *const bottom = B.CreateLoad(B.getInt32Ty(), WorkerField(B, victim, 1), "bottom");
+            B.CreateCondBr(B.CreateICmpSGT(top, bottom), TakeBlock, RaceBlock);
+
+            // The victim emptied its deque since the peek.
+            B.SetInsertPoint(RaceBlock);
+            Unlock(B, victim);
+            B.CreateBr(FailBlock);
+
+            B.SetInsertPoint(FailBlock);
+            B.CreateRet(B.getFalse());
+
+            B.SetInsertPoint(TakeBlock);
+            {
+                auto *const available = B.CreateSub(top, bottom, "available");
+                auto *const count = B.CreateBinaryIntrinsic(
+                    Intrinsic::umin, B.CreateLShr(B.CreateAdd(available, B.getInt32(1)), B.getInt32(1)),
+                    B.getInt32(MARK_STEAL_BATCH), nullptr, "count"
+                );
+                auto *const entries = B.CreateLoad(B.getPtrTy(), WorkerField(B, victim, 0), "entries");
+                B.CreateMemCpy(
+                    batch, Align(8), B.CreateInBoundsGEP(B.getPtrTy(), entries, bottom), Align(8),
+                    B.getSizeOf(B.getPtrTy(), count)
+                );
+                auto *const newBottom = B.CreateAdd(bottom, count, "newBottom");
+                auto *const isEmpty = B.CreateICmpEQ(newBottom, top);
+                StoreAtomic(B, B.CreateSelect(isEmpty, B.getInt32(0), newBottom), WorkerField(B, victim, 1));
+                StoreAtomic(B, B.CreateSelect(isEmpty, B.getInt32(0), top), WorkerField(B, victim, 2));
+                Unlock(B, victim);
+
+                B.CreateStore(B.getInt32(0), i);
+
+                auto *const WhileCond = B.CreateBasicBlock("while.cond");
+                auto *const WhileBody = B.CreateBasicBlock("while.body");
+                auto *const WhileEnd = B.CreateBasicBlock("while.end");
+
+                B.CreateBr(WhileCond);
+                B.SetInsertPoint(WhileCond);
+                B.CreateCondBr(B.CreateICmpULT(B.CreateLoad(B.getInt32Ty(), i), count), WhileBody, WhileEnd);
+                B.SetInsertPoint(WhileBody);
+                {
+                    auto *const index = B.CreateLoad(B.getInt32Ty(), i);
+                    auto *const object =
+                        B.CreateLoad(B.getPtrTy(), B.CreateInBoundsGEP(BatchType, batch, {B.getInt32(0), index}));
+                    B.CreateCall(PushFunction(B), {thief, object});
+                    B.CreateStore(B.CreateAdd(index, B.getInt32(1), "i+1", true, true), i);
+                    B.CreateBr(WhileCond);
+                }
+                B.SetInsertPoint(WhileEnd);
+                B.CreateRet(B.getTrue());
+            }
+
+            return F;
+        }());
+
+        return StealFunction;
+    }
+
+    /**
+     * The body of a mark worker, run by each GC thread with its worker. It
+     * blackens the objects of its deque, steals when it runs out, and
+     * returns once every worker is out of objects: an idle worker is
+     * counted in $markIdle, and only workers that aren't idle push objects,
+     * so when all are idle every deque is empty.
+     */
+    static Function *WorkerFunction(LoxBuilder &Builder, Function *BlackenFunction) {
+        static auto *WorkerFunction([&Builder, BlackenFunction] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getPtrTy(), {Builder.getPtrTy()}, false), Function::InternalLinkage,
+                "$markWorker", Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            static const auto SetSpecific = B.getModule().getOrInsertFunction(
+                "pthread_setspecific", FunctionType::get(B.getInt32Ty(), {B.getInt32Ty(), B.getPtrTy()}, false)
+            );
+            static const auto SchedYield =
+                B.getModule().getOrInsertFunction("sched_yield", FunctionType::get(B.getInt32Ty(), {}, false));
+
+            const auto &M = B.getModule();
+            auto *const self = F->arg_begin();
+            auto *const i = CreateEntryBlockAlloca(F, B.getInt32Ty(), "i");
+
+            // $markObject finds the worker of the thread through the key.
+            B.CreateCall(SetSpecific, {B.CreateLoad(B.getInt32Ty(), M.getMarkWorkerKey()), self});
+            auto *const threads = B.CreateLoad(B.getInt32Ty(), M.getGCThreads(), "threads");
+
+            auto *const WorkBlock = B.CreateBasicBlock("work");
+            auto *const BlackenBlock = B.CreateBasicBlock("blacken");
+            auto *const StealBlock = B.CreateBasicBlock("steal");
+            auto *const StealCondBlock = B.CreateBasicBlock("steal.cond");
+            auto *const StealBodyBlock = B.CreateBasicBlock("steal.body");
+            auto *const StealTryBlock = B.CreateBasicBlock("steal.try");
+            auto *const IdleBlock = B.CreateBasicBlock("idle");
+            auto *const WaitBlock = B.CreateBasicBlock("wait");
+            auto *const ScanBlock = B.CreateBasicBlock("scan");
+            auto *const ScanCondBlock = B.CreateBasicBlock("scan.cond");
+            auto *const ScanBodyBlock = B.CreateBasicBlock("scan.body");
+            auto *const WakeBlock = B.CreateBasicBlock("wake");
+            auto *const YieldBlock = B.CreateBasicBlock("yield");
+            auto *const DoneBlock = B.CreateBasicBlock("done");
+
+            B.CreateBr(WorkBlock);
+
+            B.SetInsertPoint(WorkBlock);
+            auto *const object = B.CreateCall(PopFunction(B), {self}, "object");
+            B.CreateCondBr(B.CreateIsNull(object), StealBlock, BlackenBlock);
+
+            B.SetInsertPoint(BlackenBlock);
+            B.CreateCall(BlackenFunction, {object});
+            B.CreateBr(WorkBlock);
+
+            // Try each other worker in turn.
+            B.SetInsertPoint(StealBlock);
+            B.CreateStore(B.getInt32(0), i);
+            B.CreateBr(StealCondBlock);
+
+            B.SetInsertPoint(StealCondBlock);
+            auto *const victimIndex = B.CreateLoad(B.getInt32Ty(), i);
+            B.CreateCondBr(B.CreateICmpULT(victimIndex, threads), StealBodyBlock, IdleBlock);
+
+            B.SetInsertPoint(StealBodyBlock);
+            auto *const victim = WorkerAt(B, victimIndex);
+            B.CreateStore(B.CreateAdd(victimIndex, B.getInt32(1), "i+1", true, true), i);
+            B.CreateCondBr(B.CreateICmpEQ(victim, self), StealCondBlock, StealTryBlock);
+
+            B.SetInsertPoint(StealTryBlock);
+            B.CreateCondBr(B.CreateCall(StealFunction(B), {self, victim}), WorkBlock, StealCondBlock);
+
+            B.SetInsertPoint(IdleBlock);
+            B.CreateAtomicRMW(
+                AtomicRMWInst::Add, M.getMarkIdle(), B.getInt32(1), MaybeAlign(4), AtomicOrdering::SequentiallyConsistent
+            );
+            B.CreateBr(WaitBlock);
+
+            B.SetInsertPoint(WaitBlock);
+            auto *const idle = B.CreateLoad(B.getInt32Ty(), M.getMarkIdle(), "idle");
+            idle->setAtomic(AtomicOrdering::SequentiallyConsistent);
+            B.CreateCondBr(B.CreateICmpEQ(idle, threads), DoneBlock, ScanBlock);
+
+            // While others are still working, look for objects to steal.
+            B.SetInsertPoint(ScanBlock);
+            B.CreateStore(B.getInt32(0), i);
+            B.CreateBr(ScanCondBlock);
+
+            B.SetInsertPoint(ScanCondBlock);
+            auto *const scanIndex = B.CreateLoad(B.getInt32Ty(), i);
+            B.CreateCondBr(B.CreateICmpULT(scanIndex, threads), ScanBodyBlock, YieldBlock);
+
+            B.SetInsertPoint(ScanBodyBlock);
+            B.CreateStore(B.CreateAdd(scanIndex, B.getInt32(1), "i+1", true, true), i);
+            B.CreateCondBr(HasEntries(B, WorkerAt(B, scanIndex)), WakeBlock, ScanCondBlock);
+
+            B.SetInsertPoint(WakeBlock);
+            B.CreateAtomicRMW(
+                AtomicRMWInst::Sub, M.getMarkIdle(), B.getInt32(1), MaybeAlign(4), AtomicOrdering::SequentiallyConsistent
+            );
+            B.CreateBr(StealBlock);
+
+            B.SetInsertPoint(YieldBlock);
+            B.CreateCall(SchedYield);
+            B.CreateBr(WaitBlock);
+
+            B.SetInsertPoint(DoneBlock);
+            B.CreateRet(B.getNullPtr());
+
+            return F;
+        }());
+
+        return WorkerFunction;
+    }
+
+    void InitializeMarkWorkers(LoxBuilder &Builder) {
+        static auto *InitializeFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage,
+                "$initializeMarkWorkers", Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            static const auto SysConf =
+                B.getModule().getOrInsertFunction("sysconf", FunctionType::get(B.getInt64Ty(), {B.getInt32Ty()}, false));
+            static const auto KeyCreate = B.getModule().getOrInsertFunction(
+                "pthread_key_create", FunctionType::get(B.getInt32Ty(), {B.getPtrTy(), B.getPtrTy()}, false)
+            );
+            static const auto AlignedAlloc = B.getModule().getOrInsertFunction(
+                "aligned_alloc", FunctionType::get(B.getPtrTy(), {B.getInt64Ty(), B.getInt64Ty()}, false)
+            );
+            static const auto Free =
+                B.getModule().getOrInsertFunction("free", FunctionType::get(B.getVoidTy(), {B.getPtrTy()}, false));
+
+            const auto &M = B.getModule();
+
+            auto *const AllocateBlock = B.CreateBasicBlock("allocate");
+            auto *const FailedBlock = B.CreateBasicBlock("failed");
+            auto *const AllocatedBlock = B.CreateBasicBlock("allocated");
+            auto *const EndBlock = B.CreateBasicBlock("end");
+
+            // Zero threads means one per online CPU.
+            auto *const cpus = B.CreateBinaryIntrinsic(
+                Intrinsic::smax,
+                B.CreateBinaryIntrinsic(
+                    Intrinsic::smin, B.CreateCall(SysConf, {B.getInt32(_SC_NPROCESSORS_ONLN)}),
+                    B.getInt64(MAX_GC_THREADS)
+                ),
+                B.getInt64(1)
+            );
+            auto *const configured = B.CreateLoad(B.getInt32Ty(), M.getGCThreads());
+            auto *const threads = B.CreateSelect(
+                B.CreateICmpEQ(configured, B.getInt32(0)), B.CreateTrunc(cpus, B.getInt32Ty()), configured, "threads"
+            );
+            B.CreateStore(threads, M.getGCThreads());
+            B.CreateCondBr(B.CreateICmpUGT(threads, B.getInt32(1)), AllocateBlock, EndBlock);
+
+            B.SetInsertPoint(AllocateBlock);
+            auto *const size = B.CreateMul(
+                B.CreateZExt(threads, B.getInt64Ty()), B.getSizeOf(M.getMarkWorkerStructType(), 1u), "size"
+            );
+            auto *const keyResult = B.CreateCall(KeyCreate, {M.getMarkWorkerKey(), B.getNullPtr()});
+            auto *const workers = B.CreateCall(AlignedAlloc, {B.getInt64(64), size}, "workers");
+            B.CreateCondBr(
+                B.CreateOr(B.CreateICmpNE(keyResult, B.getInt32(0)), B.CreateIsNull(workers)), FailedBlock,
+                AllocatedBlock
+            );
+
+            // Without workers, major collections are marked incrementally by the program's thread.
+            B.SetInsertPoint(FailedBlock);
+            B.CreateCall(Free, {workers});
+            B.CreateStore(B.getInt32(1), M.getGCThreads());
+            B.CreateBr(EndBlock);
+
+            B.SetInsertPoint(AllocatedBlock);
+            B.CreateMemSet(workers, B.getInt8(0), size, Align(64));
+            B.CreateStore(workers, M.getMarkWorkers());
+            B.CreateBr(EndBlock);
+
+            B.SetInsertPoint(EndBlock);
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(InitializeFunction);
+    }
+
+    void FreeMarkWorkers(LoxBuilder &Builder) {
+        static auto *FreeWorkersFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$freeMarkWorkers",
+                Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            static const auto Free =
+                B.getModule().getOrInsertFunction("free", FunctionType::get(B.getVoidTy(), {B.getPtrTy()}, false));
+
+            const auto &M = B.getModule();
+            auto *const i = CreateEntryBlockAlloca(F, B.getInt32Ty(), "i");
+            auto *const workers = B.CreateLoad(B.getPtrTy(), M.getMarkWorkers(), "workers");
+
+            auto *const WhileCond = B.CreateBasicBlock("while.cond");
+            auto *const WhileBody = B.CreateBasicBlock("while.body");
+            auto *const WhileEnd = B.CreateBasicBlock("while.end");
+            auto *const EndBlock = B.CreateBasicBlock("end");
+
+            B.CreateStore(B.getInt32(0), i);
+            B.CreateCondBr(B.CreateIsNull(workers), EndBlock, WhileCond);
+
+            B.SetInsertPoint(WhileCond);
+            B.CreateCondBr(
+                B.CreateICmpULT(B.CreateLoad(B.getInt32Ty(), i), B.CreateLoad(B.getInt32Ty(), M.getGCThreads())),
+                WhileBody, WhileEnd
+            );
+            B.SetInsertPoint(WhileBody);
+            {
+                auto *const index = B.CreateLoad(B.getInt32Ty(), i);
+                B.CreateCall(Free, {B.CreateLoad(B.getPtrTy(), WorkerField(B, WorkerAt(B, index), 0))});
+                B.CreateStore(B.CreateAdd(index, B.getInt32(1), "i+1", true, true), i);
+                B.CreateBr(WhileCond);
+            }
+
+            B.SetInsertPoint(WhileEnd);
+            B.CreateCall(Free, {workers});
+            B.CreateStore(B.getNullPtr(), M.getMarkWorkers());
+            B.CreateBr(EndBlock);
+
+            B.SetInsertPoint(EndBlock);
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(FreeWorkersFunction);
+    }
+
+    void TraceParallel(LoxBuilder &Builder, Function *BlackenFunction) {
+        static auto *TraceParallelFunction([&Builder, BlackenFunction] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$traceParallel",
+                Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            static const auto ThreadCreate = B.getModule().getOrInsertFunction(
+                "pthread_create",
+                FunctionType::get(B.getInt32Ty(), {B.getPtrTy(), B.getPtrTy(), B.getPtrTy(), B.getPtrTy()}, false)
+            );
+            static const auto ThreadJoin = B.getModule().getOrInsertFunction(
+                "pthread_join", FunctionType::get(B.getInt32Ty(), {B.getInt64Ty(), B.getPtrTy()}, false)
+            );
+
+            if constexpr (DEBUG_LOG_GC) {
+                B.PrintString("-- trace parallel --");
+            }
+
+            const auto &M = B.getModule();
+            auto *const Worker = WorkerFunction(B, BlackenFunction);
+            auto *const i = CreateEntryBlockAlloca(F, B.getInt32Ty(), "i");
+            auto *const threads = B.CreateLoad(B.getInt32Ty(), M.getGCThreads(), "threads");
+
+            // Loops over the workers from the first index, calling the body with each.
+            const auto ForEachWorker = [&](const std::string_view name, const unsigned first,
+                                           const std::function<void(LoxBuilder &, Value *)> &body) {
+                auto *const WhileCond = B.CreateBasicBlock(std::string(name) + ".cond");
+                auto *const WhileBody = B.CreateBasicBlock(std::string(name) + ".body");
+                auto *const WhileEnd = B.CreateBasicBlock(std::string(name) + ".end");
+
+                B.CreateStore(B.getInt32(first), i);
+                B.CreateBr(WhileCond);
+                B.SetInsertPoint(WhileCond);
+                B.CreateCondBr(B.CreateICmpULT(B.CreateLoad(B.getInt32Ty(), i), threads), WhileBody, WhileEnd);
+                B.SetInsertPoint(WhileBody);
+                auto *const index = B.CreateLoad(B.getInt32Ty(), i);
+                body(B, WorkerAt(B, index));
+                B.CreateStore(B.CreateAdd(index, B.getInt32(1), "i+1", true, true), i);
+                B.CreateBr(WhileCond);
+                B.SetInsertPoint(WhileEnd);
+            };
+
+            // The roots are on the gray stack: hand them to the first worker, for the others to steal.
+            {
+                auto *const ShareFunction = Function::Create(
+                    FunctionType::get(B.getVoidTy(), {B.getPtrTy()}, false), Function::InternalLinkage,
+                    "$markWorkerShare", B.getModule()
+                );
+                LoxBuilder ShareBuilder(B.getContext(), B.getModule(), *ShareFunction);
+                ShareBuilder.SetInsertPoint(ShareBuilder.CreateBasicBlock("entry"));
+                ShareBuilder.CreateCall(
+                    PushFunction(ShareBuilder), {WorkerAt(ShareBuilder, ShareBuilder.getInt32(0)), ShareFunction->arg_begin()}
+                );
+                ShareBuilder.CreateRetVoid();
+
+                M.getGrayStack().CreatePopAll(B, ShareFunction);
+            }
+
+            B.CreateStore(B.getInt32(0), M.getMarkIdle());
+            B.CreateStore(B.getTrue(), M.getParallelMarking());
+
+            // A thread that fails to start counts as idle from the start; its work is stolen by the others.
+            ForEachWorker("start", 1, [&](LoxBuilder &B, Value *worker) {
+                auto *const FailedBlock = B.CreateBasicBlock("start.failed");
+                auto *const StartedBlock = B.CreateBasicBlock("started");
+                auto *const thread = WorkerField(B, worker, 6);
+                B.CreateCondBr(
+                    B.CreateICmpEQ(B.CreateCall(ThreadCreate, {thread, B.getNullPtr(), Worker, worker}), B.getInt32(0)),
+                    StartedBlock, FailedBlock
+                );
+                B.SetInsertPoint(FailedBlock);
+                B.CreateStore(B.getInt64(0), thread);
+                B.CreateAtomicRMW(
+                    AtomicRMWInst::Add, M.getMarkIdle(), B.getInt32(1), MaybeAlign(4),
+                    AtomicOrdering::SequentiallyConsistent
+                );
+                B.CreateBr(StartedBlock);
+                B.SetInsertPoint(StartedBlock);
+            });
+
+            // The collecting thread is the first worker.
+            B.CreateCall(Worker, {WorkerAt(B, B.getInt32(0))});
+
+            ForEachWorker("join", 1, [&](LoxBuilder &B, Value *worker) {
+                auto *const JoinBlock = B.CreateBasicBlock("join");
+                auto *const JoinedBlock = B.CreateBasicBlock("joined");
+                auto *const thread = B.CreateLoad(B.getInt64Ty(), WorkerField(B, worker, 6), "thread");
+                B.CreateCondBr(B.CreateICmpNE(thread, B.getInt64(0)), JoinBlock, JoinedBlock);
+                B.SetInsertPoint(JoinBlock);
+                B.CreateCall(ThreadJoin, {thread, B.getNullPtr()});
+                B.CreateBr(JoinedBlock);
+                B.SetInsertPoint(JoinedBlock);
+            });
+
+            B.CreateStore(B.getFalse(), M.getParallelMarking());
+
+            ForEachWorker("sum", 0, [&](LoxBuilder &B, Value *worker) {
+                auto *const workerBytes = WorkerField(B, worker, 5);
+                B.CreateStore(
+                    B.CreateAdd(
+                        B.CreateLoad(B.getInt64Ty(), M.getMarkedBytes()), B.CreateLoad(B.getInt64Ty(), workerBytes)
+                    ),
+                    M.getMarkedBytes()
+                );
+                B.CreateStore(B.getInt64(0), workerBytes);
+            });
+
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(TraceParallelFunction);
+    }
+
+    void PushMarkWorker(LoxBuilder &B, Value *ObjectPtr) {
+        assert(ObjectPtr->getType() == B.getPtrTy());
+
+        static const auto GetSpecific = B.getModule().getOrInsertFunction(
+            "pthread_getspecific", FunctionType::get(B.getPtrTy(), {B.getInt32Ty()}, false)
+        );
+
+        auto *const worker =
+            B.CreateCall(GetSpecific, {B.CreateLoad(B.getInt32Ty(), B.getModule().getMarkWorkerKey())}, "worker");
+        B.CreateCall(PushFunction(B), {worker, ObjectPtr});
+
+        auto *const workerBytes = WorkerField(B, worker, 5);
+        B.CreateStore(
+            B.CreateAdd(
+                B.CreateLoad(B.getInt64Ty(), workerBytes), B.CreateZExt(SlotSize(B, ObjectPtr), B.getInt64Ty())
+            ),
+            workerBytes
+        );
+    }
+}// namespace lox
@@ -0,0 +1,34 @@
+#ifndef PARALLELMARK_H
+#define PARALLELMARK_H
+
+#include "LoxBuilder.h"
+
+namespace lox {
+    // With more than one GC thread, a major collection is marked in a single
+    // pause by all of them: the collecting thread and helpers started for the
+    // collection. Each worker owns a deque of gray objects, guarded by a spin
+    // lock, pushing and popping at its top; a worker whose deque is empty
+    // steals a batch from the bottom of another's. Mark bits are set
+    // atomically, so that exactly one worker blackens each object.
+
+    // A thief takes half of the victim's deque, up to this many objects.
+    constexpr int32_t MARK_STEAL_BATCH = 64;
+
+    // Resolves the number of GC threads and, if there are several,
+    // allocates their workers; runs once the settings are configured.
+    void InitializeMarkWorkers(LoxBuilder &Builder);
+    // Releases the workers' deques.
+    void FreeMarkWorkers(LoxBuilder &Builder);
+
+    /**
+     * Blackens the objects on the gray stack, and everything reachable from
+     * them, with every worker. Returns once all objects are marked, with
+     * the bytes marked by the workers added to the marked bytes.
+     */
+    void TraceParallel(LoxBuilder &Builder, Function *BlackenFunction);
+
+    // Pushes an object, just marked by the current worker, onto its deque.
+    void PushMarkWorker(LoxBuilder &Builder, Value *ObjectPtr);
+}// namespace lox
+
+#endif//PARALLELMARK_H
@@ -0,0 +1,321 @@
+#include "Profile.h"
+
+#include "Memory.h"
+
+#include <csignal>
+#include <cstddef>
+#include <sys/time.h>
+
+namespace lox {
+    // A struct itimerval: the interval then the first expiry, each in seconds and microseconds.
+    static StructType *getITimerValStructType(LoxBuilder &Builder) {
+        return StructType::get(Builder.getInt64Ty(), Builder.getInt64Ty(), Builder.getInt64Ty(), Builder.getInt64Ty());
+    }
+
+    static void SetProfileTimer(LoxBuilder &Builder, const uint64_t intervalMicroseconds) {
+        static const auto SetITimer = Builder.getModule().getOrInsertFunction(
+            "setitimer",
+            FunctionType::get(Builder.getInt32Ty(), {Builder.getInt32Ty(), Builder.getPtrTy(), Builder.getPtrTy()}, false)
+        );
+
+        auto *const ITimerValStruct = getITimerValStructType(Builder);
+        auto *const timer = CreateEntryBlockAlloca(Builder.getFunction(), ITimerValStruct, "timer");
+        for (const unsigned int field: {0, 2}) {
+            Builder.CreateStore(Builder.getInt64(0), Builder.CreateStructGEP(ITimerValStruct, timer, field));
+            Builder.CreateStore(
+                Builder.getInt64(intervalMicroseconds), Builder.CreateStructGEP(ITimerValStruct, timer, field + 1)
+            );
+        }
+        Builder.CreateCall(SetITimer, {Builder.getInt32(ITIMER_PROF), timer, Builder.getNullPtr()});
+    }
+
+    /**
+     * Installs the handler of SIGPROF with sigaction and SA_RESTART, so that a
+     * sample taken during a system call such as read() doesn't fail it with EINTR.
+     */
+    static void SetProfileHandler(LoxBuilder &Builder, Value *Handler) {
+        static const auto SigAction = Builder.getModule().getOrInsertFunction(
+            "sigaction", FunctionType::get(
+                             Builder.getInt32Ty(), {Builder.getInt32Ty(), Builder.getPtrTy(), Builder.getPtrTy()}, false
+                         )
+        );
+
+        // A struct sigaction, laid out as in the C library's headers; an empty sa_mask is all zeroes.
+        auto *const action = CreateEntryBlockAlloca(
+            Builder.getFunction(), ArrayType::get(Builder.getInt8Ty(), sizeof(struct sigaction)), "action"
+        );
+        action->setAlignment(Align(alignof(struct sigaction)));
+        Builder.CreateMemSet(action, Builder.getInt8(0), sizeof(struct sigaction), Align(8));
+        Builder.CreateStore(
+            Handler,
+            Builder.CreateConstInBoundsGEP1_64(Builder.getInt8Ty(), action, offsetof(struct sigaction, sa_handler))
+        );
+        Builder.CreateStore(
+            Builder.getInt32(SA_RESTART),
+            Builder.CreateConstInBoundsGEP1_64(Builder.getInt8Ty(), action, offsetof(struct sigaction, sa_flags))
+        );
+        Builder.CreateCall(SigAction, {Builder.getInt32(SIGPROF), action, Builder.getNullPtr()});
+    }
+
+    // The SIGPROF handler: records the Lox stack, innermost function first.
+    static Function *CreateSampleFunction(LoxBuilder &Builder) {
+        auto *const F = Function::Create(
+            FunctionType::get(Builder.getVoidTy(), {Builder.getInt32Ty()}, false), Function::InternalLinkage,
+            "$profileSample", Builder.getModule()
+        );
+
+        LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+        auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+        B.SetInsertPoint(EntryBasicBlock);
+
+        const auto &M = B.getModule();
+        auto *const SampleStruct = M.getProfileSampleStructType();
+        auto *const RootFrameStruct = M.getRootFrameStructType();
+        auto *const samples = M.getProfileSamples();
+
+        // A GC thread may take the signal while another is still recording, so the
+        // sample is reserved atomically.
+        auto *const index = B.CreateAtomicRMW(
+            AtomicRMWInst::Add, M.getProfileCount(), B.getInt64(1), MaybeAlign(8), AtomicOrdering::Monotonic
+        );
+        auto *const sample = B.CreateInBoundsGEP(
+            samples->getValueType(), samples, {B.getInt64(0), B.CreateURem(index, B.getInt64(PROFILE_SAMPLES))},
+            "sample"
+        );
+        auto *const names = B.CreateStructGEP(SampleStruct, sample, 2, "names");
+        auto *const innermost = B.CreateLoad(B.getPtrTy(), M.getRootFrames(), "innermost");
+
+        auto *const WhileCond = B.CreateBasicBlock("while.cond");
+        auto *const WhileBody = B.CreateBasicBlock("while.body");
+        auto *const WhileEnd = B.CreateBasicBlock("while.end");
+
+        B.CreateBr(WhileCond);
+        B.SetInsertPoint(WhileCond);
+        auto *const frame = B.CreatePHI(B.getPtrTy(), 2, "frame");
+        auto *const depth = B.CreatePHI(B.getInt32Ty(), 2, "depth");
+        frame->addIncoming(innermost, EntryBasicBlock);
+        depth->addIncoming(B.getInt32(0), EntryBasicBlock);
+        B.CreateCondBr(
+            B.CreateAnd(B.CreateIsNotNull(frame), B.CreateICmpULT(depth, B.getInt32(PROFILE_MAX_DEPTH))), WhileBody,
+            WhileEnd
+        );
+
+        B.SetInsertPoint(WhileBody);
+        B.CreateStore(
+            B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(RootFrameStruct, frame, 3)),
+            B.CreateInBoundsGEP(B.getPtrTy(), names, depth)
+        );
+        frame->addIncoming(B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(RootFrameStruct, frame, 0)), WhileBody);
+        depth->addIncoming(B.CreateAdd(depth, B.getInt32(1), "depth+1", true, true), WhileBody);
+        B.CreateBr(WhileCond);
+
+        B.SetInsertPoint(WhileEnd);
+        B.CreateStore(depth, B.CreateStructGEP(SampleStruct, sample, 0));
+        B.CreateStore(B.CreateIsNotNull(frame), B.CreateStructGEP(SampleStruct, sample, 1));
+        B.CreateRetVoid();
+
+        return F;
+    }
+
+    void StartProfiler(LoxBuilder &Builder) {
+        static auto *StartProfilerFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$startProfiler",
+                Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            SetProfileHandler(B, CreateSampleFunction(B));
+            SetProfileTimer(B, PROFILE_INTERVAL_US);
+
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(StartProfilerFunction);
+    }
+
+    void WriteProfile(LoxBuilder &Builder) {
+        static auto *WriteProfileFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getVoidTy(), {}, false), Function::InternalLinkage, "$writeProfile",
+                Builder.getModule()
+            );
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            static const auto GetEnv =
+                B.getModule().getOrInsertFunction("getenv", FunctionType::get(B.getPtrTy(), {B.getPtrTy()}, false));
+            static const auto FOpen = B.getModule().getOrInsertFunction(
+                "fopen", FunctionType::get(B.getPtrTy(), {B.getPtrTy(), B.getPtrTy()}, false)
+            );
+            static const auto FPrintF = B.getModule().getOrInsertFunction(
+                "fprintf", FunctionType::get(B.getInt8Ty(), {B.getPtrTy(), B.getPtrTy()}, true)
+            );
+            static const auto FClose =
+                B.getModule().getOrInsertFunction("fclose", FunctionType::get(B.getInt32Ty(), {B.getPtrTy()}, false));
+            static const auto MemCmp = B.getModule().getOrInsertFunction(
+                "memcmp", FunctionType::get(B.getInt32Ty(), {B.getPtrTy(), B.getPtrTy(), B.getInt64Ty()}, false)
+            );
+
+            const auto &M = B.getModule();
+            auto *const SampleStruct = M.getProfileSampleStructType();
+            auto *const samples = M.getProfileSamples();
+
+            // No more samples are taken while, or after, they are written.
+            SetProfileTimer(B, 0);
+            SetProfileHandler(B, B.CreateIntToPtr(B.getInt64(reinterpret_cast<uint64_t>(SIG_IGN)), B.getPtrTy()));
+
+            auto *const OpenBlock = B.CreateBasicBlock("open");
+            auto *const NotOpenBlock = B.CreateBasicBlock("not.open");
+            auto *const ForCond = B.CreateBasicBlock("for.cond");
+            auto *const ForBody = B.CreateBasicBlock("for.body");
+            auto *const RepeatBlock = B.CreateBasicBlock("repeat");
+            auto *const PrintBlock = B.CreateBasicBlock("print");
+            auto *const FramesCond = B.CreateBasicBlock("frames.cond");
+            auto *const FramesBody = B.CreateBasicBlock("frames.body");
+            auto *const FramesEnd = B.CreateBasicBlock("frames.end");
+            auto *const ForInc = B.CreateBasicBlock("for.inc");
+            auto *const ForEnd = B.CreateBasicBlock("for.end");
+            auto *const EndBlock = B.CreateBasicBlock("end");
+
+            auto *const variable = B.CreateCall(GetEnv, {B.CreateGlobalCachedString("LOX_PROFILE")});
+            auto *const path = B.CreateSelect(
+                B.CreateIsNull(variable), B.CreateGlobalCachedString("profile.folded"), variable, "path"
+            );
+            auto *const file = B.CreateCall(FOpen, {path, B.CreateGlobalCachedString("w")});
+            B.CreateCondBr(B.CreateIsNull(file), NotOpenBlock, OpenBlock);
+
+            B.SetInsertPoint(NotOpenBlock);
+            B.PrintFErr(B.CreateGlobalCachedString("Could not write the profile to '%s'.\n"), {path});
+            B.CreateBr(EndBlock);
+
+            // The ring buffer holds the latest samples, from the oldest one not overwritten.
+            B.SetInsertPoint(OpenBlock);
+            auto *const count = B.CreateLoad(B.getInt64Ty(), M.getProfileCount(), "count");
+            auto *const dropped = B.CreateSub(
+                count, B.CreateBinaryIntrinsic(Intrinsic::umin, count, B.getInt64(PROFILE_SAMPLES)), "dropped"
+            );
+            auto *const i = CreateEntryBlockAlloca(F, B.getInt64Ty(), "i");
+            auto *const repeated = CreateEntryBlockAlloca(F, B.getInt64Ty(), "repeated");
+            auto *const k = CreateEntryBlockAlloca(F, B.getInt32Ty(), "k");
+            B.CreateStore(dropped, i);
+            B.CreateStore(B.getInt64(1), repeated);
+
+            // A run longer than the buffer only has a profile of its end, which must not pass for the whole run.
+            auto *const DroppedBlock = B.CreateBasicBlock("dropped");
+            B.CreateCondBr(B.CreateICmpNE(dropped, B.getInt64(0)), DroppedBlock, ForCond);
+            B.SetInsertPoint(DroppedBlock);
+            B.PrintFErr(
+                B.CreateGlobalCachedString("The profile only has the last %lld of %lld samples: %lld were dropped.\n"),
+                {B.getInt64(PROFILE_SAMPLES), count, dropped}
+            );
+            B.CreateBr(ForCond);
+
+            B.SetInsertPoint(ForCond);
+            auto *const index = B.CreateLoad(B.getInt64Ty(), i, "index");
+            B.CreateCondBr(B.CreateICmpULT(index, count), ForBody, ForEnd);
+
+            const auto Sample = [&](Value *sampleIndex) {
+                return B.CreateInBoundsGEP(
+                    samples->getValueType(), samples,
+                    {B.getInt64(0), B.CreateURem(sampleIndex, B.getInt64(PROFILE_SAMPLES))}
+                );
+            };
+
+            // A sample the same as the next one is counted with it.
+            B.SetInsertPoint(ForBody);
+            auto *const sample = Sample(index);
+            auto *const depth = B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(SampleStruct, sample, 0), "depth");
+            auto *const truncated =
+                B.CreateLoad(B.getInt1Ty(), B.CreateStructGEP(SampleStruct, sample, 1), "truncated");
+            auto *const names = B.CreateStructGEP(SampleStruct, sample, 2, "names");
+            {
+                auto *const nextIndex = B.CreateAdd(index, B.getInt64(1), "next", true, true);
+                auto *const next = Sample(nextIndex);
+                auto *const CompareBlock = B.CreateBasicBlock("compare");
+                B.CreateCondBr(B.CreateICmpULT(nextIndex, count), CompareBlock, PrintBlock);
+                B.SetInsertPoint(CompareBlock);
+                auto *const sameDepth = B.CreateAnd(
+                    B.CreateICmpEQ(depth, B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(SampleStruct, next, 0))),
+                    B.CreateICmpEQ(truncated, B.CreateLoad(B.getInt1Ty(), B.CreateStructGEP(SampleStruct, next, 1)))
+                );
+                auto *const sameNames = B.CreateICmpEQ(
+                    B.CreateCall(
+                        MemCmp, {names, B.CreateStructGEP(SampleStruct, next, 2),
+                                 B.CreateMul(B.CreateZExt(depth, B.getInt64Ty()), B.getInt64(sizeof(void *)))}
+                    ),
+                    B.getInt32(0)
+                );
+                B.CreateCondBr(B.CreateAnd(sameDepth, sameNames), RepeatBlock, PrintBlock);
+            }
+
+            B.SetInsertPoint(RepeatBlock);
+            B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt64Ty(), repeated), B.getInt64(1)), repeated);
+            B.CreateBr(ForInc);
+
+            // The stack is written from the outermost function; a stack deeper than
+            // the sample starts with `...`, one outside any Lox function is the runtime.
+            B.SetInsertPoint(PrintBlock);
+            B.CreateCall(
+                FPrintF, {file, B.CreateSelect(
+                                    truncated, B.CreateGlobalCachedString("...;"),
+                                    B.CreateSelect(
+                                        B.CreateICmpEQ(depth, B.getInt32(0)), B.CreateGlobalCachedString("[runtime]"),
+                                        B.CreateGlobalCachedString("")
+                                    )
+                                )}
+            );
+            B.CreateStore(depth, k);
+            B.CreateBr(FramesCond);
+
+            B.SetInsertPoint(FramesCond);
+            auto *const frame = B.CreateLoad(B.getInt32Ty(), k, "frame");
+            B.CreateCondBr(B.CreateICmpUGT(frame, B.getInt32(0)), FramesBody, FramesEnd);
+
+            B.SetInsertPoint(FramesBody);
+            auto *const frameIndex = B.CreateSub(frame, B.getInt32(1), "frame-1", true, true);
+            B.CreateCall(
+                FPrintF, {file,
+                          B.CreateSelect(
+                              B.CreateICmpEQ(frame, depth), B.CreateGlobalCachedString("%s"),
+                              B.CreateGlobalCachedString(";%s")
+                          ),
+                          B.CreateLoad(B.getPtrTy(), B.CreateInBoundsGEP(B.getPtrTy(), names, frameIndex))}
+            );
+            B.CreateStore(frameIndex, k);
+            B.CreateBr(FramesCond);
+
+            B.SetInsertPoint(FramesEnd);
+            B.CreateCall(
+                FPrintF, {file, B.CreateGlobalCachedString(" %lld\n"), B.CreateLoad(B.getInt64Ty(), repeated)}
+            );
+            B.CreateStore(B.getInt64(1), repeated);
+            B.CreateBr(ForInc);
+
+            B.SetInsertPoint(ForInc);
+            B.CreateStore(B.CreateAdd(index, B.getInt64(1), "i+1", true, true), i);
+            B.CreateBr(ForCond);
+
+            B.SetInsertPoint(ForEnd);
+            B.CreateCall(FClose, {file});
+            B.CreateBr(EndBlock);
+
+            B.SetInsertPoint(EndBlock);
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        Builder.CreateCall(WriteProfileFunction);
+    }
+}// namespace lox
@@ -0,0 +1,24 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "LoxBuilder.h"
+
+namespace lox {
+    /**
+     * Starts the sampling profiler of a --profile program: every PROFILE_INTERVAL_US
+     * of CPU time, SIGPROF records the names of the functions in the chain of root
+     * frames, which is the Lox stack, into a ring buffer of the latest samples.
+     */
+    void StartProfiler(LoxBuilder &Builder);
+
+    /**
+     * Stops the profiler and writes the samples as collapsed stacks, a line per
+     * stack such as `script;fib;fib 12`, to the file named by the LOX_PROFILE
+     * environment variable, or profile.folded. Consecutive identical samples
+     * are merged into one line; flame graph tools merge the rest. If the ring
+     * buffer overflowed, the number of samples dropped is reported on stderr.
+     */
+    void WriteProfile(LoxBuilder &Builder);
+}// namespace lox
+
+#endif//PROFILE_H
@@ -0,0 +1,549 @@
+#include "../Debug.h"
+#include "GC.h"
+#include "LoxBuilder.h"
+#include "Memory.h"
+
+namespace lox {
+
+    Value *LoxBuilder::AllocateShape(Value *parent, Value *key) {
+        assert(parent->getType() == getPtrTy());
+        assert(key->getType() == getPtrTy());
+
+        static auto *AllocateShapeFunction([this] {
+            auto *const F = Function::Create(
+                FunctionType::get(getPtrTy(), {getPtrTy(), getPtrTy()}, false), Function::InternalLinkage,
+                "$allocateShape", getModule()
+            );
+
+            LoxBuilder B(getContext(), getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const arguments = F->args().begin();
+            auto *const parent = arguments;
+            auto *const key = arguments + 1;
+
+            auto *const ShapeStruct = B.getModule().getShapeStructType();
+            auto *const shapes = B.getModule().getShapes();
+
+            // Shapes are not Lox objects: they live until the end of the program.
+            auto *const ptr = B.AllocateBuffer(B.getSizeOf(ShapeStruct, 1), "shape");
+
+            auto *const count = B.CreateSelect(
+                B.CreateIsNull(parent), B.getInt32(0),
+                B.CreateAdd(
+                    B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(ShapeStruct, parent, 2)), B.getInt32(1), "count",
+                    true, true
+                )
+            );
+
+            B.CreateStore(parent, B.CreateStructGEP(ShapeStruct, ptr, 0));
+            B.CreateStore(key, B.CreateStructGEP(ShapeStruct, ptr, 1));
+            B.CreateStore(count, B.CreateStructGEP(ShapeStruct, ptr, 2));
+            B.CreateStore(B.AllocateTable(), B.CreateStructGEP(ShapeStruct, ptr, 3));
+            B.CreateStore(B.CreateLoad(B.getPtrTy(), shapes), B.CreateStructGEP(ShapeStruct, ptr, 4));
+            B.CreateStore(ptr, shapes);
+
+            if constexpr (DEBUG_LOG_GC) {
+                B.PrintF({B.CreateGlobalCachedString("allocate shape %p (parent %p, count %d)\n"), ptr, parent, count});
+            }
+
+            B.CreateRet(ptr);
+
+            return F;
+        }());
+
+        return CreateCall(AllocateShapeFunction, {parent, key});
+    }
+
+    // Returns the slot of the key in the shape, or -1 if the shape has no such key.
+    static Value *FindSlot(LoxBuilder &Builder, Value *shape, Value *key) {
+        static auto *FindSlotFunction([&Builder] {
+            auto *const F = Function::Create(
+                FunctionType::get(Builder.getInt32Ty(), {Builder.getPtrTy(), Builder.getPtrTy()}, false),
+                Function::InternalLinkage, "$shapeFindSlot", Builder.getModule()
+            );
+
+            F->addFnAttr(Attribute::AlwaysInline);
+
+            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const arguments = F->args().begin();
+            auto *const key = arguments + 1;
+
+            auto *const ShapeStruct = B.getModule().getShapeStructType();
+
+            auto *const WhileCond = B.CreateBasicBlock("while.cond");
+            auto *const WhileBody = B.CreateBasicBlock("while.body");
+            auto *const FoundBlock = B.CreateBasicBlock("found");
+            auto *const NextBlock = B.CreateBasicBlock("next");
+            auto *const NotFoundBlock = B.CreateBasicBlock("notfound");
+
+            B.CreateBr(WhileCond);
+            B.SetInsertPoint(WhileCond);
+            auto *const current = B.CreatePHI(B.getPtrTy(), 2, "shape");
+            current->addIncoming(arguments, EntryBasicBlock);
+            // The root shape, which has no parent, has no keys.
+            auto *const parent = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(ShapeStruct, current, 0), "parent");
+            B.CreateCondBr(B.CreateIsNull(parent), NotFoundBlock, WhileBody);
+
+            B.SetInsertPoint(WhileBody);
+            auto *const currentKey = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(ShapeStruct, current, 1), "key");
+            B.CreateCondBr(B.CreateICmpEQ(currentKey, key), FoundBlock, NextBlock);
+
+            B.SetInsertPoint(NextBlock);
+            current->addIncoming(parent, NextBlock);
+            B.CreateBr(WhileCond);
+
+            B.SetInsertPoint(FoundBlock);
+            B.CreateRet(B.CreateSub(
+                B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(ShapeStruct, current, 2)), B.getInt32(1), "slot", true,
+                true
+            ));
+
+            B.SetInsertPoint(NotFoundBlock);
+            B.CreateRet(B.getInt32(-1));
+
+            return F;
+        }());
+
+        return Builder.CreateCall(FindSlotFunction, {shape, key});
+    }
+
+    Value *LoxBuilder::InstanceGetField(Value *instance, Value *key) {
+        assert(instance->getType() == getPtrTy());
+        assert(key->getType() == getPtrTy());
+
+        static auto *GetFieldFunction([this] {
+            auto *const F = Function::Create(
+                FunctionType::get(getInt64Ty(), {getPtrTy(), getPtrTy()}, false), Function::InternalLinkage,
+                "$instanceGetField", getModule()
+            );
+
+            LoxBuilder B(getContext(), getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const arguments = F->args().begin();
+            auto *const instance = arguments;
+            auto *const key = arguments + 1;
+
+            auto *const IsDictionaryBlock = B.CreateBasicBlock("dictionary");
+            auto *const IsShapeBlock = B.CreateBasicBlock("shape");
+            auto *const FoundBlock = B.CreateBasicBlock("found");
+            auto *const NotFoundBlock = B.CreateBasicBlock("notfound");
+
+            auto *const fields = B.CreateLoad(B.getPtrTy(), B.CreateObjStructGEP(ObjType::INSTANCE, instance, 2));
+            B.CreateCondBr(B.CreateIsNotNull(fields), IsDictionaryBlock, IsShapeBlock);
+
+            B.SetInsertPoint(IsDictionaryBlock);
+            B.CreateRet(B.TableGet(fields, key));
+
+            B.SetInsertPoint(IsShapeBlock);
+            auto *const shape = B.CreateLoad(B.getPtrTy(), B.CreateObjStructGEP(ObjType::INSTANCE, instance, 3));
+            auto *const slot = FindSlot(B, shape, key);
+            B.CreateCondBr(B.CreateICmpSGE(slot, B.getInt32(0)), FoundBlock, NotFoundBlock);
+
+            B.SetInsertPoint(FoundBlock);
+            B.CreateRet(B.CreateLoad(
+                B.getInt64Ty(), B.CreateInBoundsGEP(
+                                    B.getModule().getStructType(ObjType::INSTANCE), instance,
+                                    {B.getInt32(0), B.getInt32(4), slot}
+                                )
+            ));
+
+            B.SetInsertPoint(NotFoundBlock);
+            B.CreateRet(B.getUninitializedVal());
+
+            return F;
+        }());
+
+        return CreateCall(GetFieldFunction, {instance, key});
+    }
+
+    void LoxBuilder::InstanceSetField(Value *instance, Value *key, Value *value) {
+        assert(instance->getType() == getPtrTy());
+        assert(key->getType() == getPtrTy());
+        assert(value->getType() == getInt64Ty());
+
+        static auto *SetFieldFunction([this] {
+            auto *const F = Function::Create(
+                FunctionType::get(getVoidTy(), {getPtrTy(), getPtrTy(), getInt64Ty()}, false),
+                Function::InternalLinkage, "$instanceSetField", getModule()
+            );
+
+            LoxBuilder B(getContext(), getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const arguments = F->args().begin();
+            auto *const instance = arguments;
+            auto *const key = arguments + 1;
+            auto *const value = arguments + 2;
+
+            auto *const InstanceStruct = B.getModule().getStructType(ObjType::INSTANCE);
+            auto *const ShapeStruct = B.getModule().getShapeStructType();
+
+            auto *const IsDictionaryBlock = B.CreateBasicBlock("dictionary");
+            auto *const IsShapeBlock = B.CreateBasicBlock("shape");
+            auto *const FoundBlock = B.CreateBasicBlock("found");
+            auto *const NotFoundBlock = B.CreateBasicBlock("notfound");
+            auto *const TransitionBlock = B.CreateBasicBlock("transition");
+            auto *const NewShapeBlock = B.CreateBasicBlock("new.shape");
+            auto *const AddFieldBlock = B.CreateBasicBlock("add.field");
+            auto *const ToDictionaryBlock = B.CreateBasicBlock("to.dictionary");
+
+            auto *const $fields = B.CreateStructGEP(InstanceStruct, instance, 2);
+            auto *const $shape = B.CreateStructGEP(InstanceStruct, instance, 3);
+
+            auto *const fields = B.CreateLoad(B.getPtrTy(), $fields);
+            B.CreateCondBr(B.CreateIsNotNull(fields), IsDictionaryBlock, IsShapeBlock);
+
+            B.SetInsertPoint(IsDictionaryBlock);
+            {
+                B.TableSet(fields, key, value);
+                B.CreateRetVoid();
+            }
+
+            B.SetInsertPoint(IsShapeBlock);
+            auto *const shape = B.CreateLoad(B.getPtrTy(), $shape);
+            auto *const slot = FindSlot(B, shape, key);
+            B.CreateCondBr(B.CreateICmpSGE(slot, B.getInt32(0)), FoundBlock, NotFoundBlock);
+
+            B.SetInsertPoint(FoundBlock);
+            {
+                auto *const field = B.CreateInBoundsGEP(InstanceStruct, instance, {B.getInt32(0), B.getInt32(4), slot});
+                DeletionBarrier(B, B.CreateLoad(B.getInt64Ty(), field));
+                B.CreateStore(value, field);
+                B.CreateRetVoid();
+            }
+
+            B.SetInsertPoint(NotFoundBlock);
+            auto *const count = B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(ShapeStruct, shape, 2));
+            B.CreateCondBr(
+                B.CreateICmpULT(count, B.getInt32(INSTANCE_INLINE_FIELDS)), TransitionBlock, ToDictionaryBlock
+            );
+
+            B.SetInsertPoint(TransitionBlock);
+            // Instances that add the same keys in the same order share the shape.
+            auto *const transitions = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(ShapeStruct, shape, 3));
+            auto *const existing = B.TableGet(transitions, key);
+            B.CreateCondBr(B.IsUninitialized(existing), NewShapeBlock, AddFieldBlock);
+
+            B.SetInsertPoint(NewShapeBlock);
+            auto *const newShape = B.AllocateShape(shape, key);
+            B.TableSet(transitions, key, B.CreatePtrToInt(newShape, B.getInt64Ty()));
+            B.CreateBr(AddFieldBlock);
+
+            B.SetInsertPoint(AddFieldBlock);
+            {
+                auto *const next = B.CreatePHI(B.getPtrTy(), 2, "next");
+                next->addIncoming(B.CreateIntToPtr(existing, B.getPtrTy()), TransitionBlock);
+                next->addIncoming(newShape, NewShapeBlock);
+                B.CreateStore(next, $shape);
+                B.CreateStore(value, B.CreateInBoundsGEP(InstanceStruct, instance, {B.getInt32(0), B.getInt32(4), count}));
+                B.CreateRetVoid();
+            }
+
+            B.SetInsertPoint(ToDictionaryBlock);
+            {
+                // Too many fields for the inline slots: copy the fields into a table,
+                // which will be used for all further accesses to this instance. The
+                // instance is left without a shape so that no inline cache matches it.
+                auto *const table = B.AllocateTable();
+                auto *const current = CreateEntryBlockAlloca(F, B.getPtrTy(), "current");
+                B.CreateStore(shape, current);
+
+                auto *const WhileCond = B.CreateBasicBlock("while.cond");
+                auto *const WhileBody = B.CreateBasicBlock("while.body");
+                auto *const WhileEnd = B.CreateBasicBlock("while.end");
+
+                B.CreateBr(WhileCond);
+                B.SetInsertPoint(WhileCond);
+                auto *const s = B.CreateLoad(B.getPtrTy(), current);
+                auto *const parent = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(ShapeStruct, s, 0));
+                B.CreateCondBr(B.CreateIsNull(parent), WhileEnd, WhileBody);
+                B.SetInsertPoint(WhileBody);
+                {
+                    auto *const fieldSlot = B.CreateSub(
+                        B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(ShapeStruct, s, 2)), B.getInt32(1), "slot", true,
+                        true
+                    );
+                    B.TableSet(
+                        table, B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(ShapeStruct, s, 1)),
+                        B.CreateLoad(
+                            B.getInt64Ty(),
+                            B.CreateInBoundsGEP(InstanceStruct, instance, {B.getInt32(0), B.getInt32(4), fieldSlot})
+                        )
+                    );
+                    B.CreateStore(parent, current);
+                    B.CreateBr(WhileCond);
+                }
+                B.SetInsertPoint(WhileEnd);
+                B.TableSet(table, key, value);
+                B.CreateStore(table, $fields);
+                B.CreateStore(B.getNullPtr(), $shape);
+                B.CreateRetVoid();
+            }
+
+            return F;
+        }());
+
+        CreateCall(SetFieldFunction, {instance, key, value});
+    }
+
+    static GlobalVariable *CreatePropertyCache(LoxBuilder &Builder) {
+        auto *const EntryStruct = Builder.getModule().getPropertyCacheEntryStructType();
+        auto *const CacheType = ArrayType::get(EntryStruct, PROPERTY_CACHE_ENTRIES);
+        auto *const noShape = Builder.getModule().getNoShape();
+        auto *const empty = ConstantStruct::get(EntryStruct, {noShape, noShape, Builder.getInt32(-1)});
+
+        auto *const cache = new GlobalVariable(
+            Builder.getModule(), CacheType, false, GlobalValue::PrivateLinkage,
+            ConstantArray::get(CacheType, std::vector<Constant *>(PROPERTY_CACHE_ENTRIES, empty)), "$cache.property"
+        );
+        cache->setAlignment(Align(8));
+
+        return cache;
+    }
+
+    static Value *CreateCacheEntryGEP(LoxBuilder &B, Value *cache, const unsigned int entry, const unsigned int field) {
+        return B.CreateInBoundsGEP(
+            ArrayType::get(B.getModule().getPropertyCacheEntryStructType(), PROPERTY_CACHE_ENTRIES), cache,
+            {B.getInt32(0), B.getInt32(entry), B.getInt32(field)}
+        );
+    }
+
+    // Moves the older entries down, dropping the oldest, and puts the new entry first.
+    static void InsertCacheEntry(LoxBuilder &B, Value *cache, Value *from, Value *to, Value *slot) {
+        auto *const EntryStruct = B.getModule().getPropertyCacheEntryStructType();
+        auto *const CacheType = ArrayType::get(EntryStruct, PROPERTY_CACHE_ENTRIES);
+        for (unsigned int i = PROPERTY_CACHE_ENTRIES - 1; i > 0; i--) {
+            B.CreateStore(
+                B.CreateLoad(EntryStruct, B.CreateConstInBoundsGEP2_32(CacheType, cache, 0, i - 1)),
+                B.CreateConstInBoundsGEP2_32(CacheType, cache, 0, i)
+            );
+        }
+        B.CreateStore(from, CreateCacheEntryGEP(B, cache, 0, 0));
+        B.CreateStore(to, CreateCacheEntryGEP(B, cache, 0, 1));
+        B.CreateStore(slot, CreateCacheEntryGEP(B, cache, 0, 2));
+    }
+
+    static Value *CreateInlineFieldGEP(LoxBuilder &B, Value *instance, Value *slot) {
+        return B.CreateInBoundsGEP(
+            B.getModule().getStructType(ObjType::INSTANCE), instance, {B.getInt32(0), B.getInt32(4), slot}
+        );
+    }
+
+    Value *LoxBuilder::InstanceGetFieldCached(Value *instance, Value *key) {
+        assert(instance->getType() == getPtrTy());
+        assert(key->getType() == getPtrTy());
+
+        // Probes the remaining cache entries, then falls back to a lookup in the shape.
+        static auto *GetFieldFunction([this] {
+            auto *const F = Function::Create(
+                FunctionType::get(getInt64Ty(), {getPtrTy(), getPtrTy(), getPtrTy()}, false),
+                Function::InternalLinkage, "$instanceGetFieldCached", getModule()
+            );
+
+            LoxBuilder B(getContext(), getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const arguments = F->args().begin();
+            auto *const instance = arguments;
+            auto *const key = arguments + 1;
+            auto *const cache = arguments + 2;
+
+            auto *const IsDictionaryBlock = B.CreateBasicBlock("dictionary");
+            auto *const IsShapeBlock = B.CreateBasicBlock("shape");
+            auto *const FoundBlock = B.CreateBasicBlock("found");
+            auto *const IsFieldBlock = B.CreateBasicBlock("field");
+            auto *const NotFieldBlock = B.CreateBasicBlock("notfield");
+
+            auto *const fields = B.CreateLoad(B.getPtrTy(), B.CreateObjStructGEP(ObjType::INSTANCE, instance, 2));
+            B.CreateCondBr(B.CreateIsNotNull(fields), IsDictionaryBlock, IsShapeBlock);
+
+            B.SetInsertPoint(IsDictionaryBlock);
+            B.CreateRet(B.TableGet(fields, key));
+
+            B.SetInsertPoint(FoundBlock);
+            auto *const slot = B.CreatePHI(B.getInt32Ty(), PROPERTY_CACHE_ENTRIES, "slot");
+
+            B.SetInsertPoint(IsShapeBlock);
+            auto *const shape = B.CreateLoad(B.getPtrTy(), B.CreateObjStructGEP(ObjType::INSTANCE, instance, 3));
+            for (unsigned int i = 1; i < PROPERTY_CACHE_ENTRIES; i++) {
+                auto *const NextBlock = B.CreateBasicBlock("next");
+                auto *const from = B.CreateLoad(B.getPtrTy(), CreateCacheEntryGEP(B, cache, i, 0));
+                auto *const entrySlot = B.CreateLoad(B.getInt32Ty(), CreateCacheEntryGEP(B, cache, i, 2));
+                slot->addIncoming(entrySlot, B.GetInsertBlock());
+                B.CreateCondBr(B.CreateICmpEQ(from, shape), FoundBlock, NextBlock);
+                B.SetInsertPoint(NextBlock);
+            }
+
+            auto *const shapeSlot = FindSlot(B, shape, key);
+            InsertCacheEntry(B, cache, shape, shape, shapeSlot);
+            slot->addIncoming(shapeSlot, B.GetInsertBlock());
+            B.CreateBr(FoundBlock);
+
+            B.SetInsertPoint(FoundBlock);
+            B.CreateCondBr(B.CreateICmpSGE(slot, B.getInt32(0)), IsFieldBlock, NotFieldBlock);
+
+            B.SetInsertPoint(IsFieldBlock);
+            B.CreateRet(B.CreateLoad(B.getInt64Ty(), CreateInlineFieldGEP(B, instance, slot)));
+
+            B.SetInsertPoint(NotFieldBlock);
+            B.CreateRet(B.getUninitializedVal());
+
+            return F;
+        }());
+
+        auto *const cache = CreatePropertyCache(*this);
+
+        auto *const HitBlock = CreateBasicBlock("property.cache.hit");
+        auto *const IsFieldBlock = CreateBasicBlock("property.cache.field");
+        auto *const MissBlock = CreateBasicBlock("property.cache.miss");
+        auto *const EndBlock = CreateBasicBlock("property.cache.end");
+
+        // Most sites only ever see one shape: check the first entry inline.
+        auto *const shape = CreateLoad(getPtrTy(), CreateObjStructGEP(ObjType::INSTANCE, instance, 3), "shape");
+        auto *const from = CreateLoad(getPtrTy(), CreateCacheEntryGEP(*this, cache, 0, 0));
+        CreateCondBr(CreateICmpEQ(shape, from), HitBlock, MissBlock);
+
+        SetInsertPoint(HitBlock);
+        auto *const slot = CreateLoad(getInt32Ty(), CreateCacheEntryGEP(*this, cache, 0, 2), "slot");
+        CreateCondBr(CreateICmpSGE(slot, getInt32(0)), IsFieldBlock, EndBlock);
+
+        SetInsertPoint(IsFieldBlock);
+        auto *const field = CreateLoad(getInt64Ty(), CreateInlineFieldGEP(*this, instance, slot));
+        CreateBr(EndBlock);
+
+        SetInsertPoint(MissBlock);
+        auto *const missed = CreateCall(GetFieldFunction, {instance, key, cache});
+        CreateBr(EndBlock);
+
+        SetInsertPoint(EndBlock);
+        auto *const result = CreatePHI(getInt64Ty(), 3, "field");
+        result->addIncoming(getUninitializedVal(), HitBlock);
+        result->addIncoming(field, IsFieldBlock);
+        result->addIncoming(missed, MissBlock);
+
+        return result;
+    }
+
+    void LoxBuilder::InstanceSetFieldCached(Value *instance, Value *key, Value *value) {
+        assert(instance->getType() == getPtrTy());
+        assert(key->getType() == getPtrTy());
+        assert(value->getType() == getInt64Ty());
+
+        // Probes the remaining cache entries, then falls back to setting the field
+        // and caching the slot and the shape transition.
+        static auto *SetFieldFunction([this] {
+            auto *const F = Function::Create(
+                FunctionType::get(getVoidTy(), {getPtrTy(), getPtrTy(), getInt64Ty(), getPtrTy()}, false),
+                Function::InternalLinkage, "$instanceSetFieldCached", getModule()
+            );
+
+            LoxBuilder B(getContext(), getModule(), *F);
+
+            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
+            B.SetInsertPoint(EntryBasicBlock);
+
+            auto *const arguments = F->args().begin();
+            auto *const instance = arguments;
+            auto *const key = arguments + 1;
+            auto *const value = arguments + 2;
+            auto *const cache = arguments + 3;
+
+            auto *const IsDictionaryBlock = B.CreateBasicBlock("dictionary");
+            auto *const IsShapeBlock = B.CreateBasicBlock("shape");
+            auto *const FoundBlock = B.CreateBasicBlock("found");
+            auto *const CacheBlock = B.CreateBasicBlock("cache");
+            auto *const EndBlock = B.CreateBasicBlock("end");
+
+            auto *const $fields = B.CreateObjStructGEP(ObjType::INSTANCE, instance, 2);
+            auto *const $shape = B.CreateObjStructGEP(ObjType::INSTANCE, instance, 3);
+
+            auto *const fields = B.CreateLoad(B.getPtrTy(), $fields);
+            B.CreateCondBr(B.CreateIsNotNull(fields), IsDictionaryBlock, IsShapeBlock);
+
+            B.SetInsertPoint(IsDictionaryBlock);
+            B.TableSet(fields, key, value);
+            B.CreateRetVoid();
+
+            B.SetInsertPoint(FoundBlock);
+            auto *const slot = B.CreatePHI(B.getInt32Ty(), PROPERTY_CACHE_ENTRIES - 1, "slot");
+            auto *const to = B.CreatePHI(B.getPtrTy(), PROPERTY_CACHE_ENTRIES - 1, "to");
+
+            B.SetInsertPoint(IsShapeBlock);
+            auto *const shape = B.CreateLoad(B.getPtrTy(), $shape);
+            for (unsigned int i = 1; i < PROPERTY_CACHE_ENTRIES; i++) {
+                auto *const NextBlock = B.CreateBasicBlock("next");
+                auto *const from = B.CreateLoad(B.getPtrTy(), CreateCacheEntryGEP(B, cache, i, 0));
+                slot->addIncoming(B.CreateLoad(B.getInt32Ty(), CreateCacheEntryGEP(B, cache, i, 2)), B.GetInsertBlock());
+                to->addIncoming(B.CreateLoad(B.getPtrTy(), CreateCacheEntryGEP(B, cache, i, 1)), B.GetInsertBlock());
+                B.CreateCondBr(B.CreateICmpEQ(from, shape), FoundBlock, NextBlock);
+                B.SetInsertPoint(NextBlock);
+            }
+
+            B.InstanceSetField(instance, key, value);
+            // Instances that switched to dictionary mode can't be cached.
+            B.CreateCondBr(B.CreateIsNull(B.CreateLoad(B.getPtrTy(), $fields)), CacheBlock, EndBlock);
+
+            B.SetInsertPoint(CacheBlock);
+            auto *const newShape = B.CreateLoad(B.getPtrTy(), $shape);
+            InsertCacheEntry(B, cache, shape, newShape, FindSlot(B, newShape, key));
+            B.CreateBr(EndBlock);
+
+            B.SetInsertPoint(FoundBlock);
+            {
+                // The slot holds a value to overwrite only if the store doesn't add the field.
+                auto *const field = CreateInlineFieldGEP(B, instance, slot);
+                DeletionBarrier(
+                    B, B.CreateSelect(B.CreateICmpEQ(to, shape), B.CreateLoad(B.getInt64Ty(), field), B.getNilVal())
+                );
+                B.CreateStore(value, field);
+                B.CreateStore(to, $shape);
+                B.CreateBr(EndBlock);
+            }
+
+            B.SetInsertPoint(EndBlock);
+            B.CreateRetVoid();
+
+            return F;
+        }());
+
+        auto *const cache = CreatePropertyCache(*this);
+
+        auto *const HitBlock = CreateBasicBlock("property.cache.hit");
+        auto *const MissBlock = CreateBasicBlock("property.cache.miss");
+        auto *const EndBlock = CreateBasicBlock("property.cache.end");
+
+        auto *const $shape = CreateObjStructGEP(ObjType::INSTANCE, instance, 3);
+        auto *const shape = CreateLoad(getPtrTy(), $shape, "shape");
+        auto *const from = CreateLoad(getPtrTy(), CreateCacheEntryGEP(*this, cache, 0, 0));
+        CreateCondBr(CreateICmpEQ(shape, from), HitBlock, MissBlock);
+
+        SetInsertPoint(HitBlock);
+        auto *const slot = CreateLoad(getInt32Ty(), CreateCacheEntryGEP(*this, cache, 0, 2), "slot");
+        auto *const to = CreateLoad(getPtrTy(), CreateCacheEntryGEP(*this, cache, 0, 1));
+        auto *const field = CreateInlineFieldGEP(*this, instance, slot);
+        DeletionBarrier(*this, CreateSelect(CreateICmpEQ(to, shape), CreateLoad(getInt64Ty(), field), getNilVal()));
+        CreateStore(value, field);
+        CreateStore(to, $shape);
+        CreateBr(EndBlock);
+
+        SetInsertPoint(MissBlock);
+        CreateCall(SetFieldFunction, {instance, key, value, cache});
+        CreateBr(EndBlock);
+
+        SetInsertPoint(EndBlock);
+    }
+}// namespace lox
@@ -149,29 +149,10 @@ namespace lox {
         return B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(StackStruct, stack, 1));
     }
 
-    void GlobalStack::CreateSet(LoxBuilder &B, Value *index, Value *value) const {
-        auto *const $stack = B.CreateStructGEP(StackStruct, stack, 0);
-        auto *const stack = B.CreateLoad(B.getPtrTy(), $stack);
-        auto *const addr = B.CreateInBoundsGEP(B.getPtrTy(), stack, index);
-
-        if constexpr (DEBUG_STACK) {
-            B.PrintF({B.CreateGlobalCachedString("set value: %d %p -> %p\n"), index, value, addr});
-        }
-
-        B.CreateStore(value, addr);
+    Value *GlobalStack::CreateGetHighWater(IRBuilder<> &B) const {
+        return B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(StackStruct, stack, 3));
     }
 
-    // Create N new slots on the stack
-    // The new slots will be initialized to nullptr only if the stack storage
-    // needs to be reallocated.
-    void GlobalStack::CreatePushN(LoxModule &M, IRBuilder<> &Builder, Value *N) const {
-        auto *const count = CreateGetCount(Builder);
-        auto *const size = Builder.CreateAdd(N, count, "newCount", true, true);
-        ensureCapacity(M, Builder, stack, StackStruct, size);
-        Builder.CreateStore(size, Builder.CreateStructGEP(StackStruct, stack, 1));
-    }
-
-
     void GlobalStack::CreatePush(LoxModule &M, IRBuilder<> &Builder, Value *Object) const {
         static auto *PushFunction([&Builder, &M, this] {
             auto *const F = Function::Create(
@@ -207,40 +188,17 @@ namespace lox {
             auto *const newCount = B.CreateAdd(B.getInt32(1), count, "newcount", true, true);
             B.CreateStore(newCount, $count);
 
-            B.CreateRetVoid();
-
-            return F;
-        }());
-
-        Builder.CreateCall(PushFunction, {stack, Object});
-    }
-
-    void GlobalStack::CreatePopN(LoxBuilder &Builder, Value *N) const {
-        static auto *PopFunction([&] {
-            auto *const F = Function::Create(
-                FunctionType::get(Builder.getVoidTy(), {Builder.getPtrTy(), Builder.getInt32Ty()}, false),
-                Function::InternalLinkage, "$stackPopN", Builder.getModule()
+            auto *const $highWater = B.CreateStructGEP(StackStruct, stackGlobal, 3);
+            B.CreateStore(
+                B.CreateBinaryIntrinsic(Intrinsic::umax, newCount, B.CreateLoad(B.getInt32Ty(), $highWater)), $highWater
             );
 
-            LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
-
-            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
-            B.SetInsertPoint(EntryBasicBlock);
-
-            auto *const arguments = F->args().begin();
-            auto *const $count = B.CreateStructGEP(StackStruct, arguments, 1);
-            auto *const N = arguments + 1;
-
-            auto *const count = B.CreateLoad(B.getInt32Ty(), $count);
-
-            B.CreateStore(B.CreateSub(count, N, "count", true, true), $count);
-
             B.CreateRetVoid();
 
             return F;
         }());
 
-        Builder.CreateCall(PopFunction, {stack, N});
+        Builder.CreateCall(PushFunction, {stack, Object});
     }
 
     void GlobalStack::CreatePopAll(LoxBuilder &Builder, Function *FunctionPointer) const {
@@ -292,11 +250,13 @@ namespace lox {
         Builder.CreateCall(IterateFunction, {stack, FunctionPointer});
     }
 
-    void GlobalStack::CreateIterateObjectValues(LoxBuilder &Builder, Function *FunctionPointer) const {
-        static auto *IterateFunction([&] {
+    void GlobalStack::CreatePopAtMost(LoxBuilder &Builder, Function *FunctionPointer, Value *Limit) const {
+        assert(Limit->getType() == Builder.getInt32Ty());
+
+        static auto *PopFunction([&] {
             auto *const F = Function::Create(
-                FunctionType::get(Builder.getVoidTy(), {Builder.getPtrTy(), Builder.getPtrTy()}, false),
-                Function::InternalLinkage, "$iterateStack", Builder.getModule()
+                FunctionType::get(Builder.getVoidTy(), {Builder.getPtrTy(), Builder.getPtrTy(), Builder.getInt32Ty()}, false),
+                Function::InternalLinkage, "$stackPopAtMost", Builder.getModule()
             );
 
             LoxBuilder B(Builder.getContext(), Builder.getModule(), *F);
@@ -308,85 +268,44 @@ namespace lox {
             auto *const $stack = B.CreateStructGEP(StackStruct, arguments, 0);
             auto *const $count = B.CreateStructGEP(StackStruct, arguments, 1);
             auto *const function = arguments + 1;
+            auto *const limit = arguments + 2;
 
-            auto *const stack = B.CreateLoad(B.getPtrTy(), $stack);
-            auto *const count = B.CreateLoad(B.getInt32Ty(), $count);
-
-            if constexpr (DEBUG_STACK || DEBUG_LOG_GC) {
-                B.PrintF({B.CreateGlobalCachedString("--iterate stack values (%d)--\n"), count});
-            }
-            auto *const i = CreateEntryBlockAlloca(F, B.getInt32Ty(), "i");
-
-            B.CreateStore(B.getInt32(1), i);
-
-            auto *const ForCond = B.CreateBasicBlock("for.cond");
-            auto *const ForBody = B.CreateBasicBlock("for.body");
-            auto *const ForInc = B.CreateBasicBlock("for.inc");
-            auto *const ForEnd = B.CreateBasicBlock("for.end");
-
-            B.CreateBr(ForCond);
-            B.SetInsertPoint(ForCond);
-            B.CreateCondBr(B.CreateICmpSLE(B.CreateLoad(B.getInt32Ty(), i), count), ForBody, ForEnd);
-            B.SetInsertPoint(ForBody);
-
-            auto *const top = B.CreateSub(B.CreateLoad(B.getInt32Ty(), $count), B.CreateLoad(B.getInt32Ty(), i));
-            auto *const addr = B.CreateInBoundsGEP(B.getPtrTy(), stack, top);
+            auto *const remaining = CreateEntryBlockAlloca(F, B.getInt32Ty(), "remaining");
+            B.CreateStore(limit, remaining);
 
-            auto *const ptr = B.CreateLoad(B.getPtrTy(), addr);
-
-            if constexpr (DEBUG_STACK || DEBUG_LOG_GC) {
-                B.PrintF(
-                    {B.CreateGlobalCachedString("iter ptr %d: %p %p\n"), B.CreateLoad(B.getInt32Ty(), i), addr, ptr}
-                );
-            }
-
-            auto *const IsObjBlock = B.CreateBasicBlock("is.obj");
-            auto *const EndBlock = B.CreateBasicBlock("end.obj");
-            auto *const IsNotNull = B.CreateBasicBlock("is.notnull");
-            auto *const IsNotObjBlock = DEBUG_LOG_GC ? B.CreateBasicBlock("is.not.obj") : EndBlock;
-
-            B.CreateCondBr(B.CreateIsNull(ptr), IsNotObjBlock, IsNotNull);
-            B.SetInsertPoint(IsNotNull);
-
-            auto *const value = B.CreateLoad(B.getInt64Ty(), ptr);
-
-            if constexpr (DEBUG_STACK || DEBUG_LOG_GC) {
-                B.PrintF({B.CreateGlobalCachedString("iter value: %d\n"), value});
-            }
-            auto *const CheckObjBlock = B.CreateBasicBlock("check.obj");
+            auto *const WhileCond = B.CreateBasicBlock("while.cond");
+            auto *const WhileBody = B.CreateBasicBlock("while.body");
+            auto *const WhileEnd = B.CreateBasicBlock("while.end");
 
-            B.CreateCondBr(B.IsNil(value), IsNotObjBlock, CheckObjBlock);
+            B.CreateBr(WhileCond);
+            B.SetInsertPoint(WhileCond);
+            B.CreateCondBr(
+                B.CreateAnd(
+                    B.CreateICmpSGT(B.CreateLoad(B.getInt32Ty(), $count), B.getInt32(0)),
+                    B.CreateICmpSGT(B.CreateLoad(B.getInt32Ty(), remaining), B.getInt32(0))
+                ),
+                WhileBody, WhileEnd
+            );
+            B.SetInsertPoint(WhileBody);
+            {
+                B.CreateStore(B.CreateSub(B.CreateLoad(B.getInt32Ty(), remaining), B.getInt32(1)), remaining);
+                auto *const newCount =
+                    B.CreateSub(B.CreateLoad(B.getInt32Ty(), $count), B.getInt32(1), "newCount", true, true);
+                B.CreateStore(newCount, $count);
+                auto *const addr = B.CreateInBoundsGEP(B.getPtrTy(), B.CreateLoad(B.getPtrTy(), $stack), newCount);
+                auto *const ptr = B.CreateLoad(B.getPtrTy(), addr);
 
-            B.SetInsertPoint(CheckObjBlock);
-            B.CreateCondBr(B.IsObj(value), IsObjBlock, IsNotObjBlock);
-            B.SetInsertPoint(IsObjBlock);
-            if constexpr (DEBUG_STACK || DEBUG_LOG_GC) {
-                B.PrintF({B.CreateGlobalCachedString("calling function %p(%d, %p)\n"), function, value, value});
-            }
-            B.CreateCall(FunctionType::get(B.getVoidTy(), {B.getPtrTy()}, false), function, {(B.AsObj(value))});
-            B.CreateBr(EndBlock);
+                B.CreateCall(FunctionType::get(B.getVoidTy(), {B.getPtrTy()}, false), function, {ptr});
 
-            if constexpr (DEBUG_LOG_GC) {
-                B.SetInsertPoint(IsNotObjBlock);
-                B.PrintF({B.CreateGlobalCachedString("not object %p\n"), ptr});
-                B.CreateBr(EndBlock);
+                B.CreateBr(WhileCond);
             }
-
-            B.SetInsertPoint(EndBlock);
-
-            B.CreateBr(ForInc);
-
-            B.SetInsertPoint(ForInc);
-            B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt32Ty(), i), B.getInt32(1), "i+1", true, true), i);
-            B.CreateBr(ForCond);
-
-            B.SetInsertPoint(ForEnd);
-
+            B.SetInsertPoint(WhileEnd);
             B.CreateRetVoid();
+
             return F;
         }());
 
-        Builder.CreateCall(IterateFunction, {stack, FunctionPointer});
+        Builder.CreateCall(PopFunction, {stack, FunctionPointer, Limit});
     }
 
     void GlobalStack::CreateFree(LoxBuilder &Builder) const {
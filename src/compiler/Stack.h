@@ -20,9 +20,10 @@ namespace lox {
         StructType *const StackStruct = StructType::create(
             M.getContext(),
             {
-                PointerType::getUnqual(M.getContext()),
-                IntegerType::getInt32Ty(M.getContext()),
-                IntegerType::getInt32Ty(M.getContext()),
+                PointerType::getUnqual(M.getContext()), // entries
+                IntegerType::getInt32Ty(M.getContext()),// count
+                IntegerType::getInt32Ty(M.getContext()),// capacity
+                IntegerType::getInt32Ty(M.getContext()),// high water mark of the count
             },
             "Stack"
         );
@@ -41,14 +42,12 @@ namespace lox {
         }
 
         Value *CreateGetCount(IRBuilder<> &B) const;
-
-        void CreateSet(LoxBuilder &B, Value *index, Value *value) const;
+        Value *CreateGetHighWater(IRBuilder<> &B) const;
 
         void CreatePush(LoxModule &M, IRBuilder<> &Builder, Value *Object) const;
-        void CreatePushN(LoxModule &M, IRBuilder<> &Builder, Value *N) const;
-        void CreatePopN(LoxBuilder &Builder, Value *N) const;
         void CreatePopAll(LoxBuilder &Builder, Function *FunctionPointer) const;
-        void CreateIterateObjectValues(LoxBuilder &Builder, Function *FunctionPointer) const;
+        // Pops at most Limit (an i32) entries, calling the function with each.
+        void CreatePopAtMost(LoxBuilder &Builder, Function *FunctionPointer, Value *Limit) const;
         void CreateFree(LoxBuilder &Builder) const;
     };
 }// namespace lox
@@ -2,12 +2,16 @@
 #include "GC.h"
 #include "MDUtil.h"
 
+#include <llvm/Transforms/Utils/Cloning.h>
 #include <ranges>
 #include <vector>
 
 namespace lox {
 
-    void FunctionCompiler::evaluate(const Stmt &stmt) { std::visit(*this, stmt); }
+    void FunctionCompiler::evaluate(const Stmt &stmt) {
+        setDebugLine(lineOf(stmt));
+        std::visit(*this, stmt);
+    }
 
     void FunctionCompiler::operator()(const BlockStmtPtr &blockStmt) {
         beginScope();
@@ -15,9 +19,13 @@ namespace lox {
         endScope();
     }
 
-    static Function *
-    CreateLLVMFunction(LoxBuilder &Builder, const FunctionStmtPtr &functionStmt, const std::string_view name) {
-        std::vector<Type *> paramTypes(functionStmt->parameters.size(), Builder.getInt64Ty());
+    static Function *CreateLLVMFunction(
+        LoxBuilder &Builder, const FunctionStmtPtr &functionStmt, const std::string_view name,
+        const bool isNumber = false
+    ) {
+        std::vector<Type *> paramTypes(
+            functionStmt->parameters.size(), isNumber ? Builder.getDoubleTy() : Builder.getInt64Ty()
+        );
         // The second parameter is for the receiver instance for methods
         // or the function object value itself for functions.
         paramTypes.insert(paramTypes.begin(), Builder.getInt64Ty());
@@ -25,7 +33,31 @@ namespace lox {
         paramTypes.insert(paramTypes.begin(), Builder.getPtrTy());
         auto *const FT = FunctionType::get(IntegerType::getInt64Ty(Builder.getContext()), paramTypes, false);
 
-        return Function::Create(FT, Function::InternalLinkage, name, Builder.getModule());
+        return Function::Create(
+            FT, Function::InternalLinkage, isNumber ? (name + ".number").str() : name, Builder.getModule()
+        );
+    }
+
+    // Fills in the body of a clone of F which takes its parameters as unboxed
+    // numbers: the parameters are boxed again where F would use them, so that
+    // the type checks on them can be folded away by the optimizer.
+    static void CreateNumberClone(Function *F, Function *NumberF) {
+        ValueToValueMapTy VMap;
+        auto *const EntryBlock = BasicBlock::Create(F->getContext(), "entry", NumberF);
+        IRBuilder<> Builder(EntryBlock);
+        for (auto &&[arg, numberArg]: zip(F->args(), NumberF->args())) {
+            numberArg.setName(arg.getName());
+            VMap[&arg] = arg.getType() == numberArg.getType() ? &numberArg
+                                                               : Builder.CreateBitCast(&numberArg, arg.getType());
+        }
+
+        SmallVector<ReturnInst *> Returns;
+        CloneFunctionInto(NumberF, F, VMap, CloneFunctionChangeType::LocalChangesOnly, Returns);
+
+        // Continue into the cloned body, keeping its allocas in the entry block.
+        auto *const ClonedEntryBlock = cast<BasicBlock>(VMap[&F->getEntryBlock()]);
+        Builder.CreateBr(ClonedEntryBlock);
+        MergeBlockIntoPredecessor(ClonedEntryBlock);
     }
 
     void FunctionCompiler::CreateFunction(
@@ -33,6 +65,17 @@ namespace lox {
         const std::function<void(Value *)> &initializer = [](auto *V) -> Value * { return V; }
     ) {
         auto *const F = CreateLLVMFunction(Builder, functionStmt, name);
+        // Direct calls to functions with number arguments call a clone specialised for them.
+        auto *const NumberF = functionStmt->type == LoxFunctionType::FUNCTION && !functionStmt->parameters.empty()
+                                  ? CreateLLVMFunction(Builder, functionStmt, name, true)
+                                  : nullptr;
+        const auto functionMetadata = [&] {
+            auto *nameNode = MDString::get(Builder.getContext(), name);
+            auto *arityNode = ValueAsMetadata::get(Builder.getInt32(functionStmt->parameters.size()));
+            std::vector<Metadata *> operands{nameNode, arityNode, nameNode};
+            if (NumberF != nullptr) operands.push_back(MDString::get(Builder.getContext(), NumberF->getName()));
+            return MDTuple::get(Builder.getContext(), operands);
+        };
 
         if (functionStmt->type == LoxFunctionType::INITIALIZER) {
             // Initializers always return their instance which is the second parameter.
@@ -46,9 +89,7 @@ namespace lox {
         if (functionStmt->type == LoxFunctionType::FUNCTION) {
             auto *const variable =
                 insertVariable(functionStmt->name.getLexeme(), Builder.ObjVal(closurePtr), !isGlobalScope());
-            auto *nameNode = MDString::get(Builder.getContext(), name);
-            auto *arityNode = ValueAsMetadata::get(Builder.getInt32(functionStmt->parameters.size()));
-            metadata::setMetadata(variable, "lox-function", MDTuple::get(Builder.getContext(), {nameNode, arityNode, nameNode}));
+            metadata::setMetadata(variable, "lox-function", functionMetadata());
         }
 
         FunctionCompiler C(Builder.getContext(), Builder.getModule(), *F, functionStmt->type, this);
@@ -60,13 +101,9 @@ namespace lox {
                 // This improves recursive calling performance since there is no
                 // need for an upvalue any longer.
                 auto *const variable = C.insertVariable(name, B.getFunction()->arg_begin() + 1);
-                auto *nameNode = MDString::get(Builder.getContext(), name);
-                auto *arityNode = ValueAsMetadata::get(Builder.getInt32(functionStmt->parameters.size()));
-                metadata::setMetadata(
-                    variable, "lox-function", MDTuple::get(Builder.getContext(), {nameNode, arityNode, nameNode})
-                );
+                metadata::setMetadata(variable, "lox-function", functionMetadata());
             }
-        });
+        }, functionStmt->name.getLine());
 
         // Store captured variables in the closure's upvalue array.
         if (!C.upvalues.empty()) {
@@ -76,12 +113,8 @@ namespace lox {
 
             if constexpr (DEBUG_UPVALUES) { Builder.PrintF({Builder.CreateGlobalCachedString("capture variables\n")}); }
 
-            auto *const upvaluesArraySize =
-                Builder.getSizeOf(Builder.getModule().getStructType(ObjType::UPVALUE), C.upvalues.size());
-
-            auto *const upvaluesArrayPtr = Builder.CreateReallocate(
-                Builder.getNullPtr(), Builder.getInt32(0), Builder.CreateTrunc(upvaluesArraySize, Builder.getInt32Ty())
-            );
+            auto *const upvaluesArraySize = Builder.getSizeOf(Builder.getPtrTy(), C.upvalues.size());
+            auto *const upvaluesArrayPtr = Builder.AllocateBuffer(upvaluesArraySize, "upvalues");
 
             // Initialize upvalues to nullptr.
             for (const auto &upvalue: C.upvalues) {
@@ -109,6 +142,8 @@ namespace lox {
                 );
                 Builder.CreateStore(upvalue->isLocal ? captureLocal(upvalue->value) : upvalue->value, upvalueIndex);
             }
+            // Capturing locals allocates, so the closure may already have been promoted.
+            WriteBarrier(Builder, closurePtr);
 
             Builder.CreateInvariantStart(upvaluesArrayPtr, upvaluesArraySize);
 
@@ -117,6 +152,8 @@ namespace lox {
         }
 
         Builder.CreateInvariantStart(closurePtr, Builder.getSizeOf(ObjType::CLOSURE));
+
+        if (NumberF != nullptr) CreateNumberClone(F, NumberF);
     }
 
     void FunctionCompiler::operator()(const FunctionStmtPtr &functionStmt) {
@@ -152,7 +189,9 @@ namespace lox {
             }
         }
 
-        insertVariable(varStmt->name.getLexeme(), evaluate(varStmt->initializer));
+        // A local that is only ever assigned numbers, and that no closure captures, is stored unboxed.
+        const bool isNumber = varStmt->type == InferredType::NUMBER && !varStmt->isCaptured;
+        insertVariable(varStmt->name.getLexeme(), evaluate(varStmt->initializer), false, isNumber);
     }
 
     void FunctionCompiler::operator()(const WhileStmtPtr &whileStmt) {
@@ -165,6 +204,7 @@ namespace lox {
         Builder.CreateCondBr(Builder.IsTruthy(evaluate(whileStmt->condition)), Body, Exit);
         Builder.SetInsertPoint(Body);
         evaluate(whileStmt->body);
+        PollGCStatsRequest(Builder);
         Builder.CreateBr(Cond);
         Builder.SetInsertPoint(Exit);
     }
@@ -188,7 +228,7 @@ namespace lox {
     void FunctionCompiler::operator()(const ClassStmtPtr &classStmt) {
         const auto className = classStmt->name.getLexeme();
         auto *const klass = DelayGC(Builder, [&className](LoxBuilder &B) {
-            auto *const nameObj = B.AllocateString(className, ("class_" + className).str());
+            auto *const nameObj = B.CreateStringConstant(className);
             return B.AllocateClass(nameObj);
         });
         auto *const methods =
@@ -225,6 +265,7 @@ namespace lox {
             auto *const supermethods =
                 Builder.CreateLoad(Builder.getPtrTy(), Builder.CreateObjStructGEP(ObjType::CLASS, superklass, 2));
             Builder.TableAddAll(supermethods, methods);
+            WriteBarrier(Builder, klass);
             Builder.CreateBr(EndBlock);
 
             Builder.SetInsertPoint(IsNotClassBlock);
@@ -246,6 +287,7 @@ namespace lox {
                     Builder.getInt64Ty(), Builder.CreateObjStructGEP(ObjType::FUNCTION, function, 3)
                 );
                 Builder.TableSet(methods, Builder.AsObj(name), Builder.ObjVal(closure));
+                WriteBarrier(Builder, klass, Builder.ObjVal(closure));
             });
         }
 
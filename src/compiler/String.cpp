@@ -1,6 +1,8 @@
+#include "GC.h"
 #include "Memory.h"
 #include "ModuleCompiler.h"
 #include "Stack.h"
+#include "Table.h"
 #include "Value.h"
 #include <llvm/IR/Value.h>
 
@@ -45,69 +47,58 @@ namespace lox {
 
             auto *const index = CreateEntryBlockAlloca(F, B.getInt32Ty(), "index");
             auto *const capacity = B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 1));
-            B.CreateStore(B.CreateURem(hash, capacity), index);
-
-            auto *const ForStartBlock = B.CreateBasicBlock("for.start");
-
-            B.CreateBr(ForStartBlock);
-            B.SetInsertPoint(ForStartBlock);
             auto *const entries = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 2));
-            auto *const entry = B.CreateInBoundsGEP(B.getModule().getEntryStructType(), entries, B.CreateLoad(B.getInt32Ty(), index), "entry");
-            auto *const entryKey = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getEntryStructType(), entry, 0));
-
-            auto *const KeyIsNullBlock = B.CreateBasicBlock("key.null");
-            auto *const KeyIsNotNullBlock = B.CreateBasicBlock("key.notnull");
-            auto *const CheckKeyIsSameBlock = B.CreateBasicBlock("key.issame?");
-            auto *const EndIfBlock = B.CreateBasicBlock("key.endif");
-
-            B.CreateCondBr(B.CreateIsNull(entryKey), KeyIsNullBlock, KeyIsNotNullBlock);
+            auto *const control = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 3));
 
-            B.SetInsertPoint(KeyIsNullBlock);
-
-            auto *const IsNilBlock = B.CreateBasicBlock("value.isnil");
-
-            auto *const entryValue = B.CreateLoad(B.getInt64Ty(), B.CreateStructGEP(B.getModule().getEntryStructType(), entry, 1));
-            B.CreateCondBr(B.IsNil(entryValue), IsNilBlock, EndIfBlock);
-
-            B.SetInsertPoint(IsNilBlock);
-            B.CreateRet(B.getNullPtr());
+            auto *const FoundBlock = B.CreateBasicBlock("found");
+            auto *const NotFoundBlock = B.CreateBasicBlock("notfound");
 
-            B.SetInsertPoint(KeyIsNotNullBlock);
-            B.CreateBr(CheckKeyIsSameBlock);
-
-            B.SetInsertPoint(CheckKeyIsSameBlock);
-
-            auto *const SameLengthBlock = B.CreateBasicBlock("same.length");
-            auto *const SameHashBlock = B.CreateBasicBlock("same.hash");
-            auto *const SameStringBlock = B.CreateBasicBlock("same.string");
-
-            auto *const keyLength = B.CreateLoad(B.getInt32Ty(), B.CreateObjStructGEP(ObjType::STRING, entryKey, 2));
-            B.CreateCondBr(B.CreateICmpEQ(keyLength, length), SameLengthBlock, EndIfBlock);
-
-            B.SetInsertPoint(SameLengthBlock);
-            auto *const keyHash = B.CreateLoad(B.getInt32Ty(), B.CreateObjStructGEP(ObjType::STRING, entryKey, 3));
-            B.CreateCondBr(B.CreateICmpEQ(keyHash, hash), SameHashBlock, EndIfBlock);
-
-            B.SetInsertPoint(SameHashBlock);
-            auto *const keyString = B.CreateLoad(B.getPtrTy(), B.CreateObjStructGEP(ObjType::STRING, entryKey, 1));
             static const auto MemCmp = B.getModule().getOrInsertFunction(
                 "memcmp",
                 FunctionType::get(B.getInt32Ty(), {B.getPtrTy(), B.getPtrTy(), B.getInt64Ty()}, false)
             );
-            B.CreateCondBr(B.CreateICmpEQ(B.CreateCall(MemCmp, {string, keyString, length}), B.getInt32(0)), SameStringBlock, EndIfBlock);
-
-            B.SetInsertPoint(SameStringBlock);
-            B.CreateRet(B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getEntryStructType(), entry, 0)));
-
-            B.SetInsertPoint(EndIfBlock);
 
-            // index = (index + 1) & (capacity - 1) === index = index % capacity
-            B.CreateStore(
-                B.CreateAnd(B.CreateAdd(B.CreateLoad(B.getInt32Ty(), index), B.getInt32(1), "index+1", true, true), B.CreateSub(capacity, B.getInt32(1), "capacity-1", true, true)),
-                index
+            CreateTableProbe(
+                B, control, capacity, hash,
+                [&](LoxBuilder &M, Value *slot) {
+                    auto *const entry = M.CreateInBoundsGEP(M.getModule().getEntryStructType(), entries, slot, "entry");
+                    auto *const entryKey = M.CreateLoad(M.getPtrTy(), M.CreateStructGEP(M.getModule().getEntryStructType(), entry, 0));
+
+                    auto *const CheckHashBlock = M.CreateBasicBlock("check.hash");
+                    auto *const CheckStringBlock = M.CreateBasicBlock("check.string");
+                    auto *const EndCheckBlock = M.CreateBasicBlock("check.end");
+
+                    auto *const StartBlock = M.GetInsertBlock();
+                    auto *const keyLength = M.CreateLoad(M.getInt32Ty(), M.CreateObjStructGEP(ObjType::STRING, entryKey, 2));
+                    M.CreateCondBr(M.CreateICmpEQ(keyLength, length), CheckHashBlock, EndCheckBlock);
+
+                    M.SetInsertPoint(CheckHashBlock);
+                    auto *const keyHash = M.CreateLoad(M.getInt32Ty(), M.CreateObjStructGEP(ObjType::STRING, entryKey, 3));
+                    M.CreateCondBr(M.CreateICmpEQ(keyHash, hash), CheckStringBlock, EndCheckBlock);
+
+                    M.SetInsertPoint(CheckStringBlock);
+                    auto *const keyString = M.CreateLoad(M.getPtrTy(), M.CreateObjStructGEP(ObjType::STRING, entryKey, 1));
+                    auto *const isSame = M.CreateICmpEQ(
+                        M.CreateCall(MemCmp, {string, keyString, M.CreateZExt(length, M.getInt64Ty())}), M.getInt32(0)
+                    );
+                    M.CreateBr(EndCheckBlock);
+
+                    M.SetInsertPoint(EndCheckBlock);
+                    auto *const result = M.CreatePHI(M.getInt1Ty(), 3);
+                    result->addIncoming(M.getFalse(), StartBlock);
+                    result->addIncoming(M.getFalse(), CheckHashBlock);
+                    result->addIncoming(isSame, CheckStringBlock);
+                    return result;
+                },
+                index, FoundBlock, NotFoundBlock
             );
 
-            B.CreateBr(ForStartBlock);
+            B.SetInsertPoint(FoundBlock);
+            auto *const entry = B.CreateInBoundsGEP(B.getModule().getEntryStructType(), entries, B.CreateLoad(B.getInt32Ty(), index), "entry");
+            B.CreateRet(B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getEntryStructType(), entry, 0)));
+
+            B.SetInsertPoint(NotFoundBlock);
+            B.CreateRet(B.getNullPtr());
 
             return F;
         }());
@@ -216,68 +207,87 @@ namespace lox {
         return CreateCall(AllocateStringFunction, {String, Length}, name);
     }
 
-    Value *LoxBuilder::AllocateString(const StringRef String, const std::string_view name) {
-        static auto *AllocateStringFunction([this] {
-            auto *const F = Function::Create(
-                FunctionType::get(
-                    getPtrTy(),
-                    {getPtrTy(), getInt32Ty(), getInt32Ty()},
-                    false
-                ),
-                Function::InternalLinkage,
-                "$allocateString",
-                getModule()
-            );
-
-            LoxBuilder B(getContext(), getModule(), *F);
-
-            auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
-            B.SetInsertPoint(EntryBasicBlock);
-
-            auto *const arguments = F->args().begin();
-
-            auto *const String = arguments;
-            auto *const Length = arguments + 1;
-            auto *const hash = arguments + 2;
-
-            auto *const interned = FindStringEntry(B, B.CreateLoad(B.getPtrTy(), B.getModule().getRuntimeStrings()), String, Length, hash);
-
-            auto *const IsInternedBlock = B.CreateBasicBlock("is.interned");
-            auto *const NotInternedBlock = B.CreateBasicBlock("end");
-
-            B.CreateCondBr(B.CreateIsNull(interned), NotInternedBlock, IsInternedBlock);
-
-            B.SetInsertPoint(IsInternedBlock);
-            B.CreateRet(interned);
-
-            B.SetInsertPoint(NotInternedBlock);
-
-            auto *const ptr = B.AllocateObj(ObjType::STRING);
+    Constant *LoxBuilder::CreateStringConstant(const StringRef String) {
+        auto &constants = getModule().getStringConstants();
+        if (auto *const constant = constants.lookup(String)) { return constant; }
 
-            B.CreateStore(String, B.CreateObjStructGEP(ObjType::STRING, ptr, 1));
-            B.CreateStore(Length, B.CreateObjStructGEP(ObjType::STRING, ptr, 2));
-            B.CreateStore(hash, B.CreateObjStructGEP(ObjType::STRING, ptr, 3));
-            B.CreateStore(B.getFalse(), B.CreateObjStructGEP(ObjType::STRING, ptr, 4));
-
-            B.TableSet(B.CreateLoad(B.getPtrTy(), B.getModule().getRuntimeStrings()), ptr, B.getNilVal());
-
-            B.CreateRet(ptr);
-
-            return F;
-        }());
-
-        // FNV-1a hash function.
+        // FNV-1a hash function, matching the runtime $strhash.
         unsigned int hash = -2128831035;
         for (const char i: String) {
-            hash ^= i;
+            hash ^= static_cast<unsigned char>(i);
             hash *= 16777619;
         }
 
-        auto *const ptr = CreateCall(AllocateStringFunction, {CreateGlobalCachedString(String), getInt32(String.size()), getInt32(hash)}, name);
+        // String constants are not in the heap, so the GC
+        // treats them as permanently marked and never sweeps them.
+        auto *const StringStruct = getModule().getStructType(ObjType::STRING);
+        auto *const constant = new GlobalVariable(
+            getModule(), StringStruct, false, GlobalValue::PrivateLinkage,
+            ConstantStruct::get(
+                StringStruct,
+                {ConstantStruct::get(getModule().getObjStructType(), {ObjTypeInt(ObjType::STRING)}),
+                 CreateGlobalCachedString(String), getInt32(String.size()), getInt32(hash), getFalse()}
+            ),
+            "$string"
+        );
+        constant->setAlignment(Align(8));
+        constants[String] = constant;
+
+        return constant;
+    }
 
-        CreateInvariantStart(ptr, getSizeOf(ObjType::STRING));
+    Value *LoxBuilder::AllocateInternTable() {
+        auto *const table = AllocateTable();
+        auto &constants = getModule().getStringConstants();
+        if (constants.empty()) { return table; }
+
+        // Lay out the entries and control bytes as $tableSet would, so that
+        // the string constants are interned without hashing or probing at runtime.
+        unsigned int capacity = TABLE_GROUP_WIDTH;
+        while (constants.size() + 1 > capacity * 3 / 4) { capacity *= 2; }
+
+        auto *const EntryStruct = getModule().getEntryStructType();
+        auto *const empty = ConstantStruct::get(EntryStruct, {getNullPtr(), getInt64(0)});
+        std::vector<Constant *> entries(capacity, empty);
+        std::vector<int8_t> control(capacity, CONTROL_EMPTY);
+        for (const auto &entry: constants) {
+            const auto *const hash = cast<ConstantInt>(entry.getValue()->getInitializer()->getAggregateElement(3));
+            const auto h = static_cast<uint32_t>(hash->getZExtValue());
+            auto start = ProbeStart(h, capacity);
+            auto index = start;
+            while (control[index] != CONTROL_EMPTY) {
+                index = start + (index + 1 - start) % TABLE_GROUP_WIDTH;
+                if (index == start) { index = start = (start + TABLE_GROUP_WIDTH) & (capacity - 1); }
+            }
+            entries[index] = ConstantStruct::get(EntryStruct, {entry.getValue(), cast<Constant>(getNilVal())});
+            control[index] = ControlHash(h);
+        }
 
-        return ptr;
+        auto *const EntriesType = ArrayType::get(EntryStruct, capacity);
+        auto *const ControlType = ArrayType::get(getInt8Ty(), capacity);
+        auto *const PrebuiltType = StructType::get(getContext(), {EntriesType, ControlType});
+        auto *const prebuilt = new GlobalVariable(
+            getModule(), PrebuiltType, true, GlobalValue::PrivateLinkage,
+            ConstantStruct::get(
+                PrebuiltType,
+                {ConstantArray::get(EntriesType, entries),
+                 ConstantDataArray::get(getContext(), ArrayRef(reinterpret_cast<const uint8_t *>(control.data()), capacity))}
+            ),
+            "$strings.prebuilt"
+        );
+        prebuilt->setAlignment(Align(8));
+
+        auto *const size = getSizeOf(PrebuiltType, 1);
+        auto *const ptr = AllocateBuffer(size, "entries");
+        CreateMemCpy(ptr, Align(8), prebuilt, Align(8), size);
+
+        auto *const TableStruct = getModule().getTableStructType();
+        CreateStore(getInt32(constants.size()), CreateStructGEP(TableStruct, table, 0));
+        CreateStore(getInt32(capacity), CreateStructGEP(TableStruct, table, 1));
+        CreateStore(ptr, CreateStructGEP(TableStruct, table, 2));
+        CreateStore(CreateStructGEP(PrebuiltType, ptr, 1), CreateStructGEP(TableStruct, table, 3));
+
+        return table;
     }
 
     Value *LoxBuilder::Concat(Value *a, Value *b) {
@@ -316,8 +326,7 @@ namespace lox {
                 true
             );
 
-            auto *const StringMalloc = B.CreateRealloc(
-                B.getNullPtr(),
+            auto *const StringMalloc = B.AllocateBuffer(
                 B.CreateSExt(B.CreateAdd(B.getInt32(1), NewLength, "NewLength", true, true), B.getInt64Ty()), "concat string"
             );
 
@@ -359,7 +368,10 @@ namespace lox {
 
             B.SetInsertPoint(IsInternedBlock);
             // Temporary string not required anymore.
-            B.IRBuilder::CreateFree(StringMalloc);
+            B.FreeBuffer(StringMalloc);
+            // The intern table is weak, so the string may have been unreachable since
+            // a major collection started marking: reviving it must mark it.
+            DeletionBarrier(B, B.ObjVal(interned));
             B.CreateRet(interned);
 
             B.SetInsertPoint(NotInternedBlock);
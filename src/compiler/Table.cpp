@@ -1,9 +1,11 @@
 #include "Table.h"
 #include "../Debug.h"
+#include "GC.h"
 #include "LoxBuilder.h"
 #include "Memory.h"
 #include "ModuleCompiler.h"
 
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/Value.h>
 
 namespace lox {
@@ -27,14 +29,12 @@ namespace lox {
             auto *const EntryBasicBlock = B.CreateBasicBlock("entry");
             B.SetInsertPoint(EntryBasicBlock);
 
-            auto *const ptr = B.CreateRealloc(
-                B.getNullPtr(),
-                B.getSizeOf(getModule().getTableStructType()), "table"
-            );
+            auto *const ptr = B.AllocateBuffer(B.getSizeOf(getModule().getTableStructType(), 1), "table");
 
             B.CreateStore(B.getInt32(0), B.CreateStructGEP(B.getModule().getTableStructType(), ptr, 0));
             B.CreateStore(B.getInt32(0), B.CreateStructGEP(B.getModule().getTableStructType(), ptr, 1));
             B.CreateStore(B.getNullPtr(), B.CreateStructGEP(B.getModule().getTableStructType(), ptr, 2));
+            B.CreateStore(B.getNullPtr(), B.CreateStructGEP(B.getModule().getTableStructType(), ptr, 3));
 
             B.CreateRet(ptr);
 
@@ -44,12 +44,117 @@ namespace lox {
         return CreateCall(AllocateTableFunction);
     }
 
-    Value *FindEntry(LoxBuilder &Builder, Value *Entries, Value *Capacity, Value *Key) {
+    void CreateTableProbe(
+        LoxBuilder &B, Value *Control, Value *Capacity, Value *Hash,
+        const std::function<Value *(LoxBuilder &, Value *)> &IsMatch, Value *Index, BasicBlock *FoundBlock,
+        BasicBlock *NotFoundBlock
+    ) {
+        auto *const F = B.GetInsertBlock()->getParent();
+        auto *const GroupType = FixedVectorType::get(B.getInt8Ty(), TABLE_GROUP_WIDTH);
+        auto *const GroupMaskType = B.getIntNTy(TABLE_GROUP_WIDTH);
+
+        auto *const start = CreateEntryBlockAlloca(F, B.getInt32Ty(), "probe.start");
+        auto *const matches = CreateEntryBlockAlloca(F, B.getInt32Ty(), "probe.matches");
+        auto *const insert = CreateEntryBlockAlloca(F, B.getInt32Ty(), "probe.insert");
+
+        auto *const mask = B.CreateSub(Capacity, B.getInt32(1), "capacity-1", true, true);
+        auto *const controlHash = B.CreateVectorSplat(
+            TABLE_GROUP_WIDTH, B.CreateTrunc(B.CreateAnd(Hash, B.getInt32(0x7f)), B.getInt8Ty()), "control.hash"
+        );
+        B.CreateStore(
+            B.CreateAnd(B.CreateMul(B.CreateLShr(Hash, B.getInt32(7)), B.getInt32(TABLE_GROUP_WIDTH)), mask), start
+        );
+        B.CreateStore(B.getInt32(-1), insert);
+
+        auto *const GroupBlock = B.CreateBasicBlock("probe.group");
+        auto *const MatchCondBlock = B.CreateBasicBlock("probe.match.cond");
+        auto *const MatchBlock = B.CreateBasicBlock("probe.match");
+        auto *const MatchFoundBlock = B.CreateBasicBlock("probe.found");
+        auto *const NoMatchBlock = B.CreateBasicBlock("probe.nomatch");
+        auto *const SetInsertBlock = B.CreateBasicBlock("probe.setinsert");
+        auto *const CheckEmptyBlock = B.CreateBasicBlock("probe.checkempty");
+        auto *const MatchNotFoundBlock = B.CreateBasicBlock("probe.notfound");
+        auto *const NextGroupBlock = B.CreateBasicBlock("probe.next");
+
+        // Compares all the control bytes of a group at once and collects the
+        // results as a bit mask, which SSE2 does with a pcmpeqb and a pmovmskb.
+        auto GroupMask = [&](Value *Comparison) {
+            return B.CreateZExt(B.CreateBitCast(Comparison, GroupMaskType), B.getInt32Ty());
+        };
+        auto FirstSlot = [&](Value *GroupStart, Value *Mask) {
+            return B.CreateAdd(GroupStart, B.CreateIntrinsic(Intrinsic::cttz, {B.getInt32Ty()}, {Mask, B.getTrue()}));
+        };
+
+        B.CreateBr(GroupBlock);
+        B.SetInsertPoint(GroupBlock);
+        auto *const groupStart = B.CreateLoad(B.getInt32Ty(), start, "group.start");
+        auto *const group = B.CreateAlignedLoad(
+            GroupType, B.CreateInBoundsGEP(B.getInt8Ty(), Control, groupStart), Align(1), "group"
+        );
+
+        B.CreateStore(GroupMask(B.CreateICmpEQ(group, controlHash)), matches);
+        B.CreateBr(MatchCondBlock);
+
+        B.SetInsertPoint(MatchCondBlock);
+        B.CreateCondBr(B.CreateICmpNE(B.CreateLoad(B.getInt32Ty(), matches), B.getInt32(0)), MatchBlock, NoMatchBlock);
+
+        B.SetInsertPoint(MatchBlock);
+        {
+            auto *const remaining = B.CreateLoad(B.getInt32Ty(), matches);
+            auto *const index = FirstSlot(groupStart, remaining);
+            // Clear the lowest set bit, so the next iteration checks the next match.
+            B.CreateStore(B.CreateAnd(remaining, B.CreateSub(remaining, B.getInt32(1))), matches);
+            B.CreateCondBr(IsMatch(B, index), MatchFoundBlock, MatchCondBlock);
+
+            B.SetInsertPoint(MatchFoundBlock);
+            B.CreateStore(index, Index);
+            B.CreateBr(FoundBlock);
+        }
+
+        B.SetInsertPoint(NoMatchBlock);
+        {
+            // Empty and deleted control bytes are the negative ones.
+            auto *const available = GroupMask(B.CreateICmpSLT(group, Constant::getNullValue(GroupType)));
+            B.CreateCondBr(
+                B.CreateAnd(
+                    B.CreateICmpSLT(B.CreateLoad(B.getInt32Ty(), insert), B.getInt32(0)),
+                    B.CreateICmpNE(available, B.getInt32(0))
+                ),
+                SetInsertBlock,
+                CheckEmptyBlock
+            );
+
+            B.SetInsertPoint(SetInsertBlock);
+            B.CreateStore(FirstSlot(groupStart, available), insert);
+            B.CreateBr(CheckEmptyBlock);
+        }
+
+        B.SetInsertPoint(CheckEmptyBlock);
+        {
+            // The key would have been inserted before an empty slot,
+            // so a group with an empty slot ends the probe.
+            auto *const empty = GroupMask(B.CreateICmpEQ(
+                group, ConstantVector::getSplat(ElementCount::getFixed(TABLE_GROUP_WIDTH), B.getInt8(CONTROL_EMPTY))
+            ));
+            B.CreateCondBr(B.CreateICmpNE(empty, B.getInt32(0)), MatchNotFoundBlock, NextGroupBlock);
+
+            B.SetInsertPoint(MatchNotFoundBlock);
+            B.CreateStore(B.CreateLoad(B.getInt32Ty(), insert), Index);
+            B.CreateBr(NotFoundBlock);
+        }
+
+        B.SetInsertPoint(NextGroupBlock);
+        B.CreateStore(B.CreateAnd(B.CreateAdd(groupStart, B.getInt32(TABLE_GROUP_WIDTH)), mask), start);
+        B.CreateBr(GroupBlock);
+    }
+
+    // Returns the slot of the key or, if it's not in the table, the slot to insert it into.
+    Value *FindEntry(LoxBuilder &Builder, Value *Entries, Value *Control, Value *Capacity, Value *Key) {
         static auto *FindEntryFunction([&Builder] {
             auto *const F = Function::Create(
                 FunctionType::get(
-                    Builder.getPtrTy(),
-                    {Builder.getPtrTy(), Builder.getInt32Ty(), Builder.getPtrTy()},
+                    Builder.getInt32Ty(),
+                    {Builder.getPtrTy(), Builder.getPtrTy(), Builder.getInt32Ty(), Builder.getPtrTy()},
                     false
                 ),
                 Function::InternalLinkage,
@@ -64,88 +169,38 @@ namespace lox {
 
             auto *const arguments = F->arg_begin();
             auto *const entries = arguments;
-            auto *const capacity = arguments + 1;
-            auto *const key = arguments + 2;
+            auto *const control = arguments + 1;
+            auto *const capacity = arguments + 2;
+            auto *const key = arguments + 3;
 
             auto *const hash = B.CreateLoad(B.getInt32Ty(), B.CreateObjStructGEP(ObjType::STRING, key, 3, "hash"));
             auto *const index = CreateEntryBlockAlloca(F, B.getInt32Ty(), "index");
-            auto *const tombstone = CreateEntryBlockAlloca(F, B.getPtrTy(), "tombstone");
-            B.CreateStore(Constant::getNullValue(PointerType::getUnqual(B.getContext())), tombstone);
-            B.CreateStore(B.CreateURem(hash, capacity), index);
 
-            auto *const ForStartBlock = B.CreateBasicBlock("for.start");
+            auto *const EndBlock = B.CreateBasicBlock("end");
 
-            B.CreateBr(ForStartBlock);
-            B.SetInsertPoint(ForStartBlock);
-            {
-                auto *const entry = B.CreateInBoundsGEP(B.getModule().getEntryStructType(), entries, B.CreateLoad(B.getInt32Ty(), index), "entryx");
-                auto *const entryKey = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getEntryStructType(), entry, 0));
-
-                auto *const KeyIsNullBlock = B.CreateBasicBlock("key.null");
-                auto *const KeyIsNotNullBlock = B.CreateBasicBlock("key.notnull");
-                auto *const CheckKeyIsSameBlock = B.CreateBasicBlock("key.issame?");
-                auto *const KeyIsSameBlock = B.CreateBasicBlock("key.issame");
-                auto *const EndIfBlock = B.CreateBasicBlock("key.endif");
-
-                B.CreateCondBr(B.CreateIsNull(entryKey), KeyIsNullBlock, KeyIsNotNullBlock);
-
-                B.SetInsertPoint(KeyIsNullBlock);
-                {
-                    auto *const IsNilBlock = B.CreateBasicBlock("value.isnil");
-                    auto *const IsNotNilBlock = B.CreateBasicBlock("value.notnil");
-                    auto *const EndNilCheckBlock = B.CreateBasicBlock("value.end");
-
-                    auto *const entryValue = B.CreateLoad(B.getInt64Ty(), B.CreateStructGEP(B.getModule().getEntryStructType(), entry, 1));
-                    B.CreateCondBr(B.IsNil(entryValue), IsNilBlock, IsNotNilBlock);
-
-                    B.SetInsertPoint(IsNilBlock);
-                    auto *const tombstonePtr = B.CreateLoad(B.getPtrTy(), tombstone);
-                    B.CreateRet(B.CreateSelect(B.CreateIsNotNull(tombstonePtr), tombstonePtr, entry));
-
-                    B.SetInsertPoint(IsNotNilBlock);
-                    {
-                        auto *const IsTombstoneNullBlock = B.CreateBasicBlock("tombstone.isnull");
-
-                        B.CreateCondBr(B.CreateIsNull(B.CreateLoad(B.getPtrTy(), tombstone)), IsTombstoneNullBlock, EndNilCheckBlock);
-                        B.SetInsertPoint(IsTombstoneNullBlock);
-                        {
-                            B.CreateStore(entry, tombstone);
-                            B.CreateBr(EndNilCheckBlock);
-                        }
-                        B.SetInsertPoint(EndNilCheckBlock);
-                        {
-                            B.CreateBr(EndIfBlock);
-                        }
-                    }
-                }
-                B.SetInsertPoint(KeyIsNotNullBlock);
-                {
-                    B.CreateBr(CheckKeyIsSameBlock);
-                }
-                B.SetInsertPoint(CheckKeyIsSameBlock);
-                {
-                    B.CreateCondBr(B.CreateICmpEQ(B.CreatePtrDiff(B.getPtrTy(), entryKey, key), B.getInt64(0)), KeyIsSameBlock, EndIfBlock);
-                    B.SetInsertPoint(KeyIsSameBlock);
-                    {
-                        B.CreateRet(entry);
-                    }
-                }
-                B.SetInsertPoint(EndIfBlock);
-                {
-                    // index = (index + 1) & (capacity - 1) === index = index % capacity
-                    B.CreateStore(
-                        B.CreateAnd(B.CreateAdd(B.CreateLoad(B.getInt32Ty(), index), B.getInt32(1), "index+1", true, true), B.CreateSub(capacity, B.getInt32(1), "capacity-1", true, true)),
-                        index
-                    );
-
-                    B.CreateBr(ForStartBlock);
-                }
-            }
+            CreateTableProbe(
+                B, control, capacity, hash,
+                [&](LoxBuilder &M, Value *slot) {
+                    // Keys are interned strings, so they can be compared by pointer.
+                    auto *const entry = M.CreateInBoundsGEP(M.getModule().getEntryStructType(), entries, slot, "entry");
+                    auto *const entryKey =
+                        M.CreateLoad(M.getPtrTy(), M.CreateStructGEP(M.getModule().getEntryStructType(), entry, 0));
+                    return M.CreateICmpEQ(entryKey, key);
+                },
+                index, EndBlock, EndBlock
+            );
+
+            B.SetInsertPoint(EndBlock);
+            B.CreateRet(B.CreateLoad(B.getInt32Ty(), index));
 
             return F;
         }());
 
-        return Builder.CreateCall(FindEntryFunction, {Entries, Capacity, Key});
+        return Builder.CreateCall(FindEntryFunction, {Entries, Control, Capacity, Key});
+    }
+
+    static Value *ControlByte(LoxBuilder &B, Value *Control, Value *Index) {
+        return B.CreateInBoundsGEP(B.getInt8Ty(), Control, Index, "control");
     }
 
     void PrintEntry(LoxBuilder &B, Value *value) {
@@ -183,107 +238,87 @@ namespace lox {
             if constexpr (DEBUG_LOG_GC) {
                 B.PrintF({B.CreateGlobalCachedString("adjustCapcity: %d\n"), capacity});
             }
-            auto *const entries = B.CreateRealloc(B.getNullPtr(), B.getSizeOf(B.getModule().getEntryStructType(), capacity), "entries");
-            auto *const i = CreateEntryBlockAlloca(F, B.getInt32Ty(), "i");
-
-            B.CreateStore(B.getInt32(0), i);
 
-            // First initialize all entries to null values.
-            auto *const ForCond = B.CreateBasicBlock("for.cond");
-            auto *const ForBody = B.CreateBasicBlock("for.body");
-            auto *const ForInc = B.CreateBasicBlock("for.inc");
-            auto *const ForEnd = B.CreateBasicBlock("for.end");
-
-            B.CreateBr(ForCond);
-            B.SetInsertPoint(ForCond);
-            B.CreateCondBr(B.CreateICmpSLT(B.CreateLoad(B.getInt32Ty(), i), capacity), ForBody, ForEnd);
-            B.SetInsertPoint(ForBody);
-
-            auto *const entry = B.CreateInBoundsGEP(B.getModule().getEntryStructType(), entries, B.CreateLoad(B.getInt32Ty(), i));
-
-            // key
-            B.CreateStore(
-                B.getNullPtr(),
-                B.CreateStructGEP(getModule().getEntryStructType(), entry, 0)
+            // The control bytes follow the entries in the same allocation.
+            auto *const entriesSize =
+                B.CreateZExt(B.getSizeOf(B.getModule().getEntryStructType(), capacity), B.getInt64Ty());
+            auto *const entries = B.AllocateBuffer(
+                B.CreateAdd(entriesSize, B.CreateZExt(capacity, B.getInt64Ty())), "entries"
             );
+            auto *const control = B.CreateInBoundsGEP(B.getInt8Ty(), entries, entriesSize, "control");
 
-            // value
-            B.CreateStore(
-                B.getNilVal(),
-                B.CreateStructGEP(getModule().getEntryStructType(), entry, 1)
-            );
-
-            B.CreateBr(ForInc);
-            B.SetInsertPoint(ForInc);
-            B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt32Ty(), i), B.getInt32(1), "i+1", true, true), i);
-            B.CreateBr(ForCond);
-
-            B.SetInsertPoint(ForEnd);
+            // Empty slots have a null key, so that iterating the entries can skip them.
+            B.CreateMemSet(entries, B.getInt8(0), entriesSize, Align(8));
+            B.CreateMemSet(control, B.getInt8(CONTROL_EMPTY), capacity, Align(1));
 
             B.CreateStore(
                 B.getInt32(0),
                 B.CreateStructGEP(B.getModule().getTableStructType(), table, 0)
             );
 
-            // ...
+            auto *const i = CreateEntryBlockAlloca(F, B.getInt32Ty(), "i");
             B.CreateStore(B.getInt32(0), i);
 
-            auto *const ForCond2 = B.CreateBasicBlock("for.cond");
-            auto *const ForBody2 = B.CreateBasicBlock("for.body");
-            auto *const ForInc2 = B.CreateBasicBlock("for.inc");
-            auto *const ForEnd2 = B.CreateBasicBlock("for.end");
+            auto *const ForCond = B.CreateBasicBlock("for.cond");
+            auto *const ForBody = B.CreateBasicBlock("for.body");
+            auto *const ForInc = B.CreateBasicBlock("for.inc");
+            auto *const ForEnd = B.CreateBasicBlock("for.end");
 
             auto *const tableCapacity = B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 1));
+            auto *const oldEntries = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 2));
+            auto *const oldControl = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 3));
 
-            B.CreateBr(ForCond2);
-            B.SetInsertPoint(ForCond2);
+            B.CreateBr(ForCond);
+            B.SetInsertPoint(ForCond);
 
             B.CreateCondBr(
                 B.CreateICmpSLT(
                     B.CreateLoad(B.getInt32Ty(), i),
                     tableCapacity
                 ),
-                ForBody2,
-                ForEnd2
+                ForBody,
+                ForEnd
             );
-            B.SetInsertPoint(ForBody2);
+            B.SetInsertPoint(ForBody);
 
-            auto *const NotNullBlock = B.CreateBasicBlock("key.notnull");
+            auto *const FullBlock = B.CreateBasicBlock("slot.full");
 
-            auto *const entry2 = B.CreateInBoundsGEP(
-                B.getModule().getEntryStructType(),
-                B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 2)),
-                B.CreateLoad(B.getInt32Ty(), i)
-            );
-            auto *const entryKeyPtr = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(getModule().getEntryStructType(), entry2, 0));
-            B.CreateCondBr(B.CreateIsNull(entryKeyPtr), ForInc2, NotNullBlock);
+            auto *const index = B.CreateLoad(B.getInt32Ty(), i);
+            auto *const oldControlByte = B.CreateLoad(B.getInt8Ty(), ControlByte(B, oldControl, index));
+            B.CreateCondBr(B.CreateICmpSLT(oldControlByte, B.getInt8(0)), ForInc, FullBlock);
 
-            B.SetInsertPoint(NotNullBlock);
+            B.SetInsertPoint(FullBlock);
 
-            auto *const dest = FindEntry(B, entries, capacity, entryKeyPtr);
+            auto *const entry = B.CreateInBoundsGEP(B.getModule().getEntryStructType(), oldEntries, index);
+            auto *const entryKeyPtr = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(getModule().getEntryStructType(), entry, 0));
+
+            auto *const slot = FindEntry(B, entries, control, capacity, entryKeyPtr);
+            auto *const dest = B.CreateInBoundsGEP(B.getModule().getEntryStructType(), entries, slot);
 
             B.CreateStore(
                 entryKeyPtr,
                 B.CreateStructGEP(getModule().getEntryStructType(), dest, 0)
             );
             B.CreateStore(
-                B.CreateLoad(B.getInt64Ty(), B.CreateStructGEP(getModule().getEntryStructType(), entry2, 1)),
+                B.CreateLoad(B.getInt64Ty(), B.CreateStructGEP(getModule().getEntryStructType(), entry, 1)),
                 B.CreateStructGEP(getModule().getEntryStructType(), dest, 1)
             );
+            B.CreateStore(oldControlByte, ControlByte(B, control, slot));
 
             auto *const count = B.CreateStructGEP(B.getModule().getTableStructType(), table, 0);
             B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt32Ty(), count), B.getInt32(1), "count+1", true, true), count);
 
-            B.CreateBr(ForInc2);
-            B.SetInsertPoint(ForInc2);
+            B.CreateBr(ForInc);
+            B.SetInsertPoint(ForInc);
             B.CreateStore(B.CreateAdd(B.CreateLoad(B.getInt32Ty(), i), B.getInt32(1), "i+1", true, true), i);
-            B.CreateBr(ForCond2);
+            B.CreateBr(ForCond);
 
-            B.SetInsertPoint(ForEnd2);
+            B.SetInsertPoint(ForEnd);
 
-            B.IRBuilder::CreateFree(B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 2)));
+            B.FreeBuffer(oldEntries);
             B.CreateStore(capacity, B.CreateStructGEP(B.getModule().getTableStructType(), table, 1));
             B.CreateStore(entries, B.CreateStructGEP(B.getModule().getTableStructType(), table, 2));
+            B.CreateStore(control, B.CreateStructGEP(B.getModule().getTableStructType(), table, 3));
 
             B.CreateRetVoid();
 
@@ -318,6 +353,7 @@ namespace lox {
             auto *const CheckCapacityBlock = B.CreateBasicBlock("initialCapacity.check");
             auto *const EndCheckBlock = B.CreateBasicBlock("initialCapacity.checkend");
 
+            // The count includes deleted slots, so that there is always an empty slot to end a probe.
             B.CreateCondBr(
                 B.CreateICmpSGT(
                     B.CreateAdd(count, B.getInt32(1), "count+1", true, true),
@@ -329,8 +365,8 @@ namespace lox {
             B.SetInsertPoint(CheckCapacityBlock);
 
             auto *const newCapacity = B.CreateSelect(
-                B.CreateICmpSLT(initialCapacity, B.getInt32(8)),
-                B.getInt32(8),
+                B.CreateICmpSLT(initialCapacity, B.getInt32(TABLE_GROUP_WIDTH)),
+                B.getInt32(TABLE_GROUP_WIDTH),
                 B.CreateMul(initialCapacity, B.getInt32(2), "newcapacity", true, true)
             );
 
@@ -340,20 +376,19 @@ namespace lox {
             B.SetInsertPoint(EndCheckBlock);
 
             auto *const capacity = B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 1));
-            auto *const entry = FindEntry(B, B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 2)), capacity, key);
-            auto *const isNewKey = B.CreateIsNull(B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(getModule().getEntryStructType(), entry, 0)));
+            auto *const entries = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 2));
+            auto *const control = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 3));
+            auto *const slot = FindEntry(B, entries, control, capacity, key);
+            auto *const entry = B.CreateInBoundsGEP(B.getModule().getEntryStructType(), entries, slot, "entry");
+            auto *const controlByte = ControlByte(B, control, slot);
+            auto *const oldControlByte = B.CreateLoad(B.getInt8Ty(), controlByte);
+            auto *const isNewKey = B.CreateICmpSLT(oldControlByte, B.getInt8(0));
 
             auto *const IsNewEntryBlock = B.CreateBasicBlock("newentry");
             auto *const EndBlock = B.CreateBasicBlock("end");
 
-            B.CreateCondBr(
-                B.CreateAnd(
-                    isNewKey,
-                    B.IsNil(B.CreateLoad(B.getInt64Ty(), B.CreateStructGEP(getModule().getEntryStructType(), entry, 1)))
-                ),
-                IsNewEntryBlock,
-                EndBlock
-            );
+            // Reusing a deleted slot doesn't change the count.
+            B.CreateCondBr(B.CreateICmpEQ(oldControlByte, B.getInt8(CONTROL_EMPTY)), IsNewEntryBlock, EndBlock);
             B.SetInsertPoint(IsNewEntryBlock);
 
             B.CreateStore(
@@ -370,11 +405,14 @@ namespace lox {
                 B.CreateStructGEP(getModule().getEntryStructType(), entry, 0)
             );
 
-            // value
-            B.CreateStore(
-                value,
-                B.CreateStructGEP(getModule().getEntryStructType(), entry, 1)
-            );
+            // value, which is marked if it replaces the value of an existing key
+            // while the GC is marking: the values of empty and deleted slots are stale.
+            auto *const $value = B.CreateStructGEP(getModule().getEntryStructType(), entry, 1);
+            DeletionBarrier(B, B.CreateSelect(isNewKey, B.getNilVal(), B.CreateLoad(B.getInt64Ty(), $value)));
+            B.CreateStore(value, $value);
+
+            auto *const hash = B.CreateLoad(B.getInt32Ty(), B.CreateObjStructGEP(ObjType::STRING, key, 3, "hash"));
+            B.CreateStore(B.CreateTrunc(B.CreateAnd(hash, B.getInt32(0x7f)), B.getInt8Ty()), controlByte);
 
             B.CreateRet(isNewKey);
 
@@ -423,23 +461,25 @@ namespace lox {
             auto *const capacity = B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 1));
             auto *const entries = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 2));
 
-            auto *const entry = FindEntry(B, entries, capacity, key);
-            auto *const entryKey = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(getModule().getEntryStructType(), entry, 0));
+            auto *const control = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 3));
+
+            auto *const slot = FindEntry(B, entries, control, capacity, key);
 
             auto *const EntryKeyNullBlock = B.CreateBasicBlock("entry.keynull");
             auto *const EndBlock = B.CreateBasicBlock("entry.end");
 
-            B.CreateCondBr(B.CreateIsNull(entryKey), EntryKeyNullBlock, EndBlock);
+            B.CreateCondBr(B.CreateICmpSLT(B.CreateLoad(B.getInt8Ty(), ControlByte(B, control, slot)), B.getInt8(0)), EntryKeyNullBlock, EndBlock);
 
             B.SetInsertPoint(EntryKeyNullBlock);
             {
                 if constexpr (DEBUG_TABLE_ENTRIES) {
-                    B.PrintF({B.CreateGlobalCachedString("return entry key null %p (%s)\n"), entryKey, B.AsCString(B.ObjVal(key))});
+                    B.PrintF({B.CreateGlobalCachedString("return entry key null (%s)\n"), B.AsCString(B.ObjVal(key))});
                 }
                 B.CreateRet(B.getUninitializedVal());
             }
             B.SetInsertPoint(EndBlock);
 
+            auto *const entry = B.CreateInBoundsGEP(B.getModule().getEntryStructType(), entries, slot, "entry");
             auto *const entryValue = B.CreateLoad(B.getInt64Ty(), B.CreateStructGEP(getModule().getEntryStructType(), entry, 1));
 
             if constexpr (DEBUG_TABLE_ENTRIES) {
@@ -562,22 +602,25 @@ namespace lox {
             auto *const capacity = B.CreateLoad(B.getInt32Ty(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 1));
             auto *const entries = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 2));
 
-            auto *const entry = FindEntry(B, entries, capacity, key);
-            auto *const entryKey = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getEntryStructType(), entry, 0));
+            auto *const control = B.CreateLoad(B.getPtrTy(), B.CreateStructGEP(B.getModule().getTableStructType(), table, 3));
+
+            auto *const slot = FindEntry(B, entries, control, capacity, key);
+            auto *const controlByte = ControlByte(B, control, slot);
 
             auto *const EntryKeyNullBlock = B.CreateBasicBlock("entry.keynull");
             auto *const EndBlock = B.CreateBasicBlock("entry.end");
 
-            B.CreateCondBr(B.CreateIsNull(entryKey), EntryKeyNullBlock, EndBlock);
+            B.CreateCondBr(B.CreateICmpSLT(B.CreateLoad(B.getInt8Ty(), controlByte), B.getInt8(0)), EntryKeyNullBlock, EndBlock);
 
             B.SetInsertPoint(EntryKeyNullBlock);
             B.CreateRet(B.getFalse());
 
             B.SetInsertPoint(EndBlock);
 
-            // Place a tombstone.
+            // Mark the slot as deleted, so that probes continue past it.
+            auto *const entry = B.CreateInBoundsGEP(B.getModule().getEntryStructType(), entries, slot, "entry");
             B.CreateStore(B.getNullPtr(), B.CreateStructGEP(B.getModule().getEntryStructType(), entry, 0));
-            B.CreateStore(B.getTrueVal(), B.CreateStructGEP(B.getModule().getEntryStructType(), entry, 1));
+            B.CreateStore(B.getInt8(CONTROL_DELETED), controlByte);
 
             B.CreateRet(B.getTrue());
 
@@ -3,9 +3,44 @@
 #include "LoxBuilder.h"
 #include <llvm/IR/Value.h>
 
+#include <cstdint>
+#include <functional>
+
 namespace lox {
     constexpr bool DEBUG_TABLE_ENTRIES = false;
+
+    // Tables are SwissTable-style: each entry has a control byte, which is
+    // either empty, deleted or the low 7 bits of the key's hash. Lookups
+    // compare a group of control bytes at once and only look at the entries
+    // whose hash fragment matches. The capacity is a power of two and at
+    // least one group.
+    constexpr int TABLE_GROUP_WIDTH = 16;
+    constexpr int8_t CONTROL_EMPTY = -128;
+    constexpr int8_t CONTROL_DELETED = -2;
+
+    constexpr int8_t ControlHash(const uint32_t hash) { return static_cast<int8_t>(hash & 0x7f); }
+
+    // The first slot of the group where probing for the hash starts.
+    constexpr uint32_t ProbeStart(const uint32_t hash, const uint32_t capacity) {
+        return (hash >> 7) * TABLE_GROUP_WIDTH & (capacity - 1);
+    }
+
+    /**
+     * Emits a probe for the hash over the control bytes of a table.
+     *
+     * IsMatch is called with the index of each slot whose control byte matches
+     * the hash and must return an i1 which is true if the slot holds the key.
+     * If the key is found, the slot is stored into Index and control continues
+     * at FoundBlock; otherwise, the first empty or deleted slot in probe order
+     * is stored into Index and control continues at NotFoundBlock.
+     */
+    void CreateTableProbe(
+        LoxBuilder &B, Value *Control, Value *Capacity, Value *Hash,
+        const std::function<Value *(LoxBuilder &, Value *)> &IsMatch, Value *Index, BasicBlock *FoundBlock,
+        BasicBlock *NotFoundBlock
+    );
+
     void IterateTable(LoxBuilder &Builder, Value *Table, Function *FunctionPtr);
     Value *TableDelete(LoxBuilder &Builder, Value *Table, Value *Key);
 }
-#endif
\ No newline at end of file
+#endif
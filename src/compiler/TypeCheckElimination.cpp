@@ -0,0 +1,471 @@
+#include "TypeCheckElimination.h"
+
+#include "Value.h"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/PostOrderIterator.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PatternMatch.h>
+
+#include <climits>
+#include <functional>
+#include <optional>
+#include <vector>
+
+using namespace llvm::PatternMatch;
+
+namespace lox {
+    namespace {
+        // The kind of a NaN-boxed value. NONE is the kind of a value which is
+        // never computed, the bottom of the lattice, and ANY the top.
+        struct Kind {
+            enum Tag : uint8_t { NONE, NUMBER, OBJECT, OTHER, ANY } tag = NONE;
+            // The ObjType of an OBJECT, 0 if unknown.
+            uint8_t objType = 0;
+
+            bool operator==(const Kind &) const = default;
+
+            static Kind of(const uint64_t bits) {
+                if ((bits & QNAN) != QNAN) return {NUMBER};
+                if ((bits & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT)) return {OBJECT};
+                return {OTHER};
+            }
+
+            // The kind of a value which is either of a or b.
+            static Kind meet(const Kind a, const Kind b) {
+                if (a.tag == NONE) return b;
+                if (b.tag == NONE) return a;
+                if (a.tag != b.tag) return {ANY};
+                return {a.tag, a.objType == b.objType ? a.objType : uint8_t{0}};
+            }
+
+            // The kind of a value of the known kind which passed a check for the checked kind.
+            static Kind refine(const Kind known, const Kind checked) {
+                if (known.tag == checked.tag && known.objType != 0) return known;
+                return checked;
+            }
+        };
+
+        // Whether a value of the kind passes a check for the checked kind, if that's known.
+        std::optional<bool> Passes(const Kind kind, const Kind checked) {
+            switch (kind.tag) {
+                case Kind::NONE:
+                case Kind::ANY:
+                    return std::nullopt;
+                case Kind::NUMBER:
+                case Kind::OTHER:
+                    return kind.tag == checked.tag;
+                case Kind::OBJECT:
+                    if (checked.tag != Kind::OBJECT) return false;
+                    if (checked.objType == 0 || kind.objType == checked.objType) return true;
+                    if (kind.objType != 0) return false;
+                    return std::nullopt;
+            }
+            return std::nullopt;
+        }
+
+        // Returns the value checked, and the kind which passes the check, if the value is a check.
+        std::optional<std::pair<Value *, Kind>> MatchCheck(Value *value) {
+            Value *checked;
+            ICmpInst::Predicate predicate;
+            // IsNumber
+            if (match(value, m_ICmp(predicate, m_And(m_Value(checked), m_SpecificInt(QNAN)), m_SpecificInt(QNAN))) &&
+                predicate == ICmpInst::ICMP_NE) {
+                return std::pair{checked, Kind{Kind::NUMBER}};
+            }
+            // IsObj
+            if (match(value, m_ICmp(
+                                 predicate, m_And(m_Value(checked), m_SpecificInt(QNAN | SIGN_BIT)),
+                                 m_SpecificInt(QNAN | SIGN_BIT)
+                             )) &&
+                predicate == ICmpInst::ICMP_EQ) {
+                return std::pair{checked, Kind{Kind::OBJECT}};
+            }
+            // IsString, IsInstance and the other object type checks
+            if (auto *const call = dyn_cast<CallInst>(value)) {
+                if (const auto *const callee = call->getCalledFunction(); callee && callee->getName() == "$checkType") {
+                    if (const auto *const type = dyn_cast<ConstantInt>(call->getArgOperand(1))) {
+                        return std::pair{
+                            call->getArgOperand(0), Kind{Kind::OBJECT, static_cast<uint8_t>(type->getZExtValue())}
+                        };
+                    }
+                }
+            }
+            return std::nullopt;
+        }
+
+        struct Slot {
+            Kind kind{Kind::ANY};
+            // A value known to be in the slot: the last value stored, or the first loaded since.
+            Value *content = nullptr;
+
+            bool operator==(const Slot &) const = default;
+        };
+
+        // What is known at a point of the function.
+        struct State {
+            std::vector<Slot> slots;
+            // The kinds of values learned from the checks guarding the point.
+            DenseMap<Value *, Kind> refined;
+
+            bool operator==(const State &other) const {
+                if (slots != other.slots || refined.size() != other.refined.size()) return false;
+                for (const auto &[value, kind]: refined) {
+                    if (const auto it = other.refined.find(value); it == other.refined.end() || it->second != kind) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Merges the state of another path into this one.
+            void meet(const State &other) {
+                for (unsigned int i = 0; i < slots.size(); i++) {
+                    slots[i].kind = Kind::meet(slots[i].kind, other.slots[i].kind);
+                    if (slots[i].content != other.slots[i].content) slots[i].content = nullptr;
+                }
+                SmallVector<Value *> unrefined;
+                for (auto &[value, kind]: refined) {
+                    if (const auto it = other.refined.find(value); it != other.refined.end()) {
+                        kind = Kind::meet(kind, it->second);
+                    } else {
+                        unrefined.push_back(value);
+                    }
+                }
+                for (auto *const value: unrefined) refined.erase(value);
+            }
+        };
+
+        bool SameKinds(const DenseMap<Instruction *, Kind> &a, const DenseMap<Instruction *, Kind> &b) {
+            if (a.size() != b.size()) return false;
+            for (const auto &[I, kind]: a) {
+                if (const auto it = b.find(I); it == b.end() || it->second != kind) return false;
+            }
+            return true;
+        }
+
+        // A loaded value may depend on values from later rounds of the analysis,
+        // so the number of rounds is bounded; the last one assumes nothing about loads.
+        constexpr unsigned int MAX_ROUNDS = 8;
+
+        class TypeCheckElimination {
+            Function &F;
+            std::vector<BasicBlock *> order;
+            unsigned int slotCount = 0;
+            // The loads and stores of the tracked slots, with the slot index.
+            DenseMap<Instruction *, unsigned int> slotAccesses;
+            // Instructions which overwrite every slot, such as the memset clearing the frame.
+            SmallPtrSet<Instruction *, 2> clobbers;
+            // The kind of each load of a slot, from the previous round.
+            DenseMap<Instruction *, Kind> loadKinds;
+            bool pessimistic = false;
+            // The kinds of values, which don't depend on the point where they're used.
+            DenseMap<Value *, Kind> kinds;
+            // The values being evaluated, with their depth, to break cycles through phis.
+            DenseMap<Value *, unsigned int> evaluating;
+            DenseMap<BasicBlock *, State> states;
+
+            /**
+             * Finds the root frame, the alloca linked into $rootFrames, and its
+             * slots which only the function accesses: a slot whose address is
+             * passed anywhere, such as to capture it in an upvalue, isn't tracked.
+             */
+            void collectSlots() {
+                const auto &DL = F.getParent()->getDataLayout();
+                auto *const rootFrames = F.getParent()->getNamedGlobal("$rootFrames");
+                if (rootFrames == nullptr) return;
+
+                AllocaInst *frame = nullptr;
+                for (auto &I: instructions(F)) {
+                    if (auto *const store = dyn_cast<StoreInst>(&I); store && store->getPointerOperand() == rootFrames) {
+                        frame = dyn_cast<AllocaInst>(store->getValueOperand());
+                        if (frame != nullptr) break;
+                    }
+                }
+                if (frame == nullptr) return;
+                auto *const FrameType = dyn_cast<StructType>(frame->getAllocatedType());
+                // The slots are the last element, after the header.
+                if (FrameType == nullptr || FrameType->getNumElements() < 2) return;
+                const auto slotsIndex = FrameType->getNumElements() - 1;
+                if (!isa<ArrayType>(FrameType->getElementType(slotsIndex))) return;
+                const int64_t header = DL.getStructLayout(FrameType)->getElementOffset(slotsIndex);
+
+                DenseMap<int64_t, SmallVector<Instruction *>> accesses;
+                DenseSet<int64_t> escaped;
+                SmallPtrSet<Instruction *, 2> frameClobbers;
+                SmallVector<std::pair<Value *, int64_t>> worklist{{frame, 0}};
+                while (!worklist.empty()) {
+                    auto [pointer, offset] = worklist.pop_back_val();
+                    for (auto *const user: pointer->users()) {
+                        auto *const I = cast<Instruction>(user);
+                        if (auto *const GEP = dyn_cast<GetElementPtrInst>(I)) {
+                            APInt GEPOffset(DL.getIndexTypeSizeInBits(GEP->getType()), 0);
+                            if (!GEP->accumulateConstantOffset(DL, GEPOffset)) return;
+                            worklist.emplace_back(GEP, offset + GEPOffset.getSExtValue());
+                        } else if (auto *const load = dyn_cast<LoadInst>(I)) {
+                            if (offset < header) continue;
+                            if (load->getType()->isIntegerTy(64) && load->isSimple()) {
+                                accesses[offset].push_back(load);
+                            } else {
+                                escaped.insert(offset);
+                            }
+                        } else if (auto *const store = dyn_cast<StoreInst>(I);
+                                   store && store->getPointerOperand() == pointer && store->getValueOperand() != pointer) {
+                            if (offset < header) continue;
+                            if (store->getValueOperand()->getType()->isIntegerTy(64) && store->isSimple()) {
+                                accesses[offset].push_back(store);
+                            } else {
+                                escaped.insert(offset);
+                            }
+                        } else if (store && offset == 0 && store->getPointerOperand() == rootFrames) {
+                            // Linking the frame into the chain: the GC only reads the slots.
+                        } else if (isa<PtrToIntInst>(I) && offset == 0) {
+                            // The stack overflow check only compares the frame's address.
+                        } else if (auto *const memset = dyn_cast<MemSetInst>(I);
+                                   memset && memset->getDest() == pointer) {
+                            frameClobbers.insert(memset);
+                        } else if (offset >= header) {
+                            escaped.insert(offset);
+                        } else {
+                            return;
+                        }
+                    }
+                }
+
+                clobbers = std::move(frameClobbers);
+                for (const auto &[offset, instructions]: accesses) {
+                    if (escaped.contains(offset)) continue;
+                    for (auto *const I: instructions) slotAccesses[I] = slotCount;
+                    slotCount++;
+                }
+            }
+
+            /**
+             * Finds the locals which have no slot in the root frame, allocas of an
+             * i64 which are only loaded and stored; they're tracked like slots.
+             */
+            void collectAllocaSlots() {
+                for (auto &I: F.getEntryBlock()) {
+                    auto *const alloca = dyn_cast<AllocaInst>(&I);
+                    if (alloca == nullptr || !alloca->getAllocatedType()->isIntegerTy(64)) continue;
+                    const auto tracked = all_of(alloca->users(), [alloca](const User *user) {
+                        if (const auto *const load = dyn_cast<LoadInst>(user)) {
+                            return load->getType()->isIntegerTy(64) && load->isSimple();
+                        }
+                        const auto *const store = dyn_cast<StoreInst>(user);
+                        return store != nullptr && store->getValueOperand() != alloca &&
+                               store->getValueOperand()->getType()->isIntegerTy(64) && store->isSimple();
+                    });
+                    if (!tracked) continue;
+                    for (auto *const user: alloca->users()) slotAccesses[cast<Instruction>(user)] = slotCount;
+                    slotCount++;
+                }
+            }
+
+            // The kind of a value, and the lowest depth of the values being evaluated
+            // which it depends on, if any. A value in a cycle of phis is evaluated
+            // optimistically, so it's only known once the first value of the cycle is.
+            std::pair<Kind, unsigned int> evaluate(Value *value) {
+                if (auto *const constant = dyn_cast<ConstantInt>(value)) {
+                    return {constant->getBitWidth() == 64 ? Kind::of(constant->getZExtValue()) : Kind{Kind::ANY}, UINT_MAX};
+                }
+                if (auto *const constant = dyn_cast<ConstantFP>(value)) {
+                    return {Kind::of(constant->getValueAPF().bitcastToAPInt().getZExtValue()), UINT_MAX};
+                }
+                if (!isa<Instruction>(value)) return {Kind{Kind::ANY}, UINT_MAX};
+                if (const auto it = kinds.find(value); it != kinds.end()) return {it->second, UINT_MAX};
+                if (const auto it = evaluating.find(value); it != evaluating.end()) return {Kind{Kind::NONE}, it->second};
+
+                const unsigned int depth = evaluating.size();
+                evaluating[value] = depth;
+                unsigned int dependsOn = UINT_MAX;
+                const auto operand = [&](Value *op) {
+                    const auto [kind, opDependsOn] = evaluate(op);
+                    dependsOn = std::min(dependsOn, opDependsOn);
+                    return kind;
+                };
+
+                Kind kind{Kind::ANY};
+                Value *ptr;
+                if (auto *const phi = dyn_cast<PHINode>(value)) {
+                    kind = Kind{Kind::NONE};
+                    for (Value *const incoming: phi->incoming_values()) kind = Kind::meet(kind, operand(incoming));
+                } else if (auto *const select = dyn_cast<SelectInst>(value)) {
+                    kind = Kind::meet(operand(select->getTrueValue()), operand(select->getFalseValue()));
+                } else if (isa<LoadInst>(value)) {
+                    if (slotAccesses.contains(cast<Instruction>(value)) && !pessimistic) {
+                        kind = loadKinds.lookup(cast<Instruction>(value));
+                    }
+                } else if (auto *const bitcast = dyn_cast<BitCastInst>(value)) {
+                    // Between i64 and double: only numbers are boxed as their bits.
+                    if (operand(bitcast->getOperand(0)).tag == Kind::NUMBER) kind = Kind{Kind::NUMBER};
+                } else if (value->getType()->isDoubleTy() &&
+                           (isa<BinaryOperator, UnaryOperator, SIToFPInst, UIToFPInst>(value))) {
+                    // The NaN which arithmetic produces from numbers is a number too.
+                    kind = Kind{Kind::NUMBER};
+                } else if (value->getType()->isDoubleTy() && isa<Argument, LoadInst>(value)) {
+                    // Number clones of functions are only called with numbers,
+                    // and locals are only kept as doubles if they are numbers.
+                    kind = Kind{Kind::NUMBER};
+                } else if (match(value, m_Or(m_PtrToInt(m_Value(ptr)), m_SpecificInt(QNAN | SIGN_BIT)))) {
+                    kind = Kind{Kind::OBJECT};
+                    if (auto *const call = dyn_cast<CallInst>(ptr)) {
+                        const auto *const callee = call->getCalledFunction();
+                        if (callee && callee->getName() == "$allocateObject") {
+                            if (const auto *const type = dyn_cast<ConstantInt>(call->getArgOperand(0))) {
+                                kind.objType = static_cast<uint8_t>(type->getZExtValue());
+                            }
+                        }
+                    }
+                }
+
+                evaluating.erase(value);
+                if (dependsOn >= depth) {
+                    kinds[value] = kind;
+                    return {kind, UINT_MAX};
+                }
+                return {kind, dependsOn};
+            }
+
+            Kind kindAt(Value *value, const State &state) {
+                const auto kind = evaluate(value).first;
+                if (const auto it = state.refined.find(value); it != state.refined.end()) {
+                    return Kind::refine(kind, it->second);
+                }
+                return kind;
+            }
+
+            // Applies what is known on the edge of a branch taken when the condition is true.
+            void refine(Value *condition, State &state) {
+                Value *left;
+                Value *right;
+                if (match(condition, m_LogicalAnd(m_Value(left), m_Value(right)))) {
+                    refine(left, state);
+                    refine(right, state);
+                    return;
+                }
+                const auto check = MatchCheck(condition);
+                if (!check) return;
+                const auto [value, checked] = *check;
+                state.refined[value] = Kind::refine(kindAt(value, state), checked);
+                for (auto &slot: state.slots) {
+                    if (slot.content == value) slot.kind = Kind::refine(slot.kind, checked);
+                }
+            }
+
+            void transfer(Instruction &I, State &state, DenseMap<Instruction *, Kind> *observed) {
+                if (clobbers.contains(&I)) {
+                    for (auto &slot: state.slots) slot = Slot{};
+                    return;
+                }
+                const auto it = slotAccesses.find(&I);
+                if (it == slotAccesses.end()) return;
+                auto &slot = state.slots[it->second];
+                if (auto *const store = dyn_cast<StoreInst>(&I)) {
+                    slot = Slot{kindAt(store->getValueOperand(), state), store->getValueOperand()};
+                } else {
+                    if (observed != nullptr) (*observed)[&I] = slot.kind;
+                    if (slot.content == nullptr) slot.content = &I;
+                }
+            }
+
+            // Computes the state at the start of each reachable block.
+            void solve() {
+                kinds.clear();
+                states.clear();
+                states[&F.getEntryBlock()].slots.assign(slotCount, Slot{});
+
+                for (bool changed = true; changed;) {
+                    changed = false;
+                    for (auto *const BB: order) {
+                        const auto it = states.find(BB);
+                        if (it == states.end()) continue;
+                        State state = it->second;
+                        for (auto &I: *BB) transfer(I, state, nullptr);
+
+                        auto *const terminator = BB->getTerminator();
+                        auto *const branch = dyn_cast<BranchInst>(terminator);
+                        for (unsigned int i = 0; i < terminator->getNumSuccessors(); i++) {
+                            State out = state;
+                            if (branch && branch->isConditional() && i == 0 &&
+                                branch->getSuccessor(0) != branch->getSuccessor(1)) {
+                                refine(branch->getCondition(), out);
+                            }
+                            auto [entry, inserted] = states.try_emplace(terminator->getSuccessor(i), out);
+                            if (inserted) {
+                                changed = true;
+                                continue;
+                            }
+                            State merged = entry->second;
+                            merged.meet(out);
+                            if (!(merged == entry->second)) {
+                                entry->second = std::move(merged);
+                                changed = true;
+                            }
+                        }
+                    }
+                }
+            }
+
+            // Replays the reachable blocks from their solved states, calling the
+            // function with each check and what is known about its value.
+            void replay(DenseMap<Instruction *, Kind> *observed, const std::function<void(Instruction &, Kind, Kind)> &check) {
+                for (auto *const BB: order) {
+                    const auto it = states.find(BB);
+                    if (it == states.end()) continue;
+                    State state = it->second;
+                    for (auto &I: *BB) {
+                        if (const auto matched = MatchCheck(&I); matched && check) {
+                            check(I, kindAt(matched->first, state), matched->second);
+                        }
+                        transfer(I, state, observed);
+                    }
+                }
+            }
+
+        public:
+            explicit TypeCheckElimination(Function &F) : F(F) {
+                for (auto *const BB: ReversePostOrderTraversal<Function *>(&F)) order.push_back(BB);
+                collectSlots();
+                collectAllocaSlots();
+            }
+
+            bool run() {
+                for (unsigned int round = 0;; round++) {
+                    solve();
+                    if (slotCount == 0 || pessimistic) break;
+                    DenseMap<Instruction *, Kind> observed;
+                    replay(&observed, nullptr);
+                    if (SameKinds(observed, loadKinds)) break;
+                    loadKinds = std::move(observed);
+                    pessimistic = round + 1 == MAX_ROUNDS;
+                }
+
+                SmallVector<std::pair<Instruction *, bool>> folded;
+                replay(nullptr, [&folded](Instruction &I, const Kind kind, const Kind checked) {
+                    if (const auto passes = Passes(kind, checked)) folded.emplace_back(&I, *passes);
+                });
+                for (const auto &[I, passes]: folded) {
+                    I->replaceAllUsesWith(ConstantInt::getBool(I->getContext(), passes));
+                    I->eraseFromParent();
+                }
+                return !folded.empty();
+            }
+        };
+    }// namespace
+
+    PreservedAnalyses TypeCheckEliminationPass::run(Function &F, FunctionAnalysisManager &) {
+        if (F.isDeclaration() || !TypeCheckElimination(F).run()) return PreservedAnalyses::all();
+
+        PreservedAnalyses PA;
+        PA.preserveSet<CFGAnalyses>();
+        return PA;
+    }
+}// namespace lox
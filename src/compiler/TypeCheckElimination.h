@@ -0,0 +1,29 @@
+#ifndef TYPECHECKELIMINATION_H
+#define TYPECHECKELIMINATION_H
+
+#include <llvm/IR/PassManager.h>
+
+using namespace llvm;
+
+namespace lox {
+    /**
+     * Folds the tag checks of NaN-boxed values (IsNumber, IsObj and the
+     * object type checks of $checkType) whose outcome is already known:
+     *
+     *  - numbers produced by floating point operations or kept unboxed,
+     *    objects boxed by ObjVal and constants are of a known kind;
+     *  - a passed check tells the kind of the value on the branch it guards,
+     *    such as the operands after the check of an arithmetic operation;
+     *  - kinds flow through phis and selects, and through the local slots of
+     *    the function's root frame: the GC only reads the slots, so unless an
+     *    upvalue captures a slot, only the function changes it, across calls.
+     *
+     * It runs at the start of the pipeline, while the checks still have the
+     * form LoxBuilder emits.
+     */
+    struct TypeCheckEliminationPass : PassInfoMixin<TypeCheckEliminationPass> {
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+    };
+}// namespace lox
+
+#endif//TYPECHECKELIMINATION_H
@@ -184,10 +184,9 @@ namespace lox {
                 }
 
                 // Close the upvalue by copying the value from the current location.
-                B.CreateStore(
-                    B.CreateLoad(Builder.getInt64Ty(), B.CreateLoad(Builder.getPtrTy(), loc)),
-                    closed
-                );
+                auto *const closedValue = B.CreateLoad(Builder.getInt64Ty(), B.CreateLoad(Builder.getPtrTy(), loc));
+                B.CreateStore(closedValue, closed);
+                WriteBarrier(B, foundUpvalue, closedValue);
 
                 // And then setting the new location to the "closed" field.
                 B.CreateStore(
@@ -1,8 +1,10 @@
 #include "Value.h"
 #include "../Debug.h"
 #include "Callstack.h"
+#include "GC.h"
 #include "LoxBuilder.h"
 #include "Memory.h"
+#include "Profile.h"
 #include "Upvalue.h"
 
 #include <llvm/ADT/StringExtras.h>
@@ -394,12 +396,16 @@ namespace lox {
         );
     }
 
-    void LoxBuilder::Exit(Value *code) {
+    void LoxBuilder::Exit(Value *code, const bool freeObjects) {
         assert(code->getType() == getInt32Ty());
 
         static const auto Exit =
             getModule().getOrInsertFunction("exit", FunctionType::get(getVoidTy(), {getInt32Ty()}, false));
 
+        // As at the end of main: the reports, while the heap is still there, then the heap.
+        WriteGCStats(*this);
+        if (getModule().isProfiling()) WriteProfile(*this);
+        if (freeObjects) FreeObjects(*this);
         CreateCall(Exit, code);
         CreateUnreachable();
     }
@@ -409,12 +415,8 @@ namespace lox {
         const bool freeObjects
     ) {
         PrintFErr(CreateGlobalCachedString(message), values);
-        // Push the current location onto the call stack, so that it's printed as part of the stacktrace.
-        PushCall(*this, line, location);
-        PrintStackTrace(*this);
-
-        if (freeObjects) FreeObjects(*this);
+        PrintStackTrace(*this, line, location);
 
-        Exit(getInt32(70));
+        Exit(getInt32(70), freeObjects);
     }
 }// namespace lox
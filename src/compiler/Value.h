@@ -1,6 +1,7 @@
 #ifndef OBJECT_H
 #define OBJECT_H
 
+#include <array>
 #include <cstdint>
 
 constexpr uint64_t SIGN_BIT = 0x8000000000000000;
@@ -26,6 +27,12 @@ namespace lox {
         INSTANCE = 6,
         BOUND_METHOD = 7,
     };
+
+    // Statistics per ObjType are indexed by the type, which starts at 1.
+    constexpr unsigned int OBJ_TYPE_COUNT = 8;
+    // Upper bounds, in nanoseconds, of the buckets of the GC pause histogram
+    // in the LOX_GC_STATS report; the last bucket counts the longer pauses.
+    constexpr std::array<uint64_t, 5> GC_PAUSE_BUCKETS{10'000, 100'000, 1'000'000, 10'000'000, 100'000'000};
 }
 
 #endif//OBJECT_H
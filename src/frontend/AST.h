@@ -4,6 +4,7 @@
 #include "../Util.h"
 #include "Token.h"
 
+#include <cstdint>
 #include <memory>
 #include <optional>
 #include <utility>
@@ -35,6 +36,23 @@ namespace lox {
         AND = TokenType::AND
     };
 
+    // The set of types a value may have at runtime, as inferred by TypeInference.
+    enum class InferredType : uint8_t {
+        NONE = 0,
+        NIL = 1 << 0,
+        BOOLEAN = 1 << 1,
+        NUMBER = 1 << 2,
+        STRING = 1 << 3,
+        INSTANCE = 1 << 4,
+        // Functions, classes and bound methods.
+        CALLABLE = 1 << 5,
+        ANY = NIL | BOOLEAN | NUMBER | STRING | INSTANCE | CALLABLE
+    };
+
+    constexpr InferredType operator|(const InferredType a, const InferredType b) {
+        return static_cast<InferredType>(static_cast<uint8_t>(a) | static_cast<uint8_t>(b));
+    }
+
     enum class LoxFunctionType {
         NONE,
         FUNCTION,
@@ -85,7 +103,12 @@ namespace lox {
     struct Assignable : private Uncopyable {
         Token name;
         mutable signed long distance = -1;
+        // For locals, the index of the variable in its scope, assigned by the Resolver.
+        // For globals, the index in the global table cached on first access.
+        mutable signed long slot = -1;
         mutable bool isCaptured = false;
+        // The types the expression may evaluate to, as inferred by TypeInference.
+        mutable InferredType type = InferredType::ANY;
         explicit Assignable(const Token &name) : name{name} {
         }
     };
@@ -95,6 +118,7 @@ namespace lox {
         Token token;
         BinaryOp op;
         Expr right;
+        mutable InferredType type = InferredType::ANY;
         explicit BinaryExpr(Expr left, const Token &token, const BinaryOp op, Expr right)
             : left(std::move(left)), token{token}, op{op}, right{std::move(right)} {}
     };
@@ -103,6 +127,7 @@ namespace lox {
         Expr callee;
         Token keyword;
         std::vector<Expr> arguments;
+        mutable InferredType type = InferredType::ANY;
         explicit CallExpr(Expr callee, const Token &keyword, std::vector<Expr> arguments)
             : callee{std::move(callee)}, keyword{keyword}, arguments{std::move(arguments)} {}
     };
@@ -110,6 +135,7 @@ namespace lox {
     struct GetExpr : private Uncopyable {
         Expr object;
         Token name;
+        mutable InferredType type = InferredType::ANY;
         explicit GetExpr(Expr object, const Token &name)
             : object{std::move(object)}, name{name} {}
     };
@@ -118,6 +144,7 @@ namespace lox {
         Expr object;
         Token name;
         Expr value;
+        mutable InferredType type = InferredType::ANY;
         explicit SetExpr(Expr object, const Token &name, Expr value)
             : object{std::move(object)}, name{name}, value{std::move(value)} {}
     };
@@ -136,17 +163,20 @@ namespace lox {
         Token token;
         UnaryOp op;
         Expr expression;
+        mutable InferredType type = InferredType::ANY;
         explicit UnaryExpr(const Token &token, const UnaryOp op, Expr expression)
             : token{token}, op{op}, expression{std::move(expression)} {}
     };
 
     struct GroupingExpr : Uncopyable {
         Expr expression;
+        mutable InferredType type = InferredType::ANY;
         explicit GroupingExpr(Expr expression) : expression{std::move(expression)} {}
     };
 
     struct LiteralExpr : Uncopyable {
         Literal literal;
+        mutable InferredType type = InferredType::ANY;
         explicit LiteralExpr(const Literal &literal) : literal{literal} {}
     };
 
@@ -154,6 +184,7 @@ namespace lox {
         Expr left;
         LogicalOp op;
         Expr right;
+        mutable InferredType type = InferredType::ANY;
         explicit LogicalExpr(Expr left, const LogicalOp op, Expr right)
             : left{std::move(left)}, op{op}, right{std::move(right)} {}
     };
@@ -167,6 +198,29 @@ namespace lox {
         AssignExpr(const Token &name, Expr value) : Assignable(name), value{std::move(value)} {}
     };
 
+    // The inferred type of an expression; ANY unless TypeInference has run.
+    inline InferredType typeOf(const Expr &expr) {
+        return std::visit([](const auto &e) { return e->type; }, expr);
+    }
+
+    // The line of an expression's token, or of its first operand; 0 for a literal.
+    inline unsigned int lineOf(const Expr &expr) {
+        return std::visit(
+            overloaded{
+                [](const BinaryExprPtr &binaryExpr) { return binaryExpr->token.getLine(); },
+                [](const CallExprPtr &callExpr) { return callExpr->keyword.getLine(); },
+                [](const GetExprPtr &getExpr) { return getExpr->name.getLine(); },
+                [](const SetExprPtr &setExpr) { return setExpr->name.getLine(); },
+                [](const UnaryExprPtr &unaryExpr) { return unaryExpr->token.getLine(); },
+                [](const GroupingExprPtr &groupingExpr) { return lineOf(groupingExpr->expression); },
+                [](const LiteralExprPtr &) { return 0u; },
+                [](const LogicalExprPtr &logicalExpr) { return lineOf(logicalExpr->left); },
+                [](const auto &assignable) { return assignable->name.getLine(); },
+            },
+            expr
+        );
+    }
+
     struct ExpressionStmt;
     struct FunctionStmt;
     struct ReturnStmt;
@@ -218,6 +272,8 @@ namespace lox {
         LoxFunctionType type;
         std::vector<Token> parameters;
         StmtList body;
+        // The number of parameters and locals declared in the body, counted by the Resolver.
+        mutable unsigned long slotCount = 0;
         explicit FunctionStmt(const Token &name, const LoxFunctionType type, std::vector<Token> parameters, StmtList body)
             : name{name}, type{type}, parameters{std::move(parameters)}, body{std::move(body)} {}
     };
@@ -237,11 +293,17 @@ namespace lox {
     struct VarStmt : Uncopyable {
         Token name;
         Expr initializer;
+        // The types of every value assigned to the variable, and whether a closure
+        // captures it, as inferred by TypeInference.
+        mutable InferredType type = InferredType::ANY;
+        mutable bool isCaptured = true;
         explicit VarStmt(const Token &name, Expr initializer) : name{name}, initializer{std::move(initializer)} {}
     };
 
     struct BlockStmt : Uncopyable {
         StmtList statements;
+        // The number of variables declared in the block, counted by the Resolver.
+        mutable unsigned long slotCount = 0;
         explicit BlockStmt(StmtList statements)
             : statements{std::move(statements)} {}
     };
@@ -264,6 +326,24 @@ namespace lox {
               methods{std::move(methods)} {}
     };
 
+    // The line a statement starts on, as far as its tokens tell; 0 for a block.
+    inline unsigned int lineOf(const Stmt &stmt) {
+        return std::visit(
+            overloaded{
+                [](const ExpressionStmtPtr &expressionStmt) { return lineOf(expressionStmt->expression); },
+                [](const FunctionStmtPtr &functionStmt) { return functionStmt->name.getLine(); },
+                [](const ReturnStmtPtr &returnStmt) { return returnStmt->keyword.getLine(); },
+                [](const IfStmtPtr &ifStmt) { return lineOf(ifStmt->condition); },
+                [](const PrintStmtPtr &printStmt) { return lineOf(printStmt->expression); },
+                [](const VarStmtPtr &varStmt) { return varStmt->name.getLine(); },
+                [](const BlockStmtPtr &) { return 0u; },
+                [](const WhileStmtPtr &whileStmt) { return lineOf(whileStmt->condition); },
+                [](const ClassStmtPtr &classStmt) { return classStmt->name.getLine(); },
+            },
+            stmt
+        );
+    }
+
     using Program = std::vector<Stmt>;
 
 }// namespace lox
@@ -15,7 +15,12 @@ namespace lox {
             SUBCLASS
         };
 
-        using Scope = std::unordered_map<std::string_view, bool>;
+        struct Variable {
+            bool defined;
+            signed long slot;
+        };
+
+        using Scope = std::unordered_map<std::string_view, Variable>;
         std::vector<Scope> scopes;
         LoxFunctionType currentFunction = LoxFunctionType::NONE;
         ClassType currentClass = ClassType::NONE;
@@ -24,8 +29,11 @@ namespace lox {
             scopes.emplace_back();
         }
 
-        void endScope() {
+        // Returns the number of variables declared in the scope.
+        unsigned long endScope() {
+            const auto count = scopes.back().size();
             scopes.pop_back();
+            return count;
         }
 
         void declare(const Token &name) {
@@ -34,20 +42,22 @@ namespace lox {
             if (scope.contains(name.getLexeme())) {
                 lox::error(name, "Already a variable with this name in this scope.");
             }
-            scope[name.getLexeme()] = false;
+            const auto slot = static_cast<signed long>(scope.size());
+            scope[name.getLexeme()] = {false, slot};
         }
 
         void define(const Token &name) {
             if (scopes.empty()) return;
-            scopes.back()[name.getLexeme()] = true;
+            scopes.back()[name.getLexeme()].defined = true;
         }
 
         void resolveLocal(const Assignable &expr, const Token &name) const {
             if (scopes.empty()) return;
 
             for (signed i = static_cast<int>(scopes.size()) - 1; i >= 0; i--) {
-                if (scopes.at(i).contains(name.getLexeme())) {
+                if (const auto variable = scopes.at(i).find(name.getLexeme()); variable != scopes.at(i).end()) {
                     expr.distance = static_cast<signed>(scopes.size() - 1 - i);
+                    expr.slot = variable->second.slot;
                     return;
                 }
             }
@@ -63,7 +73,7 @@ namespace lox {
                 define(param);
             }
             resolve(function->body);
-            endScope();
+            function->slotCount = endScope();
             currentFunction = enclosingFunction;
         }
 
@@ -71,7 +81,7 @@ namespace lox {
         void operator()(const BlockStmtPtr &blockStmt) {
             beginScope();
             resolve(blockStmt->statements);
-            endScope();
+            blockStmt->slotCount = endScope();
         }
 
         void operator()(const FunctionStmtPtr &functionStmt) {
@@ -133,11 +143,11 @@ namespace lox {
 
             if (classStmt->super_class.has_value()) {
                 beginScope();
-                scopes.back()["super"] = true;
+                scopes.back()["super"] = {true, 0};
             }
 
             beginScope();
-            scopes.back()["this"] = true;
+            scopes.back()["this"] = {true, 0};
 
             for (auto &method: classStmt->methods) {
                 resolveFunction(method, method->type);
@@ -199,7 +209,7 @@ namespace lox {
         void operator()(const VarExprPtr &varExpr) {
             if (!scopes.empty() &&
                 scopes.back().contains(varExpr->name.getLexeme()) &&
-                !scopes.back()[varExpr->name.getLexeme()]) {
+                !scopes.back()[varExpr->name.getLexeme()].defined) {
                 lox::error(varExpr->name, "Can't read local variable in its own initializer.");
                 return;
             }
@@ -0,0 +1,288 @@
+#ifndef TYPEINFERENCE_H
+#define TYPEINFERENCE_H
+#include "AST.h"
+
+#include <array>
+#include <unordered_map>
+
+using namespace std::literals;
+
+namespace lox {
+
+    // The globals every runtime defines before the script runs.
+    constexpr std::array NATIVE_FUNCTIONS = {"clock"sv, "exit"sv, "read"sv, "utf"sv, "printerr"sv};
+
+    /**
+     * Infers the types that variables and expressions of a resolved program may
+     * have at runtime, and annotates the AST with them.
+     *
+     * The inference is flow-insensitive for variables: a variable may hold any
+     * type of value assigned to it anywhere in the program, including from
+     * closures. Starting from variables that hold nothing, the program is
+     * interpreted abstractly until no variable's types grow any more, so that
+     * a variable only ever assigned numbers, such as `i` in `i = i + 1`, is
+     * inferred to be a number. Values from calls and properties may be anything.
+     */
+    class TypeInference {
+        struct Local {
+            InferredType type = InferredType::NONE;
+            unsigned int functionDepth;
+            bool isCaptured = false;
+            const VarStmt *declaration = nullptr;
+        };
+
+        using Scope = std::unordered_map<std::string_view, size_t>;
+        std::vector<Scope> scopes;
+        // The locals in order of declaration, which is the same on every pass.
+        std::vector<Local> locals;
+        size_t localsCount = 0;
+        // Only globals declared by the program, or by the runtime, are tracked;
+        // other names can't be read without a runtime error.
+        std::unordered_map<std::string_view, InferredType> globals;
+        unsigned int functionDepth = 0;
+        bool changed = false;
+
+        void beginScope() { scopes.emplace_back(); }
+
+        void endScope() { scopes.pop_back(); }
+
+        void assign(InferredType &variable, const InferredType type) {
+            if ((variable | type) == variable) return;
+            variable = variable | type;
+            changed = true;
+        }
+
+        void declare(const std::string_view name, const InferredType type, const VarStmt *declaration = nullptr) {
+            if (scopes.empty()) {
+                assign(globals[name], type);
+                return;
+            }
+
+            const auto index = localsCount++;
+            if (index == locals.size()) locals.push_back({.functionDepth = functionDepth, .declaration = declaration});
+            scopes.back()[name] = index;
+            assign(locals[index].type, type);
+        }
+
+        [[nodiscard]] Local *lookupLocal(const Assignable &assignable) {
+            if (assignable.distance == -1) return nullptr;
+            const auto &scope = scopes.at(scopes.size() - 1 - assignable.distance);
+            auto &local = locals[scope.at(assignable.name.getLexeme())];
+            if (local.functionDepth != functionDepth) local.isCaptured = true;
+            return &local;
+        }
+
+        InferredType lookup(const Assignable &assignable) {
+            if (const auto *const local = lookupLocal(assignable)) return local->type;
+            if (const auto global = globals.find(assignable.name.getLexeme()); global != globals.end()) {
+                return global->second;
+            }
+            return InferredType::ANY;
+        }
+
+        void inferFunction(const FunctionStmtPtr &function) {
+            functionDepth++;
+            beginScope();
+            for (auto &param: function->parameters) { declare(param.getLexeme(), InferredType::ANY); }
+            inferBlock(function->body);
+            endScope();
+            functionDepth--;
+        }
+
+        static bool mayBe(const InferredType type, const InferredType of) {
+            return (static_cast<uint8_t>(type) & static_cast<uint8_t>(of)) != 0;
+        }
+
+    public:
+        void operator()(const BlockStmtPtr &blockStmt) {
+            beginScope();
+            inferBlock(blockStmt->statements);
+            endScope();
+        }
+
+        void operator()(const FunctionStmtPtr &functionStmt) {
+            declare(functionStmt->name.getLexeme(), InferredType::CALLABLE);
+            inferFunction(functionStmt);
+        }
+
+        void operator()(const ExpressionStmtPtr &expressionStmt) { infer(expressionStmt->expression); }
+
+        void operator()(const PrintStmtPtr &printStmt) { infer(printStmt->expression); }
+
+        void operator()(const ReturnStmtPtr &returnStmt) {
+            if (returnStmt->expression.has_value()) infer(returnStmt->expression.value());
+        }
+
+        void operator()(const VarStmtPtr &varStmt) {
+            const auto type = infer(varStmt->initializer);
+            declare(varStmt->name.getLexeme(), type, varStmt.get());
+            if (scopes.empty()) varStmt->type = globals[varStmt->name.getLexeme()];
+        }
+
+        void operator()(const WhileStmtPtr &whileStmt) {
+            infer(whileStmt->condition);
+            infer(whileStmt->body);
+        }
+
+        void operator()(const IfStmtPtr &ifStmt) {
+            infer(ifStmt->condition);
+            infer(ifStmt->thenBranch);
+            if (ifStmt->elseBranch.has_value()) infer(ifStmt->elseBranch.value());
+        }
+
+        void operator()(const ClassStmtPtr &classStmt) {
+            declare(classStmt->name.getLexeme(), InferredType::CALLABLE);
+
+            if (classStmt->super_class.has_value()) {
+                this->operator()(classStmt->super_class.value());
+                beginScope();
+                declare("super", InferredType::CALLABLE);
+            }
+
+            beginScope();
+            declare("this", InferredType::INSTANCE);
+
+            for (auto &method: classStmt->methods) { inferFunction(method); }
+
+            endScope();
+
+            if (classStmt->super_class.has_value()) endScope();
+        }
+
+        InferredType operator()(const AssignExprPtr &assignExpr) {
+            const auto type = infer(assignExpr->value);
+            if (auto *const local = lookupLocal(*assignExpr)) {
+                assign(local->type, type);
+            } else {
+                assign(globals[assignExpr->name.getLexeme()], type);
+            }
+            return assignExpr->type = type;
+        }
+
+        InferredType operator()(const BinaryExprPtr &binaryExpr) {
+            const auto left = infer(binaryExpr->left);
+            const auto right = infer(binaryExpr->right);
+
+            switch (binaryExpr->op) {
+                case BinaryOp::PLUS: {
+                    // Two numbers or two strings; anything else is a runtime error.
+                    auto type = InferredType::NONE;
+                    if (mayBe(left, InferredType::NUMBER) && mayBe(right, InferredType::NUMBER)) {
+                        type = type | InferredType::NUMBER;
+                    }
+                    if (mayBe(left, InferredType::STRING) && mayBe(right, InferredType::STRING)) {
+                        type = type | InferredType::STRING;
+                    }
+                    return binaryExpr->type = type;
+                }
+                case BinaryOp::MINUS:
+                case BinaryOp::SLASH:
+                case BinaryOp::STAR:
+                    return binaryExpr->type = InferredType::NUMBER;
+                case BinaryOp::GREATER:
+                case BinaryOp::GREATER_EQUAL:
+                case BinaryOp::LESS:
+                case BinaryOp::LESS_EQUAL:
+                case BinaryOp::BANG_EQUAL:
+                case BinaryOp::EQUAL_EQUAL:
+                    return binaryExpr->type = InferredType::BOOLEAN;
+            }
+
+            std::unreachable();
+        }
+
+        InferredType operator()(const CallExprPtr &callExpr) {
+            infer(callExpr->callee);
+            for (auto &arg: callExpr->arguments) { infer(arg); }
+            return callExpr->type = InferredType::ANY;
+        }
+
+        InferredType operator()(const GetExprPtr &getExpr) {
+            infer(getExpr->object);
+            return getExpr->type = InferredType::ANY;
+        }
+
+        InferredType operator()(const SetExprPtr &setExpr) {
+            infer(setExpr->object);
+            return setExpr->type = infer(setExpr->value);
+        }
+
+        InferredType operator()(const ThisExprPtr &thisExpr) {
+            return thisExpr->type = lookup(*thisExpr);
+        }
+
+        InferredType operator()(const SuperExprPtr &superExpr) {
+            lookup(*superExpr);
+            // A method bound to this.
+            return superExpr->type = InferredType::CALLABLE;
+        }
+
+        InferredType operator()(const VarExprPtr &varExpr) { return varExpr->type = lookup(*varExpr); }
+
+        InferredType operator()(const GroupingExprPtr &groupingExpr) {
+            return groupingExpr->type = infer(groupingExpr->expression);
+        }
+
+        InferredType operator()(const LiteralExprPtr &literalExpr) const {
+            return literalExpr->type = std::visit(
+                       overloaded{
+                           [](const bool) { return InferredType::BOOLEAN; },
+                           [](const double) { return InferredType::NUMBER; },
+                           [](const std::string_view) { return InferredType::STRING; },
+                           [](const std::nullptr_t) { return InferredType::NIL; },
+                       },
+                       literalExpr->literal
+                   );
+        }
+
+        InferredType operator()(const LogicalExprPtr &logicalExpr) {
+            // The result is one of the operands.
+            const auto left = infer(logicalExpr->left);
+            return logicalExpr->type = left | infer(logicalExpr->right);
+        }
+
+        InferredType operator()(const UnaryExprPtr &unaryExpr) {
+            infer(unaryExpr->expression);
+            return unaryExpr->type =
+                       unaryExpr->op == UnaryOp::MINUS ? InferredType::NUMBER : InferredType::BOOLEAN;
+        }
+
+    private:
+        InferredType infer(const Expr &expr) { return std::visit(*this, expr); }
+
+        void infer(const Stmt &stmt) { std::visit(*this, stmt); }
+
+        void inferBlock(const StmtList &statements) {
+            for (auto &stmt: statements) { infer(stmt); }
+        }
+
+    public:
+        void infer(const Program &program) {
+            for (const auto name: NATIVE_FUNCTIONS) { globals[name] = InferredType::CALLABLE; }
+            // Declare the globals up front, so that functions reading a global
+            // declared after them don't see it as unknown.
+            for (auto &stmt: program) {
+                if (const auto *const varStmt = std::get_if<VarStmtPtr>(&stmt)) {
+                    globals.try_emplace((*varStmt)->name.getLexeme(), InferredType::NONE);
+                } else if (const auto *const functionStmt = std::get_if<FunctionStmtPtr>(&stmt)) {
+                    globals.try_emplace((*functionStmt)->name.getLexeme(), InferredType::NONE);
+                } else if (const auto *const classStmt = std::get_if<ClassStmtPtr>(&stmt)) {
+                    globals.try_emplace((*classStmt)->name.getLexeme(), InferredType::NONE);
+                }
+            }
+
+            do {
+                changed = false;
+                localsCount = 0;
+                inferBlock(program);
+            } while (changed);
+
+            for (const auto &local: locals) {
+                if (local.declaration == nullptr) continue;
+                local.declaration->type = local.type;
+                local.declaration->isCaptured = local.isCaptured;
+            }
+        }
+    };
+}// namespace lox
+#endif// TYPEINFERENCE_H
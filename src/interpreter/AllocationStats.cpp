@@ -0,0 +1,24 @@
+#include "AllocationStats.h"
+
+#include <cstdlib>
+#include <fstream>
+
+namespace lox {
+
+    void writeAllocationStats(const size_t globals) {
+        const char *path = std::getenv("LOX_GC_STATS");
+        if (path == nullptr) { return; }
+
+        std::ofstream out(path);
+        out << "{\"objects\": {";
+        for (unsigned int type = 0; type < OBJECT_TYPE_NAMES.size(); type++) {
+            out << (type == 0 ? "" : ", ") << "\"" << OBJECT_TYPE_NAMES[type] << "\": {\"allocated\": "
+                << allocationStats.allocatedByType[type] << ", \"freed\": " << allocationStats.freedByType[type] << "}";
+        }
+        out << "},\n";
+
+        out << " \"heap\": {\"current\": " << allocationStats.current << ", \"peak\": " << allocationStats.peak
+            << "},\n";
+        out << " \"globals\": {\"count\": " << globals << "}}\n";
+    }
+}// namespace lox
@@ -0,0 +1,64 @@
+#ifndef ALLOCATIONSTATS_H
+#define ALLOCATIONSTATS_H
+
+#include <array>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace lox {
+
+    // The heap objects of the interpreter; values such as strings live in a LoxObject.
+    enum class ObjectType : uint8_t { ENVIRONMENT, CLOSURE, NATIVE, CLASS, INSTANCE };
+
+    constexpr std::array<std::string_view, 5> OBJECT_TYPE_NAMES{"environment", "closure", "native", "class", "instance"};
+
+    /**
+     * Allocation statistics for the LOX_GC_STATS report. The interpreter frees
+     * objects by reference counting, so there are no collections: only the
+     * bytes allocated and freed per object type and the current and peak heap
+     * size, counting the size of each object but not the containers it owns.
+     */
+    struct AllocationStats {
+        std::array<size_t, OBJECT_TYPE_NAMES.size()> allocatedByType{};
+        std::array<size_t, OBJECT_TYPE_NAMES.size()> freedByType{};
+        size_t current = 0;
+        size_t peak = 0;
+
+        void allocate(const ObjectType type, const size_t size) {
+            allocatedByType[static_cast<unsigned>(type)] += size;
+            current += size;
+            if (current > peak) { peak = current; }
+        }
+
+        void free(const ObjectType type, const size_t size) {
+            freedByType[static_cast<unsigned>(type)] += size;
+            current -= size;
+        }
+    };
+
+    inline AllocationStats allocationStats;
+
+    // Set by the SIGUSR1 handler: the report is written before the next statement.
+    inline volatile std::sig_atomic_t allocationStatsRequested = 0;
+
+    // A base of each heap object, which counts its allocation and its destruction.
+    template<ObjectType type, typename T>
+    struct Counted {
+        Counted() { allocationStats.allocate(type, sizeof(T)); }
+        Counted(const Counted &) : Counted() {}
+        Counted &operator=(const Counted &) = default;
+        ~Counted() { allocationStats.free(type, sizeof(T)); }
+    };
+
+    /**
+     * Writes the statistics as JSON to the file named by the LOX_GC_STATS
+     * environment variable, if it is set, in the format of the compiled
+     * runtime's report without its collector sections, along with the
+     * number of globals.
+     */
+    void writeAllocationStats(size_t globals);
+}// namespace lox
+
+#endif//ALLOCATIONSTATS_H
@@ -2,42 +2,46 @@
 
 namespace lox {
 
-        void Environment::define(const std::string_view name, const LoxObject &value) { values[name] = value; }
+        unsigned long Environment::define(const std::string_view name, const LoxObject &value) {
+            if (enclosing == nullptr) {
+                // Global variables can be re-declared, re-using the existing slot.
+                if (const auto slot = globalSlots.find(name); slot != globalSlots.end()) {
+                    values[slot->second] = value;
+                    return slot->second;
+                }
+                globalSlots[name] = values.size();
+            }
 
-        LoxObject &Environment::getAt(const unsigned long distance, const std::string_view &name) {
-            return ancestor(distance)->values[name];
+            values.push_back(value);
+            return values.size() - 1;
         }
 
-        EnvironmentPtr Environment::ancestor(const unsigned long distance) {
-            auto environment = shared_from_this();
-            for (unsigned long i = 0; i < distance; i++) { environment = environment->enclosing; }
-            return environment;
+        LoxObject &Environment::getAt(const unsigned long distance, const unsigned long slot) {
+            return ancestor(distance)->values[slot];
         }
 
-        LoxObject &Environment::get(const Token &name) {
-            if (values.contains(name.getLexeme())) { return values[name.getLexeme()]; }
-
-            if (enclosing != nullptr) { return enclosing->get(name); }
-
-            throw runtime_error(name, "Undefined variable '" + std::string(name.getLexeme()) + "'.");
+        Environment *Environment::ancestor(const unsigned long distance) {
+            auto *environment = this;
+            for (unsigned long i = 0; i < distance; i++) { environment = environment->enclosing.get(); }
+            return environment;
         }
 
-        void Environment::assign(const Token &name, const LoxObject &value) {
-            if (values.contains(name.getLexeme())) {
-                values[name.getLexeme()] = value;
-                return;
-            }
-
-            if (enclosing != nullptr) {
-                enclosing->assign(name, value);
-                return;
+        LoxObject &Environment::getGlobal(const Token &name, signed long &slot) {
+            // Global slots are never removed, so once a name is bound the
+            // slot can be cached by the caller and re-used for every access.
+            if (slot == -1) {
+                const auto global = globalSlots.find(name.getLexeme());
+                if (global == globalSlots.end()) {
+                    throw runtime_error(name, std::format("Undefined variable '{}'.", name.getLexeme()));
+                }
+                slot = static_cast<signed long>(global->second);
             }
 
-            throw runtime_error(name, std::format("Undefined variable '{}'.", name.getLexeme()));
+            return values[slot];
         }
 
-        void Environment::assignAt(const unsigned long distance, const Token &name, const LoxObject &value) {
-            ancestor(distance)->values[name.getLexeme()] = value;
+        void Environment::assignAt(const unsigned long distance, const unsigned long slot, const LoxObject &value) {
+            ancestor(distance)->values[slot] = value;
         }
 
 }
\ No newline at end of file
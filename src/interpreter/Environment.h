@@ -2,30 +2,42 @@
 #define ENVIRONMENT_H
 
 #include "../frontend/Token.h"
+#include "AllocationStats.h"
 #include "LoxObject.h"
 
 #include <format>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 namespace lox {
     class Environment;
     using EnvironmentPtr = std::shared_ptr<Environment>;
 
-    class Environment : public std::enable_shared_from_this<Environment> {
-        std::unordered_map<std::string_view, LoxObject> values;
+    class Environment : Counted<ObjectType::ENVIRONMENT, Environment> {
+        // Variables are stored in the order they are declared, matching
+        // the slots assigned by the Resolver.
+        std::vector<LoxObject> values;
+        // Only used by the global environment, which has no enclosing
+        // environment: globals are late-bound so are looked up by name.
+        std::unordered_map<std::string_view, unsigned long> globalSlots;
         EnvironmentPtr enclosing;
+
     public:
         explicit Environment() = default;
-        explicit Environment(EnvironmentPtr environment) : enclosing{std::move(environment)} {}
+        // A local environment has room for the number of variables the Resolver counted
+        // in its scope, so that defining them never reallocates.
+        explicit Environment(EnvironmentPtr environment, const size_t size) : enclosing{std::move(environment)} {
+            values.reserve(size);
+        }
 
         EnvironmentPtr get_enclosing() const { return enclosing; }
-        void define(std::string_view name, const LoxObject &value = LoxNil{});
-        LoxObject &getAt(unsigned long distance, const std::string_view &name);
-        EnvironmentPtr ancestor(unsigned long distance);
-        LoxObject &get(const Token &name);
-        void assign(const Token &name, const LoxObject &value);
-        void assignAt(unsigned long distance, const Token &name, const LoxObject &value);
+        [[nodiscard]] size_t size() const { return values.size(); }
+        unsigned long define(std::string_view name, const LoxObject &value = LoxNil{});
+        LoxObject &getAt(unsigned long distance, unsigned long slot);
+        Environment *ancestor(unsigned long distance);
+        LoxObject &getGlobal(const Token &name, signed long &slot);
+        void assignAt(unsigned long distance, unsigned long slot, const LoxObject &value);
     };
 }// namespace lox
 
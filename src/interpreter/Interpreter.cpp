@@ -1,10 +1,13 @@
 #include "Interpreter.h"
+#include "../Util.h"
 #include "LoxClass.h"
 #include "LoxFunction.h"
 #include "LoxInstance.h"
 #include "NativeFunction.h"
 
 #include <chrono>
+#include <csignal>
+#include <cstdlib>
 
 constexpr int MAX_CALL_DEPTH = 512;
 
@@ -22,27 +25,41 @@ namespace lox {
     }
 
     Interpreter::Interpreter() {
-        globals->define("clock", std::make_shared<NativeFunction>([](const std::vector<LoxObject> &) -> LoxObject {
-                            const auto now = std::chrono::system_clock::now().time_since_epoch();
-                            return LoxNumber(std::chrono::duration_cast<std::chrono::seconds>(now).count());
-                        }));
+        if (std::getenv("LOX_GC_STATS") != nullptr) {
+            std::signal(SIGUSR1, [](int) { allocationStatsRequested = 1; });
+        }
+
+        globals->define(
+            "clock", std::make_shared<NativeFunction>("clock", [](const std::vector<LoxObject> &) -> LoxObject {
+                const auto now = std::chrono::system_clock::now().time_since_epoch();
+                return LoxNumber(std::chrono::duration_cast<std::chrono::seconds>(now).count());
+            })
+        );
         globals->define(
             "exit", std::make_shared<NativeFunction>(
-                        [](const std::vector<LoxObject> &arguments) -> LoxObject {
+                        "exit",
+                        [this](const std::vector<LoxObject> &arguments) -> LoxObject {
                             const auto token = Token(IDENTIFIER, "", nullptr, 0);
-                            exit(static_cast<int>(checkNumberOperand(token, arguments.at(0))));
+                            const auto status = static_cast<int>(checkNumberOperand(token, arguments.at(0)));
+                            // The script never returns to evaluate, which would write the profile.
+                            if (profiler) { profiler->finish(); }
+                            writeAllocationStats(globals->size());
+                            exit(status);
                         },
                         1
                     )
         );
-        globals->define("read", std::make_shared<NativeFunction>([](const std::vector<LoxObject> &) -> LoxObject {
-                            const int c = getchar();
-                            if (c == -1) { return LoxNil(); }
-                            return LoxNumber(static_cast<uint8_t>(c));
-                        }));
+        globals->define(
+            "read", std::make_shared<NativeFunction>("read", [this](const std::vector<LoxObject> &) -> LoxObject {
+                const int c = getcharPolling([this] { pollAllocationStatsRequest(); });
+                if (c == -1) { return LoxNil(); }
+                return LoxNumber(static_cast<uint8_t>(c));
+            })
+        );
         globals->define(
             "utf",
             std::make_shared<NativeFunction>(
+                "utf",
                 [](const std::vector<LoxObject> &args) -> LoxObject {
                     int byte_count = 0;
                     for (int i = 0; i < 4; i++) {
@@ -74,6 +91,7 @@ namespace lox {
         );
         globals->define(
             "printerr", std::make_shared<NativeFunction>(
+                            "printerr",
                             [](const std::vector<LoxObject> &arguments) -> LoxObject {
                                 std::cerr << lox::to_string(arguments[0]) << std::endl;
                                 return LoxNil();
@@ -84,8 +102,8 @@ namespace lox {
     }
 
     [[nodiscard]] LoxObject &Interpreter::lookUpVariable(const Token &name, const Assignable &expr) const {
-        if (expr.distance == -1) { return globals->get(name); }
-        return environment->getAt(expr.distance, name.getLexeme());
+        if (expr.distance == -1) { return globals->getGlobal(name, expr.slot); }
+        return environment->getAt(expr.distance, expr.slot);
     }
 
     StmtResult Interpreter::operator()(const ClassStmtPtr &classStmt) {
@@ -100,10 +118,10 @@ namespace lox {
             }
         }
 
-        environment->define(classStmt->name.getLexeme());
+        const auto slot = environment->define(classStmt->name.getLexeme());
 
         if (super_class.has_value()) {
-            environment = std::make_shared<Environment>(environment);
+            environment = std::make_shared<Environment>(environment, 1);
             environment->define("super", super_class.value());
         }
 
@@ -116,8 +134,8 @@ namespace lox {
 
         if (super_class.has_value()) { environment = environment->get_enclosing(); }
 
-        environment->assign(
-            classStmt->name, std::make_shared<LoxClass>(classStmt->name.getLexeme(), super_class, std::move(methods))
+        environment->assignAt(
+            0, slot, std::make_shared<LoxClass>(classStmt->name.getLexeme(), super_class, std::move(methods))
         );
 
         return Nothing();
@@ -192,9 +210,9 @@ namespace lox {
     }
 
     LoxObject Interpreter::operator()(const SuperExprPtr &superExpr) const {
-        const auto &callable = std::get<LoxCallablePtr>(environment->getAt(superExpr->distance, "super"));
+        const auto &callable = std::get<LoxCallablePtr>(environment->getAt(superExpr->distance, 0));
         const auto &super_class = std::reinterpret_pointer_cast<LoxClass>(callable);
-        const auto &instance = std::get<LoxInstancePtr>(environment->getAt(superExpr->distance - 1, "this"));
+        const auto &instance = std::get<LoxInstancePtr>(environment->getAt(superExpr->distance - 1, 0));
         const auto &method = super_class->findMethod(superExpr->method.getLexeme());
         if (method == nullptr) {
             throw runtime_error(
@@ -245,10 +263,58 @@ namespace lox {
     }
 
     StmtResult Interpreter::operator()(const BlockStmtPtr &blockStmt) {
-        return executeBlock(blockStmt->statements, std::make_shared<Environment>(environment));
+        return executeBlock(blockStmt->statements, std::make_shared<Environment>(environment, blockStmt->slotCount));
+    }
+
+    static bool isNumber(const Expr &expr) { return typeOf(expr) == InferredType::NUMBER; }
+
+    // Evaluates an expression inferred to be a number. Arithmetic on operands
+    // that are also inferred to be numbers is evaluated on doubles directly,
+    // without checking and boxing the intermediate results.
+    LoxNumber Interpreter::evaluateNumber(const Expr &expr) {
+        if (const auto *const binaryExpr = std::get_if<BinaryExprPtr>(&expr);
+            binaryExpr != nullptr && isNumber((*binaryExpr)->left) && isNumber((*binaryExpr)->right)) {
+            const auto left = evaluateNumber((*binaryExpr)->left);
+            const auto right = evaluateNumber((*binaryExpr)->right);
+            switch ((*binaryExpr)->op) {
+                case BinaryOp::PLUS: return left + right;
+                case BinaryOp::MINUS: return left - right;
+                case BinaryOp::SLASH: return left / right;
+                case BinaryOp::STAR: return left * right;
+                default: std::unreachable();
+            }
+        }
+
+        if (const auto *const unaryExpr = std::get_if<UnaryExprPtr>(&expr);
+            unaryExpr != nullptr && (*unaryExpr)->op == UnaryOp::MINUS && isNumber((*unaryExpr)->expression)) {
+            return -evaluateNumber((*unaryExpr)->expression);
+        }
+
+        if (const auto *const groupingExpr = std::get_if<GroupingExprPtr>(&expr)) {
+            return evaluateNumber((*groupingExpr)->expression);
+        }
+
+        return std::get<LoxNumber>(evaluate(expr));
     }
 
     LoxObject Interpreter::operator()(const BinaryExprPtr &binaryExpr) {
+        if (isNumber(binaryExpr->left) && isNumber(binaryExpr->right)) {
+            const auto left = evaluateNumber(binaryExpr->left);
+            const auto right = evaluateNumber(binaryExpr->right);
+            switch (binaryExpr->op) {
+                case BinaryOp::PLUS: return left + right;
+                case BinaryOp::MINUS: return left - right;
+                case BinaryOp::SLASH: return left / right;
+                case BinaryOp::STAR: return left * right;
+                case BinaryOp::GREATER: return left > right;
+                case BinaryOp::GREATER_EQUAL: return left >= right;
+                case BinaryOp::LESS: return left < right;
+                case BinaryOp::LESS_EQUAL: return left <= right;
+                case BinaryOp::BANG_EQUAL: return left != right;
+                case BinaryOp::EQUAL_EQUAL: return left == right;
+            }
+        }
+
         const auto &left = evaluate(binaryExpr->left);
         const auto &right = evaluate(binaryExpr->right);
 
@@ -345,9 +411,9 @@ namespace lox {
     LoxObject Interpreter::operator()(const AssignExprPtr &assignExpr) {
         const auto &value = evaluate(assignExpr->value);
         if (assignExpr->distance == -1) {
-            globals->assign(assignExpr->name, value);
+            globals->getGlobal(assignExpr->name, assignExpr->slot) = value;
         } else {
-            environment->assignAt(assignExpr->distance, assignExpr->name, value);
+            environment->assignAt(assignExpr->distance, assignExpr->slot, value);
         }
         return value;
     }
@@ -2,6 +2,7 @@
 #define INTERPRETER1_H
 #include "../frontend/AST.h"
 #include "Environment.h"
+#include "Profiler.h"
 
 namespace lox {
     struct Return {
@@ -15,9 +16,15 @@ namespace lox {
         EnvironmentPtr globals = std::make_shared<Environment>();
         EnvironmentPtr environment = globals;
         int function_depth = 0;
+        // Only set with --profile; every hook checks it first.
+        std::unique_ptr<Profiler> profiler;
 
     public:
         Interpreter();
+
+        void enableProfiling() { profiler = std::make_unique<Profiler>(); }
+        [[nodiscard]] Profiler *getProfiler() const { return profiler.get(); }
+
         StmtResult operator()(const ExpressionStmtPtr &expressionStmt);
         StmtResult operator()(const IfStmtPtr &ifStmtPtr);
         StmtResult operator()(const PrintStmtPtr &printStmt);
@@ -46,11 +53,26 @@ namespace lox {
         [[nodiscard]] LoxObject &lookUpVariable(const Token &name, const Assignable &expr) const;
 
         LoxObject evaluate(const Expr &expr) { return std::visit(*this, expr); }
-        StmtResult evaluate(const Stmt &stmt) { return std::visit(*this, stmt); }
+        LoxNumber evaluateNumber(const Expr &expr);
+        // Writes the allocation statistics if SIGUSR1 requested them.
+        void pollAllocationStatsRequest() const {
+            if (allocationStatsRequested) [[unlikely]] {
+                allocationStatsRequested = 0;
+                writeAllocationStats(globals->size());
+            }
+        }
+
+        StmtResult evaluate(const Stmt &stmt) {
+            pollAllocationStatsRequest();
+            if (profiler) [[unlikely]] { profiler->countLine(lineOf(stmt)); }
+            return std::visit(*this, stmt);
+        }
         void evaluate(const Program &program) {
             try {
                 for (const auto &stmt: program) { evaluate(stmt); }
             } catch (const runtime_error &e) { runtimeError(e); }
+            if (profiler) { profiler->finish(); }
+            writeAllocationStats(globals->size());
         }
     };
 }// namespace lox
@@ -6,7 +6,9 @@
 
 namespace lox {
 
-    struct LoxClass final : LoxCallable, std::enable_shared_from_this<LoxClass> {
+    struct LoxClass final : LoxCallable,
+                            std::enable_shared_from_this<LoxClass>,
+                            Counted<ObjectType::CLASS, LoxClass> {
         std::string_view name;
         std::optional<std::shared_ptr<LoxClass>> superClass;
         std::unordered_map<std::string_view, LoxFunctionPtr> methods;
@@ -3,25 +3,28 @@
 namespace lox {
 
     LoxObject LoxFunction::operator()(Interpreter &interpreter, const std::vector<LoxObject> &arguments) {
-        const auto environment = std::make_shared<Environment>(closure);
+        const Profiler::Scope scope(
+            interpreter.getProfiler(), declaration.get(), declaration->name.getLexeme(), declaration->name.getLine()
+        );
+        const auto environment = std::make_shared<Environment>(closure, declaration->slotCount);
         for (int i = 0; i < static_cast<int>(declaration->parameters.size()); i++) {
             environment->define(declaration->parameters[i].getLexeme(), arguments[i]);
         }
 
         if (const auto &result = interpreter.executeBlock(declaration->body, environment);
             std::holds_alternative<Return>(result)) {
-            if (isInitializer) { return std::move(closure->getAt(0, "this")); }
+            if (isInitializer) { return std::move(closure->getAt(0, 0)); }
 
             return std::move(std::get<Return>(result).value);
         }
 
-        if (isInitializer) { return std::move(closure->getAt(0, "this")); }
+        if (isInitializer) { return std::move(closure->getAt(0, 0)); }
 
         return LoxNil();
     }
 
     LoxFunctionPtr LoxFunction::bind(const LoxInstancePtr &instance) {
-        auto environment = std::make_shared<Environment>(closure);
+        auto environment = std::make_shared<Environment>(closure, 1);
         environment->define("this", instance);
         return std::make_shared<LoxFunction>(declaration, environment, isInitializer);
     }
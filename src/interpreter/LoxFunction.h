@@ -4,7 +4,7 @@
 
 namespace lox {
 
-    struct LoxFunction final : LoxCallable {
+    struct LoxFunction final : LoxCallable, Counted<ObjectType::CLOSURE, LoxFunction> {
         std::shared_ptr<FunctionStmt> declaration;
         EnvironmentPtr closure;
         bool isInitializer;
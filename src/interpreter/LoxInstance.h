@@ -1,5 +1,6 @@
 #ifndef LOXINSTANCE_H
 #define LOXINSTANCE_H
+#include "AllocationStats.h"
 #include "LoxObject.h"
 
 #include <memory>
@@ -8,7 +9,8 @@
 
 namespace lox {
 
-    struct LoxInstance : std::enable_shared_from_this<LoxInstance> {
+    struct LoxInstance : std::enable_shared_from_this<LoxInstance>,
+                         Counted<ObjectType::INSTANCE, LoxInstance> {
         LoxClassPtr klass;
         std::unordered_map<std::string_view, LoxObject> fields;
 
@@ -6,16 +6,18 @@
 
 namespace lox {
 
-    struct NativeFunction final : LoxCallable {
+    struct NativeFunction final : LoxCallable, Counted<ObjectType::NATIVE, NativeFunction> {
         using NativeFnType = std::function<LoxObject(const std::vector<LoxObject> &)>;
+        std::string_view name;
         NativeFnType function;
 
-        explicit NativeFunction(NativeFnType function, const int arity = 0)
-            : LoxCallable(arity), function{std::move(function)} {}
+        explicit NativeFunction(const std::string_view name, NativeFnType function, const int arity = 0)
+            : LoxCallable(arity), name{name}, function{std::move(function)} {}
 
         ~NativeFunction() override = default;
 
-        LoxObject operator()(Interpreter & /*interpreter*/, const std::vector<LoxObject> &arguments) override {
+        LoxObject operator()(Interpreter &interpreter, const std::vector<LoxObject> &arguments) override {
+            const Profiler::Scope scope(interpreter.getProfiler(), this, name, 0);
             return function(arguments);
         }
 
@@ -0,0 +1,105 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <ranges>
+
+namespace lox {
+
+    // The script is the outermost function, and the root of the call tree.
+    Profiler::Profiler() : functions{{"script", 0, 1, {}, {}, 1}}, nodes{{0}}, calls{{0, 0, Clock::now()}} {}
+
+    void Profiler::enter(const void *key, const std::string_view name, const unsigned int line) {
+        const auto [entry, inserted] = functionIndex.try_emplace(key, functions.size());
+        const auto function = entry->second;
+        if (inserted) { functions.push_back({name, line}); }
+        functions[function].calls++;
+        functions[function].active++;
+
+        const auto [child, created] = nodes[calls.back().node].children.try_emplace(function, nodes.size());
+        const auto node = child->second;
+        if (created) { nodes.push_back({function}); }
+
+        calls.push_back({function, node, Clock::now()});
+    }
+
+    void Profiler::exit() {
+        const auto call = calls.back();
+        calls.pop_back();
+
+        const auto elapsed = Clock::now() - call.start;
+        const auto exclusive = elapsed - call.children;
+        auto &function = functions[call.function];
+        if (--function.active == 0) { function.inclusive += elapsed; }
+        function.exclusive += exclusive;
+        nodes[call.node].exclusive += exclusive;
+
+        if (!calls.empty()) { calls.back().children += elapsed; }
+    }
+
+    void Profiler::writeCollapsedStacks(std::ostream &out, const size_t node, std::string &stack) const {
+        const auto length = stack.size();
+        if (!stack.empty()) { stack += ';'; }
+        stack += functions[nodes[node].function].name;
+
+        if (const auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(nodes[node].exclusive);
+            microseconds.count() > 0) {
+            out << stack << ' ' << microseconds.count() << '\n';
+        }
+        for (const auto &child: nodes[node].children | std::views::values) { writeCollapsedStacks(out, child, stack); }
+
+        stack.resize(length);
+    }
+
+    void Profiler::finish() {
+        if (finished) return;
+        finished = true;
+
+        while (!calls.empty()) { exit(); }
+
+        const auto milliseconds = [](const Clock::duration duration) {
+            return std::chrono::duration<double, std::milli>(duration).count();
+        };
+
+        std::vector<size_t> order(functions.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::ranges::stable_sort(order, std::greater{}, [&](const size_t i) { return functions[i].exclusive; });
+
+        std::cerr << "Functions, by exclusive time:\n";
+        std::cerr << std::format("{:>10}  {:>14}  {:>14}  {}\n", "calls", "inclusive ms", "exclusive ms", "function");
+        for (const auto i: order) {
+            const auto &function = functions[i];
+            std::cerr << std::format(
+                "{:>10}  {:>14.3f}  {:>14.3f}  {}{}\n", function.calls, milliseconds(function.inclusive),
+                milliseconds(function.exclusive), function.name,
+                i == 0                ? ""
+                : function.line == 0 ? " (native)"
+                                      : std::format(" (line {})", function.line)
+            );
+        }
+
+        std::vector<unsigned int> lines;
+        for (unsigned int line = 0; line < lineCounts.size(); line++) {
+            if (lineCounts[line] > 0) { lines.push_back(line); }
+        }
+        std::ranges::stable_sort(lines, std::greater{}, [&](const unsigned int line) { return lineCounts[line]; });
+
+        std::cerr << "\nStatements, by line:\n";
+        std::cerr << std::format("{:>10}  {:>14}\n", "line", "statements");
+        for (const auto line: lines) { std::cerr << std::format("{:>10}  {:>14}\n", line, lineCounts[line]); }
+
+        const auto *variable = std::getenv("LOX_PROFILE");
+        const auto path = variable == nullptr ? "profile.folded" : variable;
+        std::ofstream out(path);
+        if (!out) {
+            std::cerr << std::format("Could not write the profile to '{}'.\n", path);
+            return;
+        }
+        std::string stack;
+        writeCollapsedStacks(out, 0, stack);
+    }
+}// namespace lox
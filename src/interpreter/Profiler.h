@@ -0,0 +1,98 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace lox {
+
+    /**
+     * Records, for an interpreter run with --profile, the calls and the inclusive
+     * and exclusive time of each function, the number of statements executed on
+     * each line, and the time spent in each distinct stack of calls.
+     */
+    class Profiler {
+        using Clock = std::chrono::steady_clock;
+
+        struct Function {
+            std::string_view name;
+            // The line of the declaration, 0 for a native function.
+            unsigned int line;
+            uint64_t calls = 0;
+            Clock::duration inclusive{};
+            Clock::duration exclusive{};
+            // Calls on the stack, so that recursive calls count their time once.
+            unsigned int active = 0;
+        };
+
+        // A node of the call tree, whose path from the root is a stack of calls.
+        struct Node {
+            size_t function;
+            std::unordered_map<size_t, size_t> children;
+            Clock::duration exclusive{};
+        };
+
+        struct Call {
+            size_t function;
+            size_t node;
+            Clock::time_point start;
+            Clock::duration children{};
+        };
+
+        std::vector<Function> functions;
+        std::unordered_map<const void *, size_t> functionIndex;
+        std::vector<Node> nodes;
+        std::vector<Call> calls;
+        std::vector<uint64_t> lineCounts;
+        bool finished = false;
+
+        void enter(const void *key, std::string_view name, unsigned int line);
+        void exit();
+
+        void writeCollapsedStacks(std::ostream &out, size_t node, std::string &stack) const;
+
+    public:
+        Profiler();
+
+        /**
+         * Profiles a call for as long as it's in scope; a null profiler records nothing.
+         * The key identifies the function: calls of functions with the same key
+         * are counted together.
+         */
+        class Scope {
+            Profiler *profiler;
+
+        public:
+            Scope(Profiler *profiler, const void *key, const std::string_view name, const unsigned int line)
+                : profiler{profiler} {
+                if (profiler) [[unlikely]] { profiler->enter(key, name, line); }
+            }
+            ~Scope() {
+                if (profiler) [[unlikely]] { profiler->exit(); }
+            }
+            Scope(const Scope &) = delete;
+            Scope &operator=(const Scope &) = delete;
+        };
+
+        void countLine(const unsigned int line) {
+            if (line == 0) return;
+            if (line >= lineCounts.size()) { lineCounts.resize(line + 1); }
+            lineCounts[line]++;
+        }
+
+        /**
+         * Stops the profile, ending any calls still on the stack, then writes the
+         * report, sorted by exclusive time, to stderr and the collapsed stacks, in
+         * microseconds, to the file named by the LOX_PROFILE environment variable,
+         * or profile.folded. Only the first call has any effect.
+         */
+        void finish();
+    };
+}// namespace lox
+
+#endif//PROFILER_H
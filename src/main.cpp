@@ -1,15 +1,24 @@
+#include "compiler/CompileCache.h"
 #include "compiler/ModuleCompiler.h"
 #include "frontend/Parser.h"
 #include "frontend/Resolver.h"
 #include "frontend/Scanner.h"
+#include "frontend/TypeInference.h"
 #include "interpreter/Interpreter.h"
+#include "vm/VM.h"
 
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/TargetParser/Host.h"
 
+#include <cstdlib>
+#include <format>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <vector>
 
 
 using namespace llvm;
@@ -18,6 +27,106 @@ using namespace lox;
 cl::opt<std::string> InputFilename(cl::Positional, cl::desc("<input>"), cl::Required);
 cl::opt<std::string> OutputFilename("o", cl::desc("Output LLVM IR file"), cl::value_desc("<output>"));
 cl::opt<bool> DontOptimize("dontoptimize", cl::desc("Don't optimize the LLVM IR"));
+cl::opt<bool> Jit("jit", cl::desc("Compile the script and run it in-process with the LLVM JIT"));
+cl::opt<bool> Vm("vm", cl::desc("Run the script with the bytecode virtual machine"));
+cl::opt<bool> DebugInfo("g", cl::desc("Emit DWARF debug information mapping compiled code to lines of the script"));
+cl::opt<bool> Profile(
+    "profile", cl::desc("Profile the interpreted script, or build a sampling profiler into the compiled program")
+);
+
+// GC settings baked into compiled programs, see GCSettings.h.
+cl::OptionCategory GCCategory("GC options", "Defaults for compiled programs, overridden by the LOX_GC_* variables");
+cl::opt<std::string> GCInitialHeap(
+    "gc-initial-heap", cl::desc("Heap size at which the first major collection runs"), cl::value_desc("size"),
+    cl::cat(GCCategory)
+);
+cl::opt<double> GCGrowth(
+    "gc-growth", cl::desc("Heap growth, relative to the live bytes, before the next major collection"),
+    cl::init(GCSettings{}.growthFactor), cl::cat(GCCategory)
+);
+cl::opt<std::string> GCMinHeap(
+    "gc-min-heap", cl::desc("Lower bound of the major collection threshold"), cl::value_desc("size"),
+    cl::cat(GCCategory)
+);
+cl::opt<std::string> GCMaxHeap(
+    "gc-max-heap", cl::desc("Maximum heap size, 0 for no limit"), cl::value_desc("size"), cl::cat(GCCategory)
+);
+cl::opt<std::string> GCOutOfMemory(
+    "gc-oom", cl::desc("What to do when the live heap exceeds the maximum: error or abort"), cl::value_desc("action"),
+    cl::cat(GCCategory)
+);
+cl::opt<unsigned> GCThreads(
+    "gc-threads", cl::desc("Threads marking each major collection, 0 for one per CPU"),
+    cl::init(GCSettings{}.threads), cl::cat(GCCategory)
+);
+cl::opt<std::string> StackSize(
+    "stack-size",
+    cl::desc("Stack size of compiled programs, at most the stack's limit, 0 for all of it; overridden by LOX_STACK_SIZE"),
+    cl::value_desc("size")
+);
+cl::opt<std::string> CacheDir(
+    "cache-dir", cl::desc("Reuse objects compiled earlier from the same script and options; defaults to LOX_CACHE_DIR"),
+    cl::value_desc("directory")
+);
+
+// Returns false, after reporting the error, if one of the --gc-* options is invalid.
+bool parse_gc_settings(GCSettings &settings) {
+    for (const auto &[option, value]: {std::pair{&GCInitialHeap, &settings.initialHeap},
+                                       {&GCMinHeap, &settings.minHeap},
+                                       {&GCMaxHeap, &settings.maxHeap}}) {
+        if (option->empty()) continue;
+        const auto size = ParseByteSize(option->getValue());
+        if (!size) {
+            std::cout << "Invalid --" << option->ArgStr.str() << " size '" << option->getValue() << "'." << std::endl;
+            return false;
+        }
+        *value = *size;
+    }
+
+    if (GCGrowth <= 1.0) {
+        std::cout << "--gc-growth must be greater than 1." << std::endl;
+        return false;
+    }
+    settings.growthFactor = GCGrowth;
+
+    if (!GCOutOfMemory.empty()) {
+        const auto action = ParseOutOfMemoryAction(GCOutOfMemory.getValue());
+        if (!action) {
+            std::cout << "Invalid --gc-oom action '" << GCOutOfMemory.getValue() << "', expected error or abort."
+                      << std::endl;
+            return false;
+        }
+        settings.outOfMemory = *action;
+    }
+
+    if (GCThreads > MAX_GC_THREADS) {
+        std::cout << "--gc-threads must be at most " << MAX_GC_THREADS << "." << std::endl;
+        return false;
+    }
+    settings.threads = GCThreads;
+
+    return true;
+}
+
+// Everything, apart from the source, that changes the compiled object.
+std::vector<std::string> cache_key_options(const GCSettings &settings, const uint64_t stackSize) {
+    std::vector<std::string> options{
+        std::format("optimize={}", !DontOptimize),
+        std::format("profile={}", Profile.getValue()),
+        std::format("stack-size={}", stackSize),
+        std::format(
+            "gc={},{},{},{},{},{}", settings.initialHeap, settings.growthFactor, settings.minHeap, settings.maxHeap,
+            static_cast<int32_t>(settings.outOfMemory), settings.threads
+        ),
+    };
+    // The debug information records where the script is.
+    if (DebugInfo) {
+        SmallString<256> path(InputFilename.getValue());
+        sys::fs::make_absolute(path);
+        options.push_back(std::format("g={}", path.str().str()));
+    }
+    return options;
+}
 
 std::string read_string_from_file(const std::string &file_path) {
     const std::ifstream input_stream(file_path, std::ios_base::binary);
@@ -40,7 +149,53 @@ int main(const int argc, char **argv) {
         return 64;
     }
 
-    Scanner Scanner(read_string_from_file(InputFilename));
+    if (Jit && !OutputFilename.empty()) {
+        std::cout << "--jit cannot be used with an output file." << std::endl;
+        return 64;
+    }
+
+    if (Vm && (Jit || !OutputFilename.empty())) {
+        std::cout << "--vm cannot be used with --jit or an output file." << std::endl;
+        return 64;
+    }
+
+    if (Vm && Profile) {
+        std::cout << "--profile cannot be used with --vm." << std::endl;
+        return 64;
+    }
+
+    const bool compile = !OutputFilename.empty() || Jit;
+    GCSettings settings;
+    uint64_t stackSize = 0;
+    if (compile) {
+        if (!parse_gc_settings(settings)) return 64;
+
+        if (!StackSize.empty()) {
+            const auto size = ParseByteSize(StackSize.getValue());
+            if (!size) {
+                std::cout << "Invalid --stack-size size '" << StackSize.getValue() << "'." << std::endl;
+                return 64;
+            }
+            stackSize = *size;
+        }
+    }
+
+    const auto source = read_string_from_file(InputFilename);
+
+    // Objects are cached, IR written for inspection is always compiled.
+    std::optional<CompileCache> cache;
+    std::string cacheKey;
+    if (const auto *const variable = std::getenv("LOX_CACHE_DIR");
+        (Jit || OutputFilename.getValue().ends_with(".o")) && (!CacheDir.empty() || variable != nullptr)) {
+        cache.emplace(CacheDir.empty() ? variable : CacheDir.getValue());
+        cacheKey = CompileCache::key(source, sys::getDefaultTargetTriple(), cache_key_options(settings, stackSize));
+        if (auto object = cache->lookup(cacheKey)) {
+            if (Jit) { return ModuleCompiler::runJIT(std::move(object)); }
+            return ModuleCompiler::writeObject(OutputFilename.getValue(), object->getBuffer()) ? 0 : 65;
+        }
+    }
+
+    Scanner Scanner(source);
     const auto &tokens = Scanner.scanTokens();
     Parser Parser(tokens);
     const auto &ast = Parser.parse();
@@ -50,8 +205,27 @@ int main(const int argc, char **argv) {
     resolver.resolve(ast);
     if (hadError) return 65;
 
-    if (!OutputFilename.empty()) {
-        const ModuleCompiler ModuleCompiler;
+    TypeInference inference;
+    inference.infer(ast);
+
+    if (Vm) {
+        vm::VM VM;
+        switch (VM.interpret(ast)) {
+            case vm::InterpretResult::COMPILE_ERROR:
+                return 65;
+            case vm::InterpretResult::RUNTIME_ERROR:
+                return 70;
+            case vm::InterpretResult::OK:
+                return 0;
+        }
+    }
+
+    if (compile) {
+        ModuleCompiler ModuleCompiler;
+        ModuleCompiler.getModule().setGCSettings(settings);
+        ModuleCompiler.getModule().setStackSize(stackSize);
+        if (DebugInfo) ModuleCompiler.getModule().enableDebugInfo(InputFilename.getValue(), !DontOptimize);
+        if (Profile) ModuleCompiler.getModule().enableProfiling();
         ModuleCompiler.evaluate(ast);
 
         if (!ModuleCompiler.initializeTarget()) {
@@ -65,6 +239,19 @@ int main(const int argc, char **argv) {
                 return 65;
             }
         }
+
+        // A cache miss stores the object, which is then used as if it had been found.
+        if (cache) {
+            SmallVector<char, 0> buffer;
+            if (!ModuleCompiler.emitObject(buffer)) return 65;
+            const StringRef object(buffer.data(), buffer.size());
+            if (!cache->store(cacheKey, object)) { std::cerr << "Could not write to the compile cache." << std::endl; }
+            if (Jit) { return ModuleCompiler.runJIT(MemoryBuffer::getMemBufferCopy(object)); }
+            return ModuleCompiler.writeObject(OutputFilename.getValue(), object) ? 0 : 65;
+        }
+
+        if (Jit) { return ModuleCompiler.runJIT(); }
+
         const auto filename = OutputFilename.getValue();
         if (filename.ends_with(".o")) {
             ModuleCompiler.writeObject(filename);
@@ -76,6 +263,7 @@ int main(const int argc, char **argv) {
         }
     } else {
         Interpreter Interpreter;
+        if (Profile) Interpreter.enableProfiling();
         Interpreter.evaluate(ast);
 
         if (hadRuntimeError) return 70;
@@ -0,0 +1,524 @@
+#include "BytecodeCompiler.h"
+#include "../frontend/Error.h"
+#include "VM.h"
+
+#include <limits>
+
+namespace lox::vm {
+
+    constexpr size_t UINT8_COUNT = std::numeric_limits<uint8_t>::max() + 1;
+
+    void BytecodeCompiler::error(const std::string_view message) {
+        lox::error(line, message);
+        hadCompileError = true;
+    }
+
+    void BytecodeCompiler::emitByte(const uint8_t byte) const { currentChunk().write(byte, line); }
+
+    void BytecodeCompiler::emitOp(const OpCode op) const { emitByte(static_cast<uint8_t>(op)); }
+
+    void BytecodeCompiler::emitShort(const uint16_t value) const {
+        emitByte(static_cast<uint8_t>(value >> 8 & 0xff));
+        emitByte(static_cast<uint8_t>(value & 0xff));
+    }
+
+    uint16_t BytecodeCompiler::makeConstant(const Value value) {
+        if (const auto constant = current->constants.find(value); constant != current->constants.end()) {
+            return constant->second;
+        }
+
+        const auto constant = currentChunk().addConstant(value);
+        if (constant > std::numeric_limits<uint16_t>::max()) {
+            error("Too many constants in one chunk.");
+            return 0;
+        }
+
+        current->constants[value] = static_cast<uint16_t>(constant);
+        return static_cast<uint16_t>(constant);
+    }
+
+    void BytecodeCompiler::emitConstant(const Value value) {
+        emitOp(OpCode::CONSTANT);
+        emitShort(makeConstant(value));
+    }
+
+    uint16_t BytecodeCompiler::identifierConstant(const std::string_view name) {
+        return makeConstant(objVal(vm.copyString(name)));
+    }
+
+    size_t BytecodeCompiler::emitJump(const OpCode op) const {
+        emitOp(op);
+        emitShort(0xffff);
+        return currentChunk().code.size() - 2;
+    }
+
+    void BytecodeCompiler::patchJump(const size_t offset) {
+        // -2 to adjust for the bytecode for the jump offset itself.
+        const auto jump = currentChunk().code.size() - offset - 2;
+        if (jump > std::numeric_limits<uint16_t>::max()) { error("Too much code to jump over."); }
+
+        currentChunk().code[offset] = static_cast<uint8_t>(jump >> 8 & 0xff);
+        currentChunk().code[offset + 1] = static_cast<uint8_t>(jump & 0xff);
+    }
+
+    void BytecodeCompiler::emitLoop(const size_t loopStart) {
+        emitOp(OpCode::LOOP);
+
+        const auto offset = currentChunk().code.size() - loopStart + 2;
+        if (offset > std::numeric_limits<uint16_t>::max()) { error("Loop body too large."); }
+
+        emitShort(static_cast<uint16_t>(offset));
+    }
+
+    void BytecodeCompiler::emitReturn() const {
+        if (current->type == LoxFunctionType::INITIALIZER) {
+            emitOp(OpCode::GET_LOCAL);
+            emitByte(0);
+        } else {
+            emitOp(OpCode::NIL);
+        }
+        emitOp(OpCode::RETURN);
+    }
+
+    void BytecodeCompiler::beginScope() const { current->scopeDepth++; }
+
+    void BytecodeCompiler::endScope() const {
+        current->scopeDepth--;
+
+        auto &locals = current->locals;
+        while (!locals.empty() && locals.back().depth > current->scopeDepth) {
+            emitOp(locals.back().isCaptured ? OpCode::CLOSE_UPVALUE : OpCode::POP);
+            locals.pop_back();
+        }
+    }
+
+    void BytecodeCompiler::addLocal(const std::string_view name) {
+        if (current->locals.size() == UINT8_COUNT) {
+            error("Too many local variables in function.");
+            return;
+        }
+
+        current->locals.push_back({name, -1});
+    }
+
+    void BytecodeCompiler::declareLocal(const std::string_view name) {
+        if (current->scopeDepth == 0) return;
+        addLocal(name);
+    }
+
+    void BytecodeCompiler::markInitialized() const {
+        if (current->scopeDepth == 0) return;
+        current->locals.back().depth = current->scopeDepth;
+    }
+
+    int BytecodeCompiler::resolveLocal(const FunctionState *state, const std::string_view name) {
+        for (auto i = static_cast<int>(state->locals.size()) - 1; i >= 0; i--) {
+            if (const auto &local = state->locals[i]; local.depth != -1 && local.name == name) { return i; }
+        }
+
+        return -1;
+    }
+
+    int BytecodeCompiler::addUpvalue(FunctionState *state, const uint8_t index, const bool isLocal) {
+        auto &upvalues = state->upvalues;
+        for (size_t i = 0; i < upvalues.size(); i++) {
+            if (upvalues[i].index == index && upvalues[i].isLocal == isLocal) { return static_cast<int>(i); }
+        }
+
+        if (upvalues.size() == UINT8_COUNT) {
+            error("Too many closure variables in function.");
+            return 0;
+        }
+
+        upvalues.push_back({index, isLocal});
+        return static_cast<int>(upvalues.size() - 1);
+    }
+
+    int BytecodeCompiler::resolveUpvalue(FunctionState *state, const std::string_view name) {
+        if (state->enclosing == nullptr) return -1;
+
+        if (const auto local = resolveLocal(state->enclosing, name); local != -1) {
+            state->enclosing->locals[local].isCaptured = true;
+            return addUpvalue(state, static_cast<uint8_t>(local), true);
+        }
+
+        if (const auto upvalue = resolveUpvalue(state->enclosing, name); upvalue != -1) {
+            return addUpvalue(state, static_cast<uint8_t>(upvalue), false);
+        }
+
+        return -1;
+    }
+
+    uint16_t BytecodeCompiler::globalSlot(const std::string_view name) {
+        const auto slot = vm.globalSlot(name);
+        if (slot > std::numeric_limits<uint16_t>::max()) {
+            error("Too many global variables.");
+            return 0;
+        }
+        return static_cast<uint16_t>(slot);
+    }
+
+    void BytecodeCompiler::namedVariable(const std::string_view name, const bool isGlobal, const bool assign) {
+        if (!isGlobal) {
+            if (const auto local = resolveLocal(current, name); local != -1) {
+                emitOp(assign ? OpCode::SET_LOCAL : OpCode::GET_LOCAL);
+                emitByte(static_cast<uint8_t>(local));
+                return;
+            }
+
+            if (const auto upvalue = resolveUpvalue(current, name); upvalue != -1) {
+                emitOp(assign ? OpCode::SET_UPVALUE : OpCode::GET_UPVALUE);
+                emitByte(static_cast<uint8_t>(upvalue));
+                return;
+            }
+        }
+
+        emitOp(assign ? OpCode::SET_GLOBAL : OpCode::GET_GLOBAL);
+        emitShort(globalSlot(name));
+    }
+
+    void BytecodeCompiler::function(const FunctionStmtPtr &functionStmt, const LoxFunctionType type) {
+        FunctionState state{current, vm.allocate<ObjFunction>(), type, {}, {}, {}};
+        state.function->name = vm.copyString(functionStmt->name.getLexeme());
+        state.function->arity = static_cast<int>(functionStmt->parameters.size());
+        // Slot zero holds the receiver for methods and the callee for functions.
+        state.locals.push_back({type == LoxFunctionType::FUNCTION ? "" : "this", 0});
+        current = &state;
+
+        beginScope();
+        for (const auto &parameter: functionStmt->parameters) {
+            line = parameter.getLine();
+            addLocal(parameter.getLexeme());
+            markInitialized();
+        }
+
+        for (const auto &statement: functionStmt->body) { evaluate(statement); }
+
+        emitReturn();
+
+        auto *const function = state.function;
+        function->upvalueCount = static_cast<int>(state.upvalues.size());
+        current = state.enclosing;
+
+        line = functionStmt->name.getLine();
+        emitOp(OpCode::CLOSURE);
+        emitShort(makeConstant(objVal(function)));
+        for (const auto &[index, isLocal]: state.upvalues) {
+            emitByte(isLocal ? 1 : 0);
+            emitByte(index);
+        }
+    }
+
+    ObjFunction *BytecodeCompiler::compile(const Program &program) {
+        FunctionState state{nullptr, vm.allocate<ObjFunction>(), LoxFunctionType::NONE, {}, {}, {}};
+        state.locals.push_back({"", 0});
+        current = &state;
+
+        for (const auto &statement: program) { evaluate(statement); }
+
+        emitReturn();
+        current = nullptr;
+
+        return hadCompileError ? nullptr : state.function;
+    }
+
+    void BytecodeCompiler::operator()(const ExpressionStmtPtr &expressionStmt) {
+        evaluate(expressionStmt->expression);
+        emitOp(OpCode::POP);
+    }
+
+    void BytecodeCompiler::operator()(const IfStmtPtr &ifStmt) {
+        evaluate(ifStmt->condition);
+
+        const auto thenJump = emitJump(OpCode::JUMP_IF_FALSE);
+        emitOp(OpCode::POP);
+        evaluate(ifStmt->thenBranch);
+
+        const auto elseJump = emitJump(OpCode::JUMP);
+        patchJump(thenJump);
+        emitOp(OpCode::POP);
+
+        if (ifStmt->elseBranch.has_value()) { evaluate(ifStmt->elseBranch.value()); }
+        patchJump(elseJump);
+    }
+
+    void BytecodeCompiler::operator()(const PrintStmtPtr &printStmt) {
+        evaluate(printStmt->expression);
+        emitOp(OpCode::PRINT);
+    }
+
+    void BytecodeCompiler::operator()(const VarStmtPtr &varStmt) {
+        const auto name = varStmt->name.getLexeme();
+        line = varStmt->name.getLine();
+        declareLocal(name);
+
+        evaluate(varStmt->initializer);
+
+        if (current->scopeDepth > 0) {
+            markInitialized();
+            return;
+        }
+
+        line = varStmt->name.getLine();
+        emitOp(OpCode::DEFINE_GLOBAL);
+        emitShort(globalSlot(name));
+    }
+
+    void BytecodeCompiler::operator()(const FunctionStmtPtr &functionStmt) {
+        const auto name = functionStmt->name.getLexeme();
+        line = functionStmt->name.getLine();
+
+        // Mark the function as initialized before compiling the body
+        // so that the function can refer to itself recursively.
+        declareLocal(name);
+        markInitialized();
+
+        function(functionStmt, LoxFunctionType::FUNCTION);
+
+        if (current->scopeDepth == 0) {
+            emitOp(OpCode::DEFINE_GLOBAL);
+            emitShort(globalSlot(name));
+        }
+    }
+
+    void BytecodeCompiler::operator()(const ReturnStmtPtr &returnStmt) {
+        line = returnStmt->keyword.getLine();
+        if (!returnStmt->expression.has_value() || current->type == LoxFunctionType::INITIALIZER) {
+            emitReturn();
+            return;
+        }
+
+        evaluate(returnStmt->expression.value());
+        line = returnStmt->keyword.getLine();
+        emitOp(OpCode::RETURN);
+    }
+
+    void BytecodeCompiler::operator()(const BlockStmtPtr &blockStmt) {
+        beginScope();
+        for (const auto &statement: blockStmt->statements) { evaluate(statement); }
+        endScope();
+    }
+
+    void BytecodeCompiler::operator()(const WhileStmtPtr &whileStmt) {
+        const auto loopStart = currentChunk().code.size();
+        evaluate(whileStmt->condition);
+
+        const auto exitJump = emitJump(OpCode::JUMP_IF_FALSE);
+        emitOp(OpCode::POP);
+        evaluate(whileStmt->body);
+        emitLoop(loopStart);
+
+        patchJump(exitJump);
+        emitOp(OpCode::POP);
+    }
+
+    void BytecodeCompiler::operator()(const ClassStmtPtr &classStmt) {
+        const auto className = classStmt->name.getLexeme();
+        const auto isGlobal = current->scopeDepth == 0;
+        line = classStmt->name.getLine();
+
+        const auto nameConstant = identifierConstant(className);
+        declareLocal(className);
+
+        emitOp(OpCode::CLASS);
+        emitShort(nameConstant);
+
+        if (isGlobal) {
+            emitOp(OpCode::DEFINE_GLOBAL);
+            emitShort(globalSlot(className));
+        } else {
+            markInitialized();
+        }
+
+        if (classStmt->super_class.has_value()) {
+            const auto &superclass = classStmt->super_class.value();
+            line = superclass->name.getLine();
+            namedVariable(superclass->name.getLexeme(), superclass->distance == -1, false);
+
+            beginScope();
+            addLocal("super");
+            markInitialized();
+
+            namedVariable(className, isGlobal, false);
+            emitOp(OpCode::INHERIT);
+        }
+
+        namedVariable(className, isGlobal, false);
+
+        for (const auto &method: classStmt->methods) {
+            line = method->name.getLine();
+            const auto methodConstant = identifierConstant(method->name.getLexeme());
+            function(method, method->type);
+            emitOp(OpCode::METHOD);
+            emitShort(methodConstant);
+        }
+
+        emitOp(OpCode::POP);
+
+        if (classStmt->super_class.has_value()) { endScope(); }
+    }
+
+    void BytecodeCompiler::operator()(const BinaryExprPtr &binaryExpr) {
+        evaluate(binaryExpr->left);
+        evaluate(binaryExpr->right);
+        line = binaryExpr->token.getLine();
+
+        switch (binaryExpr->op) {
+            case BinaryOp::PLUS:
+                emitOp(OpCode::ADD);
+                break;
+            case BinaryOp::MINUS:
+                emitOp(OpCode::SUBTRACT);
+                break;
+            case BinaryOp::SLASH:
+                emitOp(OpCode::DIVIDE);
+                break;
+            case BinaryOp::STAR:
+                emitOp(OpCode::MULTIPLY);
+                break;
+            case BinaryOp::GREATER:
+                emitOp(OpCode::GREATER);
+                break;
+            case BinaryOp::GREATER_EQUAL:
+                emitOp(OpCode::LESS);
+                emitOp(OpCode::NOT);
+                break;
+            case BinaryOp::LESS:
+                emitOp(OpCode::LESS);
+                break;
+            case BinaryOp::LESS_EQUAL:
+                emitOp(OpCode::GREATER);
+                emitOp(OpCode::NOT);
+                break;
+            case BinaryOp::BANG_EQUAL:
+                emitOp(OpCode::EQUAL);
+                emitOp(OpCode::NOT);
+                break;
+            case BinaryOp::EQUAL_EQUAL:
+                emitOp(OpCode::EQUAL);
+                break;
+        }
+    }
+
+    void BytecodeCompiler::operator()(const CallExprPtr &callExpr) {
+        // Method calls are compiled to a single INVOKE instruction
+        // which avoids allocating a bound method.
+        if (std::holds_alternative<GetExprPtr>(callExpr->callee)) {
+            const auto &getExpr = std::get<GetExprPtr>(callExpr->callee);
+            evaluate(getExpr->object);
+            const auto name = identifierConstant(getExpr->name.getLexeme());
+            for (const auto &argument: callExpr->arguments) { evaluate(argument); }
+            line = callExpr->keyword.getLine();
+            emitOp(OpCode::INVOKE);
+            emitShort(name);
+            emitByte(static_cast<uint8_t>(callExpr->arguments.size()));
+            return;
+        }
+
+        if (std::holds_alternative<SuperExprPtr>(callExpr->callee)) {
+            const auto &superExpr = std::get<SuperExprPtr>(callExpr->callee);
+            line = superExpr->name.getLine();
+            namedVariable("this", false, false);
+            const auto name = identifierConstant(superExpr->method.getLexeme());
+            for (const auto &argument: callExpr->arguments) { evaluate(argument); }
+            line = callExpr->keyword.getLine();
+            namedVariable("super", false, false);
+            emitOp(OpCode::SUPER_INVOKE);
+            emitShort(name);
+            emitByte(static_cast<uint8_t>(callExpr->arguments.size()));
+            return;
+        }
+
+        evaluate(callExpr->callee);
+        for (const auto &argument: callExpr->arguments) { evaluate(argument); }
+        line = callExpr->keyword.getLine();
+        emitOp(OpCode::CALL);
+        emitByte(static_cast<uint8_t>(callExpr->arguments.size()));
+    }
+
+    void BytecodeCompiler::operator()(const GetExprPtr &getExpr) {
+        evaluate(getExpr->object);
+        line = getExpr->name.getLine();
+        emitOp(OpCode::GET_PROPERTY);
+        emitShort(identifierConstant(getExpr->name.getLexeme()));
+    }
+
+    void BytecodeCompiler::operator()(const SetExprPtr &setExpr) {
+        evaluate(setExpr->object);
+        evaluate(setExpr->value);
+        line = setExpr->name.getLine();
+        emitOp(OpCode::SET_PROPERTY);
+        emitShort(identifierConstant(setExpr->name.getLexeme()));
+    }
+
+    void BytecodeCompiler::operator()(const ThisExprPtr &thisExpr) {
+        line = thisExpr->name.getLine();
+        namedVariable("this", false, false);
+    }
+
+    void BytecodeCompiler::operator()(const SuperExprPtr &superExpr) {
+        line = superExpr->name.getLine();
+        const auto name = identifierConstant(superExpr->method.getLexeme());
+        namedVariable("this", false, false);
+        namedVariable("super", false, false);
+        emitOp(OpCode::GET_SUPER);
+        emitShort(name);
+    }
+
+    void BytecodeCompiler::operator()(const GroupingExprPtr &groupingExpr) { evaluate(groupingExpr->expression); }
+
+    void BytecodeCompiler::operator()(const LiteralExprPtr &literalExpr) {
+        std::visit(
+            overloaded{
+                [this](const bool value) { emitOp(value ? OpCode::TRUE : OpCode::FALSE); },
+                [this](const double value) { emitConstant(numberVal(value)); },
+                [this](const std::string_view value) { emitConstant(objVal(vm.copyString(value))); },
+                [this](const std::nullptr_t) { emitOp(OpCode::NIL); },
+            },
+            literalExpr->literal
+        );
+    }
+
+    void BytecodeCompiler::operator()(const LogicalExprPtr &logicalExpr) {
+        evaluate(logicalExpr->left);
+
+        if (logicalExpr->op == LogicalOp::AND) {
+            const auto endJump = emitJump(OpCode::JUMP_IF_FALSE);
+            emitOp(OpCode::POP);
+            evaluate(logicalExpr->right);
+            patchJump(endJump);
+        } else {
+            const auto elseJump = emitJump(OpCode::JUMP_IF_FALSE);
+            const auto endJump = emitJump(OpCode::JUMP);
+            patchJump(elseJump);
+            emitOp(OpCode::POP);
+            evaluate(logicalExpr->right);
+            patchJump(endJump);
+        }
+    }
+
+    void BytecodeCompiler::operator()(const UnaryExprPtr &unaryExpr) {
+        evaluate(unaryExpr->expression);
+        line = unaryExpr->token.getLine();
+
+        switch (unaryExpr->op) {
+            case UnaryOp::MINUS:
+                emitOp(OpCode::NEGATE);
+                break;
+            case UnaryOp::BANG:
+                emitOp(OpCode::NOT);
+                break;
+        }
+    }
+
+    void BytecodeCompiler::operator()(const VarExprPtr &varExpr) {
+        line = varExpr->name.getLine();
+        namedVariable(varExpr->name.getLexeme(), varExpr->distance == -1, false);
+    }
+
+    void BytecodeCompiler::operator()(const AssignExprPtr &assignExpr) {
+        evaluate(assignExpr->value);
+        line = assignExpr->name.getLine();
+        namedVariable(assignExpr->name.getLexeme(), assignExpr->distance == -1, true);
+    }
+}// namespace lox::vm
@@ -0,0 +1,103 @@
+#ifndef BYTECODECOMPILER_H
+#define BYTECODECOMPILER_H
+
+#include "../frontend/AST.h"
+#include "Object.h"
+
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace lox::vm {
+    class VM;
+
+    // Compiles a resolved Program into bytecode for the VM. The Resolver
+    // has already reported scoping errors so this only needs to decide
+    // whether a variable is global (distance == -1) or a local/upvalue.
+    class BytecodeCompiler {
+        struct Local {
+            std::string_view name;
+            int depth;
+            bool isCaptured = false;
+        };
+
+        struct Upvalue {
+            uint8_t index;
+            bool isLocal;
+        };
+
+        struct FunctionState {
+            FunctionState *enclosing;
+            ObjFunction *function;
+            LoxFunctionType type;
+            std::vector<Local> locals;
+            std::vector<Upvalue> upvalues;
+            std::unordered_map<Value, uint16_t> constants;
+            int scopeDepth = 0;
+        };
+
+        VM &vm;
+        FunctionState *current = nullptr;
+        unsigned int line = 0;
+        bool hadCompileError = false;
+
+        void error(std::string_view message);
+
+        Chunk &currentChunk() const { return current->function->chunk; }
+
+        void emitByte(uint8_t byte) const;
+        void emitOp(OpCode op) const;
+        void emitShort(uint16_t value) const;
+        void emitConstant(Value value);
+        uint16_t makeConstant(Value value);
+        uint16_t identifierConstant(std::string_view name);
+        size_t emitJump(OpCode op) const;
+        void patchJump(size_t offset);
+        void emitLoop(size_t loopStart);
+        void emitReturn() const;
+
+        void beginScope() const;
+        void endScope() const;
+        void addLocal(std::string_view name);
+        void declareLocal(std::string_view name);
+        void markInitialized() const;
+        static int resolveLocal(const FunctionState *state, std::string_view name);
+        int resolveUpvalue(FunctionState *state, std::string_view name);
+        int addUpvalue(FunctionState *state, uint8_t index, bool isLocal);
+        uint16_t globalSlot(std::string_view name);
+        void namedVariable(std::string_view name, bool isGlobal, bool assign);
+        void function(const FunctionStmtPtr &functionStmt, LoxFunctionType type);
+
+        void evaluate(const Expr &expr) { std::visit(*this, expr); }
+        void evaluate(const Stmt &stmt) { std::visit(*this, stmt); }
+
+    public:
+        explicit BytecodeCompiler(VM &vm) : vm{vm} {}
+
+        ObjFunction *compile(const Program &program);
+
+        void operator()(const ExpressionStmtPtr &expressionStmt);
+        void operator()(const IfStmtPtr &ifStmt);
+        void operator()(const PrintStmtPtr &printStmt);
+        void operator()(const VarStmtPtr &varStmt);
+        void operator()(const FunctionStmtPtr &functionStmt);
+        void operator()(const ReturnStmtPtr &returnStmt);
+        void operator()(const BlockStmtPtr &blockStmt);
+        void operator()(const WhileStmtPtr &whileStmt);
+        void operator()(const ClassStmtPtr &classStmt);
+        void operator()(const BinaryExprPtr &binaryExpr);
+        void operator()(const CallExprPtr &callExpr);
+        void operator()(const GetExprPtr &getExpr);
+        void operator()(const SetExprPtr &setExpr);
+        void operator()(const ThisExprPtr &thisExpr);
+        void operator()(const SuperExprPtr &superExpr);
+        void operator()(const GroupingExprPtr &groupingExpr);
+        void operator()(const LiteralExprPtr &literalExpr);
+        void operator()(const LogicalExprPtr &logicalExpr);
+        void operator()(const UnaryExprPtr &unaryExpr);
+        void operator()(const VarExprPtr &varExpr);
+        void operator()(const AssignExprPtr &assignExpr);
+    };
+}// namespace lox::vm
+
+#endif//BYTECODECOMPILER_H
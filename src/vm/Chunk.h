@@ -0,0 +1,79 @@
+#ifndef VM_CHUNK_H
+#define VM_CHUNK_H
+
+#include "Value.h"
+
+#include <cstdint>
+#include <vector>
+
+// Operands are stored after the opcode, 16-bit operands in big-endian order:
+//   CONSTANT, *_GLOBAL, *_PROPERTY, GET_SUPER, CLASS, METHOD: u16 constant/global index
+//   *_LOCAL, *_UPVALUE, CALL: u8
+//   JUMP, JUMP_IF_FALSE, LOOP: u16 offset
+//   INVOKE, SUPER_INVOKE: u16 name constant, u8 argument count
+//   CLOSURE: u16 function constant, followed by (u8 isLocal, u8 index) per upvalue
+#define LOX_OPCODES(X)                                                                                                 \
+    X(CONSTANT)                                                                                                        \
+    X(NIL)                                                                                                             \
+    X(TRUE)                                                                                                            \
+    X(FALSE)                                                                                                           \
+    X(POP)                                                                                                             \
+    X(GET_LOCAL)                                                                                                       \
+    X(SET_LOCAL)                                                                                                       \
+    X(GET_GLOBAL)                                                                                                      \
+    X(DEFINE_GLOBAL)                                                                                                   \
+    X(SET_GLOBAL)                                                                                                      \
+    X(GET_UPVALUE)                                                                                                     \
+    X(SET_UPVALUE)                                                                                                     \
+    X(GET_PROPERTY)                                                                                                    \
+    X(SET_PROPERTY)                                                                                                    \
+    X(GET_SUPER)                                                                                                       \
+    X(EQUAL)                                                                                                           \
+    X(GREATER)                                                                                                         \
+    X(LESS)                                                                                                            \
+    X(ADD)                                                                                                             \
+    X(SUBTRACT)                                                                                                        \
+    X(MULTIPLY)                                                                                                        \
+    X(DIVIDE)                                                                                                          \
+    X(NOT)                                                                                                             \
+    X(NEGATE)                                                                                                          \
+    X(PRINT)                                                                                                           \
+    X(JUMP)                                                                                                            \
+    X(JUMP_IF_FALSE)                                                                                                   \
+    X(LOOP)                                                                                                            \
+    X(CALL)                                                                                                            \
+    X(INVOKE)                                                                                                          \
+    X(SUPER_INVOKE)                                                                                                    \
+    X(CLOSURE)                                                                                                         \
+    X(CLOSE_UPVALUE)                                                                                                   \
+    X(RETURN)                                                                                                          \
+    X(CLASS)                                                                                                           \
+    X(INHERIT)                                                                                                         \
+    X(METHOD)
+
+namespace lox::vm {
+
+    enum class OpCode : uint8_t {
+#define LOX_OPCODE_ENUM(name) name,
+        LOX_OPCODES(LOX_OPCODE_ENUM)
+#undef LOX_OPCODE_ENUM
+    };
+
+    struct Chunk {
+        std::vector<uint8_t> code;
+        std::vector<unsigned int> lines;
+        std::vector<Value> constants;
+
+        void write(const uint8_t byte, const unsigned int line) {
+            code.push_back(byte);
+            lines.push_back(line);
+        }
+
+        size_t addConstant(const Value value) {
+            constants.push_back(value);
+            return constants.size() - 1;
+        }
+    };
+}// namespace lox::vm
+
+#endif//VM_CHUNK_H
@@ -0,0 +1,232 @@
+#include "../Debug.h"
+#include "VM.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+namespace lox::vm {
+
+    size_t sizeOf(const Obj *object) {
+        switch (object->type) {
+            case ObjType::STRING:
+                return sizeof(ObjString) + static_cast<const ObjString *>(object)->chars.capacity();
+            case ObjType::FUNCTION:
+                return sizeof(ObjFunction);
+            case ObjType::CLOSURE:
+                return sizeof(ObjClosure) +
+                       static_cast<const ObjClosure *>(object)->upvalues.size() * sizeof(ObjUpvalue *);
+            case ObjType::UPVALUE:
+                return sizeof(ObjUpvalue);
+            case ObjType::CLASS:
+                return sizeof(ObjClass);
+            case ObjType::INSTANCE:
+                return sizeof(ObjInstance);
+            case ObjType::BOUND_METHOD:
+                return sizeof(ObjBoundMethod);
+        }
+
+        std::unreachable();
+    }
+
+    void VM::freeObject(Obj *object) {
+        const auto size = sizeOf(object);
+        bytesAllocated -= size;
+        stats.freedByType[static_cast<unsigned>(object->type)] += size;
+
+        switch (object->type) {
+            case ObjType::STRING:
+                delete static_cast<ObjString *>(object);
+                break;
+            case ObjType::FUNCTION:
+                delete static_cast<ObjFunction *>(object);
+                break;
+            case ObjType::CLOSURE:
+                delete static_cast<ObjClosure *>(object);
+                break;
+            case ObjType::UPVALUE:
+                delete static_cast<ObjUpvalue *>(object);
+                break;
+            case ObjType::CLASS:
+                delete static_cast<ObjClass *>(object);
+                break;
+            case ObjType::INSTANCE:
+                delete static_cast<ObjInstance *>(object);
+                break;
+            case ObjType::BOUND_METHOD:
+                delete static_cast<ObjBoundMethod *>(object);
+                break;
+        }
+    }
+
+    void VM::markObject(Obj *object) {
+        if (object == nullptr || object->isMarked) return;
+
+        object->isMarked = true;
+        grayStack.push_back(object);
+        stats.grayStackHighWater = std::max(stats.grayStackHighWater, grayStack.size());
+    }
+
+    void VM::markValue(const Value value) {
+        if (isObj(value)) { markObject(asObj(value)); }
+    }
+
+    void VM::markTable(const Table &table) {
+        for (const auto &[key, value]: table) {
+            markObject(key);
+            markValue(value);
+        }
+    }
+
+    void VM::markRoots() {
+        for (const auto *slot = stack.get(); slot < stackTop; slot++) { markValue(*slot); }
+
+        for (unsigned int i = 0; i < frameCount; i++) { markObject(frames[i].closure); }
+
+        for (auto *upvalue = openUpvalues; upvalue != nullptr; upvalue = upvalue->nextOpen) { markObject(upvalue); }
+
+        for (const auto global: globals) { markValue(global); }
+        for (auto *const name: globalNames) { markObject(name); }
+
+        markObject(initString);
+    }
+
+    void VM::blackenObject(Obj *object) {
+        switch (object->type) {
+            case ObjType::STRING:
+                break;
+            case ObjType::FUNCTION: {
+                const auto *const function = static_cast<ObjFunction *>(object);
+                markObject(function->name);
+                for (const auto constant: function->chunk.constants) { markValue(constant); }
+                break;
+            }
+            case ObjType::CLOSURE: {
+                const auto *const closure = static_cast<ObjClosure *>(object);
+                markObject(closure->function);
+                for (auto *const upvalue: closure->upvalues) { markObject(upvalue); }
+                break;
+            }
+            case ObjType::UPVALUE:
+                markValue(static_cast<ObjUpvalue *>(object)->closed);
+                break;
+            case ObjType::CLASS: {
+                const auto *const klass = static_cast<ObjClass *>(object);
+                markObject(klass->name);
+                markTable(klass->methods);
+                markObject(klass->initializer);
+                break;
+            }
+            case ObjType::INSTANCE: {
+                const auto *const instance = static_cast<ObjInstance *>(object);
+                markObject(instance->klass);
+                markTable(instance->fields);
+                break;
+            }
+            case ObjType::BOUND_METHOD: {
+                const auto *const bound = static_cast<ObjBoundMethod *>(object);
+                markValue(bound->receiver);
+                markObject(bound->method);
+                break;
+            }
+        }
+    }
+
+    void VM::sweep() {
+        Obj *previous = nullptr;
+        auto *object = objects;
+        while (object != nullptr) {
+            if (object->isMarked) {
+                object->isMarked = false;
+                previous = object;
+                object = object->next;
+            } else {
+                auto *const unreached = object;
+                object = object->next;
+                if (previous != nullptr) {
+                    previous->next = object;
+                } else {
+                    objects = object;
+                }
+
+                freeObject(unreached);
+            }
+        }
+    }
+
+    void VM::collectGarbage() {
+        const auto before = bytesAllocated;
+        const auto start = std::chrono::steady_clock::now();
+        if constexpr (DEBUG_LOG_GC) { std::cerr << "-- gc begin\n"; }
+
+        markRoots();
+
+        while (!grayStack.empty()) {
+            auto *const object = grayStack.back();
+            grayStack.pop_back();
+            blackenObject(object);
+        }
+
+        // The string table is weak: remove strings that are about to be freed.
+        std::erase_if(strings, [](const auto &entry) { return !entry.second->isMarked; });
+
+        sweep();
+
+        nextGC = bytesAllocated * VM_GC_GROWTH_FACTOR;
+        collections++;
+
+        const uint64_t pause =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        stats.pauseTotal += pause;
+        stats.pauseMax = std::max(stats.pauseMax, pause);
+        stats.pauseHistogram[std::ranges::count_if(GC_PAUSE_BUCKETS, [&](const auto bound) { return pause >= bound; })]++;
+
+        if constexpr (DEBUG_LOG_GC) {
+            std::cerr << "-- gc end, collected " << before - bytesAllocated << " bytes (from " << before << " to "
+                      << bytesAllocated << ") next at " << nextGC << "\n";
+        }
+    }
+
+    static std::string formatDuration(const uint64_t nanoseconds) {
+        if (nanoseconds >= 1'000'000) { return std::to_string(nanoseconds / 1'000'000) + "ms"; }
+        if (nanoseconds >= 1'000) { return std::to_string(nanoseconds / 1'000) + "us"; }
+        return std::to_string(nanoseconds) + "ns";
+    }
+
+    static constexpr std::array<std::string_view, OBJ_TYPE_COUNT> OBJ_TYPE_NAMES{
+        "", "string", "function", "closure", "upvalue", "class", "instance", "bound_method"
+    };
+
+    // Writes the GC statistics as JSON to the file named by LOX_GC_STATS, in
+    // the same format as the compiled runtime; the VM has no minor collections.
+    void VM::writeGCStats() const {
+        const char *path = std::getenv("LOX_GC_STATS");
+        if (path == nullptr) { return; }
+
+        std::ofstream out(path);
+        out << "{\"collections\": {\"minor\": 0, \"major\": " << collections << "},\n";
+
+        out << " \"pauses\": {\"total_ns\": " << stats.pauseTotal << ", \"max_ns\": " << stats.pauseMax
+            << ", \"histogram\": {";
+        for (unsigned int i = 0; i <= GC_PAUSE_BUCKETS.size(); i++) {
+            const auto label = i < GC_PAUSE_BUCKETS.size() ? "<" + formatDuration(GC_PAUSE_BUCKETS[i])
+                                                            : ">=" + formatDuration(GC_PAUSE_BUCKETS.back());
+            out << (i == 0 ? "" : ", ") << "\"" << label << "\": " << stats.pauseHistogram[i];
+        }
+        out << "}},\n";
+
+        out << " \"objects\": {";
+        for (unsigned int type = 1; type < OBJ_TYPE_COUNT; type++) {
+            out << (type == 1 ? "" : ", ") << "\"" << OBJ_TYPE_NAMES[type] << "\": {\"allocated\": "
+                << stats.allocatedByType[type] << ", \"freed\": " << stats.freedByType[type] << "}";
+        }
+        out << "},\n";
+
+        out << " \"heap\": {\"current\": " << bytesAllocated << ", \"peak\": " << stats.peakHeap << "},\n";
+        out << " \"strings\": {\"interned\": " << strings.size() << ", \"capacity\": " << strings.bucket_count()
+            << "},\n";
+        out << " \"gray_stack\": {\"high_water\": " << stats.grayStackHighWater << "}}\n";
+    }
+}// namespace lox::vm
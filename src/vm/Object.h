@@ -0,0 +1,105 @@
+#ifndef VM_OBJECT_H
+#define VM_OBJECT_H
+
+#include "Chunk.h"
+#include "Value.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace lox::vm {
+    class VM;
+    struct ObjString;
+
+    // Strings are interned so tables can be keyed by pointer.
+    using Table = std::unordered_map<ObjString *, Value>;
+    using NativeFn = Value (*)(VM &vm, const Value *args);
+
+    struct Obj {
+        const ObjType type;
+        bool isMarked = false;
+        Obj *next = nullptr;
+
+        explicit Obj(const ObjType type) : type{type} {}
+    };
+
+    struct ObjString final : Obj {
+        const std::string chars;
+
+        explicit ObjString(std::string chars) : Obj(ObjType::STRING), chars{std::move(chars)} {}
+    };
+
+    struct ObjFunction final : Obj {
+        int arity = 0;
+        int upvalueCount = 0;
+        Chunk chunk;
+        ObjString *name = nullptr;
+        NativeFn native = nullptr;
+
+        explicit ObjFunction() : Obj(ObjType::FUNCTION) {}
+    };
+
+    struct ObjUpvalue final : Obj {
+        Value *location;
+        Value closed = NIL_VAL;
+        ObjUpvalue *nextOpen = nullptr;
+
+        explicit ObjUpvalue(Value *slot) : Obj(ObjType::UPVALUE), location{slot} {}
+    };
+
+    struct ObjClosure final : Obj {
+        ObjFunction *const function;
+        std::vector<ObjUpvalue *> upvalues;
+
+        explicit ObjClosure(ObjFunction *function)
+            : Obj(ObjType::CLOSURE), function{function}, upvalues(function->upvalueCount, nullptr) {}
+    };
+
+    struct ObjClass final : Obj {
+        ObjString *const name;
+        Table methods;
+        ObjClosure *initializer = nullptr;
+
+        explicit ObjClass(ObjString *name) : Obj(ObjType::CLASS), name{name} {}
+    };
+
+    struct ObjInstance final : Obj {
+        ObjClass *const klass;
+        Table fields;
+
+        explicit ObjInstance(ObjClass *klass) : Obj(ObjType::INSTANCE), klass{klass} {}
+    };
+
+    struct ObjBoundMethod final : Obj {
+        const Value receiver;
+        ObjClosure *const method;
+
+        explicit ObjBoundMethod(const Value receiver, ObjClosure *method)
+            : Obj(ObjType::BOUND_METHOD), receiver{receiver}, method{method} {}
+    };
+
+    inline bool isObjType(const Value value, const ObjType type) { return isObj(value) && asObj(value)->type == type; }
+
+    inline bool isString(const Value value) { return isObjType(value, ObjType::STRING); }
+
+    inline bool isClass(const Value value) { return isObjType(value, ObjType::CLASS); }
+
+    inline bool isInstance(const Value value) { return isObjType(value, ObjType::INSTANCE); }
+
+    inline ObjString *asString(const Value value) { return static_cast<ObjString *>(asObj(value)); }
+
+    inline ObjFunction *asFunction(const Value value) { return static_cast<ObjFunction *>(asObj(value)); }
+
+    inline ObjClosure *asClosure(const Value value) { return static_cast<ObjClosure *>(asObj(value)); }
+
+    inline ObjClass *asClass(const Value value) { return static_cast<ObjClass *>(asObj(value)); }
+
+    inline ObjInstance *asInstance(const Value value) { return static_cast<ObjInstance *>(asObj(value)); }
+
+    inline ObjBoundMethod *asBoundMethod(const Value value) { return static_cast<ObjBoundMethod *>(asObj(value)); }
+
+    std::string to_string(Value value);
+}// namespace lox::vm
+
+#endif//VM_OBJECT_H
@@ -0,0 +1,606 @@
+#include "VM.h"
+#include "BytecodeCompiler.h"
+#include "../Util.h"
+#include "../frontend/Error.h"
+
+#include <csignal>
+#include <cstdlib>
+#include <ctime>
+#include <format>
+#include <iostream>
+
+// Computed gotos are a GNU extension, supported by both GCC and Clang.
+#if defined(__GNUC__)
+#define COMPUTED_GOTO
+#endif
+
+namespace lox::vm {
+
+    std::string to_string(const Value value) {
+        if (isNumber(value)) { return std::format("{:g}", asNumber(value)); }
+        if (value == NIL_VAL) { return "nil"; }
+        if (value == TRUE_VAL) { return "true"; }
+        if (value == FALSE_VAL) { return "false"; }
+
+        switch (const auto *const object = asObj(value); object->type) {
+            case ObjType::STRING:
+                return asString(value)->chars;
+            case ObjType::FUNCTION: {
+                const auto *const function = asFunction(value);
+                if (function->native != nullptr) { return "<native fn>"; }
+                if (function->name == nullptr) { return "<script>"; }
+                return std::format("<fn {}>", function->name->chars);
+            }
+            case ObjType::CLOSURE:
+                return to_string(objVal(asClosure(value)->function));
+            case ObjType::UPVALUE:
+                return "upvalue";
+            case ObjType::CLASS:
+                return asClass(value)->name->chars;
+            case ObjType::INSTANCE:
+                return std::format("{} instance", asInstance(value)->klass->name->chars);
+            case ObjType::BOUND_METHOD:
+                return to_string(objVal(asBoundMethod(value)->method->function));
+        }
+
+        std::unreachable();
+    }
+
+    VM::VM() {
+        initString = copyString("init");
+
+        if (std::getenv("LOX_GC_STATS") != nullptr) {
+            std::signal(SIGUSR1, [](int) { gcStatsRequested = 1; });
+        }
+
+        defineNative("clock", 0, [](VM &, const Value *) -> Value {
+            return numberVal(static_cast<double>(std::clock()) / CLOCKS_PER_SEC);
+        });
+
+        defineNative("exit", 1, [](VM &vm, const Value *args) -> Value {
+            if (!isNumber(args[0])) { throw std::runtime_error("Operand must be a number."); }
+            // std::exit doesn't run the destructor, which writes the final report otherwise.
+            vm.writeGCStats();
+            vm.gcStatsWritten = true;
+            std::exit(static_cast<int>(asNumber(args[0])));
+        });
+
+        defineNative("read", 0, [](VM &vm, const Value *) -> Value {
+            const int c = getcharPolling([&vm] { vm.pollGCStatsRequest(); });
+            if (c == -1) { return NIL_VAL; }
+            return numberVal(static_cast<uint8_t>(c));
+        });
+
+        defineNative("utf", 4, [](VM &vm, const Value *args) -> Value {
+            std::string bytes;
+            for (int i = 0; i < 4; i++) {
+                if (i > 0 && args[i] == NIL_VAL) continue;
+
+                if (!isNumber(args[i]) || asNumber(args[i]) < 0 || asNumber(args[i]) > 255) {
+                    throw std::runtime_error("utf parameter should be a number between 0 and 255.");
+                }
+
+                bytes.push_back(static_cast<char>(asNumber(args[i])));
+            }
+
+            return objVal(vm.takeString(std::move(bytes)));
+        });
+
+        defineNative("printerr", 1, [](VM &, const Value *args) -> Value {
+            std::cerr << to_string(args[0]) << std::endl;
+            return NIL_VAL;
+        });
+    }
+
+    VM::~VM() {
+        if (!gcStatsWritten) { writeGCStats(); }
+
+        while (objects != nullptr) {
+            auto *const next = objects->next;
+            freeObject(objects);
+            objects = next;
+        }
+    }
+
+    void VM::defineNative(const std::string_view name, const int arity, const NativeFn function) {
+        auto *const native = allocate<ObjFunction>();
+        native->arity = arity;
+        native->native = function;
+        globals[globalSlot(name)] = objVal(native);
+    }
+
+    size_t VM::globalSlot(const std::string_view name) {
+        if (const auto slot = globalSlots.find(name); slot != globalSlots.end()) { return slot->second; }
+
+        auto *const string = copyString(name);
+        globals.push_back(UNINITIALIZED_VAL);
+        globalNames.push_back(string);
+        globalSlots[string->chars] = globals.size() - 1;
+        return globals.size() - 1;
+    }
+
+    ObjString *VM::copyString(const std::string_view chars) {
+        if (const auto interned = strings.find(chars); interned != strings.end()) { return interned->second; }
+
+        auto *const string = allocate<ObjString>(std::string(chars));
+        strings[string->chars] = string;
+        return string;
+    }
+
+    ObjString *VM::takeString(std::string &&chars) {
+        if (const auto interned = strings.find(chars); interned != strings.end()) { return interned->second; }
+
+        auto *const string = allocate<ObjString>(std::move(chars));
+        strings[string->chars] = string;
+        return string;
+    }
+
+    void VM::resetStack() {
+        stackTop = stack.get();
+        frameCount = 0;
+        openUpvalues = nullptr;
+    }
+
+    void VM::runtimeError(const std::string &message) {
+        const auto &frame = frames[frameCount - 1];
+        const auto &chunk = frame.closure->function->chunk;
+        const auto line = chunk.lines[frame.ip - chunk.code.data() - 1];
+        lox::runtimeError(lox::runtime_error(Token(IDENTIFIER, "", nullptr, line), message));
+        resetStack();
+    }
+
+    bool VM::call(ObjClosure *closure, const int argCount) {
+        if (argCount != closure->function->arity) {
+            runtimeError(std::format("Expected {} arguments but got {}.", closure->function->arity, argCount));
+            return false;
+        }
+
+        if (frameCount == FRAMES_MAX) {
+            runtimeError("Stack overflow.");
+            return false;
+        }
+
+        pollGCStatsRequest();
+
+        auto &frame = frames[frameCount++];
+        frame.closure = closure;
+        frame.ip = closure->function->chunk.code.data();
+        frame.slots = stackTop - argCount - 1;
+        return true;
+    }
+
+    bool VM::callValue(const Value callee, const int argCount) {
+        if (isObj(callee)) {
+            switch (asObj(callee)->type) {
+                case ObjType::BOUND_METHOD: {
+                    const auto *const bound = asBoundMethod(callee);
+                    stackTop[-argCount - 1] = bound->receiver;
+                    return call(bound->method, argCount);
+                }
+                case ObjType::CLASS: {
+                    auto *const klass = asClass(callee);
+                    stackTop[-argCount - 1] = objVal(allocate<ObjInstance>(klass));
+                    if (klass->initializer != nullptr) { return call(klass->initializer, argCount); }
+                    if (argCount != 0) {
+                        runtimeError(std::format("Expected 0 arguments but got {}.", argCount));
+                        return false;
+                    }
+                    return true;
+                }
+                case ObjType::CLOSURE:
+                    return call(asClosure(callee), argCount);
+                case ObjType::FUNCTION: {
+                    const auto *const function = asFunction(callee);
+                    if (argCount != function->arity) {
+                        runtimeError(std::format("Expected {} arguments but got {}.", function->arity, argCount));
+                        return false;
+                    }
+                    try {
+                        const auto result = function->native(*this, stackTop - argCount);
+                        stackTop -= argCount + 1;
+                        push(result);
+                        return true;
+                    } catch (const std::runtime_error &e) {
+                        runtimeError(e.what());
+                        return false;
+                    }
+                }
+                default:
+                    break;
+            }
+        }
+
+        runtimeError("Can only call functions and classes.");
+        return false;
+    }
+
+    bool VM::invoke(ObjString *name, const int argCount) {
+        const auto receiver = peek(argCount);
+
+        if (!isInstance(receiver)) {
+            runtimeError("Only instances have properties.");
+            return false;
+        }
+
+        const auto *const instance = asInstance(receiver);
+
+        if (const auto field = instance->fields.find(name); field != instance->fields.end()) {
+            stackTop[-argCount - 1] = field->second;
+            return callValue(field->second, argCount);
+        }
+
+        return invokeFromClass(instance->klass, name, argCount);
+    }
+
+    bool VM::invokeFromClass(const ObjClass *klass, ObjString *name, const int argCount) {
+        const auto method = klass->methods.find(name);
+        if (method == klass->methods.end()) {
+            runtimeError(std::format("Undefined property '{}'.", name->chars));
+            return false;
+        }
+
+        return call(asClosure(method->second), argCount);
+    }
+
+    bool VM::bindMethod(const ObjClass *klass, ObjString *name) {
+        const auto method = klass->methods.find(name);
+        if (method == klass->methods.end()) {
+            runtimeError(std::format("Undefined property '{}'.", name->chars));
+            return false;
+        }
+
+        auto *const bound = allocate<ObjBoundMethod>(peek(0), asClosure(method->second));
+        pop();
+        push(objVal(bound));
+        return true;
+    }
+
+    ObjUpvalue *VM::captureUpvalue(Value *local) {
+        ObjUpvalue *prevUpvalue = nullptr;
+        auto *upvalue = openUpvalues;
+        while (upvalue != nullptr && upvalue->location > local) {
+            prevUpvalue = upvalue;
+            upvalue = upvalue->nextOpen;
+        }
+
+        if (upvalue != nullptr && upvalue->location == local) { return upvalue; }
+
+        auto *const createdUpvalue = allocate<ObjUpvalue>(local);
+        createdUpvalue->nextOpen = upvalue;
+
+        if (prevUpvalue == nullptr) {
+            openUpvalues = createdUpvalue;
+        } else {
+            prevUpvalue->nextOpen = createdUpvalue;
+        }
+
+        return createdUpvalue;
+    }
+
+    void VM::closeUpvalues(const Value *last) {
+        while (openUpvalues != nullptr && openUpvalues->location >= last) {
+            auto *const upvalue = openUpvalues;
+            upvalue->closed = *upvalue->location;
+            upvalue->location = &upvalue->closed;
+            openUpvalues = upvalue->nextOpen;
+        }
+    }
+
+    void VM::concatenate() {
+        // Both operands stay on the stack until the result is allocated
+        // so that they are reachable if the allocation triggers a GC.
+        const auto *const b = asString(peek(0));
+        const auto *const a = asString(peek(1));
+        auto *const result = takeString(a->chars + b->chars);
+        pop();
+        pop();
+        push(objVal(result));
+    }
+
+    InterpretResult VM::interpret(const Program &program) {
+        BytecodeCompiler Compiler(*this);
+        auto *const function = Compiler.compile(program);
+        if (function == nullptr) { return InterpretResult::COMPILE_ERROR; }
+
+        auto *const closure = allocate<ObjClosure>(function);
+        push(objVal(closure));
+        call(closure, 0);
+
+        enableGC = true;
+        return run();
+    }
+
+    InterpretResult VM::run() {
+        auto *frame = &frames[frameCount - 1];
+        auto *ip = frame->ip;
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, static_cast<uint16_t>((ip[-2] << 8) | ip[-1]))
+#define READ_CONSTANT() (frame->closure->function->chunk.constants[READ_SHORT()])
+#define READ_STRING() asString(READ_CONSTANT())
+#define SAVE_FRAME() (frame->ip = ip)
+#define LOAD_FRAME()                                                                                                   \
+    do {                                                                                                               \
+        frame = &frames[frameCount - 1];                                                                               \
+        ip = frame->ip;                                                                                                \
+    } while (false)
+#define RUNTIME_ERROR(message)                                                                                         \
+    do {                                                                                                               \
+        SAVE_FRAME();                                                                                                  \
+        runtimeError(message);                                                                                         \
+        return InterpretResult::RUNTIME_ERROR;                                                                         \
+    } while (false)
+#define BINARY_OP(valueType, op)                                                                                       \
+    do {                                                                                                               \
+        if (!isNumber(stackTop[-1]) || !isNumber(stackTop[-2])) { RUNTIME_ERROR("Operands must be numbers."); }        \
+        stackTop[-2] = valueType(asNumber(stackTop[-2]) op asNumber(stackTop[-1]));                                    \
+        stackTop--;                                                                                                    \
+    } while (false)
+
+#ifdef COMPUTED_GOTO
+// Labels as values are what -Wpedantic warns about, in the dispatch table and loop only.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define LOX_OPCODE_LABEL(name) &&op_##name,
+        static void *dispatchTable[] = {LOX_OPCODES(LOX_OPCODE_LABEL)};
+#undef LOX_OPCODE_LABEL
+#define DISPATCH() goto *dispatchTable[READ_BYTE()]
+#define OPCODE(name) op_##name:
+        DISPATCH();
+#else
+#define DISPATCH() goto dispatch
+#define OPCODE(name) case OpCode::name:
+    dispatch:
+        switch (static_cast<OpCode>(READ_BYTE())) {
+#endif
+
+        OPCODE(CONSTANT) {
+            push(READ_CONSTANT());
+            DISPATCH();
+        }
+        OPCODE(NIL) {
+            push(NIL_VAL);
+            DISPATCH();
+        }
+        OPCODE(TRUE) {
+            push(TRUE_VAL);
+            DISPATCH();
+        }
+        OPCODE(FALSE) {
+            push(FALSE_VAL);
+            DISPATCH();
+        }
+        OPCODE(POP) {
+            stackTop--;
+            DISPATCH();
+        }
+        OPCODE(GET_LOCAL) {
+            push(frame->slots[READ_BYTE()]);
+            DISPATCH();
+        }
+        OPCODE(SET_LOCAL) {
+            frame->slots[READ_BYTE()] = peek(0);
+            DISPATCH();
+        }
+        OPCODE(GET_GLOBAL) {
+            const auto slot = READ_SHORT();
+            const auto value = globals[slot];
+            if (value == UNINITIALIZED_VAL) {
+                RUNTIME_ERROR(std::format("Undefined variable '{}'.", globalNames[slot]->chars));
+            }
+            push(value);
+            DISPATCH();
+        }
+        OPCODE(DEFINE_GLOBAL) {
+            globals[READ_SHORT()] = pop();
+            DISPATCH();
+        }
+        OPCODE(SET_GLOBAL) {
+            const auto slot = READ_SHORT();
+            if (globals[slot] == UNINITIALIZED_VAL) {
+                RUNTIME_ERROR(std::format("Undefined variable '{}'.", globalNames[slot]->chars));
+            }
+            globals[slot] = peek(0);
+            DISPATCH();
+        }
+        OPCODE(GET_UPVALUE) {
+            push(*frame->closure->upvalues[READ_BYTE()]->location);
+            DISPATCH();
+        }
+        OPCODE(SET_UPVALUE) {
+            *frame->closure->upvalues[READ_BYTE()]->location = peek(0);
+            DISPATCH();
+        }
+        OPCODE(GET_PROPERTY) {
+            auto *const name = READ_STRING();
+            if (!isInstance(peek(0))) { RUNTIME_ERROR("Only instances have properties."); }
+
+            const auto *const instance = asInstance(peek(0));
+            if (const auto field = instance->fields.find(name); field != instance->fields.end()) {
+                stackTop[-1] = field->second;
+                DISPATCH();
+            }
+
+            SAVE_FRAME();
+            if (!bindMethod(instance->klass, name)) { return InterpretResult::RUNTIME_ERROR; }
+            DISPATCH();
+        }
+        OPCODE(SET_PROPERTY) {
+            auto *const name = READ_STRING();
+            if (!isInstance(peek(1))) { RUNTIME_ERROR("Only instances have fields."); }
+
+            asInstance(peek(1))->fields[name] = peek(0);
+            const auto value = pop();
+            stackTop[-1] = value;
+            DISPATCH();
+        }
+        OPCODE(GET_SUPER) {
+            auto *const name = READ_STRING();
+            const auto *const superclass = asClass(pop());
+            SAVE_FRAME();
+            if (!bindMethod(superclass, name)) { return InterpretResult::RUNTIME_ERROR; }
+            DISPATCH();
+        }
+        OPCODE(EQUAL) {
+            stackTop[-2] = boolVal(valuesEqual(stackTop[-2], stackTop[-1]));
+            stackTop--;
+            DISPATCH();
+        }
+        OPCODE(GREATER) {
+            BINARY_OP(boolVal, >);
+            DISPATCH();
+        }
+        OPCODE(LESS) {
+            BINARY_OP(boolVal, <);
+            DISPATCH();
+        }
+        OPCODE(ADD) {
+            if (isNumber(stackTop[-1]) && isNumber(stackTop[-2])) {
+                stackTop[-2] = numberVal(asNumber(stackTop[-2]) + asNumber(stackTop[-1]));
+                stackTop--;
+            } else if (isString(stackTop[-1]) && isString(stackTop[-2])) {
+                concatenate();
+            } else {
+                RUNTIME_ERROR("Operands must be two numbers or two strings.");
+            }
+            DISPATCH();
+        }
+        OPCODE(SUBTRACT) {
+            BINARY_OP(numberVal, -);
+            DISPATCH();
+        }
+        OPCODE(MULTIPLY) {
+            BINARY_OP(numberVal, *);
+            DISPATCH();
+        }
+        OPCODE(DIVIDE) {
+            BINARY_OP(numberVal, /);
+            DISPATCH();
+        }
+        OPCODE(NOT) {
+            stackTop[-1] = boolVal(isFalsey(stackTop[-1]));
+            DISPATCH();
+        }
+        OPCODE(NEGATE) {
+            if (!isNumber(peek(0))) { RUNTIME_ERROR("Operand must be a number."); }
+            stackTop[-1] = numberVal(-asNumber(stackTop[-1]));
+            DISPATCH();
+        }
+        OPCODE(PRINT) {
+            std::cout << to_string(pop()) << '\n';
+            DISPATCH();
+        }
+        OPCODE(JUMP) {
+            const auto offset = READ_SHORT();
+            ip += offset;
+            DISPATCH();
+        }
+        OPCODE(JUMP_IF_FALSE) {
+            const auto offset = READ_SHORT();
+            if (isFalsey(peek(0))) { ip += offset; }
+            DISPATCH();
+        }
+        OPCODE(LOOP) {
+            const auto offset = READ_SHORT();
+            ip -= offset;
+            pollGCStatsRequest();
+            DISPATCH();
+        }
+        OPCODE(CALL) {
+            const int argCount = READ_BYTE();
+            SAVE_FRAME();
+            if (!callValue(peek(argCount), argCount)) { return InterpretResult::RUNTIME_ERROR; }
+            LOAD_FRAME();
+            DISPATCH();
+        }
+        OPCODE(INVOKE) {
+            auto *const method = READ_STRING();
+            const int argCount = READ_BYTE();
+            SAVE_FRAME();
+            if (!invoke(method, argCount)) { return InterpretResult::RUNTIME_ERROR; }
+            LOAD_FRAME();
+            DISPATCH();
+        }
+        OPCODE(SUPER_INVOKE) {
+            auto *const method = READ_STRING();
+            const int argCount = READ_BYTE();
+            const auto *const superclass = asClass(pop());
+            SAVE_FRAME();
+            if (!invokeFromClass(superclass, method, argCount)) { return InterpretResult::RUNTIME_ERROR; }
+            LOAD_FRAME();
+            DISPATCH();
+        }
+        OPCODE(CLOSURE) {
+            auto *const function = asFunction(READ_CONSTANT());
+            auto *const closure = allocate<ObjClosure>(function);
+            push(objVal(closure));
+            for (int i = 0; i < function->upvalueCount; i++) {
+                const auto isLocal = READ_BYTE();
+                const auto index = READ_BYTE();
+                closure->upvalues[i] =
+                    isLocal ? captureUpvalue(frame->slots + index) : frame->closure->upvalues[index];
+            }
+            DISPATCH();
+        }
+        OPCODE(CLOSE_UPVALUE) {
+            closeUpvalues(stackTop - 1);
+            stackTop--;
+            DISPATCH();
+        }
+        OPCODE(RETURN) {
+            const auto result = pop();
+            closeUpvalues(frame->slots);
+            frameCount--;
+            if (frameCount == 0) {
+                pop();
+                return InterpretResult::OK;
+            }
+
+            stackTop = frame->slots;
+            push(result);
+            LOAD_FRAME();
+            DISPATCH();
+        }
+        OPCODE(CLASS) {
+            push(objVal(allocate<ObjClass>(READ_STRING())));
+            DISPATCH();
+        }
+        OPCODE(INHERIT) {
+            const auto superclass = peek(1);
+            if (!isClass(superclass)) { RUNTIME_ERROR("Superclass must be a class."); }
+
+            auto *const subclass = asClass(peek(0));
+            subclass->methods = asClass(superclass)->methods;
+            subclass->initializer = asClass(superclass)->initializer;
+            pop();
+            DISPATCH();
+        }
+        OPCODE(METHOD) {
+            auto *const name = READ_STRING();
+            auto *const method = asClosure(peek(0));
+            auto *const klass = asClass(peek(1));
+            klass->methods[name] = objVal(method);
+            if (name == initString) { klass->initializer = method; }
+            pop();
+            DISPATCH();
+        }
+
+#ifdef COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#else
+        }
+        std::unreachable();
+#endif
+
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_CONSTANT
+#undef READ_STRING
+#undef SAVE_FRAME
+#undef LOAD_FRAME
+#undef RUNTIME_ERROR
+#undef BINARY_OP
+#undef DISPATCH
+#undef OPCODE
+    }
+}// namespace lox::vm
@@ -0,0 +1,142 @@
+#ifndef VM_H
+#define VM_H
+
+#include "../frontend/AST.h"
+#include "Object.h"
+
+#include <algorithm>
+#include <array>
+#include <csignal>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace lox::vm {
+    constexpr unsigned int FRAMES_MAX = 512;
+    constexpr unsigned int STACK_MAX = FRAMES_MAX * 256;
+    constexpr size_t VM_FIRST_GC_AT = 1024 * 1024;
+    constexpr size_t VM_GC_GROWTH_FACTOR = 2;
+
+    enum class InterpretResult {
+        OK,
+        COMPILE_ERROR,
+        RUNTIME_ERROR
+    };
+
+    struct CallFrame {
+        ObjClosure *closure;
+        uint8_t *ip;
+        Value *slots;
+    };
+
+    size_t sizeOf(const Obj *object);
+
+    // Set by the SIGUSR1 handler: the GC statistics are written at the next poll.
+    inline volatile std::sig_atomic_t gcStatsRequested = 0;
+
+    // Statistics for the LOX_GC_STATS report, in the format of the compiled runtime.
+    struct GCStats {
+        std::array<size_t, OBJ_TYPE_COUNT> allocatedByType{};
+        std::array<size_t, OBJ_TYPE_COUNT> freedByType{};
+        std::array<size_t, GC_PAUSE_BUCKETS.size() + 1> pauseHistogram{};
+        uint64_t pauseTotal = 0;
+        uint64_t pauseMax = 0;
+        size_t peakHeap = 0;
+        size_t grayStackHighWater = 0;
+    };
+
+    class VM {
+        std::unique_ptr<Value[]> stack = std::make_unique<Value[]>(STACK_MAX);
+        Value *stackTop = stack.get();
+        std::array<CallFrame, FRAMES_MAX> frames{};
+        unsigned int frameCount = 0;
+        ObjUpvalue *openUpvalues = nullptr;
+
+        // Globals are late-bound: the compiler assigns each name a slot on
+        // first use and the slot remains UNINITIALIZED_VAL until defined.
+        std::vector<Value> globals;
+        std::vector<ObjString *> globalNames;
+        std::unordered_map<std::string_view, size_t> globalSlots;
+
+        std::unordered_map<std::string_view, ObjString *> strings;
+        ObjString *initString = nullptr;
+
+        Obj *objects = nullptr;
+        std::vector<Obj *> grayStack;
+        size_t bytesAllocated = 0;
+        size_t nextGC = VM_FIRST_GC_AT;
+        size_t collections = 0;
+        GCStats stats;
+        // Set once the final report is written, by exit().
+        bool gcStatsWritten = false;
+        bool enableGC = false;
+
+        void push(const Value value) { *stackTop++ = value; }
+
+        Value pop() { return *--stackTop; }
+
+        [[nodiscard]] Value peek(const int distance) const { return stackTop[-1 - distance]; }
+
+        void resetStack();
+        void runtimeError(const std::string &message);
+        void defineNative(std::string_view name, int arity, NativeFn function);
+
+        bool call(ObjClosure *closure, int argCount);
+        bool callValue(Value callee, int argCount);
+        bool invoke(ObjString *name, int argCount);
+        bool invokeFromClass(const ObjClass *klass, ObjString *name, int argCount);
+        bool bindMethod(const ObjClass *klass, ObjString *name);
+        ObjUpvalue *captureUpvalue(Value *local);
+        void closeUpvalues(const Value *last);
+        void concatenate();
+        InterpretResult run();
+
+        void collectGarbage();
+        void markRoots();
+        void markValue(Value value);
+        void markObject(Obj *object);
+        void markTable(const Table &table);
+        void blackenObject(Obj *object);
+        void sweep();
+        void freeObject(Obj *object);
+        void writeGCStats() const;
+
+    public:
+        VM();
+        ~VM();
+        VM(const VM &) = delete;
+        VM &operator=(const VM &) = delete;
+
+        InterpretResult interpret(const Program &program);
+
+        // Writes the GC statistics if SIGUSR1 requested them, at allocations, calls and loop back-edges.
+        void pollGCStatsRequest() const {
+            if (gcStatsRequested) [[unlikely]] {
+                gcStatsRequested = 0;
+                writeGCStats();
+            }
+        }
+
+        template<typename T, typename... Args>
+        T *allocate(Args &&...args) {
+            pollGCStatsRequest();
+            if (enableGC && bytesAllocated > nextGC) { collectGarbage(); }
+
+            auto *const object = new T(std::forward<Args>(args)...);
+            object->next = objects;
+            objects = object;
+            const auto size = sizeOf(object);
+            bytesAllocated += size;
+            stats.allocatedByType[static_cast<unsigned>(object->type)] += size;
+            stats.peakHeap = std::max(stats.peakHeap, bytesAllocated);
+            return object;
+        }
+
+        ObjString *copyString(std::string_view chars);
+        ObjString *takeString(std::string &&chars);
+        size_t globalSlot(std::string_view name);
+    };
+}// namespace lox::vm
+
+#endif//VM_H
@@ -0,0 +1,37 @@
+#ifndef VM_VALUE_H
+#define VM_VALUE_H
+
+#include "../compiler/Value.h"
+
+#include <bit>
+#include <cstdint>
+
+namespace lox::vm {
+    struct Obj;
+
+    // Values use the same NaN boxing scheme as the LLVM compiler.
+    using Value = uint64_t;
+
+    inline bool isNumber(const Value value) { return (value & QNAN) != QNAN; }
+
+    inline double asNumber(const Value value) { return std::bit_cast<double>(value); }
+
+    inline Value numberVal(const double number) { return std::bit_cast<Value>(number); }
+
+    inline Value boolVal(const bool boolean) { return boolean ? TRUE_VAL : FALSE_VAL; }
+
+    inline bool isFalsey(const Value value) { return value == NIL_VAL || value == FALSE_VAL; }
+
+    inline bool isObj(const Value value) { return (value & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT); }
+
+    inline Obj *asObj(const Value value) { return reinterpret_cast<Obj *>(value & ~(SIGN_BIT | QNAN)); }
+
+    inline Value objVal(const Obj *object) { return SIGN_BIT | QNAN | reinterpret_cast<uint64_t>(object); }
+
+    inline bool valuesEqual(const Value a, const Value b) {
+        if (isNumber(a) && isNumber(b)) { return asNumber(a) == asNumber(b); }
+        return a == b;
+    }
+}// namespace lox::vm
+
+#endif//VM_VALUE_H